@@ -0,0 +1,480 @@
+#include "fsck.hpp"
+#include "latencydev.hpp"
+#include "memdev.hpp"
+#include "myfs.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+
+// Ages a file system with a seeded mix of creates, appends, truncates and deletes, and every interval
+// reports how the free space is cut up by then, how long the writes took and how fast the aged files
+// read back on a simulated disk. The same seed and options age the same way every run, so allocator
+// and defrag changes compare directly: run it before and after and diff the rows.
+// usage: age_bench [--operations 20000] [--interval 2000] [--seed 42] [--files 48] [--device-size 4194304]
+//                  [--file-size lognormal:16384:1] [--append-size lognormal:2048:1] [--mix 30,40,10,20]
+//                  [--pack 0] [--profile hdd] [--json]
+
+#define AGE_DEFAULT_OPERATIONS 20000
+#define AGE_DEFAULT_INTERVAL 2000
+#define AGE_DEFAULT_SEED 42
+#define AGE_DEFAULT_FILES 48
+#define AGE_DEFAULT_DEVICE_SIZE (4 * 1024 * 1024)
+// no file grows past this share of the device, a single one could fill it otherwise
+#define AGE_MAX_FILE_SHARE 8
+
+enum AgeOp : size_t {
+	CREATE_OP,
+	APPEND_OP,
+	TRUNCATE_OP,
+	DELETE_OP,
+	AGE_OP_COUNT
+};
+
+struct SizeDistribution {
+	enum class Kind {
+		FIXED,
+		UNIFORM,
+		LOGNORMAL
+	};
+	Kind kind;
+	double first;  // the size, the minimum or the median
+	double second; // the maximum or sigma
+
+	// fixed:N, uniform:MIN:MAX or lognormal:MEDIAN:SIGMA
+	static SizeDistribution parse(const std::string& text) {
+		std::vector<std::string> parts;
+		std::istringstream stream(text);
+		std::string part;
+		while (std::getline(stream, part, ':')) {
+			parts.push_back(part);
+		}
+		if (parts.size() == 2 && parts[0] == "fixed") {
+			return {Kind::FIXED, std::stod(parts[1]), 0};
+		}
+		if (parts.size() == 3 && parts[0] == "uniform" && std::stod(parts[1]) <= std::stod(parts[2])) {
+			return {Kind::UNIFORM, std::stod(parts[1]), std::stod(parts[2])};
+		}
+		if (parts.size() == 3 && parts[0] == "lognormal" && std::stod(parts[1]) > 0) {
+			return {Kind::LOGNORMAL, std::stod(parts[1]), std::stod(parts[2])};
+		}
+		throw std::invalid_argument("Invalid size distribution: " + text);
+	}
+
+	size_t sample(std::mt19937_64& random) const {
+		switch (kind) {
+		case Kind::FIXED:
+			return static_cast<size_t>(first);
+		case Kind::UNIFORM:
+			return std::uniform_int_distribution<size_t>(static_cast<size_t>(first), static_cast<size_t>(second))(random);
+		case Kind::LOGNORMAL:
+			return static_cast<size_t>(std::lognormal_distribution<double>(std::log(first), second)(random));
+		}
+		return 0;
+	}
+};
+
+struct Options {
+	size_t operations = AGE_DEFAULT_OPERATIONS;
+	size_t interval = AGE_DEFAULT_INTERVAL;
+	uint64_t seed = AGE_DEFAULT_SEED;
+	size_t files = AGE_DEFAULT_FILES;
+	size_t deviceSize = AGE_DEFAULT_DEVICE_SIZE;
+	SizeDistribution fileSize = {SizeDistribution::Kind::LOGNORMAL, 16384, 1};
+	SizeDistribution appendSize = {SizeDistribution::Kind::LOGNORMAL, 2048, 1};
+	std::vector<double> mix = {30, 40, 10, 20}; // weights of the ops, in AgeOp order
+	size_t packEvery = 0;						// intervals between packs, 0 never packs
+	bool hdd = true;
+	bool json = false;
+};
+
+// what happened since the last report
+struct Interval {
+	size_t ops[AGE_OP_COUNT] = {};
+	size_t full = 0;	  // writes that found no hole big enough
+	size_t grown = 0;	  // appends to a file that had data
+	size_t grownInPlace = 0;
+	std::vector<double> writeLatencies; // microseconds, of every op that allocates
+};
+
+// one row of the report
+struct Report {
+	size_t operations;
+	size_t files;
+	size_t liveBytes;
+	size_t freeBytes;
+	size_t holes;
+	size_t largestHole;
+	size_t strandedBytes; // allocated to no file, truncations leave their tails behind until the next mount
+	double adjacent;	  // files starting right where the one before them in their directory ends
+	double inPlace;		  // appends that grew the file where it was instead of moving it
+	double p50;
+	double p90;
+	double p99;
+	double maxLatency;
+	double readMegabytesPerSecond; // simulated
+	size_t full;
+	size_t problems;
+	bool packed;
+};
+
+using Clock = std::chrono::steady_clock;
+
+#pragma region layout
+
+// directories hold MAX_DIRECTORY_SIZE names, so the files are spread over two levels of them
+static std::string directoryPath(size_t index) {
+	size_t perTop = MAX_DIRECTORY_SIZE * MAX_DIRECTORY_SIZE;
+	return "/d" + std::to_string(index / perTop) + "/e" + std::to_string(index / MAX_DIRECTORY_SIZE % MAX_DIRECTORY_SIZE);
+}
+
+static std::string filePath(size_t index) {
+	return directoryPath(index) + "/f" + std::to_string(index % MAX_DIRECTORY_SIZE);
+}
+
+static void createDirectories(MyFs& myfs, size_t files) {
+	for (size_t index = 0; index < files; index += MAX_DIRECTORY_SIZE) {
+		std::string top = MyFs::splitPath(directoryPath(index)).first;
+		if (!myfs.isFileExists(top)) {
+			myfs.createDirectory(top);
+		}
+		myfs.createDirectory(directoryPath(index));
+	}
+}
+
+#pragma endregion
+
+#pragma region workload
+
+class Ager {
+  public:
+	Ager(MyFs& myfs_, const Options& options_)
+		: myfs(myfs_), options(options_), random(options_.seed), exists(options_.files, false),
+		  pick(options_.mix.begin(), options_.mix.end()), maxFileSize(options_.deviceSize / AGE_MAX_FILE_SHARE) {
+	}
+
+	void step(Interval& interval) {
+		size_t op = pick(random);
+		// an op that has nothing to work on creates, a create without a free slot appends
+		size_t live = static_cast<size_t>(std::count(exists.begin(), exists.end(), true));
+		if (live == 0) {
+			op = CREATE_OP;
+		} else if (op == CREATE_OP && live == exists.size()) {
+			op = APPEND_OP;
+		}
+		size_t slot = randomSlot(op != CREATE_OP);
+		interval.ops[op]++;
+		try {
+			switch (op) {
+			case CREATE_OP:
+				create(slot, interval);
+				break;
+			case APPEND_OP:
+				append(slot, interval);
+				break;
+			case TRUNCATE_OP:
+				truncate(slot, interval);
+				break;
+			default:
+				myfs.remove(filePath(slot));
+				exists[slot] = false;
+				break;
+			}
+		} catch (const std::overflow_error&) {
+			// the device is full or too cut up for the write, a delete makes room like a user would
+			interval.full++;
+			exists[slot] = myfs.isFileExists(filePath(slot));
+			size_t victim = randomSlot(true);
+			if (exists[victim]) {
+				myfs.remove(filePath(victim));
+				exists[victim] = false;
+			}
+		}
+	}
+
+  private:
+	size_t randomSlot(bool existing) {
+		std::vector<size_t> candidates;
+		for (size_t slot = 0; slot < exists.size(); slot++) {
+			if (exists[slot] == existing) {
+				candidates.push_back(slot);
+			}
+		}
+		if (candidates.empty()) {
+			return 0;
+		}
+		return candidates[std::uniform_int_distribution<size_t>(0, candidates.size() - 1)(random)];
+	}
+
+	// the content tells which op wrote it, nothing reads it but the read pass
+	std::string content(size_t size) {
+		return std::string(std::min(size, maxFileSize), static_cast<char>('a' + random() % 26));
+	}
+
+	void timedWrite(const std::string& path, const std::string& data, Interval& interval) {
+		Clock::time_point start = Clock::now();
+		myfs.setContent(path, data);
+		interval.writeLatencies.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+	}
+
+	void create(size_t slot, Interval& interval) {
+		std::string path = filePath(slot);
+		std::string data = content(options.fileSize.sample(random));
+		myfs.createFile(path);
+		exists[slot] = true;
+		timedWrite(path, data, interval);
+	}
+
+	void append(size_t slot, Interval& interval) {
+		std::string path = filePath(slot);
+		std::optional<EntryInfo> before = myfs.getEntryInfo(path);
+		std::string data = myfs.getContent(path);
+		data += content(options.appendSize.sample(random));
+		data.resize(std::min(data.size(), maxFileSize));
+		timedWrite(path, data, interval);
+		if (before && before->size > 0) {
+			interval.grown++;
+			std::optional<EntryInfo> after = myfs.getEntryInfo(path);
+			if (after && after->address == before->address) {
+				interval.grownInPlace++;
+			}
+		}
+	}
+
+	void truncate(size_t slot, Interval& interval) {
+		std::string path = filePath(slot);
+		std::string data = myfs.getContent(path);
+		data.resize(data.empty() ? 0 : std::uniform_int_distribution<size_t>(0, data.size() - 1)(random));
+		timedWrite(path, data, interval);
+	}
+
+	MyFs& myfs;
+	const Options& options;
+	std::mt19937_64 random;
+	std::vector<bool> exists;
+	std::discrete_distribution<size_t> pick;
+	size_t maxFileSize;
+};
+
+#pragma endregion
+
+#pragma region measuring
+
+static double percentile(std::vector<double>& values, double share) {
+	if (values.empty()) {
+		return 0;
+	}
+	size_t index = std::min(values.size() - 1, static_cast<size_t>(share * static_cast<double>(values.size())));
+	std::nth_element(values.begin(), values.begin() + static_cast<std::ptrdiff_t>(index), values.end());
+	return values[index];
+}
+
+// every file read back in path order, like a backup would, on the simulated clock
+static double readThroughput(MyFs& myfs, LatencyBlockDevice& blkdev, const std::vector<EntryInfo>& files) {
+	blkdev.resetSimulatedTime();
+	size_t bytes = 0;
+	for (const EntryInfo& file : files) {
+		bytes += myfs.getContent(file).size();
+	}
+	double seconds = std::chrono::duration<double>(blkdev.getSimulatedTime()).count();
+	return seconds > 0 ? static_cast<double>(bytes) / seconds / (1024 * 1024) : 0;
+}
+
+static Report measure(MyFs& myfs, LatencyBlockDevice& blkdev, Interval& interval) {
+	Report report{};
+	std::vector<EntryInfo> files;
+	for (const EntryInfo& entry : myfs.listTree()) {
+		if (entry.type == FILE_TYPE) {
+			files.push_back(entry);
+		}
+	}
+	report.files = files.size();
+
+	size_t adjacent = 0;
+	for (size_t i = 0; i < files.size(); i++) {
+		report.liveBytes += files[i].size;
+		if (i == 0) {
+			continue;
+		}
+		const EntryInfo& previous = files[i - 1];
+		size_t previousEnd =
+			previous.address + (previous.size + DEFAULT_BLOCK_SIZE - 1) / DEFAULT_BLOCK_SIZE * DEFAULT_BLOCK_SIZE;
+		if (MyFs::splitPath(previous.path).first == MyFs::splitPath(files[i].path).first &&
+			files[i].address == previousEnd) {
+			adjacent++;
+		}
+	}
+	report.adjacent = files.size() > 1 ? static_cast<double>(adjacent) / static_cast<double>(files.size() - 1) : 0;
+
+	for (const std::pair<const size_t, size_t>& hole : myfs.freeSpace()) {
+		report.holes++;
+		report.freeBytes += hole.second;
+		report.largestHole = std::max(report.largestHole, hole.second);
+	}
+
+	FsckReport check = FsChecker(myfs).check(false, false);
+	report.strandedBytes = check.leakedBytes;
+	report.problems = check.problems.size();
+
+	report.inPlace = interval.grown > 0 ? static_cast<double>(interval.grownInPlace) / static_cast<double>(interval.grown) : 0;
+	report.p50 = percentile(interval.writeLatencies, 0.5);
+	report.p90 = percentile(interval.writeLatencies, 0.9);
+	report.p99 = percentile(interval.writeLatencies, 0.99);
+	report.maxLatency = interval.writeLatencies.empty()
+							? 0
+							: *std::max_element(interval.writeLatencies.begin(), interval.writeLatencies.end());
+	report.full = interval.full;
+	report.readMegabytesPerSecond = readThroughput(myfs, blkdev, files);
+	return report;
+}
+
+#pragma endregion
+
+#pragma region output
+
+static void printHeader() {
+	std::cout << std::right << std::setw(8) << "ops" << std::setw(7) << "files" << std::setw(10) << "live KiB"
+			  << std::setw(10) << "free KiB" << std::setw(7) << "holes" << std::setw(10) << "max hole" << std::setw(9)
+			  << "frag %" << std::setw(10) << "stranded" << std::setw(7) << "adj %" << std::setw(8) << "inpl %"
+			  << std::setw(8) << "p50 us" << std::setw(8) << "p90 us" << std::setw(8) << "p99 us" << std::setw(9)
+			  << "max us" << std::setw(11) << "read MB/s" << std::setw(6) << "full" << std::endl;
+}
+
+// how much of the free space no single allocation can get at
+static double fragmentation(const Report& report) {
+	return report.freeBytes > 0 ? 1 - static_cast<double>(report.largestHole) / static_cast<double>(report.freeBytes) : 0;
+}
+
+static void printRow(const Report& report) {
+	std::cout << std::right << std::fixed << std::setprecision(0) << std::setw(8) << report.operations << std::setw(7)
+			  << report.files << std::setw(10) << report.liveBytes / 1024 << std::setw(10) << report.freeBytes / 1024
+			  << std::setw(7) << report.holes << std::setw(10) << report.largestHole / 1024 << std::setw(9)
+			  << std::setprecision(1) << 100 * fragmentation(report) << std::setw(10) << report.strandedBytes / 1024
+			  << std::setw(7) << std::setprecision(0) << 100 * report.adjacent << std::setw(8) << 100 * report.inPlace
+			  << std::setprecision(1) << std::setw(8) << report.p50 << std::setw(8) << report.p90 << std::setw(8)
+			  << report.p99 << std::setw(9) << report.maxLatency << std::setw(11) << report.readMegabytesPerSecond
+			  << std::setw(6) << report.full << (report.packed ? "  packed" : "") << std::endl;
+}
+
+static void printJson(const Report& report) {
+	std::cout << "{\"operations\": " << report.operations << ", \"files\": " << report.files
+			  << ", \"live_bytes\": " << report.liveBytes << ", \"free_bytes\": " << report.freeBytes
+			  << ", \"holes\": " << report.holes << ", \"largest_hole\": " << report.largestHole
+			  << ", \"fragmentation\": " << fragmentation(report) << ", \"stranded_bytes\": " << report.strandedBytes
+			  << ", \"adjacent\": " << report.adjacent << ", \"grown_in_place\": " << report.inPlace
+			  << ", \"write_p50_us\": " << report.p50 << ", \"write_p90_us\": " << report.p90
+			  << ", \"write_p99_us\": " << report.p99 << ", \"write_max_us\": " << report.maxLatency
+			  << ", \"read_mb_per_second\": " << report.readMegabytesPerSecond << ", \"full\": " << report.full
+			  << ", \"packed\": " << (report.packed ? "true" : "false") << "}" << std::endl;
+}
+
+#pragma endregion
+
+static std::vector<double> parseMix(const std::string& text) {
+	std::vector<double> weights;
+	std::istringstream stream(text);
+	std::string value;
+	while (std::getline(stream, value, ',')) {
+		weights.push_back(std::stod(value));
+	}
+	if (weights.size() != AGE_OP_COUNT || std::all_of(weights.begin(), weights.end(), [](double w) { return w <= 0; })) {
+		throw std::invalid_argument("Invalid mix: " + text);
+	}
+	return weights;
+}
+
+int main(int argc, char** argv) {
+	Options options;
+	try {
+		for (int i = 1; i < argc; i++) {
+			std::string arg = argv[i];
+			if (arg == "--json") {
+				options.json = true;
+				continue;
+			}
+			if (i + 1 >= argc) {
+				throw std::invalid_argument(arg);
+			}
+			std::string value = argv[++i];
+			if (arg == "--operations") {
+				options.operations = std::stoull(value);
+			} else if (arg == "--interval") {
+				options.interval = std::max<size_t>(std::stoull(value), 1);
+			} else if (arg == "--seed") {
+				options.seed = std::stoull(value);
+			} else if (arg == "--files") {
+				options.files = std::max<size_t>(std::stoull(value), 1);
+			} else if (arg == "--device-size") {
+				options.deviceSize = std::stoull(value);
+			} else if (arg == "--file-size") {
+				options.fileSize = SizeDistribution::parse(value);
+			} else if (arg == "--append-size") {
+				options.appendSize = SizeDistribution::parse(value);
+			} else if (arg == "--mix") {
+				options.mix = parseMix(value);
+			} else if (arg == "--pack") {
+				options.packEvery = std::stoull(value);
+			} else if (arg == "--profile" && (value == "hdd" || value == "ssd")) {
+				options.hdd = value == "hdd";
+			} else {
+				throw std::invalid_argument(arg);
+			}
+		}
+	} catch (const std::exception&) {
+		std::cerr << "usage: age_bench [--operations 20000] [--interval 2000] [--seed 42] [--files 48] "
+					 "[--device-size 4194304]\n"
+					 "                 [--file-size lognormal:16384:1] [--append-size lognormal:2048:1] "
+					 "[--mix create,append,truncate,delete]\n"
+					 "                 [--pack intervals] [--profile hdd|ssd] [--json]"
+				  << std::endl;
+		return 1;
+	}
+
+	try {
+		MemoryBlockDevice memory(options.deviceSize);
+		// only accounted, the reads are timed on the simulated clock
+		LatencyProfile profile = options.hdd ? LatencyProfile::hdd() : LatencyProfile::ssd();
+		profile.realTime = false;
+		LatencyBlockDevice blkdev(&memory, profile);
+		MyFs myfs(&blkdev);
+		createDirectories(myfs, options.files);
+		Ager ager(myfs, options);
+
+		if (!options.json) {
+			printHeader();
+		}
+		int status = 0;
+		size_t intervals = 0;
+		for (size_t done = 0; done < options.operations;) {
+			Interval interval;
+			size_t end = std::min(done + options.interval, options.operations);
+			for (; done < end; done++) {
+				ager.step(interval);
+			}
+			intervals++;
+			bool packed = options.packEvery > 0 && intervals % options.packEvery == 0;
+			if (packed) {
+				myfs.shrink();
+			}
+			Report report = measure(myfs, blkdev, interval);
+			report.operations = done;
+			report.packed = packed;
+			if (report.problems > 0) {
+				std::cerr << "fsck found " << report.problems << " problems after " << done << " operations" << std::endl;
+				status = 1;
+			}
+			if (options.json) {
+				printJson(report);
+			} else {
+				printRow(report);
+			}
+		}
+		return status;
+	} catch (const std::exception& e) {
+		std::cerr << "age_bench: " << e.what() << std::endl;
+		return 1;
+	}
+}
@@ -0,0 +1,132 @@
+#include "myfs.hpp"
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <malloc.h>
+#include <sys/resource.h>
+
+// Page faults and time of cold reads through the mmap backend, with and without access hints.
+// usage: fault_bench [image path] [MiB per file]
+
+#define BENCH_FILE_COUNT 5
+#define BENCH_DEFAULT_FILE_MIB 32
+
+struct Mode {
+	const char* name;
+	MappingOptions options;
+};
+
+struct Sample {
+	long majorFaults;
+	long minorFaults;
+	double milliseconds;
+};
+
+class Measurement {
+  public:
+	Measurement() : start(std::chrono::steady_clock::now()) {
+		getrusage(RUSAGE_SELF, &before);
+	}
+
+	Sample finish() const {
+		rusage after{};
+		getrusage(RUSAGE_SELF, &after);
+		return {after.ru_majflt - before.ru_majflt, after.ru_minflt - before.ru_minflt,
+				std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()};
+	}
+
+  private:
+	rusage before{};
+	std::chrono::steady_clock::time_point start;
+};
+
+// pushes the image out of the page cache, so the next mount reads from disk
+static void dropCache(const std::string& path) {
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd == -1) {
+		throw std::system_error(errno, std::generic_category(), "Failed to open image");
+	}
+	fdatasync(fd);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+}
+
+static std::string fileName(int index) {
+	return "/file" + std::to_string(index);
+}
+
+static void createImage(const std::string& path, size_t fileSize, bool withSnapshot) {
+	unlink(path.c_str());
+	BlockDeviceSimulator blkdev(path, BENCH_FILE_COUNT * fileSize + 2 * MIN_DEVICE_SIZE);
+	MyFs myfs(&blkdev);
+	std::string content(fileSize, '\0');
+	for (int i = 0; i < BENCH_FILE_COUNT; i++) {
+		for (size_t j = 0; j < content.size(); j++) {
+			content[j] = static_cast<char>('a' + (i + j) % 26);
+		}
+		myfs.createFile(fileName(i));
+		myfs.setContent(fileName(i), content);
+	}
+	if (withSnapshot) {
+		// mounting an image with a snapshot skips the defrag pass, which would warm the cache up
+		myfs.createSnapshot();
+	}
+}
+
+static void printSample(const char* mode, const char* phase, const Sample& sample) {
+	std::cout << std::left << std::setw(10) << mode << std::setw(8) << phase << std::right << std::setw(12)
+			  << sample.majorFaults << std::setw(12) << sample.minorFaults << std::setw(12) << std::fixed
+			  << std::setprecision(1) << sample.milliseconds << std::endl;
+}
+
+int main(int argc, char** argv) {
+	std::string path = argc > 1 ? argv[1] : "fault_bench.img";
+	size_t fileSize = (argc > 2 ? std::stoull(argv[2]) : BENCH_DEFAULT_FILE_MIB) * 1024 * 1024;
+
+	// keep freed buffers mapped, so faulting in the buffers cat copies into doesn't drown the image's faults
+	mallopt(M_MMAP_MAX, 0);
+	mallopt(M_TRIM_THRESHOLD, -1);
+	{
+		std::string warmup(2 * fileSize, '\0');
+	}
+
+	const Mode modes[] = {{"none", {false, false, false}}, {"hints", {true, false, false}},
+						  {"populate", {true, true, false}}};
+
+	std::cout << std::left << std::setw(10) << "mode" << std::setw(8) << "phase" << std::right << std::setw(12)
+			  << "major" << std::setw(12) << "minor" << std::setw(12) << "ms" << std::endl;
+
+	// whole file reads, like cat and cp
+	createImage(path, fileSize, true);
+	for (const Mode& mode : modes) {
+		dropCache(path);
+		Measurement mountTime;
+		BlockDeviceSimulator blkdev(path, 0, mode.options);
+		MyFs myfs(&blkdev);
+		printSample(mode.name, "mount", mountTime.finish());
+
+		Measurement readTime;
+		size_t total = 0;
+		for (int i = 0; i < BENCH_FILE_COUNT; i++) {
+			total += myfs.getContent(fileName(i)).size();
+		}
+		printSample(mode.name, "cat", readTime.finish());
+		if (total != BENCH_FILE_COUNT * fileSize) {
+			std::cerr << "short read" << std::endl;
+			return 1;
+		}
+	}
+
+	// the defrag pass every plain mount runs over the data
+	createImage(path, fileSize, false);
+	for (const Mode& mode : modes) {
+		dropCache(path);
+		Measurement mountTime;
+		BlockDeviceSimulator blkdev(path, 0, mode.options);
+		MyFs myfs(&blkdev);
+		printSample(mode.name, "defrag", mountTime.finish());
+	}
+
+	unlink(path.c_str());
+	return 0;
+}
@@ -0,0 +1,425 @@
+#include "memdev.hpp"
+#include "myfs.hpp"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <thread>
+
+// The file system's operations one at a time, on a device in memory so runs repeat exactly, as json
+// for regression tracking. Every benchmark runs for each entry count, file size and thread count it
+// takes, the median and the best of the repetitions are reported per operation.
+// usage: myfs_bench [--entries 16,32,64] [--sizes 64,4096,65536,1048576] [--threads 1,2,4] [--repeat 5]
+//                   [--only name]
+
+#define BENCH_DEVICE_SIZE (64 * 1024 * 1024)
+#define BENCH_DEFAULT_REPEAT 5
+#define BENCH_SEED 42
+#define BENCH_LOOKUPS_PER_THREAD 20000
+#define BENCH_LISTINGS_PER_THREAD 2000
+// content operations per thread stop at this many bytes or this many operations
+#define BENCH_CONTENT_BYTES (16 * 1024 * 1024)
+#define BENCH_CONTENT_OPERATIONS 2000
+#define BENCH_COPY_FILE_SIZE 256
+#define BENCH_MOUNT_FILE_SIZE 1024
+// the allocator has no FAT to fill, it gets a realistic amount of fragments
+#define BENCH_FRAGMENTS 4096
+#define BENCH_ALLOCATIONS_PER_THREAD 20000
+#define BENCH_MIN_ALLOCATION 32
+#define BENCH_MAX_ALLOCATION 4096
+
+struct Parameters {
+	size_t entries;
+	size_t size;
+	size_t threads;
+};
+
+// one repetition
+struct Timing {
+	size_t operations;
+	double seconds;
+};
+
+using Clock = std::chrono::steady_clock;
+
+static double secondsSince(Clock::time_point start) {
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// body(thread) on every thread at once, timed from the common start until the last one is done,
+// rethrows what the first failing thread threw
+static double parallel(size_t threads, const std::function<void(size_t)>& body) {
+	std::atomic<size_t> ready(0);
+	std::atomic<bool> go(false);
+	std::mutex errorMutex;
+	std::exception_ptr error;
+	std::vector<std::thread> workers;
+	for (size_t thread = 0; thread < threads; thread++) {
+		workers.emplace_back([&, thread] {
+			ready++;
+			while (!go) {
+				std::this_thread::yield();
+			}
+			try {
+				body(thread);
+			} catch (...) {
+				std::lock_guard<std::mutex> lock(errorMutex);
+				if (!error) {
+					error = std::current_exception();
+				}
+			}
+		});
+	}
+	while (ready < threads) {
+		std::this_thread::yield();
+	}
+	Clock::time_point start = Clock::now();
+	go = true;
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+	double seconds = secondsSince(start);
+	if (error) {
+		std::rethrow_exception(error);
+	}
+	return seconds;
+}
+
+#pragma region layout
+
+// directories hold MAX_DIRECTORY_SIZE names, so the files are spread over two levels of them
+static std::string directoryPath(size_t index) {
+	size_t perTop = MAX_DIRECTORY_SIZE * MAX_DIRECTORY_SIZE;
+	return "/d" + std::to_string(index / perTop) + "/e" + std::to_string(index / MAX_DIRECTORY_SIZE % MAX_DIRECTORY_SIZE);
+}
+
+static std::string filePath(size_t index) {
+	return directoryPath(index) + "/f" + std::to_string(index % MAX_DIRECTORY_SIZE);
+}
+
+static std::vector<std::string> makeDirectories(MyFs& myfs, size_t files, const std::string& prefix = "") {
+	std::vector<std::string> directories;
+	for (size_t i = 0; i < files; i += MAX_DIRECTORY_SIZE) {
+		std::string top = prefix + MyFs::splitPath(directoryPath(i)).first;
+		if (!myfs.isFileExists(top)) {
+			myfs.createDirectory(top);
+			directories.push_back(top);
+		}
+		myfs.createDirectory(prefix + directoryPath(i));
+		directories.push_back(prefix + directoryPath(i));
+	}
+	return directories;
+}
+
+static void makeFiles(MyFs& myfs, size_t files, size_t size, const std::string& prefix = "") {
+	for (size_t i = 0; i < files; i++) {
+		myfs.createFile(prefix + filePath(i));
+		if (size > 0) {
+			myfs.setContent(prefix + filePath(i), std::string(size, 'a' + i % 26));
+		}
+	}
+}
+
+// nothing is packed or saved on unmount, the next repetition starts from a new device anyway
+static MountOptions benchMount() {
+	return MountOptions{true, true, false};
+}
+
+#pragma endregion
+#pragma region benchmarks
+
+static Timing benchCreateFile(const Parameters& parameters) {
+	MemoryBlockDevice blkdev(BENCH_DEVICE_SIZE);
+	MyFs myfs(&blkdev, benchMount());
+	makeDirectories(myfs, parameters.entries);
+	double seconds = parallel(parameters.threads, [&](size_t thread) {
+		for (size_t i = thread; i < parameters.entries; i += parameters.threads) {
+			myfs.createFile(filePath(i));
+		}
+	});
+	return {parameters.entries, seconds};
+}
+
+static Timing benchLookup(const Parameters& parameters, bool hit) {
+	MemoryBlockDevice blkdev(BENCH_DEVICE_SIZE);
+	MyFs myfs(&blkdev, benchMount());
+	makeDirectories(myfs, parameters.entries);
+	makeFiles(myfs, parameters.entries, 0);
+	// misses are in directories that exist, the lookup can't stop early
+	std::vector<std::string> paths;
+	for (size_t i = 0; i < parameters.entries; i++) {
+		paths.push_back(hit ? filePath(i) : directoryPath(i) + "/missing" + std::to_string(i));
+	}
+	std::atomic<size_t> wrong(0);
+	double seconds = parallel(parameters.threads, [&](size_t thread) {
+		std::mt19937_64 random(BENCH_SEED + thread);
+		for (size_t i = 0; i < BENCH_LOOKUPS_PER_THREAD; i++) {
+			if (myfs.getEntryInfo(paths[random() % paths.size()]).has_value() != hit) {
+				wrong++;
+			}
+		}
+	});
+	if (wrong > 0) {
+		throw std::runtime_error("Lookups got the wrong answer");
+	}
+	return {BENCH_LOOKUPS_PER_THREAD * parameters.threads, seconds};
+}
+
+static Timing benchListDir(const Parameters& parameters) {
+	MemoryBlockDevice blkdev(BENCH_DEVICE_SIZE);
+	MyFs myfs(&blkdev, benchMount());
+	std::vector<std::string> directories = makeDirectories(myfs, parameters.entries);
+	makeFiles(myfs, parameters.entries, 0);
+	double seconds = parallel(parameters.threads, [&](size_t thread) {
+		std::mt19937_64 random(BENCH_SEED + thread);
+		for (size_t i = 0; i < BENCH_LISTINGS_PER_THREAD; i++) {
+			myfs.listDir(directories[random() % directories.size()]);
+		}
+	});
+	return {BENCH_LISTINGS_PER_THREAD * parameters.threads, seconds};
+}
+
+static size_t contentOperations(size_t size) {
+	return std::clamp<size_t>(BENCH_CONTENT_BYTES / std::max<size_t>(size, 1), 1, BENCH_CONTENT_OPERATIONS);
+}
+
+// every thread has a file of its own
+static Timing benchContent(const Parameters& parameters, bool write) {
+	MemoryBlockDevice blkdev(BENCH_DEVICE_SIZE);
+	MyFs myfs(&blkdev, benchMount());
+	makeDirectories(myfs, parameters.threads);
+	makeFiles(myfs, parameters.threads, parameters.size);
+	size_t operations = contentOperations(parameters.size);
+	double seconds = parallel(parameters.threads, [&](size_t thread) {
+		std::string content(parameters.size, 'A' + thread % 26);
+		for (size_t i = 0; i < operations; i++) {
+			if (write) {
+				myfs.setContent(filePath(thread), content);
+			} else if (myfs.getContent(filePath(thread)).size() != parameters.size) {
+				throw std::runtime_error("Read back the wrong size");
+			}
+		}
+	});
+	return {operations * parameters.threads, seconds};
+}
+
+// half the entries are the tree, the copy needs the other half
+static Timing benchCopy(const Parameters& parameters, bool remove) {
+	MemoryBlockDevice blkdev(BENCH_DEVICE_SIZE);
+	MyFs myfs(&blkdev, benchMount());
+	size_t files = std::max<size_t>(parameters.entries / 2, 1);
+	myfs.createDirectory("/s");
+	makeDirectories(myfs, files, "/s");
+	makeFiles(myfs, files, BENCH_COPY_FILE_SIZE, "/s");
+	Clock::time_point start = Clock::now();
+	myfs.copy("/s", "/c");
+	double seconds = secondsSince(start);
+	if (remove) {
+		start = Clock::now();
+		myfs.remove("/c");
+		seconds = secondsSince(start);
+	}
+	return {files, seconds};
+}
+
+// every other allocation freed again, what's left to allocate from is holes of every size
+static void fragment(AddressAllocator& allocator, std::mt19937_64& random, std::vector<EntryInfo>* kept) {
+	std::vector<EntryInfo> allocated(2 * BENCH_FRAGMENTS);
+	for (EntryInfo& entry : allocated) {
+		entry.size = BENCH_MIN_ALLOCATION + random() % (BENCH_MAX_ALLOCATION - BENCH_MIN_ALLOCATION);
+		entry.address = allocator.allocate(entry.size);
+	}
+	for (size_t i = 0; i < allocated.size(); i++) {
+		if (i % 2 == 0) {
+			allocator.deallocate(allocated[i]);
+		} else if (kept != nullptr) {
+			kept->push_back(allocated[i]);
+		}
+	}
+}
+
+static Timing benchAllocate(const Parameters& parameters) {
+	AddressAllocator allocator(FAT_SIZE, BENCH_DEVICE_SIZE, DEFAULT_BLOCK_SIZE);
+	std::mt19937_64 random(BENCH_SEED);
+	fragment(allocator, random, nullptr);
+	double seconds = parallel(parameters.threads, [&](size_t thread) {
+		std::mt19937_64 threadRandom(BENCH_SEED + thread);
+		EntryInfo entry;
+		for (size_t i = 0; i < BENCH_ALLOCATIONS_PER_THREAD; i++) {
+			entry.size = BENCH_MIN_ALLOCATION + threadRandom() % (BENCH_MAX_ALLOCATION - BENCH_MIN_ALLOCATION);
+			entry.address = allocator.allocate(entry.size);
+			allocator.deallocate(entry);
+		}
+	});
+	return {BENCH_ALLOCATIONS_PER_THREAD * parameters.threads, seconds};
+}
+
+static Timing benchDefrag(const Parameters& parameters) {
+	MemoryBlockDevice blkdev(BENCH_DEVICE_SIZE);
+	AddressAllocator allocator(FAT_SIZE, BENCH_DEVICE_SIZE, DEFAULT_BLOCK_SIZE);
+	std::mt19937_64 random(BENCH_SEED);
+	std::vector<EntryInfo> kept;
+	fragment(allocator, random, &kept);
+	std::set<EntryInfo> entries;
+	// every extent is filled with a byte of its own, to tell whether it survived the move
+	std::map<std::string, char> fills;
+	for (size_t i = 0; i < kept.size(); i++) {
+		kept[i].path = i == 0 ? "/" : "/f" + std::to_string(i);
+		kept[i].type = i == 0 ? DIRECTORY_TYPE : FILE_TYPE;
+		fills[kept[i].path] = static_cast<char>(i % 251 + 1);
+		std::string content(kept[i].size, fills[kept[i].path]);
+		blkdev.write(kept[i].address, content.size(), content.data());
+		entries.insert(kept[i]);
+	}
+	Clock::time_point start = Clock::now();
+	allocator.defrag(entries, &blkdev);
+	double seconds = secondsSince(start);
+
+	std::string content;
+	for (const EntryInfo& entry : entries) {
+		content.resize(entry.size);
+		blkdev.read(entry.address, entry.size, content.data());
+		if (content != std::string(entry.size, fills[entry.path])) {
+			throw std::runtime_error("Defrag lost the content of " + entry.path);
+		}
+	}
+	return {parameters.entries, seconds};
+}
+
+// load and initialize, nothing packed
+static Timing benchMountTime(const Parameters& parameters) {
+	MemoryBlockDevice blkdev(BENCH_DEVICE_SIZE);
+	{
+		MyFs myfs(&blkdev, benchMount());
+		makeDirectories(myfs, parameters.entries);
+		makeFiles(myfs, parameters.entries, BENCH_MOUNT_FILE_SIZE);
+		myfs.save();
+	}
+	Clock::time_point start = Clock::now();
+	MyFs myfs(&blkdev, benchMount());
+	return {1, secondsSince(start)};
+}
+
+#pragma endregion
+
+struct Benchmark {
+	std::string name;
+	size_t fixedEntries; // 0 for every count of --entries
+	bool usesSize;
+	bool usesThreads;
+	std::function<Timing(const Parameters&)> run;
+};
+
+static std::vector<size_t> parseList(const std::string& text) {
+	std::vector<size_t> values;
+	std::istringstream stream(text);
+	std::string value;
+	while (std::getline(stream, value, ',')) {
+		values.push_back(std::stoull(value));
+	}
+	if (values.empty()) {
+		throw std::invalid_argument("Empty list");
+	}
+	return values;
+}
+
+int main(int argc, char** argv) {
+	std::vector<size_t> entryCounts = {16, 32, 64};
+	std::vector<size_t> sizes = {64, 4096, 65536, 1048576};
+	std::vector<size_t> threadCounts = {1, 2, 4};
+	size_t repeat = BENCH_DEFAULT_REPEAT;
+	std::string only;
+	try {
+		for (int i = 1; i + 1 < argc; i += 2) {
+			std::string arg = argv[i];
+			if (arg == "--entries") {
+				entryCounts = parseList(argv[i + 1]);
+			} else if (arg == "--sizes") {
+				sizes = parseList(argv[i + 1]);
+			} else if (arg == "--threads") {
+				threadCounts = parseList(argv[i + 1]);
+			} else if (arg == "--repeat") {
+				repeat = std::max<size_t>(std::stoull(argv[i + 1]), 1);
+			} else if (arg == "--only") {
+				only = argv[i + 1];
+			} else {
+				throw std::invalid_argument(arg);
+			}
+		}
+		if (argc % 2 == 0) {
+			throw std::invalid_argument(argv[argc - 1]);
+		}
+	} catch (const std::exception&) {
+		std::cerr << "usage: myfs_bench [--entries 16,32,64] [--sizes 64,4096] [--threads 1,2,4] [--repeat 5] "
+					 "[--only name]"
+				  << std::endl;
+		return 1;
+	}
+	// a file per thread in a directory of its own at most, that's the most threads there's room for
+	for (size_t& threads : threadCounts) {
+		threads = std::clamp<size_t>(threads, 1, MAX_DIRECTORY_SIZE);
+	}
+
+	std::vector<Benchmark> benchmarks = {
+		{"createFile", 0, false, true, benchCreateFile},
+		{"getEntryInfoHit", 0, false, true, [](const Parameters& p) { return benchLookup(p, true); }},
+		{"getEntryInfoMiss", 0, false, true, [](const Parameters& p) { return benchLookup(p, false); }},
+		{"listDir", 0, false, true, benchListDir},
+		// a file per thread
+		{"setContent", 1, true, true, [](const Parameters& p) { return benchContent(p, true); }},
+		{"getContent", 1, true, true, [](const Parameters& p) { return benchContent(p, false); }},
+		{"copyTree", 0, false, false, [](const Parameters& p) { return benchCopy(p, false); }},
+		{"removeTree", 0, false, false, [](const Parameters& p) { return benchCopy(p, true); }},
+		{"allocate", BENCH_FRAGMENTS, false, true, benchAllocate},
+		{"defrag", BENCH_FRAGMENTS, false, false, benchDefrag},
+		{"mount", 0, false, false, benchMountTime},
+	};
+
+	int status = 0;
+	bool first = true;
+	std::cout << "{\"device\": \"memory\", \"seed\": " << BENCH_SEED << ", \"repeat\": " << repeat
+			  << ", \"results\": [";
+	for (const Benchmark& benchmark : benchmarks) {
+		if (!only.empty() && benchmark.name.find(only) == std::string::npos) {
+			continue;
+		}
+		std::vector<size_t> benchEntries =
+			benchmark.fixedEntries == 0 ? entryCounts : std::vector<size_t>{benchmark.fixedEntries};
+		std::vector<size_t> benchSizes = benchmark.usesSize ? sizes : std::vector<size_t>{0};
+		std::vector<size_t> benchThreads = benchmark.usesThreads ? threadCounts : std::vector<size_t>{1};
+		for (size_t entries : benchEntries) {
+			for (size_t size : benchSizes) {
+				for (size_t threads : benchThreads) {
+					Parameters parameters{entries, size, threads};
+					std::vector<double> perOperation;
+					size_t operations = 0;
+					try {
+						for (size_t run = 0; run < repeat; run++) {
+							Timing timing = benchmark.run(parameters);
+							operations = timing.operations;
+							perOperation.push_back(timing.seconds * 1e9 / timing.operations);
+						}
+					} catch (const std::exception& e) {
+						std::cerr << benchmark.name << " entries=" << entries << " size=" << size
+								  << " threads=" << threads << ": " << e.what() << std::endl;
+						status = 1;
+						continue;
+					}
+					std::sort(perOperation.begin(), perOperation.end());
+					double median = perOperation[perOperation.size() / 2];
+					std::cout << (first ? "\n" : ",\n") << "  {\"name\": \"" << benchmark.name
+							  << "\", \"entries\": " << entries << ", \"size\": " << size
+							  << ", \"threads\": " << threads << ", \"operations\": " << operations
+							  << ", \"median_ns\": " << static_cast<uint64_t>(median)
+							  << ", \"min_ns\": " << static_cast<uint64_t>(perOperation.front())
+							  << ", \"ops_per_second\": " << static_cast<uint64_t>(1e9 / median) << "}";
+					first = false;
+				}
+			}
+		}
+	}
+	std::cout << "\n]}" << std::endl;
+	return status;
+}
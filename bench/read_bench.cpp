@@ -0,0 +1,119 @@
+#include "myfs.hpp"
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+// Lookup and read throughput while a writer keeps changing the file system next to the readers.
+// The writer moves one file back and forth, every listTree has to see it in exactly one place.
+// usage: read_bench [image path] [milliseconds per run]
+
+#define BENCH_MAX_THREADS 8
+#define BENCH_DEFAULT_MILLISECONDS 500
+#define BENCH_FILE_COUNT 5
+
+struct Result {
+	size_t reads;
+	size_t trees;
+	size_t errors;
+	size_t writes;
+};
+
+static std::string fileName(size_t index) {
+	return "/r/f" + std::to_string(index);
+}
+
+static void reader(MyFs& myfs, const std::atomic<bool>& stop, size_t seed, size_t& reads, size_t& trees,
+				   size_t& errors) {
+	size_t i = seed;
+	while (!stop.load(std::memory_order_relaxed)) {
+		// every 64th request looks at the whole tree instead of one file
+		if (++i % 64 == 0) {
+			MyFs::EntryView tree = myfs.listTree();
+			size_t seen = 0;
+			for (const EntryInfo& entry : tree) {
+				seen += entry.path == "/w/a" || entry.path == "/w/b";
+			}
+			errors += seen != 1;
+			trees++;
+			continue;
+		}
+		std::string path = fileName(i % BENCH_FILE_COUNT);
+		try {
+			std::optional<EntryInfo> entry = myfs.getEntryInfo(path);
+			if (!entry || myfs.getContent(path).rfind(path, 0) != 0) {
+				errors++;
+			}
+		} catch (const std::exception& e) {
+			errors++;
+		}
+		reads++;
+	}
+}
+
+static Result run(MyFs& myfs, size_t threadCount, std::chrono::milliseconds duration) {
+	std::atomic<bool> stop{false};
+	std::vector<size_t> reads(threadCount, 0);
+	std::vector<size_t> trees(threadCount, 0);
+	std::vector<size_t> errors(threadCount, 0);
+	std::vector<std::thread> threads;
+	for (size_t thread = 0; thread < threadCount; thread++) {
+		threads.emplace_back([&, thread] {
+			reader(myfs, stop, thread * 7, reads[thread], trees[thread], errors[thread]);
+		});
+	}
+
+	Result result{0, 0, 0, 0};
+	auto end = std::chrono::steady_clock::now() + duration;
+	while (std::chrono::steady_clock::now() < end) {
+		bool atA = myfs.isFileExists("/w/a");
+		myfs.move(atA ? "/w/a" : "/w/b", atA ? "/w/b" : "/w/a");
+		myfs.setContent("/w/scratch", std::to_string(result.writes));
+		result.writes++;
+	}
+	stop = true;
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+
+	for (size_t thread = 0; thread < threadCount; thread++) {
+		result.reads += reads[thread];
+		result.trees += trees[thread];
+		result.errors += errors[thread];
+	}
+	return result;
+}
+
+int main(int argc, char** argv) {
+	std::string path = argc > 1 ? argv[1] : "read_bench.img";
+	std::chrono::milliseconds duration(argc > 2 ? std::stoull(argv[2]) : BENCH_DEFAULT_MILLISECONDS);
+
+	unlink(path.c_str());
+	BlockDeviceSimulator blkdev(path);
+	MyFs myfs(&blkdev);
+	myfs.createDirectory("/r");
+	for (size_t i = 0; i < BENCH_FILE_COUNT; i++) {
+		myfs.createFile(fileName(i));
+		myfs.setContent(fileName(i), fileName(i) + std::string(1000, 'x'));
+	}
+	myfs.createDirectory("/w");
+	myfs.createFile("/w/a");
+	myfs.createFile("/w/scratch");
+
+	std::cout << std::left << std::setw(10) << "readers" << std::right << std::setw(14) << "reads/s" << std::setw(12)
+			  << "trees/s" << std::setw(12) << "writes/s" << std::setw(10) << "errors" << std::endl;
+	int status = 0;
+	for (size_t threadCount = 1; threadCount <= BENCH_MAX_THREADS; threadCount *= 2) {
+		Result result = run(myfs, threadCount, duration);
+		double seconds = std::chrono::duration<double>(duration).count();
+		std::cout << std::left << std::setw(10) << threadCount << std::right << std::fixed << std::setprecision(0)
+				  << std::setw(14) << result.reads / seconds << std::setw(12) << result.trees / seconds
+				  << std::setw(12) << result.writes / seconds << std::setw(10) << result.errors << std::endl;
+		if (result.errors != 0) {
+			status = 1;
+		}
+	}
+	unlink(path.c_str());
+	return status;
+}
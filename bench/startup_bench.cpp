@@ -0,0 +1,109 @@
+#include "myfs.hpp"
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+
+// Time to the first command, from opening an image to the listing of the root, eager and lazy mounts.
+// Half of every image's files were grown after the rest were written, so an eager mount has holes to pack.
+// usage: startup_bench [image path] [runs per size]
+
+#define BENCH_DEFAULT_RUNS 20
+#define BENCH_FILE_SIZE 2048
+#define BENCH_DEVICE_SIZE (4 * 1024 * 1024)
+
+struct Result {
+	double microseconds;
+	uint64_t bytesRead;
+	uint64_t bytesWritten;
+	bool complete; // the tree had every file
+};
+
+// directories hold MAX_DIRECTORY_SIZE entries, the files are spread over as many directories as it takes
+static std::string directoryName(size_t index) {
+	return "/d" + std::to_string(index / MAX_DIRECTORY_SIZE);
+}
+
+static std::string fileName(size_t index) {
+	return directoryName(index) + "/f" + std::to_string(index % MAX_DIRECTORY_SIZE);
+}
+
+static void makeImage(const std::string& path, size_t fileCount) {
+	unlink(path.c_str());
+	BlockDeviceSimulator blkdev(path, BENCH_DEVICE_SIZE);
+	MyFs myfs(&blkdev, MountOptions{true, true, false});
+	for (size_t i = 0; i < fileCount; i++) {
+		if (i % MAX_DIRECTORY_SIZE == 0) {
+			myfs.createDirectory(directoryName(i));
+		}
+		myfs.createFile(fileName(i));
+		myfs.setContent(fileName(i), std::string(BENCH_FILE_SIZE, 'a' + i % 26));
+	}
+	// moves every other file to the end and leaves a hole where it was
+	for (size_t i = 0; i < fileCount; i += 2) {
+		myfs.setContent(fileName(i), std::string(2 * BENCH_FILE_SIZE, 'A' + i % 26));
+	}
+	myfs.save();
+}
+
+static Result mountOnce(const std::string& image, const std::string& path, size_t fileCount, bool lazy) {
+	std::filesystem::copy_file(image, path, std::filesystem::copy_options::overwrite_existing);
+	BlockDeviceSimulator blkdev(path);
+	MountOptions options;
+	options.lazy = lazy;
+
+	auto start = std::chrono::steady_clock::now();
+	MyFs myfs(&blkdev, options);
+	myfs.listDir("/");
+	auto end = std::chrono::steady_clock::now();
+
+	size_t files = 0;
+	for (const EntryInfo& entry : myfs.listTree()) {
+		files += entry.type == FILE_TYPE;
+	}
+
+	IoStatsSnapshot stats = blkdev.getStats()->snapshot();
+	return {std::chrono::duration<double, std::micro>(end - start).count(),
+			stats.ops[static_cast<size_t>(IoOp::READ)].bytes, stats.ops[static_cast<size_t>(IoOp::WRITE)].bytes,
+			files == fileCount};
+}
+
+static Result average(const std::string& image, const std::string& path, size_t fileCount, bool lazy,
+					  size_t runs) {
+	Result total{0, 0, 0, true};
+	for (size_t run = 0; run < runs; run++) {
+		Result result = mountOnce(image, path, fileCount, lazy);
+		total.microseconds += result.microseconds;
+		total.bytesRead += result.bytesRead;
+		total.bytesWritten += result.bytesWritten;
+		total.complete = total.complete && result.complete;
+	}
+	return {total.microseconds / runs, total.bytesRead / runs, total.bytesWritten / runs, total.complete};
+}
+
+int main(int argc, char** argv) {
+	std::string path = argc > 1 ? argv[1] : "startup_bench.img";
+	size_t runs = argc > 2 ? std::stoull(argv[2]) : BENCH_DEFAULT_RUNS;
+	std::string image = path + ".orig";
+
+	std::cout << std::left << std::setw(8) << "files" << std::setw(8) << "mount" << std::right << std::setw(12)
+			  << "us" << std::setw(12) << "read" << std::setw(12) << "written" << std::endl;
+	int status = 0;
+	// the root takes MAX_DIRECTORY_SIZE directories of MAX_DIRECTORY_SIZE files
+	for (size_t fileCount : {6, 12, 24, 36}) {
+		makeImage(image, fileCount);
+		for (bool lazy : {false, true}) {
+			Result result = average(image, path, fileCount, lazy, runs);
+			std::cout << std::left << std::setw(8) << fileCount << std::setw(8) << (lazy ? "lazy" : "eager")
+					  << std::right << std::fixed << std::setprecision(0) << std::setw(12) << result.microseconds
+					  << std::setw(12) << result.bytesRead << std::setw(12) << result.bytesWritten << std::endl;
+			if (!result.complete) {
+				std::cerr << "missing files after a " << (lazy ? "lazy" : "eager") << " mount" << std::endl;
+				status = 1;
+			}
+		}
+	}
+	unlink(image.c_str());
+	unlink(path.c_str());
+	return status;
+}
@@ -0,0 +1,126 @@
+#include "latencydev.hpp"
+#include "myfs.hpp"
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+// Throughput of many threads working in their own directories of one file system, on a simulated SSD.
+// Every thread creates, writes, reads back and removes small files, so it's mostly metadata commits.
+// usage: stress_bench [image path] [operations per thread]
+
+#define BENCH_MAX_THREADS 8
+#define BENCH_DEFAULT_OPERATIONS 200
+// the root and every directory only hold MAX_DIRECTORY_SIZE names, so threads are split into groups
+#define BENCH_THREADS_PER_GROUP 4
+#define BENCH_FILES_PER_THREAD 4
+
+struct Result {
+	size_t operations;
+	size_t errors;
+	uint64_t syncs;
+	double seconds;
+};
+
+static std::string threadDirectory(size_t thread) {
+	return "/g" + std::to_string(thread / BENCH_THREADS_PER_GROUP) + "/t" + std::to_string(thread);
+}
+
+static size_t worker(MyFs& myfs, size_t thread, size_t operations) {
+	std::string directory = threadDirectory(thread);
+	size_t errors = 0;
+	for (size_t i = 0; i < operations; i++) {
+		std::string path = directory + "/f" + std::to_string(i % BENCH_FILES_PER_THREAD);
+		std::string content = path + " #" + std::to_string(i);
+		try {
+			if (myfs.isFileExists(path)) {
+				myfs.remove(path);
+			}
+			myfs.createFile(path);
+			myfs.setContent(path, content);
+			if (myfs.getContent(path) != content) {
+				errors++;
+			}
+		} catch (const std::exception& e) {
+			std::cerr << path << ": " << e.what() << std::endl;
+			errors++;
+		}
+	}
+	return errors;
+}
+
+static Result run(const std::string& path, size_t threadCount, size_t operations) {
+	unlink(path.c_str());
+	BlockDeviceSimulator raw(path);
+	LatencyProfile profile = LatencyProfile::ssd();
+	profile.realTime = true;
+	LatencyBlockDevice blkdev(&raw, profile);
+	MyFs myfs(&blkdev);
+	for (size_t thread = 0; thread < threadCount; thread++) {
+		std::string group = "/g" + std::to_string(thread / BENCH_THREADS_PER_GROUP);
+		if (!myfs.isFileExists(group)) {
+			myfs.createDirectory(group);
+		}
+		myfs.createDirectory(threadDirectory(thread));
+	}
+	blkdev.getStats()->reset();
+
+	std::vector<std::thread> threads;
+	std::vector<size_t> errors(threadCount, 0);
+	auto start = std::chrono::steady_clock::now();
+	for (size_t thread = 0; thread < threadCount; thread++) {
+		threads.emplace_back([&, thread] { errors[thread] = worker(myfs, thread, operations); });
+	}
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	Result result{threadCount * operations, 0, 0, seconds};
+	for (size_t count : errors) {
+		result.errors += count;
+	}
+	result.syncs = blkdev.getStats()->snapshot().ops[static_cast<size_t>(IoOp::SYNC)].count;
+	return result;
+}
+
+// everything the threads left behind has to survive a remount
+static size_t verify(const std::string& path, size_t threadCount) {
+	BlockDeviceSimulator blkdev(path);
+	MyFs myfs(&blkdev);
+	size_t missing = 0;
+	for (size_t thread = 0; thread < threadCount; thread++) {
+		std::vector<EntryInfo> files = myfs.listDir(threadDirectory(thread));
+		if (files.size() != BENCH_FILES_PER_THREAD) {
+			missing++;
+		}
+		for (const EntryInfo& file : files) {
+			if (myfs.getContent(file).rfind(file.path, 0) != 0) {
+				missing++;
+			}
+		}
+	}
+	return missing;
+}
+
+int main(int argc, char** argv) {
+	std::string path = argc > 1 ? argv[1] : "stress_bench.img";
+	size_t operations = argc > 2 ? std::stoull(argv[2]) : BENCH_DEFAULT_OPERATIONS;
+
+	std::cout << std::left << std::setw(10) << "threads" << std::right << std::setw(12) << "ops/s" << std::setw(12)
+			  << "syncs/op" << std::setw(10) << "errors" << std::endl;
+	int status = 0;
+	for (size_t threadCount = 1; threadCount <= BENCH_MAX_THREADS; threadCount *= 2) {
+		Result result = run(path, threadCount, operations);
+		result.errors += verify(path, threadCount);
+		std::cout << std::left << std::setw(10) << threadCount << std::right << std::setw(12) << std::fixed
+				  << std::setprecision(0) << result.operations / result.seconds << std::setw(12)
+				  << std::setprecision(2) << static_cast<double>(result.syncs) / result.operations << std::setw(10)
+				  << result.errors << std::endl;
+		if (result.errors != 0) {
+			status = 1;
+		}
+	}
+	unlink(path.c_str());
+	return status;
+}
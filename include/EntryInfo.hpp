@@ -2,44 +2,107 @@
 
 #include <string>
 #include <cstring>
+#include <cstdint>
 
 enum EntryTypes : uint8_t {
 	FILE_TYPE = 1,
 	DIRECTORY_TYPE
 };
 
+// how the records of a FAT version are laid out, older images are read in theirs and rewritten in the newest
+enum class RecordFormat : uint8_t {
+	NATIVE_UNCHECKED, // up to 0x05, host sized fields and no checksum
+	NATIVE,			  // 0x06, host sized fields and a checksum
+	FIXED			  // 0x07 on, fixed width little endian fields, 8 byte aligned
+};
+
+// on disk integers are little endian whatever the host is, compilers turn these into plain loads and stores
+template <typename T>
+inline void storeLittleEndian(char* buffer, T value) {
+	for (size_t i = 0; i < sizeof(T); i++) {
+		buffer[i] = static_cast<char>(static_cast<uint64_t>(value) >> (8 * i));
+	}
+}
+
+template <typename T>
+inline T loadLittleEndian(const char* buffer) {
+	uint64_t value = 0;
+	for (size_t i = 0; i < sizeof(T); i++) {
+		value |= static_cast<uint64_t>(static_cast<unsigned char>(buffer[i])) << (8 * i);
+	}
+	return static_cast<T>(value);
+}
+
+// Fixed record layout, every field at a fixed offset so one look at the header is enough:
+// size u64, address u64, checksum u32, path length u16, type u8, reserved u8, then the path zero padded to 8 bytes
+#define RECORD_SIZE_OFFSET 0
+#define RECORD_ADDRESS_OFFSET 8
+#define RECORD_CHECKSUM_OFFSET 16
+#define RECORD_PATH_LENGTH_OFFSET 20
+#define RECORD_TYPE_OFFSET 22
+#define RECORD_RESERVED_OFFSET 23
+#define RECORD_HEADER_SIZE 24
+#define RECORD_ALIGNMENT 8
+
 using EntryInfo = struct EntryInfo {
 	std::string path;
 	size_t size;
 	size_t address;
 	EntryTypes type;
+	uint32_t checksum = 0; // crc32c of the content
 
 	bool operator<(const EntryInfo& other) const {
 		return path < other.path;
 	}
 
-	// Serialization
+	// Serialization, always in the fixed format
 	void serialize(char* buffer) const {
-		memcpy(buffer, &type, sizeof(type));
-		size_t pathLength = path.length();
-		memcpy(buffer + sizeof(type), &pathLength, sizeof(pathLength));
-		memcpy(buffer + sizeof(type) + sizeof(pathLength), path.c_str(), pathLength);
-		memcpy(buffer + sizeof(type) + sizeof(pathLength) + pathLength, &size, sizeof(size));
-		memcpy(buffer + sizeof(type) + sizeof(pathLength) + pathLength + sizeof(size), &address, sizeof(address));
+		storeLittleEndian<uint64_t>(buffer + RECORD_SIZE_OFFSET, size);
+		storeLittleEndian<uint64_t>(buffer + RECORD_ADDRESS_OFFSET, address);
+		storeLittleEndian<uint32_t>(buffer + RECORD_CHECKSUM_OFFSET, checksum);
+		storeLittleEndian<uint16_t>(buffer + RECORD_PATH_LENGTH_OFFSET, static_cast<uint16_t>(path.length()));
+		buffer[RECORD_TYPE_OFFSET] = static_cast<char>(type);
+		buffer[RECORD_RESERVED_OFFSET] = 0;
+		memcpy(buffer + RECORD_HEADER_SIZE, path.data(), path.length());
+		memset(buffer + RECORD_HEADER_SIZE + path.length(), 0, serializedSize() - RECORD_HEADER_SIZE - path.length());
 	}
 
-	// Deserialization
+	// Deserialization of a fixed record, the caller checked it fits
 	void deserialize(const char* buffer) {
+		size = loadLittleEndian<uint64_t>(buffer + RECORD_SIZE_OFFSET);
+		address = loadLittleEndian<uint64_t>(buffer + RECORD_ADDRESS_OFFSET);
+		checksum = loadLittleEndian<uint32_t>(buffer + RECORD_CHECKSUM_OFFSET);
+		type = static_cast<EntryTypes>(buffer[RECORD_TYPE_OFFSET]);
+		path.assign(buffer + RECORD_HEADER_SIZE, loadLittleEndian<uint16_t>(buffer + RECORD_PATH_LENGTH_OFFSET));
+	}
+
+	// records of 0x06 were the host's memory layout, with a checksum
+	void deserializeNative(const char* buffer) {
+		deserializeLegacy(buffer);
+		memcpy(&checksum, buffer + legacySerializedSize(), sizeof(checksum));
+	}
+
+	// records written before 0x06 have no checksum, it has to be computed from the content
+	void deserializeLegacy(const char* buffer) {
 		memcpy(&type, buffer, sizeof(type));
 		size_t pathLength = 0;
 		memcpy(&pathLength, buffer + sizeof(type), sizeof(pathLength));
 		path = std::string(buffer + sizeof(type) + sizeof(pathLength), pathLength);
 		memcpy(&size, buffer + sizeof(type) + sizeof(pathLength) + pathLength, sizeof(size));
 		memcpy(&address, buffer + sizeof(type) + sizeof(pathLength) + pathLength + sizeof(size), sizeof(address));
+		checksum = 0;
 	}
 
 	// Get the size needed for serialization
 	[[nodiscard]] size_t serializedSize() const {
+		return RECORD_HEADER_SIZE + (path.length() + RECORD_ALIGNMENT - 1) / RECORD_ALIGNMENT * RECORD_ALIGNMENT;
+	}
+
+	[[nodiscard]] size_t nativeSerializedSize() const {
+		return legacySerializedSize() + sizeof(checksum);
+	}
+
+	[[nodiscard]] size_t legacySerializedSize() const {
 		return sizeof(type) + sizeof(size_t) + path.length() + sizeof(size) + sizeof(address);
 	}
 };
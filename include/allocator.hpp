@@ -9,7 +9,9 @@
 #include <vector>
 #include <algorithm>
 #include <functional>
+#include <mutex>
 
+// Every method takes the allocator's own lock, so it can be shared by threads working on different entries
 class AddressAllocator {
   public:
 	AddressAllocator(size_t firstAddress_, size_t lastAddress_, uint16_t BLOCK_SIZE_);
@@ -17,10 +19,28 @@ class AddressAllocator {
 	void initialize(const std::set<EntryInfo>& entries, const uint16_t BLOCK_SIZE_);
 
 	size_t allocate(size_t requestedSize);
+	// the highest place that fits, SIZE_MAX if there's none
+	size_t allocateHighest(size_t requestedSize);
 	void deallocate(const EntryInfo& entry);
+	// marks a range as used without it belonging to an entry, parts already in use are skipped
+	void reserve(size_t address, size_t size);
 	void reallocate(EntryInfo& entry, size_t newSize);
 
-	void defrag(std::set<EntryInfo>& entries, BlockDeviceSimulator* blkdevsim);
+	// packs every entry to the front in place, a crash halfway leaves data the FAT on disk points at
+	// written over, the file system moves its data with MyFs::relocateData instead
+	void defrag(std::set<EntryInfo>& entries, BlockDevice* blkdevsim);
+
+	// bytes freed since the last takeReleased
+	[[nodiscard]] size_t releasedBytes() const;
+	// passes the freed ranges that are still free to handler, merged, dropping the ones smaller than minSize,
+	// nothing is allocated until handler returns
+	void takeReleased(size_t minSize, const std::function<void(size_t address, size_t size)>& handler);
+	// every free range, as if all of it was just freed
+	void releaseAllFree();
+	// copy of the free map, key: starting address, value: size
+	[[nodiscard]] std::map<size_t, size_t> freeRanges() const;
+	// what an entry of this size takes up
+	[[nodiscard]] size_t alignToBlockSize(const size_t size) const;
 
   private:
 	// shared memory with file system
@@ -29,7 +49,15 @@ class AddressAllocator {
 	size_t lastAddress;
 	uint16_t BLOCK_SIZE;
 	std::map<size_t, size_t> freeSpaces; // key: starting address, value: size
+	// freed but not yet handed out by takeReleased, may have been allocated again since
+	std::vector<std::pair<size_t, size_t>> released;
+	size_t releasedSize;
+	mutable std::mutex allocatorMutex;
+
+	// the caller holds allocatorMutex
+	size_t allocateLocked(size_t requestedSize);
+	void reserveLocked(size_t address, size_t size);
+	void deallocateLocked(size_t startAddress, size_t size);
 
-	[[nodiscard]] size_t alignToBlockSize(const size_t size) const;
 	void mergeFreeSpaces(size_t startAddress, size_t size);
 };
@@ -12,22 +12,88 @@
 #include <cstdlib>
 #include <cstring>
 #include <system_error>
+#include "iostats.hpp"
 
 #define NEW_FILE_PERMISSIONS 0644
 
-class BlockDeviceSimulator {
+// how a range is about to be used, devices that can't use a hint ignore it
+enum class AccessHint : uint8_t {
+	NORMAL,
+	SEQUENTIAL, // read front to back, read ahead aggressively
+	RANDOM,		// small scattered reads, read ahead would be wasted
+	WILLNEED	// read soon, start loading it now
+};
+
+// how the simulator maps its image
+struct MappingOptions {
+	bool accessHints = true; // pass the file system's hints on to the kernel
+	bool populate = false;	 // fault the whole image in up front, for small hot images
+	bool hugePages = false;	 // ask for transparent huge pages, only some file systems can back them
+};
+
+// What the file system needs from the storage underneath it
+class BlockDevice {
   public:
-	explicit BlockDeviceSimulator(const std::string& fname);
-	~BlockDeviceSimulator();
+	virtual ~BlockDevice() = default;
 
-	void read(size_t addr, size_t size, char* ans);
-	void write(size_t addr, size_t size, const char* data);
+	virtual void read(size_t addr, size_t size, char* ans) = 0;
+	virtual void write(size_t addr, size_t size, const char* data) = 0;
+	// blocks until the given range reached stable storage
+	virtual void sync(size_t addr, size_t size) = 0;
+	// the range's content is no longer needed and may read back as anything, the device can release its storage
+	virtual void discard([[maybe_unused]] size_t addr, [[maybe_unused]] size_t size) {
+	}
+	virtual void advise([[maybe_unused]] size_t addr, [[maybe_unused]] size_t size, [[maybe_unused]] AccessHint hint) {
+	}
+	// moves size bytes between a host file and the range, from the file's current offset on,
+	// both return the crc32c of what was moved. These go through a buffer, devices that can reach
+	// their storage directly should move the data without one
+	virtual uint32_t fillFrom(int fd, size_t addr, size_t size);
+	virtual uint32_t copyTo(int fd, size_t addr, size_t size);
+	// copies size bytes from one range of the device to another front to back, a target below the
+	// source may overlap it
+	virtual void move(size_t from, size_t to, size_t size);
+	// the range where it lies, for devices whose storage can be addressed directly, nullptr for the rest.
+	// The caller keeps writers off the range while it looks at it
+	virtual const char* view([[maybe_unused]] size_t addr, [[maybe_unused]] size_t size) {
+		return nullptr;
+	}
+	// counters of the requests this device served, if it keeps any
+	virtual IoStats* getStats() {
+		return nullptr;
+	}
+	[[nodiscard]] virtual size_t getSize() const = 0;
+
+	// size of newly created images
+	static constexpr size_t DEFAULT_DEVICE_SIZE = 1024 * 1024;
+};
+
+class BlockDeviceSimulator : public BlockDevice {
+  public:
+	// newSize only applies if the file doesn't exist yet, existing images keep their size,
+	// the file is locked while it's open, a second one on the same image throws
+	explicit BlockDeviceSimulator(const std::string& fname, size_t newSize = DEFAULT_DEVICE_SIZE,
+								  const MappingOptions& options_ = {});
+	~BlockDeviceSimulator() override;
 
-	static constexpr int DEVICE_SIZE = 1024 * 1024;
+	void read(size_t addr, size_t size, char* ans) override;
+	void write(size_t addr, size_t size, const char* data) override;
+	void sync(size_t addr, size_t size) override;
+	void discard(size_t addr, size_t size) override;
+	void advise(size_t addr, size_t size, AccessHint hint) override;
+	// straight between the file and the mapping
+	uint32_t fillFrom(int fd, size_t addr, size_t size) override;
+	uint32_t copyTo(int fd, size_t addr, size_t size) override;
+	const char* view(size_t addr, size_t size) override;
+	IoStats* getStats() override;
+	[[nodiscard]] size_t getSize() const override;
 
   private:
 	int fd;
+	size_t deviceSize;
+	MappingOptions options;
 	unsigned char* filemap;
+	IoStats stats;
 };
 
 #endif // __BLKDEVSIM__H__
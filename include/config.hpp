@@ -4,10 +4,113 @@
 
 #pragma region myfsSettings
 #define MYFS_MAGIC "MYFS"
-#define CURR_VERSION 0x03
+#define CURR_VERSION 0x07
+// last version whose FAT records were host sized, with checksums
+#define NATIVE_RECORDS_VERSION 0x06
+// first version with the A/B header slots, its FAT records have no checksums yet
+#define SHADOW_VERSION 0x05
+// images up to this version have a single header and the FAT in place, they're upgraded on mount
+#define LEGACY_VERSION 0x04
+#define FIRST_LEGACY_VERSION 0x03
 #define MAX_DIRECTORY_SIZE 6
 #define FAT_SIZE 4096
 #define MAX_PATH_LENGTH 256
+// header area, FAT slots, journal and a bit of data
+#define MIN_DEVICE_SIZE (256 * 1024)
+#pragma endregion
+
+#pragma region shadowSettings
+// the two header slots live in front of the data, inside the first FAT_SIZE bytes
+#define HEADER_SLOT_SIZE 512
+// FAT versions are written round robin to these slots, right before the journal
+#define FAT_SLOT_COUNT 3
+#pragma endregion
+
+#pragma region integritySettings
+// the background scrubber checks this many bytes at a time
+#define SCRUB_STEP_SIZE (64 * 1024)
+// how fast myfsd scrubs its image unless it's told otherwise
+#define SCRUB_BYTES_PER_SECOND (4 * 1024 * 1024)
+#pragma endregion
+
+#pragma region fsckSettings
+// entries checked by one task of the consistency checker
+#define FSCK_BATCH_SIZE 64
+// what a check keeps in memory instead of writing to the image is kept in pages of this size
+#define OVERLAY_PAGE_SIZE 4096
+#pragma endregion
+
+#pragma region discardSettings
+// freed ranges are collected until there is this much, then discarded together
+#define DISCARD_BATCH_SIZE (64 * 1024)
+// smaller ranges aren't worth the call, they'd hardly cover a page
+#define DISCARD_MIN_SIZE (16 * 1024)
+#pragma endregion
+
+#pragma region lockSettings
+// paths hash to this many locks, unrelated paths rarely share one
+#define PATH_LOCK_STRIPES 64
+#pragma endregion
+
+#pragma region treeSettings
+// workers copying trees, 0 for one per core
+#define TREE_WORKER_THREADS 0
+// files bigger than this are copied in chunks of this size, each one a task of its own
+#define TREE_COPY_CHUNK_SIZE (256 * 1024)
+// failures spelled out in the message of a TreeOperationError, the rest are only counted
+#define TREE_ERROR_DETAILS 3
+#pragma endregion
+
+#pragma region dentrySettings
+// parsed listings of this many directories are kept, 0 parses every listing it reads
+#define DENTRY_CACHE_SIZE 256
+#pragma endregion
+
+#pragma region hostSettings
+// put and get move data between host files and the device in pieces of this size
+#define HOST_TRANSFER_CHUNK_SIZE (1024 * 1024)
+// files moved at once by put and get, 0 for one per core
+#define HOST_TRANSFER_THREADS 0
+#define NEW_DIRECTORY_PERMISSIONS 0755
+// entries of a tar import committed together
+#define TAR_IMPORT_BATCH_SIZE 256
+// sync compares files in blocks of this size and rewrites only the ones that changed
+#define SYNC_BLOCK_SIZE (16 * 1024)
+#pragma endregion
+
+#pragma region remoteSettings
+// myfsd workers running requests, 0 for one per core
+#define REMOTE_WORKER_THREADS 0
+// connections the kernel holds until they're accepted
+#define REMOTE_LISTEN_BACKLOG 64
+// a bigger frame ends the connection, a file's whole content is the biggest thing sent
+#define REMOTE_MAX_FRAME_SIZE (1024U * 1024 * 1024)
+#pragma endregion
+
+#pragma region traceSettings
+#define TRACE_MAGIC "MYTR"
+#define TRACE_VERSION 1
+// records are collected up to this size before they're written to the trace
+#define TRACE_BUFFER_SIZE (64 * 1024)
+#pragma endregion
+
+#pragma region timelineSettings
+// spans each thread keeps for the timeline, older ones are overwritten
+#define TIMELINE_RING_SIZE (64 * 1024)
+#pragma endregion
+
+#pragma region readaheadSettings
+// reads at least this big tell the device to load the whole extent ahead of the copy
+#define READAHEAD_MIN_SIZE (64 * 1024)
+#pragma endregion
+
+#pragma region journalSettings
+#define JOURNAL_MAGIC "MYJL"
+#define TRANSACTION_MAGIC "MYTX"
+// the journal lives at the end of the device
+#define JOURNAL_SIZE (64 * 1024)
+// writes up to this size are journaled too when data journaling is enabled
+#define JOURNAL_DATA_THRESHOLD 512
 #pragma endregion
 
 #pragma region editorSettings
@@ -35,6 +138,30 @@
 #define MOVE_CMD 		      "mv"
 #define COPY_CMD 			  "cp"
 #define DELETE_CMD 		      "rm"
+#define SCRUB_CMD 		      "scrub"
+#define STATS_CMD 		      "stats"
+#define SHRINK_CMD 		      "shrink"
+#define PUT_CMD 			  "put"
+#define GET_CMD 			  "get"
+#define IMPORT_TAR_CMD 		  "import-tar"
+#define EXPORT_TAR_CMD 		  "export-tar"
+#define SYNC_CMD 			  "sync"
+
+// arguments of the stats command
+#define STATS_JSON_ARG "json"
+#define STATS_RESET_ARG "reset"
+
+// batch mode, runs a script instead of the prompt, also when stdin isn't a terminal
+#define BATCH_COMMANDS_ARG "-c"
+#define BATCH_TRANSACTION_ARG "-t"
+#define BATCH_SEPARATOR ';'
+#define BATCH_COMMENT '#'
+// records every call the shell makes to the file system, for myfs_replay
+#define TRACE_ARG "--trace"
+// writes the spans of a MYFS_TIMELINE build as Chrome trace JSON on exit
+#define TIMELINE_ARG "--timeline"
+// bytes per second the daemon's background scrubber reads, 0 turns it off
+#define SCRUB_RATE_ARG "--scrub-rate"
 
 
 // reasons to not be using std::string: https://wiki.sei.cmu.edu/confluence/display/cplusplus/ERR58-CPP.+Handle+all+exceptions+thrown+before+main()+begins+executing
@@ -66,12 +193,23 @@ enum class CommandType {
 	TREE,
 	COPY,
 	MOVE,
+	SCRUB,
+	STATS,
+	SHRINK,
+	PUT,
+	GET,
+	IMPORT_TAR,
+	EXPORT_TAR,
+	SYNC,
 	UNKNOWN
 };
 #pragma endregion
 
 #pragma region allocatorSettings
 
+// defrag and compaction move data within the device through a buffer of at most this size
+#define DEVICE_MOVE_CHUNK_SIZE (1024 * 1024)
+
 // Set allocator block size depending on if 32 bit or 64 bit, work in linux only
 // why do I do this you may ask? malloc does the same so why not?
 #if __GNUC__
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// CRC32C (Castagnoli), used to validate on-disk metadata
+// pass the previous result as crc to checksum data in pieces
+uint32_t crc32c(const void* data, size_t size, uint32_t crc = 0);
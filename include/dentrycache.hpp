@@ -0,0 +1,38 @@
+#pragma once
+
+#include "EntryInfo.hpp"
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Parsed directory listings of the most recently used directories. A listing is keyed by the size and
+// checksum of the content it was parsed from, so it's only handed out while the directory's entry still
+// describes exactly that content, whoever rewrote it in between. Safe to share between threads.
+class DentryCache {
+  public:
+	explicit DentryCache(size_t capacity_);
+
+	// the names in directory, if they were parsed from the content its entry has now
+	std::optional<std::vector<std::string>> find(const EntryInfo& directory);
+	// names as parsed from content of this size and checksum
+	void insert(const std::string& path, size_t size, uint32_t checksum, std::vector<std::string> names);
+	// drops path and every directory below it
+	void invalidate(const std::string& path);
+	void clear();
+
+  private:
+	struct Listing {
+		size_t size;
+		uint32_t checksum;
+		std::vector<std::string> names;
+		std::list<std::string>::iterator age; // position in recentlyUsed
+	};
+
+	size_t capacity;
+	std::mutex mutex;
+	std::unordered_map<std::string, Listing> listings;
+	std::list<std::string> recentlyUsed; // front is the most recent
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "threadslots.hpp"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#pragma region epochSettings
+// retired objects are only checked for readers once this many piled up
+#define EPOCH_RECLAIM_BATCH 8
+#pragma endregion
+
+// Epoch based reclamation. Readers pin the current epoch while they hold pointers into shared
+// data, writers retire whatever they replaced and it's freed once every reader that could still
+// see it is gone. Pinning is a store to a slot only the pinning thread writes, so readers never wait.
+class EpochManager {
+	// one per reading thread, on its own cache line so readers don't slow each other down
+	struct alignas(64) Slot {
+		std::atomic<uint64_t> epoch{0}; // 0 while the thread isn't reading
+		size_t depth = 0;				// only touched by the owning thread
+	};
+
+  public:
+	// pins are per thread and nest, release one on the thread that took it
+	class Guard {
+	  public:
+		explicit Guard(EpochManager& manager);
+		~Guard();
+		Guard(Guard&& other) noexcept;
+		Guard(const Guard&) = delete;
+		Guard& operator=(const Guard&) = delete;
+		Guard& operator=(Guard&&) = delete;
+
+	  private:
+		Slot* slot;
+	};
+
+	EpochManager();
+	// runs every deleter still waiting, nobody may be reading anymore
+	~EpochManager();
+	EpochManager(const EpochManager&) = delete;
+	EpochManager& operator=(const EpochManager&) = delete;
+
+	[[nodiscard]] Guard pin();
+	// deleter runs once no reader pinned before this call is left
+	void retire(std::function<void()> deleter);
+
+  private:
+	void reclaim();
+
+	std::atomic<uint64_t> globalEpoch;
+	// a thread leaves its slot unpinned when it exits, the next one reuses it
+	ThreadSlots<Slot> slots;
+	std::mutex retiredMutex;
+	std::vector<std::pair<uint64_t, std::function<void()>>> retired; // epoch it was retired in
+};
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "EntryInfo.hpp"
+#include "config.hpp"
+#include <set>
+#include <vector>
+
+// Decodes a whole FAT version in one pass over the buffer it was read into. Fixed records are
+// checked with straight line loads from their header, so a record costs one branch and a path copy.
+class FatReader {
+  public:
+	// decodes records from the front until one doesn't make sense, returns how many bytes held valid records
+	static size_t decode(const char* buffer, size_t size, RecordFormat format, std::set<EntryInfo>& result);
+
+  private:
+	static size_t decodeFixed(const char* buffer, size_t size, std::vector<EntryInfo>& decoded);
+	static size_t decodeNative(const char* buffer, size_t size, bool checksummed, std::vector<EntryInfo>& decoded);
+};
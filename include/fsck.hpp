@@ -0,0 +1,71 @@
+#pragma once
+
+#include "myfs.hpp"
+#include <ostream>
+#include <set>
+#include <string>
+#include <vector>
+
+// What a check found and what a repair did about it
+struct FsckReport {
+	std::vector<std::string> problems;
+	std::vector<std::string> repairs;
+	std::vector<std::string> remaining; // what a second check after the repair still found
+	size_t entriesChecked = 0;
+	size_t directoriesChecked = 0;
+	size_t bytesVerified = 0;
+	size_t leakedBytes = 0; // used in the free map but by no entry, the next mount gets it back
+
+	[[nodiscard]] bool clean() const;
+	void print(std::ostream& out) const;
+};
+
+// Checks a mounted file system against itself: the header slots, every record of the entry table,
+// directory listings against the table, extent overlaps and the free map. Entries are checked in
+// batches on the tree pool, the whole file system is held exclusively meanwhile.
+class FsChecker {
+  public:
+	explicit FsChecker(MyFs& myfs_);
+
+	// a repair drops what can't be saved, recreates missing directories, moves overlapping entries
+	// apart, rebuilds listings and the free map from the table and checkpoints the result
+	FsckReport check(bool repair, bool verifyData);
+	// fills the entry table of an image that doesn't mount from whatever FAT version survived
+	void salvage();
+
+  private:
+	struct Findings {
+		std::vector<std::string> problems;
+		std::set<std::string> badRecords;		  // dropped
+		std::set<std::string> badListings;		  // rebuilt from the table
+		std::set<std::string> missingDirectories; // created empty
+		std::set<std::string> overlapping;		  // moved to an extent of their own
+		bool headerDamaged = false;
+		bool newerFat = false; // a damaged header slot is newer than the one mounted and its FAT is intact
+		bool freeMapDamaged = false;
+		bool fatSizeWrong = false;
+		size_t directoriesChecked = 0;
+		size_t bytesVerified = 0;
+		size_t leakedBytes = 0;
+
+		void merge(Findings& other);
+	};
+
+	Findings scan(bool verifyData);
+	void checkHeaders(Findings& findings);
+	void checkEntry(const EntryInfo& entry, const std::set<std::string>& children, bool verifyData,
+					Findings& findings);
+	void checkExtents(Findings& findings);
+	void checkFreeMap(Findings& findings);
+	void repair(const Findings& findings, FsckReport& report);
+	void rebuildListing(const EntryInfo& directory, FsckReport& report);
+	// moves an entry to a fresh extent, its content comes along if it's still intact
+	void relocate(EntryInfo entry, FsckReport& report);
+	// a header that fails its checksum but whose FAT version is intact, fat gets that version
+	std::optional<MyFs::myfs_header> readUsableHeader(size_t slot, std::vector<char>& fat);
+	bool salvageFromHeaders();
+	bool salvageFromFatSlots();
+	[[nodiscard]] size_t extentOf(const EntryInfo& entry) const;
+
+	MyFs& myfs;
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "EntryInfo.hpp"
+#include <cstdint>
+#include <string>
+#include <sys/un.h>
+
+// The wire format between myfsd and its clients. Every frame is a fixed header and a payload:
+// payload length u32, request id u32, op (requests) or status (responses) u8, all little endian.
+// A client may send as many requests as it likes before reading, responses come back tagged with
+// the request's id in whatever order the requests finished.
+#define FRAME_LENGTH_OFFSET 0
+#define FRAME_ID_OFFSET 4
+#define FRAME_CODE_OFFSET 8
+#define FRAME_HEADER_SIZE 9
+
+enum class RemoteOp : uint8_t {
+	STAT = 1,		  // path -> found u8, entry if found
+	LIST_DIR,		  // path -> count u32, entries
+	LIST_TREE,		  // -> count u32, entries
+	GET_CONTENT,	  // path -> content
+	SET_CONTENT,	  // path, content ->
+	CREATE_FILE,	  // path ->
+	CREATE_DIRECTORY, // path ->
+	REMOVE,			  // path ->
+	MOVE,			  // source, destination ->
+	COPY,			  // source, destination ->
+	STATS			  // -> the device statistics as json
+};
+
+enum class RemoteStatus : uint8_t {
+	OK,
+	FAILED // the payload is the error message
+};
+
+struct Frame {
+	uint32_t id = 0;
+	uint8_t code = 0;
+	std::string payload;
+};
+
+// throws if the path doesn't fit in a socket address
+sockaddr_un socketAddress(const std::string& path);
+// false if the peer closed the connection between frames, anything else that goes wrong throws
+bool readFrame(int fd, Frame& frame);
+// the whole frame or an exception, never raises SIGPIPE
+void writeFrame(int fd, uint32_t id, uint8_t code, const std::string& payload);
+
+// Strings are a u32 length and the bytes, entries are the fixed records of the FAT
+class MessageWriter {
+  public:
+	void putUint8(uint8_t value);
+	void putUint32(uint32_t value);
+	void putString(const std::string& value);
+	void putEntry(const EntryInfo& entry);
+
+	std::string buffer;
+};
+
+// Throws on anything that doesn't fit in what was received
+class MessageReader {
+  public:
+	explicit MessageReader(const std::string& buffer_);
+
+	uint8_t getUint8();
+	uint32_t getUint32();
+	std::string getString();
+	EntryInfo getEntry();
+
+  private:
+	const char* take(size_t size);
+
+	const std::string& buffer;
+	size_t position;
+};
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "fsprotocol.hpp"
+#include "myfs.hpp"
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Serves one mounted file system to any number of local clients over a Unix domain socket.
+// Each connection has a thread reading its requests, the requests themselves run on the pool,
+// so a client that pipelines gets its requests executed side by side and answered as they finish.
+class FsServer {
+  public:
+	// binds and listens right away, before anything is mounted, a stale socket of an earlier run is replaced
+	explicit FsServer(const std::string& socketPath_);
+	// removes the socket
+	~FsServer();
+	FsServer(const FsServer&) = delete;
+	FsServer& operator=(const FsServer&) = delete;
+
+	// accepts connections until stop(), returns once every request was answered
+	void serve(MyFs& myfs_);
+	// from any thread, but not a signal handler
+	void stop();
+
+  private:
+	struct Connection {
+		Connection(int fd_, uint32_t id_, WorkStealingPool& pool) : fd(fd_), id(id_), requests(pool), done(false) {
+		}
+
+		const int fd;
+		const uint32_t id; // the client its requests are traced for
+		std::mutex writeMutex; // responses finish on different workers
+		TaskGroup requests;
+		std::thread reader;
+		std::atomic<bool> done;
+	};
+
+	void readRequests(Connection& connection);
+	void respond(Connection& connection, const Frame& request);
+	std::string execute(RemoteOp op, const std::string& payload);
+	// joins the readers of connections that ended, all of them when stopping
+	void reap(bool all);
+
+	MyFs* myfs; // while serving
+	const std::string socketPath;
+	int listenFd;
+	WorkStealingPool pool;
+	std::mutex connectionsMutex;
+	std::list<std::unique_ptr<Connection>> connections;
+	uint32_t nextConnectionId; // connectionsMutex
+	std::atomic<bool> stopping;
+};
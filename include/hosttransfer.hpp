@@ -0,0 +1,56 @@
+#pragma once
+
+#include "myfs.hpp"
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+// A file of the host, closed whichever way the transfer ends
+class HostFile {
+  public:
+	HostFile(const std::string& path, int flags);
+	~HostFile();
+	HostFile(const HostFile&) = delete;
+	HostFile& operator=(const HostFile&) = delete;
+
+	const int fd;
+};
+
+// What a sync found different and what it did about it
+struct SyncResult {
+	size_t files = 0;		 // host files compared
+	size_t updated = 0;		 // of them written to some degree
+	size_t bytesWritten = 0; // only the blocks that changed
+	size_t removed = 0;		 // entries with nothing left on the host
+};
+
+// Copies files and whole trees between the host's file system and an image. Files go straight between
+// the host file and the device, several at a time. Entries that fail don't stop the rest, they're
+// reported together in a TreeOperationError once everything else is done.
+class HostTransfer {
+  public:
+	explicit HostTransfer(MyFs& myfs_);
+
+	// hostPath into path, a directory with everything below it, existing files are replaced
+	void put(const std::string& hostPath, const std::string& path);
+	// path out to hostPath, a directory with everything below it, existing host files are replaced
+	void get(const std::string& path, const std::string& hostPath);
+	// makes the directory path a copy of hostPath, writing only what changed and removing what's gone in one commit
+	SyncResult sync(const std::string& hostPath, const std::string& path);
+
+  private:
+	void putTree(TaskGroup& group, const std::string& hostPath, const std::string& path);
+	void putFile(const std::string& hostPath, const std::string& path);
+	void getTree(TaskGroup& group, const std::string& path, const std::string& hostPath);
+	void getFile(const EntryInfo& entry, const std::string& hostPath);
+	// every directory and regular file below hostPath, by their paths relative to it, true for directories
+	void scanHostTree(const std::string& hostPath, const std::string& relative, std::map<std::string, bool>& tree);
+	void fail(const std::string& path, const std::exception& e);
+	void finish(TaskGroup& group, const std::string& name);
+
+	MyFs& myfs;
+	WorkStealingPool pool;
+	std::mutex failuresMutex;
+	std::vector<std::pair<std::string, std::string>> failures;
+};
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "threadslots.hpp"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#pragma region ioStatsSettings
+#define IO_OP_COUNT 3
+// log-linear histogram, every power of two is split into 2^LATENCY_SUB_BITS buckets
+#define LATENCY_SUB_BITS 3
+#define LATENCY_BUCKETS ((64 - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS)
+#define MAX_IO_REGIONS 8
+#pragma endregion
+
+enum class IoOp : uint8_t {
+	READ,
+	WRITE,
+	SYNC
+};
+
+// a named address range of the device, I/O is accounted per region
+struct IoRegion {
+	std::string name;
+	size_t start;
+	size_t end;
+};
+
+// Plain copy of every counter, summed over all threads
+struct IoStatsSnapshot {
+	struct OpStats {
+		uint64_t count = 0;
+		uint64_t bytes = 0;
+		uint64_t sequential = 0; // continued where the same thread's previous request ended
+		uint64_t random = 0;
+		uint64_t totalNanoseconds = 0;
+		std::array<uint64_t, LATENCY_BUCKETS> latency{};
+
+		// upper bound of the bucket holding the given fraction of requests
+		[[nodiscard]] uint64_t percentile(double fraction) const;
+	};
+
+	std::array<OpStats, IO_OP_COUNT> ops;
+	std::vector<IoRegion> regions;
+	std::vector<uint64_t> regionBytesRead;	  // one past the regions is everything outside them
+	std::vector<uint64_t> regionBytesWritten;
+	uint64_t logicalBytesWritten = 0; // what the file system was asked to store
+
+	void print(std::ostream& out) const;
+	[[nodiscard]] std::string toJson() const;
+};
+
+// Counters for one device. Every thread gets its own shard which only it writes,
+// so recording is a handful of uncontended stores, the shards are summed on demand.
+class IoStats {
+  public:
+	IoStats();
+
+	void setRegions(const std::vector<IoRegion>& newRegions);
+
+	void record(IoOp op, size_t addr, size_t size, std::chrono::nanoseconds latency);
+	void recordLogicalWrite(size_t size);
+
+	[[nodiscard]] IoStatsSnapshot snapshot();
+	void reset();
+
+	static size_t latencyBucket(uint64_t nanoseconds);
+	static uint64_t bucketUpperBound(size_t bucket);
+
+  private:
+	using Counter = std::atomic<uint64_t>;
+
+	struct OpCounters {
+		Counter count{0};
+		Counter bytes{0};
+		Counter sequential{0};
+		Counter random{0};
+		Counter totalNanoseconds{0};
+		std::array<Counter, LATENCY_BUCKETS> latency{};
+		size_t lastEnd = SIZE_MAX; // only touched by the owning thread
+	};
+
+	struct Shard {
+		std::array<OpCounters, IO_OP_COUNT> ops;
+		std::array<Counter, MAX_IO_REGIONS + 1> regionBytesRead{};
+		std::array<Counter, MAX_IO_REGIONS + 1> regionBytesWritten{};
+		Counter logicalBytesWritten{0};
+	};
+
+	void addRegionBytes(std::array<Counter, MAX_IO_REGIONS + 1>& counters, size_t addr, size_t size);
+
+	// only the owning thread writes a counter, so a relaxed load and store is enough
+	static void bump(Counter& counter, uint64_t amount) {
+		counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+	}
+
+	// a thread that exits leaves its shard and counts behind, the next one adds to them
+	ThreadSlots<Shard> shards;
+
+	// set when the file system mounts, before requests come in
+	std::array<IoRegion, MAX_IO_REGIONS> regions;
+	std::atomic<size_t> regionCount;
+};
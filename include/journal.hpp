@@ -0,0 +1,89 @@
+#pragma once
+
+#include "blkdev.hpp"
+#include "EntryInfo.hpp"
+#include "config.hpp"
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+enum class JournalRecordType : uint8_t {
+	ENTRY_UPSERT = 1, // host sized EntryInfo in the image's record format, replaces the entry with the same path
+	ENTRY_ERASE,	  // path of the removed entry
+	DATA,			  // device address followed by the bytes written there
+	FAT_SNAPSHOT,	  // block size followed by the whole serialized FAT, only 0x04 checkpoints wrote these
+	ENTRY_RECORD	  // fixed EntryInfo record, what ENTRY_UPSERT became in 0x07
+};
+
+using JournalRecordHandler = std::function<void(JournalRecordType type, const char* payload, size_t length)>;
+
+// Records of a transaction, built up by the thread running it and handed to the journal on commit
+class JournalRecords {
+  public:
+	void logUpsert(const EntryInfo& entry);
+	void logErase(const std::string& path);
+	void logData(size_t address, const char* data, size_t size);
+	void append(const JournalRecords& other);
+	void clear();
+
+	[[nodiscard]] bool empty() const;
+	[[nodiscard]] size_t size() const;
+	[[nodiscard]] const char* data() const;
+	void forEach(const JournalRecordHandler& handler) const;
+	static void forEach(const char* records, size_t size, const JournalRecordHandler& handler);
+
+  private:
+	void appendRecord(JournalRecordType type, size_t length);
+
+	std::vector<char> records;
+};
+
+// Write-ahead log of metadata changes, lives in its own region of the device.
+// commit() appends records as one checksummed transaction and syncs it, so many
+// small changes share a single flush. After a checkpoint the FAT on disk covers
+// everything and reset() drops the log. Not thread safe, one committer at a time.
+class Journal {
+  public:
+	using RecordHandler = JournalRecordHandler;
+
+	Journal(BlockDevice* blkdevsim_, size_t address_, size_t size_);
+
+	// returns false if the region doesn't hold a valid journal
+	bool open();
+	void format();
+	// feeds every record of every committed transaction to handler, in order
+	size_t replay(const RecordHandler& handler);
+
+	// whether records of this size can still be committed
+	[[nodiscard]] bool fits(size_t recordsSize) const;
+
+	void commit(const JournalRecords& records);
+	void reset();
+
+  private:
+	struct journal_header {
+		std::array<char, 4> magic;
+		uint32_t checksum;
+		uint64_t sequence; // first transaction that belongs to this log
+	};
+
+	struct transaction_header {
+		std::array<char, 4> magic;
+		uint32_t checksum; // covers sequence, length and the payload
+		uint64_t sequence;
+		uint64_t length;
+	};
+
+	void writeHeader();
+	static uint32_t headerChecksum(const journal_header& header);
+	static uint32_t transactionChecksum(const transaction_header& header, const char* payload);
+
+	BlockDevice* blkdevsim;
+	size_t address;
+	size_t size;
+	size_t head;	   // offset of the next transaction inside the region
+	uint64_t sequence; // sequence number of the next transaction
+	std::vector<char> buffer;
+};
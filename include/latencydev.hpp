@@ -0,0 +1,59 @@
+#pragma once
+
+#include "blkdev.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+// How slow the simulated media is, see LatencyProfile::hdd/ssd for sensible numbers
+struct LatencyProfile {
+	std::chrono::nanoseconds readLatency;  // fixed cost of every read
+	std::chrono::nanoseconds writeLatency; // fixed cost of every write
+	std::chrono::nanoseconds syncLatency;  // cache flush on top of writing back
+	std::chrono::nanoseconds seekLatency;  // paid when an access doesn't continue the previous one
+	std::chrono::nanoseconds fullStrokeSeek; // extra seek cost for crossing the whole device
+	size_t bandwidth;						 // bytes per second shared by all requests, 0 for unlimited
+	size_t queueDepth;						 // requests in flight at once, the rest wait
+	bool realTime;							 // actually sleep, or only account the simulated time
+
+	static LatencyProfile hdd();
+	static LatencyProfile ssd();
+};
+
+// Wraps another block device and delays every request the way slow media would,
+// so benchmarks show the cost of seeks and of many small requests on a laptop.
+class LatencyBlockDevice : public BlockDevice {
+  public:
+	LatencyBlockDevice(BlockDevice* inner_, const LatencyProfile& profile_);
+
+	void read(size_t addr, size_t size, char* ans) override;
+	void write(size_t addr, size_t size, const char* data) override;
+	void sync(size_t addr, size_t size) override;
+	void discard(size_t addr, size_t size) override;
+	void advise(size_t addr, size_t size, AccessHint hint) override;
+	// what the users of this device saw, delays included
+	IoStats* getStats() override;
+	[[nodiscard]] size_t getSize() const override;
+
+	// sum of the delays every request saw, including the time spent queueing
+	[[nodiscard]] std::chrono::nanoseconds getSimulatedTime();
+	void resetSimulatedTime();
+
+  private:
+	using Clock = std::chrono::steady_clock;
+
+	// returns the simulated latency of the request
+	std::chrono::nanoseconds delay(size_t addr, size_t size, std::chrono::nanoseconds fixedLatency);
+	static void waitUntil(Clock::time_point deadline);
+
+	BlockDevice* inner;
+	LatencyProfile profile;
+
+	std::mutex stateMutex;
+	std::condition_variable queueSlot;
+	size_t inFlight;
+	size_t headPosition;		  // where the previous request ended
+	Clock::time_point channelFree; // the bandwidth cap is modeled as one shared transfer channel
+	std::chrono::nanoseconds simulatedTime;
+	IoStats stats;
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+/* The C interface of myfs_core, for programs that embed the file system instead of running the shell.
+ * Everything here keeps working across releases, new calls only get added. Every call returns MYFS_OK
+ * or one of the negative statuses, myfs_last_error() has the message of the calling thread's last failure.
+ * A handle can be used from many threads at once. Paths are absolute. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MYFS_API_VERSION 1
+
+#define MYFS_OK 0
+#define MYFS_ERROR (-1)		/* anything without a status of its own */
+#define MYFS_NOT_FOUND (-2) /* no entry at the path */
+#define MYFS_TOO_SMALL (-3) /* the buffer can't hold the content, the size tells how big it has to be */
+#define MYFS_INVALID (-4)	/* a null handle, path or callback, or a call out of order */
+#define MYFS_IS_DIRECTORY (-5) /* a file operation on a directory */
+
+#define MYFS_TYPE_FILE 1
+#define MYFS_TYPE_DIRECTORY 2
+
+/* flags of myfs_open */
+#define MYFS_OPEN_LAZY 1	  /* mount without packing the data first, it's packed on close instead */
+#define MYFS_OPEN_NO_FORMAT 2 /* fail on a blank image instead of formatting it */
+
+typedef struct myfs myfs_t;
+
+typedef struct myfs_stat {
+	uint64_t size;
+	uint32_t checksum; /* crc32c of the content */
+	int type;		   /* MYFS_TYPE_FILE or MYFS_TYPE_DIRECTORY */
+} myfs_stat_t;
+
+/* data points into the image itself where the device allows it, it's only valid during the call */
+typedef void (*myfs_view_fn)(const void* data, size_t size, void* context);
+/* a nonzero return stops the listing */
+typedef int (*myfs_readdir_fn)(const char* name, const myfs_stat_t* stat, void* context);
+
+int myfs_api_version(void);
+const char* myfs_last_error(void);
+
+/* new_size only applies to an image that doesn't exist yet, 0 for the default size */
+int myfs_open(const char* image, uint64_t new_size, unsigned flags, myfs_t** fs);
+/* unmounts, a null handle is fine */
+int myfs_close(myfs_t* fs);
+
+int myfs_stat(myfs_t* fs, const char* path, myfs_stat_t* stat);
+int myfs_readdir(myfs_t* fs, const char* path, myfs_readdir_fn callback, void* context);
+
+/* the whole content into buffer, size gets the content's size even if it didn't fit */
+int myfs_read(myfs_t* fs, const char* path, void* buffer, size_t capacity, size_t* size);
+/* the content without a copy, callback runs while nothing can change it */
+int myfs_read_view(myfs_t* fs, const char* path, myfs_view_fn callback, void* context);
+/* replaces the content, the file is created if it doesn't exist, a directory is MYFS_IS_DIRECTORY */
+int myfs_write(myfs_t* fs, const char* path, const void* data, size_t size);
+
+int myfs_create(myfs_t* fs, const char* path);
+int myfs_mkdir(myfs_t* fs, const char* path);
+/* a directory goes with everything in it */
+int myfs_remove(myfs_t* fs, const char* path);
+int myfs_rename(myfs_t* fs, const char* from, const char* to);
+
+/* what the calling thread changes in between is committed at once */
+int myfs_begin(myfs_t* fs);
+/* MYFS_INVALID without a myfs_begin of the calling thread to match */
+int myfs_commit(myfs_t* fs);
+
+#ifdef __cplusplus
+}
+#endif
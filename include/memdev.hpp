@@ -0,0 +1,26 @@
+#pragma once
+
+#include "blkdev.hpp"
+#include <vector>
+
+// A device that only lives in memory, starts zeroed and is gone with the object. Nothing a
+// request does depends on the disk or the page cache, so benchmarks on it repeat exactly.
+class MemoryBlockDevice : public BlockDevice {
+  public:
+	explicit MemoryBlockDevice(size_t size);
+
+	void read(size_t addr, size_t size, char* ans) override;
+	void write(size_t addr, size_t size, const char* data) override;
+	// memory is as stable as it gets, only counted
+	void sync(size_t addr, size_t size) override;
+	const char* view(size_t addr, size_t size) override;
+	// requests are counted, their latency isn't measured, it would cost more than the copy
+	IoStats* getStats() override;
+	[[nodiscard]] size_t getSize() const override;
+
+  private:
+	void check(size_t addr, size_t size) const;
+
+	std::vector<char> memory;
+	IoStats stats;
+};
@@ -6,25 +6,137 @@
 #include "EntryInfo.hpp"
 #include "config.hpp"
 #include "allocator.hpp"
+#include "journal.hpp"
+#include "epoch.hpp"
+#include "threadslots.hpp"
+#include "workpool.hpp"
+#include "dentrycache.hpp"
+#include "optrace.hpp"
 #include <stdexcept>
 #include <set>
 #include <optional>
 #include <numeric>
 #include <functional>
 #include <sstream>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
 
-#define HEADER_SIZE (sizeof(uint8_t) + sizeof(size_t))
-#define ENTRY_BUFFER_SIZE (HEADER_SIZE + MAX_PATH_LENGTH + sizeof(size_t) + sizeof(size_t))
+enum class CommitMode {
+	JOURNAL, // log changes, write a new FAT version only on checkpoints
+	SHADOW	 // write a new FAT version and flip the header on every commit
+};
+
+// What the constructor may do to the image besides mounting it
+struct MountOptions {
+	// format a device that holds no file system yet
+	bool formatBlank = true;
+	// rebuild what's left of an image that doesn't mount, check and fix one that wasn't unmounted cleanly
+	bool repair = true;
+	// defragment and checkpoint on mount and unmount, off leaves the image the way it was found
+	bool maintain = true;
+	// leave the defrag maintain does for unmount, a mount then only reads the header, the FAT and the journal,
+	// so the first command doesn't wait for every file's data to be moved
+	bool lazy = false;
+};
 
+// A tree operation that went through for some entries and failed for others
+class TreeOperationError : public std::runtime_error {
+  public:
+	TreeOperationError(const std::string& operation, std::vector<std::pair<std::string, std::string>> failures_);
+
+	// path and error message of every entry that failed
+	[[nodiscard]] const std::vector<std::pair<std::string, std::string>>& getFailures() const;
+
+  private:
+	std::vector<std::pair<std::string, std::string>> failures;
+};
+
+// Safe to share between threads. Operations lock the paths they touch, so work on
+// different subtrees runs in parallel, and their commits are flushed to the journal in groups.
+// Lookups and reads take no locks at all, they go through the published version of the entry table.
+// The entry table helpers (addTableEntry and friends) expect the caller to hold those locks.
 class MyFs {
   public:
-	explicit MyFs(BlockDeviceSimulator* blkdevsim_);
+	explicit MyFs(BlockDevice* blkdevsim_, MountOptions options = {});
 	~MyFs();
 
 	void format();
 	void save();
 	void load();
 
+	// changes made between begin and commit are flushed to the journal together
+	void beginTransaction();
+	void commitTransaction();
+	// whether the calling thread is between begin and commit
+	[[nodiscard]] bool inTransaction();
+	// journal small data writes along with the metadata, not only order them before it
+	void setDataJournaling(bool enabled);
+	void setCommitMode(CommitMode mode);
+
+	// keeps the current FAT version and the data it points at around, read only
+	void createSnapshot();
+	void dropSnapshot();
+	[[nodiscard]] bool hasSnapshot() const;
+	std::vector<EntryInfo> listSnapshot();
+	std::string getSnapshotContent(const std::string& filepath);
+
+	// packs the data to the front and hands all free space back to the device, returns its size
+	size_t shrink();
+	// the free ranges of the data area, key: starting address, value: size
+	[[nodiscard]] std::map<size_t, size_t> freeSpace() const;
+
+	// counters of the device underneath, nullptr if it doesn't keep any
+	IoStats* getIoStats();
+	// records every public call from now on, nullptr stops, the tracer has to outlive the calls
+	void setTracer(OpTracer* tracer_);
+
+	// checks the content of entries after cursor against their checksums until maxBytes were read,
+	// returns the paths that failed, cursor is left empty once every entry was checked
+	std::vector<std::string> scrub(std::string& cursor, size_t maxBytes);
+
+	class Transaction {
+	  public:
+		explicit Transaction(MyFs& myfs_);
+		~Transaction() noexcept(false);
+		Transaction(const Transaction&) = delete;
+		Transaction& operator=(const Transaction&) = delete;
+
+	  private:
+		MyFs& myfs;
+		int uncaughtExceptions;
+	};
+
+	// Every entry as of one moment, writers don't wait for it and it doesn't copy the entries.
+	// Old versions of the table can't be freed while a view is held, so let it go soon,
+	// and on the thread that got it.
+	class EntryView {
+	  public:
+		using const_iterator = std::set<EntryInfo>::const_iterator;
+
+		[[nodiscard]] const_iterator begin() const {
+			return table->begin();
+		}
+		[[nodiscard]] const_iterator end() const {
+			return table->end();
+		}
+		[[nodiscard]] size_t size() const {
+			return table->size();
+		}
+
+	  private:
+		friend class MyFs;
+		EntryView(EpochManager::Guard guard_, const std::set<EntryInfo>* table_)
+			: guard(std::move(guard_)), table(table_) {
+		}
+
+		EpochManager::Guard guard;
+		const std::set<EntryInfo>* table;
+	};
+
 	std::optional<EntryInfo> getEntryInfo(const std::string& fileName);
 
 	void addTableEntry(EntryInfo& entryToAdd);
@@ -46,28 +158,233 @@ class MyFs {
 
 	std::string getContent(const std::string& filepath);
 	std::string getContent(const EntryInfo& entry);
+	// straight into buffer if it's big enough, returns the content's size either way
+	size_t getContent(const std::string& filepath, char* buffer, size_t bufferSize);
+	// reader gets the content where it lies on the device, a copy only if the device can't be addressed,
+	// nothing can change it until reader returns
+	void viewContent(const std::string& filepath, const std::function<void(const char*, size_t)>& reader);
 	void setContent(const std::string& filepath, const std::string& content);
 	void setContent(EntryInfo entry, const std::string& content);
+	void setContent(EntryInfo entry, const char* data, size_t size);
+
+	// size bytes of a host file into filepath, created if it doesn't exist yet, without a copy in between
+	void importFile(int fd, size_t size, const std::string& filepath);
+	// filepath made equal to size bytes of a host file, only the blocks that differ are written, returns how many bytes were
+	size_t updateFile(int fd, size_t size, const std::string& filepath);
+	// the content of filepath out to a host file, before gets the entry first, while nothing can change it
+	void exportFile(const std::string& filepath, int fd, const std::function<void(const EntryInfo&)>& before = nullptr);
 
 	std::vector<EntryInfo> listDir(const std::string& currentDir);
-	std::vector<EntryInfo> listTree();
+	EntryView listTree();
 
 	static std::pair<std::string, std::string> splitPath(const std::string& filepath);
 	static std::string addCurrentDir(const std::string& filename, const std::string& currentDir);
 
   private:
+	friend class FsChecker;
+
+	// what a thread has going on in this file system, transactions nest per thread
+	struct ThreadState {
+		int transactionDepth = 0;
+		int lockDepth = 0; // an operation further up the stack already holds the locks
+		JournalRecords records;
+		// data written since the last commit, flushed before the metadata pointing at it
+		std::vector<std::pair<size_t, size_t>> dirtyRanges;
+		// journaled data, only has to reach its home before the next checkpoint
+		std::vector<std::pair<size_t, size_t>> journaledRanges;
+	};
+
+	// One parallel copy. Its tasks run on the pool under the locks of the thread that started it,
+	// and their changes end up in that thread's transaction instead of being committed on their own.
+	struct TreeOperation {
+		explicit TreeOperation(WorkStealingPool& pool) : group(pool), nextSequence(0) {
+		}
+
+		TaskGroup group;
+		std::atomic<uint64_t> nextSequence;
+		std::mutex mutex;
+		// what every task changed, merged in spawn order so a directory's records come before its children's
+		std::vector<std::pair<uint64_t, ThreadState>> batches;
+		std::vector<std::pair<std::string, std::string>> failures;
+	};
+
+	enum class LockMode {
+		READ,			  // the entry and everything above it shared
+		WRITE,			  // the entry exclusive, which keeps everyone out of its subtree too
+		WRITE_WITH_PARENT // also the directory listing it
+	};
+
+	// Everything one operation locks, taken up front in stripe order so operations never deadlock.
+	// Operations nested inside another one reuse its locks.
+	class OperationLock {
+	  public:
+		// the whole file system, for checkpoints and anything that moves data around, waits for the
+		// transactions of other threads to be committed and throws inside one of the caller's own
+		explicit OperationLock(MyFs& myfs_);
+		OperationLock(MyFs& myfs_, std::initializer_list<std::pair<std::string, LockMode>> paths);
+		~OperationLock();
+		OperationLock(const OperationLock&) = delete;
+		OperationLock& operator=(const OperationLock&) = delete;
+
+	  private:
+		MyFs& myfs;
+		bool nested;
+		bool exclusive;
+		std::vector<std::pair<size_t, bool>> stripes; // index and whether it's held exclusively
+	};
+
+	// there are two of these, a commit always writes the one not in use
 	struct myfs_header {
+		std::array<char, 4> magic;
+		uint8_t version;
+		// what the snapshot's records are written in if that's older than version, 0 if it isn't,
+		// it sits in what used to be padding, which headers always wrote as zero
+		uint8_t snapshotVersion;
+		uint16_t blockSize;
+		uint64_t generation; // the newest valid slot wins on mount
+		uint64_t fatAddress;
+		uint64_t fatSize;
+		uint64_t snapshotAddress; // FAT version kept for the snapshot, 0 if there is none
+		uint64_t snapshotSize;
+		uint32_t fatChecksum;
+		uint32_t snapshotChecksum;
+		uint32_t checksum; // covers everything above
+	};
+
+	// versions up to 0x04 had a single header followed by the FAT
+	struct legacy_header {
 		std::array<char, 4> magic;
 		uint8_t version;
 		uint16_t blockSize;
 		size_t totalFatSize;
 	};
 
+	// everything the constructor does, publishedEntries has to be freed if it throws
+	void open();
+	// returns whether the journal had transactions to replay, which means nobody unmounted cleanly
+	bool mount();
+	// whether anything on the device looks like it belongs to a file system
+	bool hasFileSystem();
+	void describeRegions();
+	// packs the data to the front and checkpoints, what maintain does on mount, or on unmount if the mount was lazy
+	void compact();
+	// packs entries to the front through staging copies at the top of the free space, never writing over
+	// what the FAT on disk points at, a checkpoint before every place gets reused
+	void relocateData();
+	void loadLegacy();
+	void commit();
+	// writes a batch of committed transactions, only one thread at a time
+	void flush(const JournalRecords& batch);
+	// writes a new FAT version holding source and flips the header to it
+	void checkpoint(const std::set<EntryInfo>& source);
+	size_t replayJournal();
+	void applyRecord(std::set<EntryInfo>& target, JournalRecordType type, const char* payload, size_t length,
+					 bool writeData);
+	void writeData(size_t address, size_t size, const char* data);
+	// setContent without the trace, for an entry of the given type only, listings are written through it
+	void writeContent(EntryInfo entry, const char* data, size_t size, EntryTypes type);
+	// false if the content doesn't match the entry's checksum, a writer may have moved it meanwhile
+	bool readContent(const EntryInfo& entry, std::string& content);
+	// hands readers an immutable copy of entries, entriesMutex or the whole file system held
+	void publishEntries();
+	void syncDirtyData(ThreadState& state);
+	ThreadState& threadState();
+	[[nodiscard]] size_t pathStripe(const std::string& path) const;
+	// hands freed ranges to the device once enough of them piled up, or right away if forced
+	size_t discardReleased(bool force);
+	WorkStealingPool& treePool();
+	void spawnTreeTask(TreeOperation& operation, const std::string& path, std::function<void()> task);
+	// waits for every task and adds their changes to the current transaction
+	void finishTreeOperation(TreeOperation& operation, const std::string& name);
+	void copyTree(TreeOperation& operation, const EntryInfo& directory, const std::string& dstPath);
+	void copyContent(TreeOperation& operation, const EntryInfo& source, const EntryInfo& destination);
+	// every entry at or below path, taken from one version of the table
+	std::vector<EntryInfo> collectSubtree(const std::string& path);
+	// the table entry of a new file or directory and its name in the parent's listing, neither if one fails
+	void addNewEntry(EntryInfo& newEntry, const std::pair<std::string, std::string>& pathAndName);
+	void removeTableEntries(std::vector<EntryInfo>& entriesToRemove);
+	// renames path and everything below it in one go, the data stays where it is
+	void renameTableEntries(const std::string& srcPath, const std::string& dstPath);
+	void initializeAllocator();
+	[[nodiscard]] bool isPinned(const EntryInfo& entry) const;
+	[[nodiscard]] size_t nextFatSlot() const;
+	[[nodiscard]] size_t fatAreaAddress() const;
+	[[nodiscard]] std::optional<myfs_header> readHeader(size_t slot);
+	static uint32_t headerChecksum(const myfs_header& header);
+	// brings the live entries to the newest record format, the next checkpoint writes them,
+	// and fills in the checksums older formats didn't keep
+	void upgradeRecords();
+	static RecordFormat recordFormatOf(uint8_t version);
+	static RecordFormat snapshotFormatOf(const myfs_header& header);
+	void recalculateFatSize();
+	static std::vector<char> serializeFat(const std::set<EntryInfo>& source);
+	static void deserializeFat(const char* buffer, size_t size, std::set<EntryInfo>& result, RecordFormat format);
+
 	std::set<EntryInfo> entries;
-	BlockDeviceSimulator* blkdevsim;
+	BlockDevice* blkdevsim;
+	MountOptions mountOptions;
 	AddressAllocator allocator;
 	size_t totalFatSize;
 	uint16_t BLOCK_SIZE;
+
+	// lock order: operationMutex, path stripes, transactionsMutex, entriesMutex, the allocator, commitMutex
+	std::shared_mutex operationMutex; // shared by every operation, exclusive for checkpoints and layout changes
+	std::array<std::shared_mutex, PATH_LOCK_STRIPES> pathLocks;
+	// threads between begin and commit, a checkpoint would write out what they haven't committed yet,
+	// so the whole file system is only taken once there are none
+	std::mutex transactionsMutex;
+	std::condition_variable transactionsDone;
+	size_t openTransactions;
+	std::mutex entriesMutex; // the entries set and totalFatSize, only writers touch them
+
+	// what readers see, replaced on every change and freed once no reader pinned it anymore
+	EpochManager entryEpochs;
+	std::atomic<const std::set<EntryInfo>*> publishedEntries;
+
+	// a thread only exits with its transactions done, so the next one takes over a clean state
+	ThreadSlots<ThreadState> threadStates;
+
+	Journal journal;
+	std::atomic<bool> journalData;
+	std::atomic<CommitMode> commitMode;
+
+	// group commit, whoever finds no flush running writes everything queued so far
+	std::mutex commitMutex;
+	std::condition_variable commitDone;
+	JournalRecords commitQueue;
+	std::vector<std::pair<size_t, size_t>> queuedJournaledRanges;
+	uint64_t queuedTicket;
+	uint64_t durableTicket;
+	bool flushing;
+	std::exception_ptr commitError; // a failed flush leaves the journal in an unknown state, every later commit fails too
+
+	// only touched by the flushing thread, or with the whole file system locked
+	std::set<EntryInfo> durableEntries; // what a mount would find, the FAT plus the journal
+	std::vector<std::pair<size_t, size_t>> checkpointRanges; // journaled data of flushed transactions
+
+	uint64_t generation;
+	size_t fatAddress;
+	// what the FAT versions on disk are written in, older than FIXED until the first checkpoint of an upgrade
+	RecordFormat recordFormat;
+	size_t snapshotAddress;
+	size_t snapshotSize;
+	uint32_t snapshotChecksum;
+	// a snapshot is never rewritten, it keeps the format of the image it was taken on
+	RecordFormat snapshotFormat;
+	std::set<EntryInfo> snapshotEntries;
+	// extents the snapshot shares with the live entries, never freed or written in place
+	std::map<size_t, size_t> pinnedExtents;
+
+	// listings don't have to be read and parsed again as long as their directory wasn't rewritten
+	DentryCache dentries;
+
+	std::atomic<OpTracer*> tracer;
+	// the tracer, unless this thread is inside an operation already, its calls belong to that one
+	OpTracer* activeTracer();
+
+	// started by the first tree copy, most file systems never need it
+	std::once_flag treePoolOnce;
+	std::unique_ptr<WorkStealingPool> treeWorkers;
 };
 
 #endif
\ No newline at end of file
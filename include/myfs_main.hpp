@@ -5,6 +5,12 @@
 #include "blkdev.hpp"
 #include "goodkilo.hpp"
 #include "shellPrompt.hpp"
+#include "hosttransfer.hpp"
+#include "tar.hpp"
+#include "remotefs.hpp"
+#include "timeline.hpp"
+#include <fstream>
+#include <functional>
 #include <iomanip>
 
 #include <cmath>
@@ -13,11 +19,35 @@
 // makes it look nicer
 #define COLUMN_SPACING 28
 
+// what a command takes, one table for the shell on an image and the one going through myfsd
+struct CommandSpec {
+	const char* name;
+	CommandType type;
+	size_t minArgs;
+	size_t maxArgs;
+	const char* usage; // what's said when the arguments don't fit
+	bool needsImage;   // can't go through myfsd
+};
+
+// runs one split up command against whatever the shell is working on, returns whether it was exit
+using CommandHandler = std::function<bool(const std::string& command, std::vector<std::string>& args, std::string& currentDir)>;
+
 std::string addCurrentDirAdvance(const std::string& path, const std::string& currentDir);
 void printHelpMessage();
 std::vector<std::string> splitCmd(const std::string& cmd);
 CommandType getCommandType(const std::string& cmd);
+// throws when the command is unknown or its arguments don't fit
+const CommandSpec& checkCommand(const std::string& command, const std::vector<std::string>& args);
+bool isPathArgument(CommandType commandType, size_t index);
 void editFile(MyFs& myfs, const std::string& fileLocation);
 void printEntries(const std::vector<EntryInfo>& entries);
+// a byte count with an optional K, M or G suffix
+size_t parseSize(const std::string& text);
 bool handleCommand(const std::string& command, std::vector<std::string>& args, MyFs& myfs, std::string& currentDir);
+// the commands that make sense through myfsd, the ones that need the image itself throw
+bool handleRemoteCommand(const std::string& command, std::vector<std::string>& args, RemoteFs& remote, std::string& currentDir);
+// splits a line, resolves its paths and hands it to handler, returns whether it was exit
+bool runCommandLine(const std::string& cmdline, const CommandHandler& handler, std::string& currentDir, bool batch);
+// runs every command of script without a prompt, returns the exit status, transaction commits it all at once if given
+int runBatch(std::istream& script, char separator, const CommandHandler& handler, MyFs* transaction);
 int main(int argc, char** argv);
\ No newline at end of file
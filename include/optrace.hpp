@@ -0,0 +1,96 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// what a trace record stands for, one per public call of MyFs, new ones only go at the end
+enum class TraceOp : uint8_t {
+	GET_ENTRY_INFO,
+	LIST_DIR,
+	LIST_TREE,
+	GET_CONTENT,
+	VIEW_CONTENT,
+	SET_CONTENT,
+	CREATE_FILE,
+	CREATE_DIRECTORY,
+	REMOVE,
+	MOVE,
+	COPY,
+	IMPORT_FILE,
+	UPDATE_FILE,
+	EXPORT_FILE,
+	BEGIN_TRANSACTION,
+	COMMIT_TRANSACTION,
+	CREATE_SNAPSHOT,
+	DROP_SNAPSHOT,
+	SHRINK,
+	COUNT
+};
+
+const char* traceOpName(TraceOp op);
+
+struct TraceRecord {
+	uint64_t start;	   // nanoseconds since the trace was started
+	uint64_t duration; // nanoseconds
+	uint32_t client;   // calls of one client happened one after another
+	TraceOp op;
+	bool failed;
+	uint64_t size; // bytes written or read, 0 where there are none
+	std::string path;
+	std::string otherPath; // where a move or copy went
+};
+
+// Writes a record of every call to a binary log: a header, then fixed little endian record headers,
+// each followed by its paths. Only sizes are kept, never content, so traces stay small and can leave
+// the machine. Records are buffered and written in batches, calls from any thread.
+class OpTracer {
+  public:
+	explicit OpTracer(const std::string& tracePath);
+	// writes what's still buffered
+	~OpTracer();
+	OpTracer(const OpTracer&) = delete;
+	OpTracer& operator=(const OpTracer&) = delete;
+
+	void record(const TraceRecord& traceRecord);
+	void flush();
+	[[nodiscard]] uint64_t now() const;
+
+	// the client the calls of this thread are recorded for, a thread gets its own unless it's told
+	static uint32_t currentClient();
+	static void setClient(uint32_t client);
+
+  private:
+	void flushLocked();
+
+	std::chrono::steady_clock::time_point started;
+	std::ofstream out;
+	std::mutex bufferMutex;
+	std::vector<char> buffer;
+};
+
+// Records one call when it's done, how long it took and whether it threw. Calls made from inside
+// another traced call, or by the tasks of one, aren't recorded, replaying the outer one makes them again.
+class TraceScope {
+  public:
+	// tracer may be null, nothing is recorded then
+	TraceScope(OpTracer* tracer_, TraceOp op, const std::string& path, uint64_t size = 0,
+			   const std::string& otherPath = "");
+	~TraceScope();
+	TraceScope(const TraceScope&) = delete;
+	TraceScope& operator=(const TraceScope&) = delete;
+
+	// for reads, the size is only known at the end
+	void setSize(uint64_t size);
+
+  private:
+	OpTracer* tracer;
+	TraceRecord traceRecord;
+	int uncaughtExceptions;
+};
+
+// every record of a trace in the order they were written, a record cut short by a crash ends it
+std::vector<TraceRecord> readTrace(const std::string& tracePath);
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "blkdev.hpp"
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Wraps another block device and keeps everything written to it in memory, reads see those writes
+// over what the device underneath holds, which is never written to. A check mounts an image through
+// this to replay its journal without touching it.
+class OverlayBlockDevice : public BlockDevice {
+  public:
+	explicit OverlayBlockDevice(BlockDevice* inner_);
+
+	void read(size_t addr, size_t size, char* ans) override;
+	void write(size_t addr, size_t size, const char* data) override;
+	// nothing of this reaches the device, there's nothing to wait for
+	void sync(size_t addr, size_t size) override;
+	void advise(size_t addr, size_t size, AccessHint hint) override;
+	[[nodiscard]] size_t getSize() const override;
+
+  private:
+	void check(size_t addr, size_t size) const;
+
+	BlockDevice* inner;
+	std::mutex pagesMutex;
+	std::unordered_map<size_t, std::vector<char>> pages; // key: page index, written ones only
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "fsprotocol.hpp"
+#include <future>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// A file system served by myfsd. Any number of threads can share one connection, every call sends its
+// request right away and only waits for its own answer, so requests from several threads are in
+// flight together. Errors of the daemon are thrown as runtime_errors with its message.
+class RemoteFs {
+  public:
+	explicit RemoteFs(const std::string& socketPath);
+	~RemoteFs();
+	RemoteFs(const RemoteFs&) = delete;
+	RemoteFs& operator=(const RemoteFs&) = delete;
+
+	std::optional<EntryInfo> getEntryInfo(const std::string& path);
+	std::vector<EntryInfo> listDir(const std::string& path);
+	std::vector<EntryInfo> listTree();
+	std::string getContent(const std::string& path);
+	void setContent(const std::string& path, const std::string& content);
+	void createFile(const std::string& path);
+	void createDirectory(const std::string& path);
+	void remove(const std::string& path);
+	void move(const std::string& source, const std::string& destination);
+	void copy(const std::string& source, const std::string& destination);
+	// the daemon's device statistics as json
+	std::string stats();
+
+  private:
+	using Response = std::pair<RemoteStatus, std::string>;
+
+	std::string call(RemoteOp op, const std::string& payload);
+	void readResponses();
+	static std::vector<EntryInfo> entries(const std::string& payload);
+
+	int fd;
+	std::mutex writeMutex;
+	std::mutex pendingMutex;
+	std::unordered_map<uint32_t, std::promise<Response>> pending;
+	uint32_t nextId;
+	bool closed; // the reader is done, nothing more will be answered
+	std::thread reader;
+};
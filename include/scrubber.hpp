@@ -0,0 +1,37 @@
+#pragma once
+
+#include "myfs.hpp"
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Walks every entry in the background and checks its content against its checksum,
+// reading at most bytesPerSecond so it doesn't starve the actual users of the image.
+class Scrubber {
+  public:
+	// myfs locks each entry while it's checked, other threads can keep using it
+	Scrubber(MyFs& myfs_, size_t bytesPerSecond_);
+	~Scrubber();
+
+	void start();
+	void stop();
+
+	std::vector<std::string> getCorruptedPaths();
+	size_t getCompletedPasses();
+
+  private:
+	void run();
+
+	MyFs& myfs;
+	size_t bytesPerSecond;
+
+	std::thread worker;
+	std::mutex stateMutex;
+	std::condition_variable wakeUp;
+	bool stopping;
+	std::set<std::string> corruptedPaths; // found by the last full pass and the current one
+	size_t completedPasses; // only the ones that got through every entry
+};
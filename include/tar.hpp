@@ -0,0 +1,33 @@
+#pragma once
+
+#include "myfs.hpp"
+#include <array>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Reads and writes whole trees as ustar archives, with pax headers for what ustar can't hold.
+// Both directions are one sequential pass over the stream, so it can be a pipe. File content goes
+// straight between the stream and the device. Entries that fail don't stop the rest unless the
+// stream itself can't be continued, they're reported together in a TreeOperationError.
+class TarStream {
+  public:
+	explicit TarStream(MyFs& myfs_);
+
+	// every entry of the archive on fd, created below path, returns how many there were
+	size_t importFrom(int fd, const std::string& path);
+	// path and everything below it, named relative to path, returns how many entries were written
+	size_t exportTo(const std::string& path, int fd);
+
+  private:
+	// the next entry and the extended headers before it, false once the archive ends
+	bool importEntry(int fd, const std::string& path, size_t& imported);
+	void makeDirectories(const std::string& path);
+	void writeHeader(int fd, const std::string& name, char type, uint64_t size);
+	void finish(const std::string& name);
+
+	MyFs& myfs;
+	std::set<std::string> knownDirectories; // created or seen by this import, no need to look them up again
+	std::vector<std::pair<std::string, std::string>> failures;
+};
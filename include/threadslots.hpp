@@ -0,0 +1,108 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// One T per thread that uses the owner, which only that thread writes while it has it. A thread hands
+// its slots back when it exits and the next new thread takes one of those before a new one is made,
+// so an owner that sees threads come and go only ever has as many slots as it had threads at once.
+// A slot is handed over as it was left, T has to be fine with a new thread picking up where the old
+// one stopped.
+template <typename T> class ThreadSlots {
+	struct Slot {
+		T value;
+		std::atomic<bool> taken{true};
+	};
+
+	// the slots of one thread, owned together with their owners so either may go first
+	struct Local {
+		std::vector<std::pair<uint64_t, std::shared_ptr<Slot>>> known;
+
+		~Local() {
+			for (std::pair<uint64_t, std::shared_ptr<Slot>>& slot : known) {
+				slot.second->taken.store(false, std::memory_order_release);
+			}
+		}
+	};
+
+  public:
+	ThreadSlots() : id(nextId().fetch_add(1)) {
+	}
+	ThreadSlots(const ThreadSlots&) = delete;
+	ThreadSlots& operator=(const ThreadSlots&) = delete;
+
+	// the calling thread's
+	T& local() {
+		// most threads only ever use one owner, so remember the last one
+		thread_local uint64_t cachedId = 0;
+		thread_local T* cachedValue = nullptr;
+		thread_local Local localSlots;
+
+		if (cachedId == id) {
+			return *cachedValue;
+		}
+		for (const std::pair<uint64_t, std::shared_ptr<Slot>>& known : localSlots.known) {
+			if (known.first == id) {
+				cachedId = id;
+				cachedValue = &known.second->value;
+				return *cachedValue;
+			}
+		}
+
+		// slots nobody else holds anymore belong to owners that are gone
+		auto gone = std::remove_if(localSlots.known.begin(), localSlots.known.end(),
+								   [](const std::pair<uint64_t, std::shared_ptr<Slot>>& known) {
+									   return known.second.use_count() == 1;
+								   });
+		localSlots.known.erase(gone, localSlots.known.end());
+
+		std::shared_ptr<Slot> slot;
+		{
+			std::lock_guard<std::mutex> lock(slotsMutex);
+			for (const std::shared_ptr<Slot>& candidate : slots) {
+				// only taken here under the lock, so nobody else can take it between the load and the store
+				if (!candidate->taken.load(std::memory_order_acquire)) {
+					candidate->taken.store(true, std::memory_order_relaxed);
+					slot = candidate;
+					break;
+				}
+			}
+			if (!slot) {
+				slot = std::make_shared<Slot>();
+				slots.push_back(slot);
+			}
+		}
+		localSlots.known.emplace_back(id, slot);
+		cachedId = id;
+		cachedValue = &slot->value;
+		return *cachedValue;
+	}
+
+	// every slot, taken or not, what threads left behind still counts
+	template <typename Visit> void forEach(Visit visit) {
+		std::lock_guard<std::mutex> lock(slotsMutex);
+		for (const std::shared_ptr<Slot>& slot : slots) {
+			visit(slot->value);
+		}
+	}
+
+	[[nodiscard]] size_t size() {
+		std::lock_guard<std::mutex> lock(slotsMutex);
+		return slots.size();
+	}
+
+  private:
+	static std::atomic<uint64_t>& nextId() {
+		static std::atomic<uint64_t> next{1};
+		return next;
+	}
+
+	const uint64_t id; // thread local lookups are keyed by this, never by address
+	std::mutex slotsMutex;
+	std::vector<std::shared_ptr<Slot>> slots;
+};
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+
+// Spans of the file system's internal phases, for a timeline that opens in Perfetto or chrome://tracing.
+// They're only compiled in with -DMYFS_TIMELINE=ON, otherwise TIMELINE_SPAN is nothing at all.
+// Every thread records into a ring of its own without taking a lock, once it's full the oldest spans go.
+#ifdef MYFS_TIMELINE
+#define TIMELINE_CONCAT_(a, b) a##b
+#define TIMELINE_CONCAT(a, b) TIMELINE_CONCAT_(a, b)
+// name has to be a string literal
+#define TIMELINE_SPAN(name) TimelineSpan TIMELINE_CONCAT(timelineSpan, __LINE__)(name)
+#else
+#define TIMELINE_SPAN(name) ((void)0)
+#endif
+
+class Timeline {
+  public:
+#ifdef MYFS_TIMELINE
+	static constexpr bool ENABLED = true;
+#else
+	static constexpr bool ENABLED = false;
+#endif
+
+	// nanoseconds since the process started recording
+	static uint64_t now();
+	static void record(const char* name, uint64_t start, uint64_t end);
+	// every span still in the rings, as Chrome trace JSON, best taken once the work is done
+	static void dump(std::ostream& out);
+};
+
+class TimelineSpan {
+  public:
+	explicit TimelineSpan(const char* name_) : name(name_), start(Timeline::now()) {
+	}
+	~TimelineSpan() {
+		Timeline::record(name, start, Timeline::now());
+	}
+	TimelineSpan(const TimelineSpan&) = delete;
+	TimelineSpan& operator=(const TimelineSpan&) = delete;
+
+  private:
+	const char* name;
+	uint64_t start;
+};
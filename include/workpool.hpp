@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of workers with a deque each. A worker runs the newest task of its own deque and
+// steals the oldest one of another worker when it runs dry, so a task spawned by a task stays
+// on the worker that spawned it while big, old subtrees are what gets stolen.
+class WorkStealingPool {
+  public:
+	// 0 starts one worker per core
+	explicit WorkStealingPool(size_t threadCount);
+	~WorkStealingPool();
+	WorkStealingPool(const WorkStealingPool&) = delete;
+	WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+	void submit(std::function<void()> task);
+	// runs one queued task on the calling thread, false if there was none
+	bool runPending();
+	[[nodiscard]] size_t size() const;
+
+  private:
+	struct Queue {
+		std::mutex mutex;
+		std::deque<std::function<void()>> tasks;
+	};
+
+	void work(size_t index);
+	bool take(size_t index, std::function<void()>& task);
+	size_t localIndex();
+
+	const uint64_t id; // thread local worker lookups are keyed by this, never by address
+	std::vector<std::unique_ptr<Queue>> queues;
+	std::vector<std::thread> workers;
+	std::atomic<size_t> nextQueue; // where tasks from outside the pool go, round robin
+	std::atomic<size_t> queued;
+
+	std::mutex sleepMutex;
+	std::condition_variable wakeUp;
+	bool stopping;
+};
+
+// Tasks that belong together. Waiting runs queued tasks instead of blocking,
+// so a task can wait for the tasks it spawned without tying up a worker.
+class TaskGroup {
+  public:
+	explicit TaskGroup(WorkStealingPool& pool_);
+	// waits, but swallows what wait() would throw
+	~TaskGroup();
+	TaskGroup(const TaskGroup&) = delete;
+	TaskGroup& operator=(const TaskGroup&) = delete;
+
+	void spawn(std::function<void()> task);
+	// until every spawned task finished, rethrows the first exception one of them threw
+	void wait();
+
+  private:
+	WorkStealingPool& pool;
+	std::atomic<size_t> outstanding;
+	std::mutex mutex;
+	std::condition_variable done;
+	std::exception_ptr error;
+};
@@ -1,32 +1,42 @@
 #include "allocator.hpp"
 #include "EntryInfo.hpp"
 #include "config.hpp"
+#include "timeline.hpp"
 
 AddressAllocator::AddressAllocator(size_t firstAddress_, size_t lastAddress_, uint16_t BLOCK_SIZE_)
-	: firstAddress(firstAddress_), lastAddress(lastAddress_), BLOCK_SIZE(BLOCK_SIZE_) {
+	: firstAddress(firstAddress_), lastAddress(lastAddress_), BLOCK_SIZE(BLOCK_SIZE_), releasedSize(0) {
 	assert(lastAddress > firstAddress + BLOCK_SIZE);
 	freeSpaces.emplace(firstAddress, lastAddress - firstAddress);
 }
 
 void AddressAllocator::initialize(const std::set<EntryInfo>& entries, const uint16_t BLOCK_SIZE_) {
+	TIMELINE_SPAN("AddressAllocator::initialize");
+	std::lock_guard<std::mutex> lock(allocatorMutex);
 	BLOCK_SIZE = BLOCK_SIZE_;
 	freeSpaces.clear();
+	released.clear();
+	releasedSize = 0;
 
 	if (entries.empty()) {
 		// If entries are empty, all space is free
 		freeSpaces.emplace(firstAddress, lastAddress - firstAddress);
 		return;
 	}
+	// entries are ordered by path, the gaps have to be found in address order
+	std::vector<EntryInfo> byAddress(entries.begin(), entries.end());
+	std::sort(byAddress.begin(), byAddress.end(),
+			  [](const EntryInfo& a, const EntryInfo& b) { return a.address < b.address; });
+
 	// Find free spaces between existing entries
 	size_t currentAddress = firstAddress;
 
-	for (const EntryInfo& entry : entries) {
+	for (const EntryInfo& entry : byAddress) {
 		if (entry.address > currentAddress) {
 			// There is a gap between the current address and the start of this entry
 			freeSpaces.emplace(currentAddress, entry.address - currentAddress);
 		}
 		// Move current address to the end of this entry
-		currentAddress = entry.address + alignToBlockSize(entry.size);
+		currentAddress = std::max(currentAddress, entry.address + alignToBlockSize(entry.size));
 	}
 
 	// Check for free space after the last entry
@@ -38,6 +48,12 @@ void AddressAllocator::initialize(const std::set<EntryInfo>& entries, const uint
 }
 
 size_t AddressAllocator::allocate(size_t requestedSize) {
+	TIMELINE_SPAN("AddressAllocator::allocate");
+	std::lock_guard<std::mutex> lock(allocatorMutex);
+	return allocateLocked(requestedSize);
+}
+
+size_t AddressAllocator::allocateLocked(size_t requestedSize) {
 	requestedSize = alignToBlockSize(requestedSize);
 
 	// Find a suitable free space block
@@ -59,12 +75,65 @@ size_t AddressAllocator::allocate(size_t requestedSize) {
 	throw std::overflow_error("Insufficient space to allocate");
 }
 
+size_t AddressAllocator::allocateHighest(size_t requestedSize) {
+	std::lock_guard<std::mutex> lock(allocatorMutex);
+	requestedSize = alignToBlockSize(requestedSize);
+	for (auto it = freeSpaces.rbegin(); it != freeSpaces.rend(); ++it) {
+		if (it->second < requestedSize) {
+			continue;
+		}
+		size_t address = it->first + it->second - requestedSize;
+		address -= address % BLOCK_SIZE;
+		if (address >= it->first) {
+			reserveLocked(address, requestedSize);
+			return address;
+		}
+	}
+	return SIZE_MAX;
+}
+
+void AddressAllocator::reserve(size_t address, size_t size) {
+	std::lock_guard<std::mutex> lock(allocatorMutex);
+	reserveLocked(address, size);
+}
+
+void AddressAllocator::reserveLocked(size_t address, size_t size) {
+	size_t end = address + alignToBlockSize(size);
+
+	// carve the range out of every free space it touches
+	auto it = freeSpaces.upper_bound(address);
+	if (it != freeSpaces.begin()) {
+		--it;
+	}
+	while (it != freeSpaces.end() && it->first < end) {
+		size_t freeStart = it->first;
+		size_t freeEnd = freeStart + it->second;
+		if (freeEnd <= address) {
+			++it;
+			continue;
+		}
+		it = freeSpaces.erase(it);
+		if (freeStart < address) {
+			freeSpaces.emplace(freeStart, address - freeStart);
+		}
+		if (freeEnd > end) {
+			freeSpaces.emplace(end, freeEnd - end);
+		}
+	}
+}
+
 void AddressAllocator::deallocate(const EntryInfo& entry) {
+	TIMELINE_SPAN("AddressAllocator::deallocate");
 	//if (entry.size == 0)
 	//	return; // No need to deallocate zero-sized entries
 
-	size_t startAddress = entry.address;
-	size_t size = alignToBlockSize(entry.size);
+	std::lock_guard<std::mutex> lock(allocatorMutex);
+	deallocateLocked(entry.address, alignToBlockSize(entry.size));
+}
+
+void AddressAllocator::deallocateLocked(size_t startAddress, size_t size) {
+	released.emplace_back(startAddress, size);
+	releasedSize += size;
 
 	// Insert the freed block into the free spaces map
 	freeSpaces.emplace(startAddress, size);
@@ -73,6 +142,8 @@ void AddressAllocator::deallocate(const EntryInfo& entry) {
 }
 
 void AddressAllocator::reallocate(EntryInfo& entry, size_t newSize) {
+	TIMELINE_SPAN("AddressAllocator::reallocate");
+	std::lock_guard<std::mutex> lock(allocatorMutex);
 	size_t oldSize = alignToBlockSize(entry.size);
 	size_t newAlignedSize = alignToBlockSize(newSize);
 	size_t oldBlockCount = (oldSize + BLOCK_SIZE - 1) / BLOCK_SIZE;
@@ -85,7 +156,11 @@ void AddressAllocator::reallocate(EntryInfo& entry, size_t newSize) {
 	}
 
 	if (newBlockCount <= oldBlockCount) {
-		// If the new size is smaller or equal within the same block, no reallocation is needed
+		// If the new size is smaller or equal within the same block, no reallocation is needed,
+		// whole blocks past the new end go back, nothing would ever free them otherwise
+		if (newBlockCount < oldBlockCount) {
+			deallocateLocked(entry.address + newAlignedSize, oldSize - newAlignedSize);
+		}
 		entry.size = newSize;
 		return;
 	}
@@ -107,13 +182,22 @@ void AddressAllocator::reallocate(EntryInfo& entry, size_t newSize) {
 	}
 
 	// Otherwise, allocate a new block and deallocate the old one
-	deallocate(entry);
-	size_t newAddress = allocate(newSize);
+	deallocateLocked(entry.address, oldSize);
+	size_t newAddress = 0;
+	try {
+		newAddress = allocateLocked(newSize);
+	} catch (const std::overflow_error&) {
+		// nowhere to go, the entry keeps its old extent and that isn't free after all
+		released.pop_back();
+		releasedSize -= oldSize;
+		reserveLocked(entry.address, oldSize);
+		throw;
+	}
 	entry.address = newAddress;
 	entry.size = newSize;
 }
 
-inline size_t AddressAllocator::alignToBlockSize(const size_t size) const {
+size_t AddressAllocator::alignToBlockSize(const size_t size) const {
 	if (size == 0) {
 		return BLOCK_SIZE;
 	}
@@ -141,8 +225,10 @@ void AddressAllocator::mergeFreeSpaces(size_t startAddress, size_t size) {
 	freeSpaces[startAddress] = size;
 }
 
-void AddressAllocator::defrag(std::set<EntryInfo>& entries, BlockDeviceSimulator* blkdevsim) {
+void AddressAllocator::defrag(std::set<EntryInfo>& entries, BlockDevice* blkdevsim) {
+	TIMELINE_SPAN("AddressAllocator::defrag");
 	// assert(nullptr == "defrag not working and corrupting data");
+	std::lock_guard<std::mutex> lock(allocatorMutex);
 	if (entries.empty()) {
 		return; // Nothing to defrag
 	}
@@ -154,42 +240,89 @@ void AddressAllocator::defrag(std::set<EntryInfo>& entries, BlockDeviceSimulator
 	std::sort(allEntries.begin(), allEntries.end(),
 			  [](const EntryInfo& a, const EntryInfo& b) { return a.address < b.address; });
 
-	// Step 3: Make sure root is at the beginning
-	auto it = std::find_if(allEntries.begin(), allEntries.end(), [](const EntryInfo& a) { return a.path == "/"; });
-	assert(it != allEntries.end());
-	EntryInfo rootEntry = *it; // root obviously must exist
-	allEntries.erase(it);
-
-	std::vector<char> buffer;
-	buffer.resize(rootEntry.size);
-	blkdevsim->read(rootEntry.address, rootEntry.size, buffer.data());
-	rootEntry.address = firstAddress;
-	blkdevsim->write(rootEntry.address, rootEntry.size, buffer.data());
-	entries.insert(rootEntry);
-
-	// Step 4: Reallocate entries to their new positions
-	size_t nextAvailableAddress = firstAddress + alignToBlockSize(rootEntry.size);
+	// every entry gets read once, load them all ahead, but not the free space after them
+	size_t usedEnd = firstAddress;
+	for (const EntryInfo& entry : allEntries) {
+		usedEnd = std::max(usedEnd, entry.address + alignToBlockSize(entry.size));
+	}
+	blkdevsim->advise(firstAddress, usedEnd - firstAddress, AccessHint::WILLNEED);
+
+	// Step 3: Move every entry down to the end of the one before it. In address order nothing moves up,
+	// so an entry only ever lands on space that's free or on its own old place, and goes through a
+	// buffer of DEVICE_MOVE_CHUNK_SIZE however much data there is. Root stays in line with the rest,
+	// pulling it to the front would land on entries that haven't moved yet
+	size_t nextAvailableAddress = firstAddress;
 	for (EntryInfo& entry : allEntries) {
-		size_t alignedSize = alignToBlockSize(entry.size);
-		buffer.resize(alignedSize);
+		if (entry.size == 0) {
+			// takes no space, there's nothing to move
+			continue;
+		}
+		if (entry.address != nextAvailableAddress) {
+			blkdevsim->move(entry.address, nextAvailableAddress, entry.size);
+			entry.address = nextAvailableAddress;
+		}
+		nextAvailableAddress += alignToBlockSize(entry.size);
+	}
+	entries.insert(allEntries.begin(), allEntries.end());
+
+	// Step 4: Set everything after all the entries to a free space
+	freeSpaces.clear();
 
-		// Read data from the old location
-		blkdevsim->read(entry.address, alignedSize, buffer.data());
+	// The first free space is from the end of the last entry to the last address
+	freeSpaces.emplace(nextAvailableAddress, lastAddress - nextAvailableAddress);
+}
 
-		// Update entry's address
-		entry.address = nextAvailableAddress;
+size_t AddressAllocator::releasedBytes() const {
+	std::lock_guard<std::mutex> lock(allocatorMutex);
+	return releasedSize;
+}
 
-		// Write data to the new location
-		blkdevsim->write(entry.address, alignedSize, buffer.data());
+std::map<size_t, size_t> AddressAllocator::freeRanges() const {
+	std::lock_guard<std::mutex> lock(allocatorMutex);
+	return freeSpaces;
+}
 
-		nextAvailableAddress += alignedSize;
-		// Insert the updated entry into the set
-		entries.insert(entry);
+void AddressAllocator::releaseAllFree() {
+	std::lock_guard<std::mutex> lock(allocatorMutex);
+	released.assign(freeSpaces.begin(), freeSpaces.end());
+	releasedSize = 0;
+	for (const std::pair<const size_t, size_t>& space : freeSpaces) {
+		releasedSize += space.second;
 	}
+}
 
-	// Step 5: Set everything after all the entries to a free space
-	freeSpaces.clear();
+void AddressAllocator::takeReleased(size_t minSize, const std::function<void(size_t address, size_t size)>& handler) {
+	std::lock_guard<std::mutex> lock(allocatorMutex);
+	std::sort(released.begin(), released.end());
+
+	// clip every released range to the free spaces, parts of it may be in use again
+	std::vector<std::pair<size_t, size_t>> result;
+	for (const std::pair<size_t, size_t>& range : released) {
+		size_t end = range.first + range.second;
+		auto it = freeSpaces.upper_bound(range.first);
+		if (it != freeSpaces.begin()) {
+			--it;
+		}
+		for (; it != freeSpaces.end() && it->first < end; ++it) {
+			size_t overlapStart = std::max(range.first, it->first);
+			size_t overlapEnd = std::min(end, it->first + it->second);
+			if (overlapStart >= overlapEnd) {
+				continue;
+			}
+			if (!result.empty() && result.back().first + result.back().second >= overlapStart) {
+				size_t mergedEnd = std::max(result.back().first + result.back().second, overlapEnd);
+				result.back().second = mergedEnd - result.back().first;
+			} else {
+				result.emplace_back(overlapStart, overlapEnd - overlapStart);
+			}
+		}
+	}
+	released.clear();
+	releasedSize = 0;
 
-	// The first free space is from the end of the last entry to the last address
-	freeSpaces.emplace(nextAvailableAddress, lastAddress - nextAvailableAddress);
+	for (const std::pair<size_t, size_t>& range : result) {
+		if (range.second >= minSize) {
+			handler(range.first, range.second);
+		}
+	}
 }
@@ -1,8 +1,80 @@
 #include "blkdev.hpp"
+#include <sys/file.h>
 #include <sys/mman.h>
+#include <algorithm>
 #include "config.hpp"
+#include "crc32c.hpp"
+#include "timeline.hpp"
+#include <vector>
 
-BlockDeviceSimulator::BlockDeviceSimulator(const std::string& fname) : fd(-1), filemap(nullptr) {
+// one read of at most size bytes, retried if a signal got in the way, 0 only at the end of the file
+static size_t readSome(int fd, char* buffer, size_t size) {
+	for (;;) {
+		ssize_t result = ::read(fd, buffer, size);
+		if (result > 0) {
+			return result;
+		}
+		if (result == 0) {
+			throw std::runtime_error("File ended before its size");
+		}
+		if (errno != EINTR) {
+			throw std::system_error(errno, std::generic_category(), "Failed to read file");
+		}
+	}
+}
+
+static size_t writeSome(int fd, const char* buffer, size_t size) {
+	for (;;) {
+		ssize_t result = ::write(fd, buffer, size);
+		if (result >= 0) {
+			return result;
+		}
+		if (errno != EINTR) {
+			throw std::system_error(errno, std::generic_category(), "Failed to write file");
+		}
+	}
+}
+
+uint32_t BlockDevice::fillFrom(int fd, size_t addr, size_t size) {
+	std::vector<char> buffer(std::min<size_t>(size, HOST_TRANSFER_CHUNK_SIZE));
+	uint32_t checksum = 0;
+	for (size_t done = 0; done < size;) {
+		size_t length = readSome(fd, buffer.data(), std::min(buffer.size(), size - done));
+		checksum = crc32c(buffer.data(), length, checksum);
+		write(addr + done, length, buffer.data());
+		done += length;
+	}
+	return checksum;
+}
+
+uint32_t BlockDevice::copyTo(int fd, size_t addr, size_t size) {
+	std::vector<char> buffer(std::min<size_t>(size, HOST_TRANSFER_CHUNK_SIZE));
+	uint32_t checksum = 0;
+	for (size_t done = 0; done < size;) {
+		size_t length = std::min(buffer.size(), size - done);
+		read(addr + done, length, buffer.data());
+		checksum = crc32c(buffer.data(), length, checksum);
+		for (size_t written = 0; written < length;) {
+			written += writeSome(fd, buffer.data() + written, length - written);
+		}
+		done += length;
+	}
+	return checksum;
+}
+
+void BlockDevice::move(size_t from, size_t to, size_t size) {
+	assert(to <= from || to >= from + size);
+	std::vector<char> buffer(std::min<size_t>(size, DEVICE_MOVE_CHUNK_SIZE));
+	for (size_t done = 0; done < size;) {
+		size_t length = std::min(buffer.size(), size - done);
+		read(from + done, length, buffer.data());
+		write(to + done, length, buffer.data());
+		done += length;
+	}
+}
+
+BlockDeviceSimulator::BlockDeviceSimulator(const std::string& fname, size_t newSize, const MappingOptions& options_)
+	: fd(-1), deviceSize(newSize), options(options_), filemap(nullptr) {
 	// Check if the file exists
 	if (access(fname.c_str(), F_OK) == -1) {
 		// File doesn't exist, create it
@@ -11,14 +83,10 @@ BlockDeviceSimulator::BlockDeviceSimulator(const std::string& fname) : fd(-1), f
 			throw std::system_error(errno, std::generic_category(), "Failed to create file");
 		}
 
-		if (lseek(fd, DEVICE_SIZE - 1, SEEK_SET) == -1) {
-			close(fd);
-			throw std::system_error(errno, std::generic_category(), "Failed to seek in file");
-		}
-
-		if (::write(fd, "\0", 1) == -1) {
+		// sparse, no data block is allocated until something is written there
+		if (ftruncate(fd, static_cast<off_t>(deviceSize)) == -1) {
 			close(fd);
-			throw std::system_error(errno, std::generic_category(), "Failed to write initial data to file");
+			throw std::system_error(errno, std::generic_category(), "Failed to size file");
 		}
 	} else {
 		// File exists, open it
@@ -26,24 +94,166 @@ BlockDeviceSimulator::BlockDeviceSimulator(const std::string& fname) : fd(-1), f
 		if (fd == -1) {
 			throw std::system_error(errno, std::generic_category(), "Failed to open file");
 		}
+		struct stat fileStat {};
+		if (fstat(fd, &fileStat) == -1) {
+			close(fd);
+			throw std::system_error(errno, std::generic_category(), "Failed to stat file");
+		}
+		deviceSize = fileStat.st_size;
+		if (deviceSize == 0) {
+			close(fd);
+			throw std::runtime_error("Empty image file");
+		}
 	}
 
-	filemap = static_cast<unsigned char*>(mmap(nullptr, DEVICE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+	// one mount per image, a second writer would overwrite the FAT and journal of the first
+	if (flock(fd, LOCK_EX | LOCK_NB) == -1) {
+		int error = errno;
+		close(fd);
+		if (error == EWOULDBLOCK) {
+			throw std::runtime_error("Image " + fname + " is in use by another mount");
+		}
+		throw std::system_error(error, std::generic_category(), "Failed to lock file");
+	}
+
+	int flags = MAP_SHARED | (options.populate ? MAP_POPULATE : 0);
+	filemap = static_cast<unsigned char*>(mmap(nullptr, deviceSize, PROT_READ | PROT_WRITE, flags, fd, 0));
 	if (filemap == MAP_FAILED) {
 		close(fd);
 		throw std::system_error(errno, std::generic_category(), "Failed to mmap file");
 	}
+	if (options.hugePages) {
+		// only a hint, most file systems can't back a shared mapping with huge pages
+		madvise(filemap, deviceSize, MADV_HUGEPAGE);
+	}
 }
 
 BlockDeviceSimulator::~BlockDeviceSimulator() {
-	munmap(filemap, DEVICE_SIZE);
+	munmap(filemap, deviceSize);
 	close(fd);
 }
 
 void BlockDeviceSimulator::read(size_t addr, size_t size, char* ans) {
+	TIMELINE_SPAN("BlockDevice::read");
+	auto start = std::chrono::steady_clock::now();
 	memcpy(ans, filemap + addr, size);
+	stats.record(IoOp::READ, addr, size, std::chrono::steady_clock::now() - start);
 }
 
 void BlockDeviceSimulator::write(size_t addr, size_t size, const char* data) {
+	TIMELINE_SPAN("BlockDevice::write");
+	auto start = std::chrono::steady_clock::now();
 	memcpy(filemap + addr, data, size);
+	stats.record(IoOp::WRITE, addr, size, std::chrono::steady_clock::now() - start);
+}
+
+const char* BlockDeviceSimulator::view(size_t addr, size_t size) {
+	if (addr > deviceSize || size > deviceSize - addr) {
+		throw std::out_of_range("View past the end of the device");
+	}
+	// counted as a read, that's what the caller does with it
+	stats.record(IoOp::READ, addr, size, std::chrono::steady_clock::duration::zero());
+	return reinterpret_cast<const char*>(filemap + addr);
+}
+
+uint32_t BlockDeviceSimulator::fillFrom(int fd, size_t addr, size_t size) {
+	uint32_t checksum = 0;
+	for (size_t done = 0; done < size;) {
+		auto start = std::chrono::steady_clock::now();
+		// the kernel copies the file straight into the mapping, the checksum reads it while it's still cached
+		char* target = reinterpret_cast<char*>(filemap + addr + done);
+		size_t length = readSome(fd, target, std::min<size_t>(HOST_TRANSFER_CHUNK_SIZE, size - done));
+		checksum = crc32c(target, length, checksum);
+		stats.record(IoOp::WRITE, addr + done, length, std::chrono::steady_clock::now() - start);
+		done += length;
+	}
+	return checksum;
+}
+
+uint32_t BlockDeviceSimulator::copyTo(int fd, size_t addr, size_t size) {
+	uint32_t checksum = 0;
+	for (size_t done = 0; done < size;) {
+		auto start = std::chrono::steady_clock::now();
+		const char* source = reinterpret_cast<const char*>(filemap + addr + done);
+		size_t length = std::min<size_t>(HOST_TRANSFER_CHUNK_SIZE, size - done);
+		checksum = crc32c(source, length, checksum);
+		for (size_t written = 0; written < length;) {
+			written += writeSome(fd, source + written, length - written);
+		}
+		stats.record(IoOp::READ, addr + done, length, std::chrono::steady_clock::now() - start);
+		done += length;
+	}
+	return checksum;
+}
+
+IoStats* BlockDeviceSimulator::getStats() {
+	return &stats;
+}
+
+size_t BlockDeviceSimulator::getSize() const {
+	return deviceSize;
+}
+
+void BlockDeviceSimulator::sync(size_t addr, size_t size) {
+	TIMELINE_SPAN("BlockDevice::sync");
+	auto begin = std::chrono::steady_clock::now();
+	// msync only accepts page aligned addresses
+	static const size_t pageSize = sysconf(_SC_PAGESIZE);
+	size_t start = addr - addr % pageSize;
+	if (msync(filemap + start, size + (addr - start), MS_SYNC) == -1) {
+		throw std::system_error(errno, std::generic_category(), "Failed to sync file");
+	}
+	stats.record(IoOp::SYNC, addr, size, std::chrono::steady_clock::now() - begin);
+}
+
+void BlockDeviceSimulator::advise(size_t addr, size_t size, AccessHint hint) {
+	if (!options.accessHints || size == 0) {
+		return;
+	}
+	// madvise works on whole pages, widen the range to cover them
+	static const size_t pageSize = sysconf(_SC_PAGESIZE);
+	size_t start = addr - addr % pageSize;
+	size_t length = std::min(addr + size, deviceSize) - start;
+
+	int advice = MADV_NORMAL;
+	switch (hint) {
+	case AccessHint::NORMAL:
+		advice = MADV_NORMAL;
+		break;
+	case AccessHint::SEQUENTIAL:
+		advice = MADV_SEQUENTIAL;
+		break;
+	case AccessHint::RANDOM:
+		advice = MADV_RANDOM;
+		break;
+	case AccessHint::WILLNEED:
+#ifdef MADV_POPULATE_READ
+		// maps the pages right away, saving a fault per page on top of the read from disk
+		if (madvise(filemap + start, length, MADV_POPULATE_READ) == 0) {
+			return;
+		}
+#endif
+		advice = MADV_WILLNEED;
+		break;
+	}
+	// hints failing changes nothing about correctness
+	madvise(filemap + start, length, advice);
+}
+
+void BlockDeviceSimulator::discard(size_t addr, size_t size) {
+	TIMELINE_SPAN("BlockDevice::discard");
+	// only whole pages can be released, the partial ones at the edges stay as they are
+	static const size_t pageSize = sysconf(_SC_PAGESIZE);
+	size_t start = (addr + pageSize - 1) / pageSize * pageSize;
+	size_t end = (addr + size) / pageSize * pageSize;
+	if (start >= end) {
+		return;
+	}
+	if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, start, end - start) == 0) {
+		return;
+	}
+	// not every file system can punch holes, dropping the pages through the mapping does the same
+	if (madvise(filemap + start, end - start, MADV_REMOVE) == -1 && errno != EOPNOTSUPP && errno != EINVAL) {
+		throw std::system_error(errno, std::generic_category(), "Failed to discard range");
+	}
 }
@@ -0,0 +1,160 @@
+#include "crc32c.hpp"
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+#define CRC32C_HAS_SSE42 1
+#endif
+
+// reversed Castagnoli polynomial
+#define CRC32C_POLY 0x82F63B78u
+// the hardware path runs three independent streams over blocks of these sizes
+#define CRC32C_LONG_BLOCK 8192
+#define CRC32C_SHORT_BLOCK 256
+
+using SliceTable = std::array<std::array<uint32_t, 256>, 8>;
+
+static SliceTable makeSliceTable() {
+	SliceTable table{};
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t crc = i;
+		for (int bit = 0; bit < 8; bit++) {
+			crc = (crc & 1) != 0 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+		}
+		table[0][i] = crc;
+	}
+	// table[k][i] is the crc of byte i followed by k zero bytes
+	for (uint32_t i = 0; i < 256; i++) {
+		for (size_t k = 1; k < table.size(); k++) {
+			table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xFF];
+		}
+	}
+	return table;
+}
+
+static const SliceTable sliceTable = makeSliceTable();
+
+// slicing-by-8, one table lookup per byte but eight of them independent
+static uint32_t crc32cSoftware(const unsigned char* bytes, size_t size, uint32_t crc) {
+	while (size > 0 && (reinterpret_cast<uintptr_t>(bytes) & 7) != 0) {
+		crc = sliceTable[0][(crc ^ *bytes++) & 0xFF] ^ (crc >> 8);
+		size--;
+	}
+	while (size >= 8) {
+		uint64_t word = 0;
+		memcpy(&word, bytes, sizeof(word));
+		word ^= crc;
+		crc = sliceTable[7][word & 0xFF] ^ sliceTable[6][(word >> 8) & 0xFF] ^ sliceTable[5][(word >> 16) & 0xFF] ^
+			  sliceTable[4][(word >> 24) & 0xFF] ^ sliceTable[3][(word >> 32) & 0xFF] ^
+			  sliceTable[2][(word >> 40) & 0xFF] ^ sliceTable[1][(word >> 48) & 0xFF] ^ sliceTable[0][word >> 56];
+		bytes += 8;
+		size -= 8;
+	}
+	while (size > 0) {
+		crc = sliceTable[0][(crc ^ *bytes++) & 0xFF] ^ (crc >> 8);
+		size--;
+	}
+	return crc;
+}
+
+#ifdef CRC32C_HAS_SSE42
+
+// a*b modulo the polynomial, both in the reflected bit order
+static uint32_t multiplyModPoly(uint32_t a, uint32_t b) {
+	uint32_t product = 0;
+	for (uint32_t mask = 1u << 31; mask != 0; mask >>= 1) {
+		if ((a & mask) != 0) {
+			product ^= b;
+		}
+		b = (b & 1) != 0 ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+	}
+	return product;
+}
+
+// x^(8*bytes) modulo the polynomial, multiplying by it appends that many zero bytes to a crc
+static uint32_t zerosOperator(size_t bytes) {
+	uint32_t result = 1u << 31; // x^0
+	uint32_t power = 1u << 30;	// x^1
+	for (size_t bits = bytes * 8; bits != 0; bits >>= 1) {
+		if ((bits & 1) != 0) {
+			result = multiplyModPoly(power, result);
+		}
+		power = multiplyModPoly(power, power);
+	}
+	return result;
+}
+
+static const uint32_t longShift = zerosOperator(CRC32C_LONG_BLOCK);
+static const uint32_t shortShift = zerosOperator(CRC32C_SHORT_BLOCK);
+
+__attribute__((target("sse4.2"))) static void crc32cStreams(const unsigned char*& bytes, size_t& size, uint32_t& crc,
+															 size_t block, uint32_t shift) {
+	// the crc32 instruction has a latency of 3 and a throughput of 1, keep three in flight
+	while (size >= 3 * block) {
+		uint64_t crc0 = crc;
+		uint64_t crc1 = 0;
+		uint64_t crc2 = 0;
+		const unsigned char* end = bytes + block;
+		do {
+			uint64_t word0 = 0;
+			uint64_t word1 = 0;
+			uint64_t word2 = 0;
+			memcpy(&word0, bytes, sizeof(word0));
+			memcpy(&word1, bytes + block, sizeof(word1));
+			memcpy(&word2, bytes + 2 * block, sizeof(word2));
+			crc0 = _mm_crc32_u64(crc0, word0);
+			crc1 = _mm_crc32_u64(crc1, word1);
+			crc2 = _mm_crc32_u64(crc2, word2);
+			bytes += 8;
+		} while (bytes < end);
+		// stitch the streams back together
+		crc = multiplyModPoly(shift, static_cast<uint32_t>(crc0)) ^ static_cast<uint32_t>(crc1);
+		crc = multiplyModPoly(shift, crc) ^ static_cast<uint32_t>(crc2);
+		bytes += 2 * block;
+		size -= 3 * block;
+	}
+}
+
+__attribute__((target("sse4.2"))) static uint32_t crc32cHardware(const unsigned char* bytes, size_t size,
+																  uint32_t crc) {
+	while (size > 0 && (reinterpret_cast<uintptr_t>(bytes) & 7) != 0) {
+		crc = _mm_crc32_u8(crc, *bytes++);
+		size--;
+	}
+	crc32cStreams(bytes, size, crc, CRC32C_LONG_BLOCK, longShift);
+	crc32cStreams(bytes, size, crc, CRC32C_SHORT_BLOCK, shortShift);
+
+	uint64_t crc64 = crc;
+	while (size >= 8) {
+		uint64_t word = 0;
+		memcpy(&word, bytes, sizeof(word));
+		crc64 = _mm_crc32_u64(crc64, word);
+		bytes += 8;
+		size -= 8;
+	}
+	crc = static_cast<uint32_t>(crc64);
+	while (size > 0) {
+		crc = _mm_crc32_u8(crc, *bytes++);
+		size--;
+	}
+	return crc;
+}
+
+#endif
+
+using CrcFunction = uint32_t (*)(const unsigned char*, size_t, uint32_t);
+
+static CrcFunction pickCrcFunction() {
+#ifdef CRC32C_HAS_SSE42
+	if (__builtin_cpu_supports("sse4.2")) {
+		return crc32cHardware;
+	}
+#endif
+	return crc32cSoftware;
+}
+
+uint32_t crc32c(const void* data, size_t size, uint32_t crc) {
+	static const CrcFunction function = pickCrcFunction();
+	return ~function(static_cast<const unsigned char*>(data), size, ~crc);
+}
@@ -0,0 +1,61 @@
+#include "dentrycache.hpp"
+
+DentryCache::DentryCache(size_t capacity_) : capacity(capacity_) {
+}
+
+std::optional<std::vector<std::string>> DentryCache::find(const EntryInfo& directory) {
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = listings.find(directory.path);
+	if (it == listings.end()) {
+		return std::nullopt;
+	}
+	Listing& listing = it->second;
+	if (listing.size != directory.size || listing.checksum != directory.checksum) {
+		// rewritten since, the next parse puts it back
+		recentlyUsed.erase(listing.age);
+		listings.erase(it);
+		return std::nullopt;
+	}
+	recentlyUsed.splice(recentlyUsed.begin(), recentlyUsed, listing.age);
+	return listing.names;
+}
+
+void DentryCache::insert(const std::string& path, size_t size, uint32_t checksum, std::vector<std::string> names) {
+	if (capacity == 0) {
+		return;
+	}
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = listings.find(path);
+	if (it != listings.end()) {
+		it->second.size = size;
+		it->second.checksum = checksum;
+		it->second.names = std::move(names);
+		recentlyUsed.splice(recentlyUsed.begin(), recentlyUsed, it->second.age);
+		return;
+	}
+	if (listings.size() >= capacity) {
+		listings.erase(recentlyUsed.back());
+		recentlyUsed.pop_back();
+	}
+	recentlyUsed.push_front(path);
+	listings.emplace(path, Listing{size, checksum, std::move(names), recentlyUsed.begin()});
+}
+
+void DentryCache::invalidate(const std::string& path) {
+	std::lock_guard<std::mutex> lock(mutex);
+	std::string prefix = path.back() == '/' ? path : path + "/";
+	for (auto it = listings.begin(); it != listings.end();) {
+		if (it->first == path || it->first.compare(0, prefix.size(), prefix) == 0) {
+			recentlyUsed.erase(it->second.age);
+			it = listings.erase(it);
+		} else {
+			++it;
+		}
+	}
+}
+
+void DentryCache::clear() {
+	std::lock_guard<std::mutex> lock(mutex);
+	listings.clear();
+	recentlyUsed.clear();
+}
@@ -0,0 +1,68 @@
+#include "epoch.hpp"
+#include <algorithm>
+
+EpochManager::EpochManager() : globalEpoch(1) {
+}
+
+EpochManager::~EpochManager() {
+	for (std::pair<uint64_t, std::function<void()>>& entry : retired) {
+		entry.second();
+	}
+}
+
+#pragma region readers
+
+EpochManager::Guard EpochManager::pin() {
+	return Guard(*this);
+}
+
+EpochManager::Guard::Guard(EpochManager& manager) : slot(&manager.slots.local()) {
+	if (slot->depth++ == 0) {
+		// seq_cst, the store has to be visible before this thread loads any shared pointer
+		slot->epoch.store(manager.globalEpoch.load());
+	}
+}
+
+EpochManager::Guard::Guard(Guard&& other) noexcept : slot(other.slot) {
+	other.slot = nullptr;
+}
+
+EpochManager::Guard::~Guard() {
+	if (slot != nullptr && --slot->depth == 0) {
+		slot->epoch.store(0, std::memory_order_release);
+	}
+}
+
+#pragma endregion
+#pragma region writers
+
+void EpochManager::retire(std::function<void()> deleter) {
+	// whoever pinned up to this epoch may have loaded the old pointer, later readers can't
+	uint64_t epoch = globalEpoch.fetch_add(1);
+	std::lock_guard<std::mutex> lock(retiredMutex);
+	retired.emplace_back(epoch, std::move(deleter));
+	if (retired.size() >= EPOCH_RECLAIM_BATCH) {
+		reclaim();
+	}
+}
+
+void EpochManager::reclaim() {
+	uint64_t oldest = UINT64_MAX;
+	slots.forEach([&oldest](const Slot& slot) {
+		uint64_t epoch = slot.epoch.load();
+		if (epoch != 0) {
+			oldest = std::min(oldest, epoch);
+		}
+	});
+
+	auto stillVisible = std::partition(retired.begin(), retired.end(),
+									   [oldest](const std::pair<uint64_t, std::function<void()>>& entry) {
+										   return entry.first >= oldest;
+									   });
+	for (auto it = stillVisible; it != retired.end(); ++it) {
+		it->second();
+	}
+	retired.erase(stillVisible, retired.end());
+}
+
+#pragma endregion
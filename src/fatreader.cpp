@@ -0,0 +1,61 @@
+#include "fatreader.hpp"
+
+size_t FatReader::decode(const char* buffer, size_t size, RecordFormat format, std::set<EntryInfo>& result) {
+	result.clear();
+	std::vector<EntryInfo> decoded;
+	decoded.reserve(size / RECORD_HEADER_SIZE);
+	size_t decodedSize = format == RecordFormat::FIXED
+							 ? decodeFixed(buffer, size, decoded)
+							 : decodeNative(buffer, size, format == RecordFormat::NATIVE, decoded);
+
+	// FAT versions are written from a set, so the records come sorted and every insert lands at the end
+	for (EntryInfo& entry : decoded) {
+		result.emplace_hint(result.end(), std::move(entry));
+	}
+	return decodedSize;
+}
+
+size_t FatReader::decodeFixed(const char* buffer, size_t size, std::vector<EntryInfo>& decoded) {
+	size_t offset = 0;
+	while (size - offset >= RECORD_HEADER_SIZE) {
+		const char* record = buffer + offset;
+		size_t pathLength = loadLittleEndian<uint16_t>(record + RECORD_PATH_LENGTH_OFFSET);
+		size_t recordSize =
+			RECORD_HEADER_SIZE + (pathLength + RECORD_ALIGNMENT - 1) / RECORD_ALIGNMENT * RECORD_ALIGNMENT;
+		// everything that makes a record undecodable folded into one test, a wrong type or address
+		// is for the checker to find, the record itself is intact
+		bool invalid = (pathLength == 0) | (pathLength > MAX_PATH_LENGTH);
+		invalid |= record[RECORD_TYPE_OFFSET] == 0;
+		invalid |= record[RECORD_RESERVED_OFFSET] != 0;
+		invalid |= recordSize > size - offset;
+		if (invalid) {
+			break;
+		}
+		decoded.emplace_back();
+		decoded.back().deserialize(record);
+		offset += recordSize;
+	}
+	return offset;
+}
+
+size_t FatReader::decodeNative(const char* buffer, size_t size, bool checksummed, std::vector<EntryInfo>& decoded) {
+	// type, path length, path, size, address, and the checksum from 0x06 on, all host sized
+	const size_t fixedSize = sizeof(EntryTypes) + 3 * sizeof(size_t) + (checksummed ? sizeof(uint32_t) : 0);
+	size_t offset = 0;
+	while (size - offset >= sizeof(EntryTypes) + sizeof(size_t)) {
+		const char* record = buffer + offset;
+		size_t pathLength = 0;
+		memcpy(&pathLength, record + sizeof(EntryTypes), sizeof(pathLength));
+		if (record[0] == 0 || pathLength == 0 || pathLength > MAX_PATH_LENGTH || fixedSize + pathLength > size - offset) {
+			break;
+		}
+		decoded.emplace_back();
+		if (checksummed) {
+			decoded.back().deserializeNative(record);
+		} else {
+			decoded.back().deserializeLegacy(record);
+		}
+		offset += fixedSize + pathLength;
+	}
+	return offset;
+}
@@ -0,0 +1,669 @@
+#include "fsck.hpp"
+#include "crc32c.hpp"
+#include "fatreader.hpp"
+#include <algorithm>
+#include <map>
+
+// anything a listing line or splitPath could trip over
+static bool isValidPath(const std::string& path) {
+	if (path == "/") {
+		return true;
+	}
+	if (path.empty() || path.size() > MAX_PATH_LENGTH || path[0] != '/' || path.back() == '/') {
+		return false;
+	}
+	return path.find("//") == std::string::npos && path.find_first_of(std::string("\n\r\0", 3)) == std::string::npos;
+}
+
+static std::vector<std::string> parseListing(const std::string& content) {
+	std::vector<std::string> names;
+	std::istringstream stream(content);
+	std::string name;
+	while (std::getline(stream, name)) {
+		names.push_back(name);
+	}
+	return names;
+}
+
+// adjacent ranges merged, the allocator doesn't always merge them itself
+static std::vector<std::pair<size_t, size_t>> normalize(const std::map<size_t, size_t>& ranges) {
+	std::vector<std::pair<size_t, size_t>> result; // start and end
+	for (const std::pair<const size_t, size_t>& range : ranges) {
+		if (!result.empty() && result.back().second >= range.first) {
+			result.back().second = std::max(result.back().second, range.first + range.second);
+		} else {
+			result.emplace_back(range.first, range.first + range.second);
+		}
+	}
+	return result;
+}
+
+static size_t totalLength(const std::vector<std::pair<size_t, size_t>>& ranges) {
+	size_t total = 0;
+	for (const std::pair<size_t, size_t>& range : ranges) {
+		total += range.second - range.first;
+	}
+	return total;
+}
+
+static size_t overlapLength(const std::vector<std::pair<size_t, size_t>>& a,
+							const std::vector<std::pair<size_t, size_t>>& b) {
+	size_t total = 0;
+	size_t i = 0;
+	size_t j = 0;
+	while (i < a.size() && j < b.size()) {
+		size_t start = std::max(a[i].first, b[j].first);
+		size_t end = std::min(a[i].second, b[j].second);
+		if (start < end) {
+			total += end - start;
+		}
+		if (a[i].second < b[j].second) {
+			i++;
+		} else {
+			j++;
+		}
+	}
+	return total;
+}
+
+bool FsckReport::clean() const {
+	return problems.empty();
+}
+
+void FsckReport::print(std::ostream& out) const {
+	for (const std::string& problem : problems) {
+		out << "problem: " << problem << '\n';
+	}
+	for (const std::string& repair : repairs) {
+		out << "repaired: " << repair << '\n';
+	}
+	for (const std::string& problem : remaining) {
+		out << "left: " << problem << '\n';
+	}
+	out << entriesChecked << " entries, " << directoriesChecked << " directories checked";
+	if (bytesVerified > 0) {
+		out << ", " << bytesVerified << " bytes of content verified";
+	}
+	if (leakedBytes > 0) {
+		out << ", " << leakedBytes << " bytes leaked";
+	}
+	out << '\n';
+}
+
+void FsChecker::Findings::merge(Findings& other) {
+	problems.insert(problems.end(), other.problems.begin(), other.problems.end());
+	badRecords.insert(other.badRecords.begin(), other.badRecords.end());
+	badListings.insert(other.badListings.begin(), other.badListings.end());
+	missingDirectories.insert(other.missingDirectories.begin(), other.missingDirectories.end());
+	overlapping.insert(other.overlapping.begin(), other.overlapping.end());
+	headerDamaged = headerDamaged || other.headerDamaged;
+	newerFat = newerFat || other.newerFat;
+	freeMapDamaged = freeMapDamaged || other.freeMapDamaged;
+	fatSizeWrong = fatSizeWrong || other.fatSizeWrong;
+	directoriesChecked += other.directoriesChecked;
+	bytesVerified += other.bytesVerified;
+	leakedBytes += other.leakedBytes;
+}
+
+FsChecker::FsChecker(MyFs& myfs_) : myfs(myfs_) {
+}
+
+size_t FsChecker::extentOf(const EntryInfo& entry) const {
+	// what the allocator hands out for it, empty entries still take a block
+	return std::max<size_t>((entry.size + myfs.BLOCK_SIZE - 1) / myfs.BLOCK_SIZE * myfs.BLOCK_SIZE, myfs.BLOCK_SIZE);
+}
+
+#pragma region checking
+
+FsckReport FsChecker::check(bool repair, bool verifyData) {
+	MyFs::OperationLock lock(myfs);
+	FsckReport report;
+	Findings findings = scan(verifyData);
+	report.problems = findings.problems;
+	report.entriesChecked = myfs.entries.size();
+	report.directoriesChecked = findings.directoriesChecked;
+	report.bytesVerified = findings.bytesVerified;
+	report.leakedBytes = findings.leakedBytes;
+	if (!repair || report.clean()) {
+		return report;
+	}
+
+	if (findings.newerFat) {
+		salvage();
+		myfs.initializeAllocator();
+		myfs.publishEntries();
+		report.repairs.push_back("went back to the newer FAT version");
+		findings = scan(verifyData);
+	}
+	this->repair(findings, report);
+	report.remaining = scan(verifyData).problems;
+	return report;
+}
+
+FsChecker::Findings FsChecker::scan(bool verifyData) {
+	Findings findings;
+	checkHeaders(findings);
+
+	std::vector<const EntryInfo*> table;
+	std::map<std::string, std::set<std::string>> children;
+	for (const EntryInfo& entry : myfs.entries) {
+		table.push_back(&entry);
+		if (entry.path != "/" && isValidPath(entry.path)) {
+			std::pair<std::string, std::string> pathAndName = MyFs::splitPath(entry.path);
+			children[pathAndName.first].insert(pathAndName.second);
+		}
+	}
+	if (myfs.entries.empty() || myfs.entries.begin()->path != "/") {
+		findings.missingDirectories.insert("/");
+	}
+
+	// nothing changes while the lock is held, the tasks only read the table and the device
+	std::vector<Findings> batches((table.size() + FSCK_BATCH_SIZE - 1) / FSCK_BATCH_SIZE);
+	{
+		static const std::set<std::string> noChildren;
+		TaskGroup group(myfs.treePool());
+		for (size_t batch = 0; batch < batches.size(); batch++) {
+			group.spawn([&, batch] {
+				size_t end = std::min(table.size(), (batch + 1) * FSCK_BATCH_SIZE);
+				for (size_t i = batch * FSCK_BATCH_SIZE; i < end; i++) {
+					auto it = children.find(table[i]->path);
+					checkEntry(*table[i], it == children.end() ? noChildren : it->second, verifyData, batches[batch]);
+				}
+			});
+		}
+		group.wait();
+	}
+	// in table order, no matter which worker got to a batch first
+	for (Findings& batch : batches) {
+		findings.merge(batch);
+	}
+	for (const std::string& path : findings.missingDirectories) {
+		findings.problems.push_back("directory " + path + " is missing");
+	}
+
+	checkExtents(findings);
+	checkFreeMap(findings);
+
+	size_t fatSize = std::accumulate(myfs.entries.begin(), myfs.entries.end(), static_cast<size_t>(0),
+									 [](size_t totalSize, const EntryInfo& entry) {
+										 return totalSize + entry.serializedSize();
+									 });
+	if (fatSize != myfs.totalFatSize) {
+		findings.problems.push_back("FAT size is counted as " + std::to_string(myfs.totalFatSize) + " but is " +
+									std::to_string(fatSize));
+		findings.fatSizeWrong = true;
+	}
+	if (fatSize > static_cast<size_t>(FAT_SIZE - myfs.BLOCK_SIZE)) {
+		findings.problems.push_back("FAT doesn't fit in a slot anymore");
+	}
+	return findings;
+}
+
+void FsChecker::checkHeaders(Findings& findings) {
+	// a legacy or salvaged image has no header of its own to compare against yet
+	if (myfs.generation == 0) {
+		return;
+	}
+	for (size_t slot = 0; slot < 2; slot++) {
+		MyFs::myfs_header header{};
+		myfs.blkdevsim->read(slot * HEADER_SLOT_SIZE, sizeof(header), reinterpret_cast<char*>(&header));
+		if (strncmp(header.magic.data(), MYFS_MAGIC, header.magic.size()) != 0) {
+			continue;
+		}
+		// what's left of the header an upgrade started from, superseded by now
+		if (slot == 0 && header.version >= FIRST_LEGACY_VERSION && header.version <= LEGACY_VERSION) {
+			continue;
+		}
+		if (myfs.readHeader(slot)) {
+			continue;
+		}
+		findings.problems.push_back("header slot " + std::to_string(slot) + " is damaged");
+		findings.headerDamaged = true;
+		// the mount went with the other slot, but this one may still lead to something newer
+		std::vector<char> fat;
+		std::optional<MyFs::myfs_header> usable = readUsableHeader(slot, fat);
+		if (usable && usable->generation > myfs.generation) {
+			findings.problems.push_back("header slot " + std::to_string(slot) +
+										" points at a newer FAT version than the one mounted");
+			findings.newerFat = true;
+		}
+	}
+}
+
+void FsChecker::checkEntry(const EntryInfo& entry, const std::set<std::string>& children, bool verifyData,
+						   Findings& findings) {
+	const std::string& path = entry.path;
+	if (!isValidPath(path)) {
+		findings.problems.push_back("invalid path \"" + path + "\"");
+		findings.badRecords.insert(path);
+		return;
+	}
+	if (entry.type != FILE_TYPE && entry.type != DIRECTORY_TYPE) {
+		findings.problems.push_back(path + " has unknown type " + std::to_string(entry.type));
+		findings.badRecords.insert(path);
+		return;
+	}
+	if (entry.address < FAT_SIZE || entry.address > myfs.fatAreaAddress() ||
+		extentOf(entry) > myfs.fatAreaAddress() - entry.address) {
+		findings.problems.push_back(path + " points outside the data area");
+		findings.badRecords.insert(path);
+		return;
+	}
+
+	// up to the first directory that's there, whatever is above it is checked by that one
+	std::string ancestor = path;
+	while (ancestor != "/") {
+		ancestor = MyFs::splitPath(ancestor).first;
+		EntryInfo key;
+		key.path = ancestor;
+		auto it = myfs.entries.find(key);
+		if (it == myfs.entries.end()) {
+			findings.missingDirectories.insert(ancestor);
+			continue;
+		}
+		if (it->type != DIRECTORY_TYPE) {
+			findings.problems.push_back(path + " is inside file " + ancestor);
+			findings.badRecords.insert(path);
+		}
+		break;
+	}
+
+	std::string content;
+	if (entry.type == FILE_TYPE) {
+		if (verifyData) {
+			if (!myfs.readContent(entry, content)) {
+				findings.problems.push_back("content of " + path + " doesn't match its checksum");
+			}
+			findings.bytesVerified += entry.size;
+		}
+		return;
+	}
+
+	findings.directoriesChecked++;
+	if (!myfs.readContent(entry, content)) {
+		findings.problems.push_back("listing of " + path + " doesn't match its checksum");
+		findings.badListings.insert(path);
+		return;
+	}
+	std::vector<std::string> listed = parseListing(content);
+	std::sort(listed.begin(), listed.end());
+	bool mismatch = false;
+	for (size_t i = 1; i < listed.size(); i++) {
+		if (listed[i] == listed[i - 1]) {
+			findings.problems.push_back(path + " lists " + listed[i] + " twice");
+			mismatch = true;
+		}
+	}
+	listed.erase(std::unique(listed.begin(), listed.end()), listed.end());
+	std::vector<std::string> difference;
+	std::set_difference(listed.begin(), listed.end(), children.begin(), children.end(), std::back_inserter(difference));
+	for (const std::string& name : difference) {
+		findings.problems.push_back(path + " lists " + name + " which has no entry");
+		mismatch = true;
+	}
+	difference.clear();
+	std::set_difference(children.begin(), children.end(), listed.begin(), listed.end(), std::back_inserter(difference));
+	for (const std::string& name : difference) {
+		findings.problems.push_back(path + " doesn't list " + name);
+		mismatch = true;
+	}
+	if (mismatch) {
+		findings.badListings.insert(path);
+	}
+	if (children.size() > MAX_DIRECTORY_SIZE) {
+		findings.problems.push_back(path + " holds more than " + std::to_string(MAX_DIRECTORY_SIZE) + " entries");
+	}
+}
+
+void FsChecker::checkExtents(Findings& findings) {
+	struct Extent {
+		size_t start;
+		size_t end;
+		const EntryInfo* entry;
+		bool live;
+	};
+	std::vector<Extent> extents;
+	std::set<std::pair<size_t, size_t>> liveExtents;
+	for (const EntryInfo& entry : myfs.entries) {
+		if (findings.badRecords.count(entry.path) == 0) {
+			extents.push_back({entry.address, entry.address + extentOf(entry), &entry, true});
+			liveExtents.emplace(entry.address, entry.size);
+		}
+	}
+	for (const EntryInfo& entry : myfs.snapshotEntries) {
+		// unchanged since the snapshot, both versions share the extent
+		if (liveExtents.count({entry.address, entry.size}) == 0) {
+			extents.push_back({entry.address, entry.address + extentOf(entry), &entry, false});
+		}
+	}
+	std::sort(extents.begin(), extents.end(), [](const Extent& a, const Extent& b) { return a.start < b.start; });
+
+	// one sweep in address order, against whichever extent reaches the furthest so far
+	const Extent* furthest = nullptr;
+	for (const Extent& extent : extents) {
+		if (furthest != nullptr && extent.start < furthest->end) {
+			findings.problems.push_back((extent.live ? "" : "snapshot of ") + extent.entry->path + " overlaps " +
+										(furthest->live ? "" : "snapshot of ") + furthest->entry->path);
+			// whichever lost its content to the other one moves, the content that's still intact stays put
+			std::string content;
+			bool moveFurthest = !extent.live || (furthest->live && !myfs.readContent(*furthest->entry, content) &&
+												 myfs.readContent(*extent.entry, content));
+			if (moveFurthest && furthest->live) {
+				findings.overlapping.insert(furthest->entry->path);
+			} else if (extent.live) {
+				findings.overlapping.insert(extent.entry->path);
+			}
+		}
+		if (furthest == nullptr || extent.end > furthest->end) {
+			furthest = &extent;
+		}
+	}
+}
+
+void FsChecker::checkFreeMap(Findings& findings) {
+	// what the free map should be, everything no entry or snapshot entry covers
+	std::map<size_t, size_t> used;
+	auto use = [&](const EntryInfo& entry) {
+		if (entry.address >= FAT_SIZE && entry.address < myfs.fatAreaAddress()) {
+			size_t& size = used[entry.address];
+			size = std::max(size, std::min(extentOf(entry), myfs.fatAreaAddress() - entry.address));
+		}
+	};
+	std::for_each(myfs.entries.begin(), myfs.entries.end(), use);
+	std::for_each(myfs.snapshotEntries.begin(), myfs.snapshotEntries.end(), use);
+
+	std::vector<std::pair<size_t, size_t>> usedRanges = normalize(used);
+	std::vector<std::pair<size_t, size_t>> freeRanges = normalize(myfs.allocator.freeRanges());
+	size_t freeBefore = totalLength(freeRanges);
+	// an entry pointing past the data area drags the free map along with it
+	for (std::pair<size_t, size_t>& range : freeRanges) {
+		range.first = std::clamp<size_t>(range.first, FAT_SIZE, myfs.fatAreaAddress());
+		range.second = std::clamp<size_t>(range.second, FAT_SIZE, myfs.fatAreaAddress());
+	}
+	if (totalLength(freeRanges) != freeBefore) {
+		findings.problems.push_back("free map reaches outside the data area");
+		findings.freeMapDamaged = true;
+	}
+	size_t freeButUsed = overlapLength(freeRanges, usedRanges);
+	if (freeButUsed > 0) {
+		findings.problems.push_back("free map hands out " + std::to_string(freeButUsed) + " bytes that are in use");
+		findings.freeMapDamaged = true;
+	}
+	size_t dataAreaSize = myfs.fatAreaAddress() - FAT_SIZE;
+	findings.leakedBytes = dataAreaSize - totalLength(usedRanges) - (totalLength(freeRanges) - freeButUsed);
+}
+
+#pragma endregion
+#pragma region repair
+
+void FsChecker::repair(const Findings& findings, FsckReport& report) {
+	std::set<std::string> listingsToRebuild = findings.badListings;
+	{
+		std::lock_guard<std::mutex> entriesLock(myfs.entriesMutex);
+		for (const std::string& path : findings.badRecords) {
+			EntryInfo key;
+			key.path = path;
+			myfs.entries.erase(key);
+			report.repairs.push_back("dropped the record of " + path);
+			if (isValidPath(path) && path != "/") {
+				listingsToRebuild.insert(MyFs::splitPath(path).first);
+			}
+		}
+
+		// dropping a directory can leave its children without one, so look again
+		std::set<std::string> missing;
+		if (myfs.entries.empty() || myfs.entries.begin()->path != "/") {
+			missing.insert("/");
+		}
+		for (const EntryInfo& entry : myfs.entries) {
+			std::string ancestor = entry.path;
+			while (ancestor != "/") {
+				ancestor = MyFs::splitPath(ancestor).first;
+				EntryInfo key;
+				key.path = ancestor;
+				if (myfs.entries.count(key) != 0) {
+					break;
+				}
+				missing.insert(ancestor);
+			}
+		}
+
+		// free space as far as the surviving entries are concerned, new extents come out of it
+		myfs.initializeAllocator();
+		for (const std::string& path : missing) {
+			EntryInfo directory;
+			directory.path = path;
+			directory.type = DIRECTORY_TYPE;
+			directory.size = 0;
+			directory.checksum = crc32c("", 0);
+			directory.address = myfs.allocator.allocate(0);
+			myfs.entries.insert(directory);
+			report.repairs.push_back("recreated directory " + path);
+			listingsToRebuild.insert(path);
+			if (path != "/") {
+				listingsToRebuild.insert(MyFs::splitPath(path).first);
+			}
+		}
+
+		for (const std::string& path : findings.overlapping) {
+			EntryInfo key;
+			key.path = path;
+			auto it = myfs.entries.find(key);
+			if (it == myfs.entries.end()) {
+				continue;
+			}
+			EntryInfo entry = *it;
+			if (entry.type == DIRECTORY_TYPE) {
+				listingsToRebuild.insert(path);
+			}
+			relocate(entry, report);
+		}
+
+		for (const std::string& path : listingsToRebuild) {
+			EntryInfo key;
+			key.path = path;
+			auto it = myfs.entries.find(key);
+			if (it != myfs.entries.end() && it->type == DIRECTORY_TYPE) {
+				rebuildListing(*it, report);
+			}
+		}
+
+		// the old extents of everything that moved are free again, and so is what nothing points at
+		myfs.initializeAllocator();
+		if (findings.freeMapDamaged) {
+			report.repairs.push_back("rebuilt the free map");
+		}
+		myfs.recalculateFatSize();
+		if (findings.fatSizeWrong) {
+			report.repairs.push_back("recounted the FAT size");
+		}
+		myfs.publishEntries();
+	}
+
+	myfs.save();
+	if (findings.headerDamaged) {
+		// the first checkpoint goes to the slot not in use, if that wasn't the damaged one the next is
+		Findings headers;
+		checkHeaders(headers);
+		if (headers.headerDamaged) {
+			myfs.save();
+		}
+		report.repairs.push_back("rewrote the header slots");
+	}
+}
+
+void FsChecker::relocate(EntryInfo entry, FsckReport& report) {
+	std::string content;
+	bool intact = myfs.readContent(entry, content);
+	if (!intact) {
+		// whatever is there belongs to the entry it overlapped
+		content.clear();
+	}
+	myfs.entries.erase(entry);
+	entry.address = myfs.allocator.allocate(content.size());
+	entry.size = content.size();
+	entry.checksum = crc32c(content.data(), content.size());
+	myfs.writeData(entry.address, content.size(), content.data());
+	myfs.entries.insert(entry);
+	report.repairs.push_back((intact ? "moved " : "emptied and moved ") + entry.path + " to an extent of its own");
+}
+
+void FsChecker::rebuildListing(const EntryInfo& directory, FsckReport& report) {
+	// the table decides what's in it, names it already listed keep their order
+	std::set<std::string> children;
+	std::string prefix = directory.path == "/" ? "/" : directory.path + "/";
+	EntryInfo key;
+	key.path = prefix;
+	for (auto it = myfs.entries.lower_bound(key); it != myfs.entries.end() && it->path.rfind(prefix, 0) == 0; ++it) {
+		if (it->path.size() > prefix.size() && it->path.find('/', prefix.size()) == std::string::npos) {
+			children.insert(it->path.substr(prefix.size()));
+		}
+	}
+	std::string content;
+	std::vector<std::string> names;
+	if (myfs.readContent(directory, content)) {
+		for (const std::string& name : parseListing(content)) {
+			if (children.count(name) != 0 && std::find(names.begin(), names.end(), name) == names.end()) {
+				names.push_back(name);
+			}
+		}
+	}
+	for (const std::string& name : children) {
+		if (std::find(names.begin(), names.end(), name) == names.end()) {
+			names.push_back(name);
+		}
+	}
+
+	std::string listing;
+	for (const std::string& name : names) {
+		listing += (listing.empty() ? "" : "\n") + name;
+	}
+	// never in place, the snapshot may still read the old listing
+	EntryInfo rebuilt = directory;
+	myfs.entries.erase(rebuilt);
+	rebuilt.address = myfs.allocator.allocate(listing.size());
+	rebuilt.size = listing.size();
+	rebuilt.checksum = crc32c(listing.data(), listing.size());
+	myfs.writeData(rebuilt.address, listing.size(), listing.data());
+	myfs.entries.insert(rebuilt);
+	report.repairs.push_back("rebuilt the listing of " + rebuilt.path);
+}
+
+#pragma endregion
+#pragma region salvage
+
+void FsChecker::salvage() {
+	MyFs::OperationLock lock(myfs);
+	std::lock_guard<std::mutex> entriesLock(myfs.entriesMutex);
+	// whatever the failed mount left behind
+	myfs.entries.clear();
+	myfs.BLOCK_SIZE = DEFAULT_BLOCK_SIZE;
+	myfs.generation = 0;
+	myfs.fatAddress = 0;
+	myfs.recordFormat = RecordFormat::FIXED;
+	myfs.snapshotAddress = 0;
+	myfs.snapshotSize = 0;
+	myfs.snapshotChecksum = 0;
+	myfs.snapshotFormat = RecordFormat::FIXED;
+	myfs.snapshotEntries.clear();
+
+	// a new header has to beat every one that still passes its checksum
+	for (size_t slot = 0; slot < 2; slot++) {
+		std::optional<MyFs::myfs_header> header = myfs.readHeader(slot);
+		if (header) {
+			myfs.generation = std::max<uint64_t>(myfs.generation, header->generation);
+		}
+	}
+	if (!salvageFromHeaders() && !salvageFromFatSlots()) {
+		throw std::runtime_error("Nothing left to salvage");
+	}
+
+	try {
+		myfs.replayJournal();
+	} catch (const std::exception& e) {
+		// the journal went down with the rest, the FAT version will have to do
+	}
+	if (myfs.recordFormat != RecordFormat::FIXED || myfs.snapshotFormat != RecordFormat::FIXED) {
+		myfs.upgradeRecords();
+	}
+	myfs.recalculateFatSize();
+}
+
+std::optional<MyFs::myfs_header> FsChecker::readUsableHeader(size_t slot, std::vector<char>& fat) {
+	// a header can fail its own checksum and still point at an intact FAT version
+	MyFs::myfs_header header{};
+	myfs.blkdevsim->read(slot * HEADER_SLOT_SIZE, sizeof(header), reinterpret_cast<char*>(&header));
+	if (strncmp(header.magic.data(), MYFS_MAGIC, header.magic.size()) != 0 || header.version < SHADOW_VERSION ||
+		header.version > CURR_VERSION || header.blockSize <= 1 || header.blockSize >= FAT_SIZE) {
+		return std::nullopt;
+	}
+	size_t fatEnd = myfs.fatAreaAddress() + FAT_SLOT_COUNT * FAT_SIZE;
+	if (header.fatSize > FAT_SIZE || header.fatAddress < myfs.fatAreaAddress() ||
+		header.fatAddress + header.fatSize > fatEnd) {
+		return std::nullopt;
+	}
+	fat.resize(header.fatSize);
+	myfs.blkdevsim->read(header.fatAddress, fat.size(), fat.data());
+	if (crc32c(fat.data(), fat.size()) != header.fatChecksum) {
+		return std::nullopt;
+	}
+	return header;
+}
+
+bool FsChecker::salvageFromHeaders() {
+	std::optional<MyFs::myfs_header> best;
+	std::vector<char> bestFat;
+	for (size_t slot = 0; slot < 2; slot++) {
+		std::vector<char> fat;
+		std::optional<MyFs::myfs_header> header = readUsableHeader(slot, fat);
+		if (header && (!best || header->generation > best->generation)) {
+			best = header;
+			bestFat = std::move(fat);
+		}
+	}
+	if (!best) {
+		return false;
+	}
+
+	// records that don't decode are dropped with the rest of the version, the check finds the holes
+	myfs.recordFormat = MyFs::recordFormatOf(best->version);
+	FatReader::decode(bestFat.data(), bestFat.size(), myfs.recordFormat, myfs.entries);
+	myfs.BLOCK_SIZE = best->blockSize;
+	myfs.fatAddress = best->fatAddress;
+	if (best->snapshotAddress != 0 && best->snapshotSize <= FAT_SIZE) {
+		std::vector<char> buffer(best->snapshotSize);
+		myfs.blkdevsim->read(best->snapshotAddress, buffer.size(), buffer.data());
+		// a snapshot that doesn't check out is dropped, its extents go back to the free space
+		if (crc32c(buffer.data(), buffer.size()) == best->snapshotChecksum) {
+			myfs.snapshotFormat = MyFs::snapshotFormatOf(*best);
+			FatReader::decode(buffer.data(), buffer.size(), myfs.snapshotFormat, myfs.snapshotEntries);
+			myfs.snapshotAddress = best->snapshotAddress;
+			myfs.snapshotSize = best->snapshotSize;
+			myfs.snapshotChecksum = best->snapshotChecksum;
+		}
+	}
+	return true;
+}
+
+bool FsChecker::salvageFromFatSlots() {
+	// no header to go by, the slot that parses into the most records is the best guess
+	size_t bestCount = 0;
+	std::set<EntryInfo> parsed;
+	std::vector<char> buffer(FAT_SIZE);
+	for (size_t slot = 0; slot < FAT_SLOT_COUNT; slot++) {
+		size_t address = myfs.fatAreaAddress() + slot * FAT_SIZE;
+		myfs.blkdevsim->read(address, buffer.size(), buffer.data());
+		for (RecordFormat format : {RecordFormat::FIXED, RecordFormat::NATIVE, RecordFormat::NATIVE_UNCHECKED}) {
+			FatReader::decode(buffer.data(), buffer.size(), format, parsed);
+			if (parsed.size() > bestCount) {
+				bestCount = parsed.size();
+				myfs.entries = parsed;
+				myfs.recordFormat = format;
+				myfs.fatAddress = address;
+			}
+		}
+	}
+	return bestCount > 0;
+}
+
+#pragma endregion
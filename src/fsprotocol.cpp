@@ -0,0 +1,142 @@
+#include "fsprotocol.hpp"
+#include "config.hpp"
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <sys/socket.h>
+
+#pragma region frames
+
+sockaddr_un socketAddress(const std::string& path) {
+	sockaddr_un address{};
+	address.sun_family = AF_UNIX;
+	if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+		throw std::runtime_error("Invalid socket path: " + path);
+	}
+	memcpy(address.sun_path, path.c_str(), path.size() + 1);
+	return address;
+}
+
+// false only if the connection ended before the first byte
+static bool receiveAll(int fd, char* buffer, size_t size) {
+	for (size_t done = 0; done < size;) {
+		ssize_t result = recv(fd, buffer + done, size - done, 0);
+		if (result == 0) {
+			if (done == 0) {
+				return false;
+			}
+			throw std::runtime_error("Connection closed in the middle of a frame");
+		}
+		if (result < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			throw std::system_error(errno, std::generic_category(), "Failed to receive");
+		}
+		done += result;
+	}
+	return true;
+}
+
+bool readFrame(int fd, Frame& frame) {
+	char header[FRAME_HEADER_SIZE];
+	if (!receiveAll(fd, header, sizeof(header))) {
+		return false;
+	}
+	uint32_t length = loadLittleEndian<uint32_t>(header + FRAME_LENGTH_OFFSET);
+	if (length > REMOTE_MAX_FRAME_SIZE) {
+		throw std::runtime_error("Frame too big: " + std::to_string(length));
+	}
+	frame.id = loadLittleEndian<uint32_t>(header + FRAME_ID_OFFSET);
+	frame.code = static_cast<uint8_t>(header[FRAME_CODE_OFFSET]);
+	frame.payload.resize(length);
+	if (length > 0 && !receiveAll(fd, frame.payload.data(), length)) {
+		throw std::runtime_error("Connection closed in the middle of a frame");
+	}
+	return true;
+}
+
+void writeFrame(int fd, uint32_t id, uint8_t code, const std::string& payload) {
+	if (payload.size() > REMOTE_MAX_FRAME_SIZE) {
+		throw std::runtime_error("Frame too big: " + std::to_string(payload.size()));
+	}
+	// one buffer, so a frame is never interleaved with another thread's
+	std::string frame(FRAME_HEADER_SIZE, '\0');
+	storeLittleEndian<uint32_t>(frame.data() + FRAME_LENGTH_OFFSET, static_cast<uint32_t>(payload.size()));
+	storeLittleEndian<uint32_t>(frame.data() + FRAME_ID_OFFSET, id);
+	frame[FRAME_CODE_OFFSET] = static_cast<char>(code);
+	frame += payload;
+	for (size_t done = 0; done < frame.size();) {
+		ssize_t result = send(fd, frame.data() + done, frame.size() - done, MSG_NOSIGNAL);
+		if (result < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			throw std::system_error(errno, std::generic_category(), "Failed to send");
+		}
+		done += result;
+	}
+}
+
+#pragma endregion
+#pragma region messages
+
+void MessageWriter::putUint8(uint8_t value) {
+	buffer += static_cast<char>(value);
+}
+
+void MessageWriter::putUint32(uint32_t value) {
+	char bytes[sizeof(value)];
+	storeLittleEndian<uint32_t>(bytes, value);
+	buffer.append(bytes, sizeof(bytes));
+}
+
+void MessageWriter::putString(const std::string& value) {
+	putUint32(static_cast<uint32_t>(value.size()));
+	buffer += value;
+}
+
+void MessageWriter::putEntry(const EntryInfo& entry) {
+	size_t start = buffer.size();
+	buffer.resize(start + entry.serializedSize());
+	entry.serialize(buffer.data() + start);
+}
+
+MessageReader::MessageReader(const std::string& buffer_) : buffer(buffer_), position(0) {
+}
+
+const char* MessageReader::take(size_t size) {
+	if (size > buffer.size() - position) {
+		throw std::runtime_error("Message cut short");
+	}
+	const char* data = buffer.data() + position;
+	position += size;
+	return data;
+}
+
+uint8_t MessageReader::getUint8() {
+	return static_cast<uint8_t>(*take(1));
+}
+
+uint32_t MessageReader::getUint32() {
+	return loadLittleEndian<uint32_t>(take(sizeof(uint32_t)));
+}
+
+std::string MessageReader::getString() {
+	uint32_t length = getUint32();
+	return std::string(take(length), length);
+}
+
+EntryInfo MessageReader::getEntry() {
+	// the header says how long the path is, the record is padded after it
+	const char* header = take(RECORD_HEADER_SIZE);
+	size_t pathLength = loadLittleEndian<uint16_t>(header + RECORD_PATH_LENGTH_OFFSET);
+	position -= RECORD_HEADER_SIZE;
+	size_t recordSize = RECORD_HEADER_SIZE + (pathLength + RECORD_ALIGNMENT - 1) / RECORD_ALIGNMENT * RECORD_ALIGNMENT;
+	EntryInfo entry;
+	entry.deserialize(take(recordSize));
+	return entry;
+}
+
+#pragma endregion
@@ -0,0 +1,212 @@
+#include "fsserver.hpp"
+#include <iostream>
+#include <sys/socket.h>
+
+FsServer::FsServer(const std::string& socketPath_)
+	: myfs(nullptr), socketPath(socketPath_), listenFd(-1), pool(REMOTE_WORKER_THREADS), nextConnectionId(1),
+	  stopping(false) {
+	sockaddr_un address = socketAddress(socketPath);
+	listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listenFd == -1) {
+		throw std::system_error(errno, std::generic_category(), "Can't create a socket");
+	}
+	int result = bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+	if (result == -1 && errno == EADDRINUSE) {
+		// left behind by a daemon that didn't get to clean up, unless one still answers on it
+		int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		bool served = probe != -1 && connect(probe, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+		if (probe != -1) {
+			close(probe);
+		}
+		if (served) {
+			close(listenFd);
+			throw std::runtime_error("Already served: " + socketPath);
+		}
+		unlink(socketPath.c_str());
+		result = bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+	}
+	if (result == -1 || listen(listenFd, REMOTE_LISTEN_BACKLOG) == -1) {
+		int error = errno;
+		close(listenFd);
+		throw std::system_error(error, std::generic_category(), "Can't listen on " + socketPath);
+	}
+}
+
+FsServer::~FsServer() {
+	stop();
+	reap(true);
+	close(listenFd);
+	unlink(socketPath.c_str());
+}
+
+void FsServer::serve(MyFs& myfs_) {
+	myfs = &myfs_;
+	while (!stopping) {
+		int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+		if (fd == -1) {
+			if (stopping) {
+				break;
+			}
+			if (errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			}
+			int error = errno;
+			stop();
+			reap(true);
+			throw std::system_error(error, std::generic_category(), "Can't accept a connection");
+		}
+		reap(false);
+		std::lock_guard<std::mutex> lock(connectionsMutex);
+		if (stopping) {
+			close(fd);
+			break;
+		}
+		connections.push_back(std::make_unique<Connection>(fd, nextConnectionId++, pool));
+		Connection& connection = *connections.back();
+		connection.reader = std::thread([this, &connection] { readRequests(connection); });
+	}
+	// nothing may still be using the file system once this returns
+	reap(true);
+}
+
+void FsServer::stop() {
+	stopping = true;
+	// wakes up accept, and every reader sees its client hang up, what's running still gets answered
+	shutdown(listenFd, SHUT_RDWR);
+	std::lock_guard<std::mutex> lock(connectionsMutex);
+	for (const std::unique_ptr<Connection>& connection : connections) {
+		shutdown(connection->fd, SHUT_RD);
+	}
+}
+
+void FsServer::reap(bool all) {
+	std::lock_guard<std::mutex> lock(connectionsMutex);
+	for (auto it = connections.begin(); it != connections.end();) {
+		if (all || (*it)->done) {
+			(*it)->reader.join();
+			// only closed here, a stop() can't hit a reused descriptor
+			close((*it)->fd);
+			it = connections.erase(it);
+		} else {
+			++it;
+		}
+	}
+}
+
+void FsServer::readRequests(Connection& connection) {
+	try {
+		Frame request;
+		while (readFrame(connection.fd, request)) {
+			// the next request is read while this one runs
+			connection.requests.spawn([this, &connection, request] { respond(connection, request); });
+		}
+	} catch (const std::exception& e) {
+		// there's no telling where the next frame starts, the connection goes
+		std::cerr << "Dropping a client: " << e.what() << std::endl;
+	}
+	try {
+		connection.requests.wait();
+	} catch (const std::exception& e) {
+		std::cerr << "Dropping a client: " << e.what() << std::endl;
+	}
+	// everything is answered, the client sees the end of the stream
+	shutdown(connection.fd, SHUT_RDWR);
+	connection.done = true;
+}
+
+void FsServer::respond(Connection& connection, const Frame& request) {
+	RemoteStatus status = RemoteStatus::OK;
+	std::string payload;
+	// requests of all connections share the workers, a trace tells them apart by connection
+	OpTracer::setClient(connection.id);
+	try {
+		payload = execute(static_cast<RemoteOp>(request.code), request.payload);
+		// writeFrame would refuse it and the client would wait forever, it gets told instead
+		if (payload.size() > REMOTE_MAX_FRAME_SIZE) {
+			throw std::runtime_error("Response too big: " + std::to_string(payload.size()) + " bytes");
+		}
+	} catch (const std::exception& e) {
+		status = RemoteStatus::FAILED;
+		payload = e.what();
+	}
+	std::lock_guard<std::mutex> lock(connection.writeMutex);
+	try {
+		writeFrame(connection.fd, request.id, static_cast<uint8_t>(status), payload);
+	} catch (const std::exception&) {
+		// the client is gone, its reader finds out on its own
+	}
+}
+
+std::string FsServer::execute(RemoteOp op, const std::string& payload) {
+	MessageReader request(payload);
+	MessageWriter response;
+	switch (op) {
+	case RemoteOp::STAT: {
+		std::optional<EntryInfo> entry = myfs->getEntryInfo(request.getString());
+		response.putUint8(entry.has_value());
+		if (entry) {
+			response.putEntry(*entry);
+		}
+		break;
+	}
+	case RemoteOp::LIST_DIR: {
+		std::vector<EntryInfo> entries = myfs->listDir(request.getString());
+		response.putUint32(static_cast<uint32_t>(entries.size()));
+		for (const EntryInfo& entry : entries) {
+			response.putEntry(entry);
+		}
+		break;
+	}
+	case RemoteOp::LIST_TREE: {
+		MyFs::EntryView tree = myfs->listTree();
+		response.putUint32(static_cast<uint32_t>(tree.size()));
+		for (const EntryInfo& entry : tree) {
+			response.putEntry(entry);
+		}
+		break;
+	}
+	case RemoteOp::GET_CONTENT: {
+		std::string path = request.getString();
+		// not read at all if it can't be sent
+		std::optional<EntryInfo> entry = myfs->getEntryInfo(path);
+		if (entry && entry->size > REMOTE_MAX_FRAME_SIZE) {
+			throw std::runtime_error("File too big to send: " + path);
+		}
+		return myfs->getContent(path);
+	}
+	case RemoteOp::SET_CONTENT: {
+		std::string path = request.getString();
+		myfs->setContent(path, request.getString());
+		break;
+	}
+	case RemoteOp::CREATE_FILE:
+		myfs->createFile(request.getString());
+		break;
+	case RemoteOp::CREATE_DIRECTORY:
+		myfs->createDirectory(request.getString());
+		break;
+	case RemoteOp::REMOVE:
+		myfs->remove(request.getString());
+		break;
+	case RemoteOp::MOVE: {
+		std::string source = request.getString();
+		myfs->move(source, request.getString());
+		break;
+	}
+	case RemoteOp::COPY: {
+		std::string source = request.getString();
+		myfs->copy(source, request.getString());
+		break;
+	}
+	case RemoteOp::STATS: {
+		IoStats* stats = myfs->getIoStats();
+		if (stats == nullptr) {
+			throw std::runtime_error("This device keeps no statistics");
+		}
+		return stats->snapshot().toJson();
+	}
+	default:
+		throw std::runtime_error("Unknown request: " + std::to_string(static_cast<int>(op)));
+	}
+	return response.buffer;
+}
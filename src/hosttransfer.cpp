@@ -0,0 +1,262 @@
+#include "hosttransfer.hpp"
+#include <dirent.h>
+#include <set>
+
+HostFile::HostFile(const std::string& path, int flags)
+	: fd(open(path.c_str(), flags | O_CLOEXEC, NEW_FILE_PERMISSIONS)) {
+	if (fd == -1) {
+		throw std::system_error(errno, std::generic_category(), "Can't open " + path);
+	}
+}
+
+HostFile::~HostFile() {
+	close(fd);
+}
+
+static std::vector<std::string> hostDirectoryEntries(const std::string& hostPath) {
+	DIR* directory = opendir(hostPath.c_str());
+	if (directory == nullptr) {
+		throw std::system_error(errno, std::generic_category(), "Can't open " + hostPath);
+	}
+	std::vector<std::string> names;
+	while (dirent* entry = readdir(directory)) {
+		std::string name = entry->d_name;
+		if (name != "." && name != "..") {
+			names.push_back(name);
+		}
+	}
+	closedir(directory);
+	return names;
+}
+
+HostTransfer::HostTransfer(MyFs& myfs_) : myfs(myfs_), pool(HOST_TRANSFER_THREADS) {
+}
+
+#pragma region put
+
+void HostTransfer::put(const std::string& hostPath, const std::string& path) {
+	struct stat info {};
+	if (stat(hostPath.c_str(), &info) == -1) {
+		throw std::system_error(errno, std::generic_category(), "Can't open " + hostPath);
+	}
+	if (!S_ISDIR(info.st_mode)) {
+		putFile(hostPath, path);
+		return;
+	}
+	TaskGroup group(pool);
+	putTree(group, hostPath, path);
+	finish(group, "put");
+}
+
+void HostTransfer::putTree(TaskGroup& group, const std::string& hostPath, const std::string& path) {
+	try {
+		if (!myfs.isFileExists(path)) {
+			myfs.createDirectory(path);
+		}
+		// the children need their directory, everything below it can go in parallel
+		for (const std::string& name : hostDirectoryEntries(hostPath)) {
+			std::string hostChild = hostPath + "/" + name;
+			std::string child = MyFs::addCurrentDir(name, path);
+			struct stat info {};
+			if (lstat(hostChild.c_str(), &info) == -1) {
+				fail(hostChild, std::system_error(errno, std::generic_category(), "Can't stat"));
+			} else if (S_ISDIR(info.st_mode)) {
+				group.spawn([this, &group, hostChild, child] { putTree(group, hostChild, child); });
+			} else if (S_ISREG(info.st_mode)) {
+				group.spawn([this, hostChild, child] {
+					try {
+						putFile(hostChild, child);
+					} catch (const std::exception& e) {
+						fail(hostChild, e);
+					}
+				});
+			}
+			// links, devices and the like have no counterpart in here
+		}
+	} catch (const std::exception& e) {
+		fail(hostPath, e);
+	}
+}
+
+void HostTransfer::putFile(const std::string& hostPath, const std::string& path) {
+	HostFile file(hostPath, O_RDONLY);
+	struct stat info {};
+	if (fstat(file.fd, &info) == -1) {
+		throw std::system_error(errno, std::generic_category(), "Can't stat " + hostPath);
+	}
+	posix_fadvise(file.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	myfs.importFile(file.fd, info.st_size, path);
+}
+
+#pragma endregion
+#pragma region get
+
+void HostTransfer::get(const std::string& path, const std::string& hostPath) {
+	std::optional<EntryInfo> entry = myfs.getEntryInfo(path);
+	if (!entry) {
+		throw std::runtime_error("File not found: " + path);
+	}
+	if (entry->type == FILE_TYPE) {
+		getFile(*entry, hostPath);
+		return;
+	}
+	TaskGroup group(pool);
+	getTree(group, path, hostPath);
+	finish(group, "get");
+}
+
+void HostTransfer::getTree(TaskGroup& group, const std::string& path, const std::string& hostPath) {
+	try {
+		if (mkdir(hostPath.c_str(), NEW_DIRECTORY_PERMISSIONS) == -1 && errno != EEXIST) {
+			throw std::system_error(errno, std::generic_category(), "Can't create directory");
+		}
+		for (const EntryInfo& child : myfs.listDir(path)) {
+			std::string hostChild = hostPath + "/" + MyFs::splitPath(child.path).second;
+			if (child.type == DIRECTORY_TYPE) {
+				group.spawn([this, &group, child, hostChild] { getTree(group, child.path, hostChild); });
+			} else {
+				group.spawn([this, child, hostChild] {
+					try {
+						getFile(child, hostChild);
+					} catch (const std::exception& e) {
+						fail(child.path, e);
+					}
+				});
+			}
+		}
+	} catch (const std::exception& e) {
+		fail(path, e);
+	}
+}
+
+void HostTransfer::getFile(const EntryInfo& entry, const std::string& hostPath) {
+	HostFile file(hostPath, O_WRONLY | O_CREAT | O_TRUNC);
+	// the host file gets its blocks in one go instead of growing with every write
+	if (entry.size > 0) {
+		posix_fallocate(file.fd, 0, entry.size);
+	}
+	myfs.exportFile(entry.path, file.fd);
+}
+
+#pragma endregion
+
+#pragma region sync
+
+SyncResult HostTransfer::sync(const std::string& hostPath, const std::string& path) {
+	// the whole host tree is known before anything is removed, a directory that can't be read stops it here
+	std::map<std::string, bool> hostTree;
+	scanHostTree(hostPath, "", hostTree);
+
+	std::optional<EntryInfo> root = myfs.getEntryInfo(path);
+	if (root && root->type != DIRECTORY_TYPE) {
+		throw std::runtime_error("Not a directory: " + path);
+	}
+	std::string prefix = path == "/" ? "" : path;
+	SyncResult result;
+
+	// what the host doesn't have, or has as the other type, goes first so the directories have room
+	std::set<std::string> vanished;
+	if (root) {
+		for (const EntryInfo& entry : myfs.listTree()) {
+			if (entry.path.size() <= prefix.size() + 1 || entry.path.compare(0, prefix.size(), prefix) != 0 ||
+				entry.path[prefix.size()] != '/') {
+				continue;
+			}
+			auto it = hostTree.find(entry.path.substr(prefix.size()));
+			if (it == hostTree.end() || it->second != (entry.type == DIRECTORY_TYPE)) {
+				vanished.insert(entry.path);
+			}
+		}
+	}
+	result.removed = vanished.size();
+	{
+		MyFs::Transaction transaction(myfs);
+		for (const std::string& entry : vanished) {
+			// a subtree goes with its top
+			bool below = false;
+			for (std::string parent = MyFs::splitPath(entry).first; parent.size() > prefix.size() + 1;
+				 parent = MyFs::splitPath(parent).first) {
+				below = below || vanished.count(parent) != 0;
+			}
+			if (!below) {
+				myfs.remove(entry);
+			}
+		}
+		if (!root) {
+			myfs.createDirectory(path);
+		}
+		// parents sort before their children
+		for (const std::pair<const std::string, bool>& entry : hostTree) {
+			if (entry.second && !myfs.isFileExists(prefix + entry.first)) {
+				myfs.createDirectory(prefix + entry.first);
+			}
+		}
+	}
+
+	std::atomic<size_t> updated(0);
+	std::atomic<size_t> bytesWritten(0);
+	TaskGroup group(pool);
+	for (const std::pair<const std::string, bool>& entry : hostTree) {
+		if (entry.second) {
+			continue;
+		}
+		result.files++;
+		std::string hostChild = hostPath + entry.first;
+		std::string child = prefix + entry.first;
+		group.spawn([this, hostChild, child, &updated, &bytesWritten] {
+			try {
+				HostFile file(hostChild, O_RDONLY);
+				struct stat info {};
+				if (fstat(file.fd, &info) == -1) {
+					throw std::system_error(errno, std::generic_category(), "Can't stat");
+				}
+				posix_fadvise(file.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+				size_t written = myfs.updateFile(file.fd, info.st_size, child);
+				if (written > 0) {
+					updated++;
+					bytesWritten += written;
+				}
+			} catch (const std::exception& e) {
+				fail(hostChild, e);
+			}
+		});
+	}
+	finish(group, "sync");
+	result.updated = updated;
+	result.bytesWritten = bytesWritten;
+	return result;
+}
+
+void HostTransfer::scanHostTree(const std::string& hostPath, const std::string& relative,
+								std::map<std::string, bool>& tree) {
+	for (const std::string& name : hostDirectoryEntries(hostPath + relative)) {
+		std::string child = relative + "/" + name;
+		struct stat info {};
+		if (lstat((hostPath + child).c_str(), &info) == -1) {
+			throw std::system_error(errno, std::generic_category(), "Can't stat " + hostPath + child);
+		}
+		if (S_ISDIR(info.st_mode)) {
+			tree.emplace(child, true);
+			scanHostTree(hostPath, child, tree);
+		} else if (S_ISREG(info.st_mode)) {
+			tree.emplace(child, false);
+		}
+	}
+}
+
+#pragma endregion
+
+void HostTransfer::fail(const std::string& path, const std::exception& e) {
+	std::lock_guard<std::mutex> lock(failuresMutex);
+	failures.emplace_back(path, e.what());
+}
+
+void HostTransfer::finish(TaskGroup& group, const std::string& name) {
+	group.wait();
+	std::lock_guard<std::mutex> lock(failuresMutex);
+	if (!failures.empty()) {
+		std::vector<std::pair<std::string, std::string>> failed = std::move(failures);
+		failures.clear();
+		throw TreeOperationError(name, std::move(failed));
+	}
+}
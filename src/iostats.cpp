@@ -0,0 +1,202 @@
+#include "iostats.hpp"
+#include <iomanip>
+#include <sstream>
+
+static const std::array<const char*, IO_OP_COUNT> OP_NAMES = {"read", "write", "sync"};
+
+IoStats::IoStats() : regions(), regionCount(0) {
+}
+
+#pragma region recording
+
+size_t IoStats::latencyBucket(uint64_t nanoseconds) {
+	if (nanoseconds < (1u << LATENCY_SUB_BITS)) {
+		return nanoseconds;
+	}
+	int msb = 63 - __builtin_clzll(nanoseconds);
+	int shift = msb - LATENCY_SUB_BITS;
+	size_t sub = (nanoseconds >> shift) & ((1u << LATENCY_SUB_BITS) - 1);
+	return (static_cast<size_t>(shift + 1) << LATENCY_SUB_BITS) | sub;
+}
+
+uint64_t IoStats::bucketUpperBound(size_t bucket) {
+	if (bucket < (1u << LATENCY_SUB_BITS)) {
+		return bucket;
+	}
+	int shift = static_cast<int>(bucket >> LATENCY_SUB_BITS) - 1;
+	uint64_t sub = bucket & ((1u << LATENCY_SUB_BITS) - 1);
+	uint64_t lower = ((1ull << LATENCY_SUB_BITS) | sub) << shift;
+	return lower + (1ull << shift) - 1;
+}
+
+void IoStats::setRegions(const std::vector<IoRegion>& newRegions) {
+	size_t count = std::min(newRegions.size(), static_cast<size_t>(MAX_IO_REGIONS));
+	std::copy(newRegions.begin(), newRegions.begin() + count, regions.begin());
+	regionCount.store(count, std::memory_order_release);
+}
+
+void IoStats::addRegionBytes(std::array<Counter, MAX_IO_REGIONS + 1>& counters, size_t addr, size_t size) {
+	size_t count = regionCount.load(std::memory_order_acquire);
+	size_t end = addr + size;
+	size_t accounted = 0;
+	for (size_t i = 0; i < count; i++) {
+		size_t overlapStart = std::max(addr, regions[i].start);
+		size_t overlapEnd = std::min(end, regions[i].end);
+		if (overlapStart < overlapEnd) {
+			bump(counters[i], overlapEnd - overlapStart);
+			accounted += overlapEnd - overlapStart;
+		}
+	}
+	if (accounted < size) {
+		bump(counters[MAX_IO_REGIONS], size - accounted);
+	}
+}
+
+void IoStats::record(IoOp op, size_t addr, size_t size, std::chrono::nanoseconds latency) {
+	Shard& shard = shards.local();
+	OpCounters& counters = shard.ops[static_cast<size_t>(op)];
+
+	bump(counters.count, 1);
+	bump(counters.bytes, size);
+	bump(addr == counters.lastEnd ? counters.sequential : counters.random, 1);
+	counters.lastEnd = addr + size;
+	bump(counters.totalNanoseconds, latency.count());
+	bump(counters.latency[latencyBucket(latency.count())], 1);
+
+	if (op == IoOp::READ) {
+		addRegionBytes(shard.regionBytesRead, addr, size);
+	} else if (op == IoOp::WRITE) {
+		addRegionBytes(shard.regionBytesWritten, addr, size);
+	}
+}
+
+void IoStats::recordLogicalWrite(size_t size) {
+	bump(shards.local().logicalBytesWritten, size);
+}
+
+#pragma endregion
+#pragma region aggregation
+
+IoStatsSnapshot IoStats::snapshot() {
+	IoStatsSnapshot result;
+	size_t count = regionCount.load(std::memory_order_acquire);
+	result.regions.assign(regions.begin(), regions.begin() + count);
+	result.regionBytesRead.resize(count + 1);
+	result.regionBytesWritten.resize(count + 1);
+
+	shards.forEach([&](const Shard& shard) {
+		for (size_t op = 0; op < IO_OP_COUNT; op++) {
+			const OpCounters& counters = shard.ops[op];
+			IoStatsSnapshot::OpStats& stats = result.ops[op];
+			stats.count += counters.count.load(std::memory_order_relaxed);
+			stats.bytes += counters.bytes.load(std::memory_order_relaxed);
+			stats.sequential += counters.sequential.load(std::memory_order_relaxed);
+			stats.random += counters.random.load(std::memory_order_relaxed);
+			stats.totalNanoseconds += counters.totalNanoseconds.load(std::memory_order_relaxed);
+			for (size_t bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+				stats.latency[bucket] += counters.latency[bucket].load(std::memory_order_relaxed);
+			}
+		}
+		for (size_t i = 0; i < count; i++) {
+			result.regionBytesRead[i] += shard.regionBytesRead[i].load(std::memory_order_relaxed);
+			result.regionBytesWritten[i] += shard.regionBytesWritten[i].load(std::memory_order_relaxed);
+		}
+		result.regionBytesRead[count] += shard.regionBytesRead[MAX_IO_REGIONS].load(std::memory_order_relaxed);
+		result.regionBytesWritten[count] += shard.regionBytesWritten[MAX_IO_REGIONS].load(std::memory_order_relaxed);
+		result.logicalBytesWritten += shard.logicalBytesWritten.load(std::memory_order_relaxed);
+	});
+	return result;
+}
+
+void IoStats::reset() {
+	// racing with a recording thread may lose that one request, good enough for statistics
+	shards.forEach([](Shard& shard) {
+		for (OpCounters& counters : shard.ops) {
+			counters.count = 0;
+			counters.bytes = 0;
+			counters.sequential = 0;
+			counters.random = 0;
+			counters.totalNanoseconds = 0;
+			for (Counter& bucket : counters.latency) {
+				bucket = 0;
+			}
+		}
+		for (size_t i = 0; i <= MAX_IO_REGIONS; i++) {
+			shard.regionBytesRead[i] = 0;
+			shard.regionBytesWritten[i] = 0;
+		}
+		shard.logicalBytesWritten = 0;
+	});
+}
+
+uint64_t IoStatsSnapshot::OpStats::percentile(double fraction) const {
+	uint64_t target = static_cast<uint64_t>(fraction * count);
+	uint64_t seen = 0;
+	for (size_t bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+		seen += latency[bucket];
+		if (seen > target) {
+			return IoStats::bucketUpperBound(bucket);
+		}
+	}
+	return 0;
+}
+
+#pragma endregion
+#pragma region output
+
+void IoStatsSnapshot::print(std::ostream& out) const {
+	out << std::left << std::setw(8) << "op" << std::right << std::setw(10) << "count" << std::setw(12) << "bytes"
+		<< std::setw(8) << "seq%" << std::setw(10) << "p50(ns)" << std::setw(10) << "p99(ns)" << "\r\n";
+	for (size_t op = 0; op < IO_OP_COUNT; op++) {
+		const OpStats& stats = ops[op];
+		uint64_t sequentialPercent = stats.count == 0 ? 0 : stats.sequential * 100 / stats.count;
+		out << std::left << std::setw(8) << OP_NAMES[op] << std::right << std::setw(10) << stats.count
+			<< std::setw(12) << stats.bytes << std::setw(8) << sequentialPercent << std::setw(10)
+			<< stats.percentile(0.5) << std::setw(10) << stats.percentile(0.99) << "\r\n";
+	}
+
+	out << "\r\n" << std::left << std::setw(10) << "region" << std::right << std::setw(12) << "read" << std::setw(12)
+		<< "written" << "\r\n";
+	for (size_t i = 0; i <= regions.size(); i++) {
+		out << std::left << std::setw(10) << (i < regions.size() ? regions[i].name : "other") << std::right
+			<< std::setw(12) << regionBytesRead[i] << std::setw(12) << regionBytesWritten[i] << "\r\n";
+	}
+
+	out << "\r\nlogical bytes written: " << logicalBytesWritten << "\r\n";
+	if (logicalBytesWritten != 0) {
+		out << "write amplification:   " << std::fixed << std::setprecision(2)
+			<< static_cast<double>(ops[static_cast<size_t>(IoOp::WRITE)].bytes) / logicalBytesWritten << "\r\n";
+	}
+}
+
+std::string IoStatsSnapshot::toJson() const {
+	std::ostringstream out;
+	out << "{\"ops\":{";
+	for (size_t op = 0; op < IO_OP_COUNT; op++) {
+		const OpStats& stats = ops[op];
+		out << (op == 0 ? "" : ",") << '"' << OP_NAMES[op] << "\":{\"count\":" << stats.count
+			<< ",\"bytes\":" << stats.bytes << ",\"sequential\":" << stats.sequential << ",\"random\":" << stats.random
+			<< ",\"total_ns\":" << stats.totalNanoseconds << ",\"p50_ns\":" << stats.percentile(0.5)
+			<< ",\"p90_ns\":" << stats.percentile(0.9) << ",\"p99_ns\":" << stats.percentile(0.99)
+			<< ",\"histogram\":[";
+		// sparse, [bucket upper bound in ns, count] pairs
+		bool first = true;
+		for (size_t bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+			if (stats.latency[bucket] != 0) {
+				out << (first ? "" : ",") << '[' << IoStats::bucketUpperBound(bucket) << ',' << stats.latency[bucket]
+					<< ']';
+				first = false;
+			}
+		}
+		out << "]}";
+	}
+	out << "},\"regions\":[";
+	for (size_t i = 0; i <= regions.size(); i++) {
+		out << (i == 0 ? "" : ",") << "{\"name\":\"" << (i < regions.size() ? regions[i].name : "other")
+			<< "\",\"bytes_read\":" << regionBytesRead[i] << ",\"bytes_written\":" << regionBytesWritten[i] << '}';
+	}
+	out << "],\"logical_bytes_written\":" << logicalBytesWritten << '}';
+	return out.str();
+}
+
+#pragma endregion
@@ -0,0 +1,189 @@
+#include "journal.hpp"
+#include "crc32c.hpp"
+#include "timeline.hpp"
+
+Journal::Journal(BlockDevice* blkdevsim_, size_t address_, size_t size_)
+	: blkdevsim(blkdevsim_), address(address_), size(size_), head(sizeof(journal_header)), sequence(1) {
+	assert(size > sizeof(journal_header) + sizeof(transaction_header));
+}
+
+#pragma region checksums
+
+uint32_t Journal::headerChecksum(const journal_header& header) {
+	return crc32c(&header.sequence, sizeof(header.sequence));
+}
+
+uint32_t Journal::transactionChecksum(const transaction_header& header, const char* payload) {
+	uint32_t crc = crc32c(&header.sequence, sizeof(header.sequence));
+	crc = crc32c(&header.length, sizeof(header.length), crc);
+	return crc32c(payload, header.length, crc);
+}
+
+#pragma endregion
+#pragma region lifecycle
+
+bool Journal::open() {
+	journal_header header{};
+	blkdevsim->read(address, sizeof(header), reinterpret_cast<char*>(&header));
+	if (strncmp(header.magic.data(), JOURNAL_MAGIC, header.magic.size()) != 0) {
+		return false;
+	}
+	if (header.checksum != headerChecksum(header)) {
+		return false;
+	}
+	sequence = header.sequence;
+	head = sizeof(journal_header);
+	return true;
+}
+
+void Journal::format() {
+	// a stale transaction right after the header could carry the new sequence, so wipe it
+	std::array<char, sizeof(transaction_header)> zeros{};
+	blkdevsim->write(address + sizeof(journal_header), zeros.size(), zeros.data());
+	head = sizeof(journal_header);
+	writeHeader();
+}
+
+void Journal::reset() {
+	// everything up to sequence is in the FAT now, older transactions no longer match the header
+	head = sizeof(journal_header);
+	writeHeader();
+}
+
+void Journal::writeHeader() {
+	journal_header header{};
+	std::memcpy(header.magic.data(), JOURNAL_MAGIC, header.magic.size());
+	header.sequence = sequence;
+	header.checksum = headerChecksum(header);
+	blkdevsim->write(address, sizeof(header), reinterpret_cast<const char*>(&header));
+	blkdevsim->sync(address, sizeof(header));
+}
+
+size_t Journal::replay(const RecordHandler& handler) {
+	TIMELINE_SPAN("Journal::replay");
+	size_t replayed = 0;
+	std::vector<char> payload;
+
+	while (head + sizeof(transaction_header) <= size) {
+		transaction_header header{};
+		blkdevsim->read(address + head, sizeof(header), reinterpret_cast<char*>(&header));
+		if (strncmp(header.magic.data(), TRANSACTION_MAGIC, header.magic.size()) != 0 ||
+			header.sequence != sequence || header.length > size - head - sizeof(header)) {
+			break; // end of the log
+		}
+		payload.resize(header.length);
+		blkdevsim->read(address + head + sizeof(header), header.length, payload.data());
+		if (header.checksum != transactionChecksum(header, payload.data())) {
+			break; // torn write, the transaction never committed
+		}
+
+		JournalRecords::forEach(payload.data(), payload.size(), handler);
+
+		head += sizeof(header) + header.length;
+		sequence++;
+		replayed++;
+	}
+	return replayed;
+}
+
+#pragma endregion
+#pragma region records
+
+void JournalRecords::appendRecord(JournalRecordType type, size_t length) {
+	records.push_back(static_cast<char>(type));
+	size_t offset = records.size();
+	records.resize(offset + sizeof(length));
+	memcpy(records.data() + offset, &length, sizeof(length));
+}
+
+void JournalRecords::logUpsert(const EntryInfo& entry) {
+	size_t length = entry.serializedSize();
+	appendRecord(JournalRecordType::ENTRY_RECORD, length);
+	size_t offset = records.size();
+	records.resize(offset + length);
+	entry.serialize(records.data() + offset);
+}
+
+void JournalRecords::logErase(const std::string& path) {
+	appendRecord(JournalRecordType::ENTRY_ERASE, path.size());
+	records.insert(records.end(), path.begin(), path.end());
+}
+
+void JournalRecords::logData(size_t dataAddress, const char* data, size_t dataSize) {
+	appendRecord(JournalRecordType::DATA, sizeof(dataAddress) + dataSize);
+	size_t offset = records.size();
+	records.resize(offset + sizeof(dataAddress));
+	memcpy(records.data() + offset, &dataAddress, sizeof(dataAddress));
+	records.insert(records.end(), data, data + dataSize);
+}
+
+void JournalRecords::append(const JournalRecords& other) {
+	records.insert(records.end(), other.records.begin(), other.records.end());
+}
+
+void JournalRecords::clear() {
+	records.clear();
+}
+
+bool JournalRecords::empty() const {
+	return records.empty();
+}
+
+size_t JournalRecords::size() const {
+	return records.size();
+}
+
+const char* JournalRecords::data() const {
+	return records.data();
+}
+
+void JournalRecords::forEach(const JournalRecordHandler& handler) const {
+	forEach(records.data(), records.size(), handler);
+}
+
+void JournalRecords::forEach(const char* records, size_t size, const JournalRecordHandler& handler) {
+	size_t offset = 0;
+	while (offset < size) {
+		auto type = static_cast<JournalRecordType>(records[offset]);
+		size_t length = 0;
+		memcpy(&length, records + offset + sizeof(type), sizeof(length));
+		offset += sizeof(type) + sizeof(length);
+		if (length > size - offset) {
+			throw std::runtime_error("Corrupted journal record");
+		}
+		handler(type, records + offset, length);
+		offset += length;
+	}
+}
+
+bool Journal::fits(size_t recordsSize) const {
+	return head + sizeof(transaction_header) + recordsSize <= size;
+}
+
+void Journal::commit(const JournalRecords& records) {
+	TIMELINE_SPAN("Journal::commit");
+	if (records.empty()) {
+		return;
+	}
+	if (!fits(records.size())) {
+		throw std::overflow_error("Journal full");
+	}
+
+	transaction_header header{};
+	std::memcpy(header.magic.data(), TRANSACTION_MAGIC, header.magic.size());
+	header.sequence = sequence;
+	header.length = records.size();
+	header.checksum = transactionChecksum(header, records.data());
+
+	// one write and one flush for the whole group
+	buffer.resize(sizeof(header) + records.size());
+	memcpy(buffer.data(), &header, sizeof(header));
+	memcpy(buffer.data() + sizeof(header), records.data(), records.size());
+	blkdevsim->write(address + head, buffer.size(), buffer.data());
+	blkdevsim->sync(address + head, buffer.size());
+
+	head += buffer.size();
+	sequence++;
+}
+
+#pragma endregion
@@ -0,0 +1,128 @@
+#include "latencydev.hpp"
+#include "config.hpp"
+#include <thread>
+
+// sleeping is only accurate to about this much, spin for the rest
+#define SPIN_THRESHOLD std::chrono::microseconds(60)
+
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+using std::chrono::nanoseconds;
+
+LatencyProfile LatencyProfile::hdd() {
+	// 7200rpm disk, half a rotation of latency and seeks dominate small requests
+	return {microseconds(4200), microseconds(4200), milliseconds(10), milliseconds(4), milliseconds(8),
+			150 * 1024 * 1024, 1, true};
+}
+
+LatencyProfile LatencyProfile::ssd() {
+	// SATA flash, no seeks but every request still pays a fixed cost
+	return {microseconds(80), microseconds(30), microseconds(500), nanoseconds(0), nanoseconds(0),
+			500 * 1024 * 1024, 32, true};
+}
+
+LatencyBlockDevice::LatencyBlockDevice(BlockDevice* inner_, const LatencyProfile& profile_)
+	: inner(inner_), profile(profile_), inFlight(0), headPosition(0), channelFree(Clock::now()),
+	  simulatedTime(0) {
+	assert(profile.queueDepth > 0);
+}
+
+void LatencyBlockDevice::read(size_t addr, size_t size, char* ans) {
+	Clock::time_point start = Clock::now();
+	nanoseconds simulated = delay(addr, size, profile.readLatency);
+	inner->read(addr, size, ans);
+	stats.record(IoOp::READ, addr, size, profile.realTime ? Clock::now() - start : simulated);
+}
+
+void LatencyBlockDevice::write(size_t addr, size_t size, const char* data) {
+	Clock::time_point start = Clock::now();
+	nanoseconds simulated = delay(addr, size, profile.writeLatency);
+	inner->write(addr, size, data);
+	stats.record(IoOp::WRITE, addr, size, profile.realTime ? Clock::now() - start : simulated);
+}
+
+void LatencyBlockDevice::sync(size_t addr, size_t size) {
+	Clock::time_point start = Clock::now();
+	// a flush writes the range back, then waits for the device cache
+	nanoseconds simulated = delay(addr, size, profile.syncLatency);
+	inner->sync(addr, size);
+	stats.record(IoOp::SYNC, addr, size, profile.realTime ? Clock::now() - start : simulated);
+}
+
+void LatencyBlockDevice::discard(size_t addr, size_t size) {
+	// trim only updates the mapping, it costs next to nothing
+	inner->discard(addr, size);
+}
+
+void LatencyBlockDevice::advise(size_t addr, size_t size, AccessHint hint) {
+	inner->advise(addr, size, hint);
+}
+
+IoStats* LatencyBlockDevice::getStats() {
+	return &stats;
+}
+
+size_t LatencyBlockDevice::getSize() const {
+	return inner->getSize();
+}
+
+std::chrono::nanoseconds LatencyBlockDevice::getSimulatedTime() {
+	std::lock_guard<std::mutex> lock(stateMutex);
+	return simulatedTime;
+}
+
+void LatencyBlockDevice::resetSimulatedTime() {
+	std::lock_guard<std::mutex> lock(stateMutex);
+	simulatedTime = nanoseconds(0);
+}
+
+nanoseconds LatencyBlockDevice::delay(size_t addr, size_t size, nanoseconds fixedLatency) {
+	std::unique_lock<std::mutex> lock(stateMutex);
+	Clock::time_point arrival = Clock::now();
+	queueSlot.wait(lock, [this] { return inFlight < profile.queueDepth; });
+	inFlight++;
+
+	nanoseconds cost = fixedLatency;
+	if (addr != headPosition) {
+		size_t distance = addr > headPosition ? addr - headPosition : headPosition - addr;
+		cost += profile.seekLatency + nanoseconds(static_cast<int64_t>(
+										  static_cast<double>(profile.fullStrokeSeek.count()) * distance / inner->getSize()));
+	}
+	headPosition = addr + size;
+
+	nanoseconds transfer(0);
+	if (profile.bandwidth != 0) {
+		transfer = nanoseconds(static_cast<int64_t>(size * 1e9 / profile.bandwidth));
+	}
+	if (!profile.realTime) {
+		// only pretend, nothing ever overlaps so there is no queueing either
+		simulatedTime += transfer + cost;
+		inFlight--;
+		return transfer + cost;
+	}
+
+	// the transfer itself waits for the shared channel
+	Clock::time_point start = std::max(Clock::now(), channelFree);
+	channelFree = start + transfer;
+	Clock::time_point deadline = start + transfer + cost;
+	nanoseconds simulated = std::chrono::duration_cast<nanoseconds>(deadline - arrival);
+	simulatedTime += simulated;
+	lock.unlock();
+
+	waitUntil(deadline);
+
+	lock.lock();
+	inFlight--;
+	lock.unlock();
+	queueSlot.notify_one();
+	return simulated;
+}
+
+void LatencyBlockDevice::waitUntil(Clock::time_point deadline) {
+	if (deadline - Clock::now() > SPIN_THRESHOLD) {
+		std::this_thread::sleep_until(deadline - SPIN_THRESHOLD);
+	}
+	while (Clock::now() < deadline) {
+		// spin, sleeping isn't precise enough for flash latencies
+	}
+}
@@ -0,0 +1,237 @@
+#include "libmyfs.h"
+#include "myfs.hpp"
+#include <memory>
+#include <unistd.h>
+
+struct myfs {
+	std::unique_ptr<BlockDeviceSimulator> blkdev;
+	std::unique_ptr<MyFs> fs;
+};
+
+static thread_local std::string lastError;
+
+// nothing may leave through the C boundary, exceptions become statuses
+template <typename Call>
+static int guarded(Call call) {
+	try {
+		return call();
+	} catch (const std::exception& e) {
+		lastError = e.what();
+	} catch (...) {
+		lastError = "Unknown error";
+	}
+	return MYFS_ERROR;
+}
+
+static int invalid(const char* what) {
+	lastError = what;
+	return MYFS_INVALID;
+}
+
+static int notFound(const char* path) {
+	lastError = std::string("No such file or directory: ") + path;
+	return MYFS_NOT_FOUND;
+}
+
+static void fillStat(const EntryInfo& entry, myfs_stat_t* stat) {
+	stat->size = entry.size;
+	stat->checksum = entry.checksum;
+	stat->type = entry.type == DIRECTORY_TYPE ? MYFS_TYPE_DIRECTORY : MYFS_TYPE_FILE;
+}
+
+int myfs_api_version(void) {
+	return MYFS_API_VERSION;
+}
+
+const char* myfs_last_error(void) {
+	return lastError.c_str();
+}
+
+int myfs_open(const char* image, uint64_t new_size, unsigned flags, myfs_t** fs) {
+	if (image == nullptr || fs == nullptr) {
+		return invalid("No image or handle given");
+	}
+	return guarded([&] {
+		// a half made image would fail every later open, it goes again if this one fails
+		bool created = access(image, F_OK) == -1;
+		try {
+			std::unique_ptr<myfs> handle = std::make_unique<myfs>();
+			handle->blkdev = std::make_unique<BlockDeviceSimulator>(
+				image, new_size == 0 ? BlockDevice::DEFAULT_DEVICE_SIZE : new_size);
+			MountOptions options;
+			options.lazy = (flags & MYFS_OPEN_LAZY) != 0;
+			options.formatBlank = (flags & MYFS_OPEN_NO_FORMAT) == 0;
+			handle->fs = std::make_unique<MyFs>(handle->blkdev.get(), options);
+			*fs = handle.release();
+		} catch (...) {
+			if (created) {
+				unlink(image);
+			}
+			throw;
+		}
+		return MYFS_OK;
+	});
+}
+
+int myfs_close(myfs_t* fs) {
+	return guarded([&] {
+		// the mount goes before its device, the unmount still writes to it
+		if (fs != nullptr) {
+			fs->fs.reset();
+		}
+		delete fs;
+		return MYFS_OK;
+	});
+}
+
+int myfs_stat(myfs_t* fs, const char* path, myfs_stat_t* stat) {
+	if (fs == nullptr || path == nullptr || stat == nullptr) {
+		return invalid("No handle, path or stat given");
+	}
+	return guarded([&] {
+		std::optional<EntryInfo> entry = fs->fs->getEntryInfo(path);
+		if (!entry) {
+			return notFound(path);
+		}
+		fillStat(*entry, stat);
+		return MYFS_OK;
+	});
+}
+
+int myfs_readdir(myfs_t* fs, const char* path, myfs_readdir_fn callback, void* context) {
+	if (fs == nullptr || path == nullptr || callback == nullptr) {
+		return invalid("No handle, path or callback given");
+	}
+	return guarded([&] {
+		if (!fs->fs->isFileExists(path)) {
+			return notFound(path);
+		}
+		for (const EntryInfo& entry : fs->fs->listDir(path)) {
+			myfs_stat_t stat{};
+			fillStat(entry, &stat);
+			if (callback(MyFs::splitPath(entry.path).second.c_str(), &stat, context) != 0) {
+				break;
+			}
+		}
+		return MYFS_OK;
+	});
+}
+
+int myfs_read(myfs_t* fs, const char* path, void* buffer, size_t capacity, size_t* size) {
+	if (fs == nullptr || path == nullptr || (buffer == nullptr && capacity > 0)) {
+		return invalid("No handle, path or buffer given");
+	}
+	return guarded([&] {
+		if (!fs->fs->isFileExists(path)) {
+			return notFound(path);
+		}
+		size_t contentSize = fs->fs->getContent(path, static_cast<char*>(buffer), capacity);
+		if (size != nullptr) {
+			*size = contentSize;
+		}
+		if (contentSize > capacity) {
+			lastError = "Buffer too small for " + std::to_string(contentSize) + " bytes";
+			return MYFS_TOO_SMALL;
+		}
+		return MYFS_OK;
+	});
+}
+
+int myfs_read_view(myfs_t* fs, const char* path, myfs_view_fn callback, void* context) {
+	if (fs == nullptr || path == nullptr || callback == nullptr) {
+		return invalid("No handle, path or callback given");
+	}
+	return guarded([&] {
+		if (!fs->fs->isFileExists(path)) {
+			return notFound(path);
+		}
+		fs->fs->viewContent(path, [&](const char* data, size_t size) { callback(data, size, context); });
+		return MYFS_OK;
+	});
+}
+
+int myfs_write(myfs_t* fs, const char* path, const void* data, size_t size) {
+	if (fs == nullptr || path == nullptr || (data == nullptr && size > 0)) {
+		return invalid("No handle, path or data given");
+	}
+	return guarded([&] {
+		// created and written in one commit
+		MyFs::Transaction transaction(*fs->fs);
+		std::optional<EntryInfo> entry = fs->fs->getEntryInfo(path);
+		if (entry && entry->type != FILE_TYPE) {
+			lastError = std::string("Is a directory: ") + path;
+			return MYFS_IS_DIRECTORY;
+		}
+		fs->fs->setContent(entry ? *entry : fs->fs->createFile(path), static_cast<const char*>(data), size);
+		return MYFS_OK;
+	});
+}
+
+int myfs_create(myfs_t* fs, const char* path) {
+	if (fs == nullptr || path == nullptr) {
+		return invalid("No handle or path given");
+	}
+	return guarded([&] {
+		fs->fs->createFile(path);
+		return MYFS_OK;
+	});
+}
+
+int myfs_mkdir(myfs_t* fs, const char* path) {
+	if (fs == nullptr || path == nullptr) {
+		return invalid("No handle or path given");
+	}
+	return guarded([&] {
+		fs->fs->createDirectory(path);
+		return MYFS_OK;
+	});
+}
+
+int myfs_remove(myfs_t* fs, const char* path) {
+	if (fs == nullptr || path == nullptr) {
+		return invalid("No handle or path given");
+	}
+	return guarded([&] {
+		if (!fs->fs->isFileExists(path)) {
+			return notFound(path);
+		}
+		fs->fs->remove(path);
+		return MYFS_OK;
+	});
+}
+
+int myfs_rename(myfs_t* fs, const char* from, const char* to) {
+	if (fs == nullptr || from == nullptr || to == nullptr) {
+		return invalid("No handle or path given");
+	}
+	return guarded([&] {
+		if (!fs->fs->isFileExists(from)) {
+			return notFound(from);
+		}
+		fs->fs->move(from, to);
+		return MYFS_OK;
+	});
+}
+
+int myfs_begin(myfs_t* fs) {
+	if (fs == nullptr) {
+		return invalid("No handle given");
+	}
+	return guarded([&] {
+		fs->fs->beginTransaction();
+		return MYFS_OK;
+	});
+}
+
+int myfs_commit(myfs_t* fs) {
+	if (fs == nullptr) {
+		return invalid("No handle given");
+	}
+	return guarded([&] {
+		if (!fs->fs->inTransaction()) {
+			return invalid("No transaction to commit");
+		}
+		fs->fs->commitTransaction();
+		return MYFS_OK;
+	});
+}
@@ -0,0 +1,40 @@
+#include "memdev.hpp"
+
+MemoryBlockDevice::MemoryBlockDevice(size_t size) : memory(size, 0) {
+}
+
+void MemoryBlockDevice::check(size_t addr, size_t size) const {
+	if (addr > memory.size() || size > memory.size() - addr) {
+		throw std::out_of_range("Access past the end of the device");
+	}
+}
+
+void MemoryBlockDevice::read(size_t addr, size_t size, char* ans) {
+	check(addr, size);
+	memcpy(ans, memory.data() + addr, size);
+	stats.record(IoOp::READ, addr, size, std::chrono::nanoseconds::zero());
+}
+
+void MemoryBlockDevice::write(size_t addr, size_t size, const char* data) {
+	check(addr, size);
+	memcpy(memory.data() + addr, data, size);
+	stats.record(IoOp::WRITE, addr, size, std::chrono::nanoseconds::zero());
+}
+
+void MemoryBlockDevice::sync(size_t addr, size_t size) {
+	stats.record(IoOp::SYNC, addr, size, std::chrono::nanoseconds::zero());
+}
+
+const char* MemoryBlockDevice::view(size_t addr, size_t size) {
+	check(addr, size);
+	stats.record(IoOp::READ, addr, size, std::chrono::nanoseconds::zero());
+	return memory.data() + addr;
+}
+
+IoStats* MemoryBlockDevice::getStats() {
+	return &stats;
+}
+
+size_t MemoryBlockDevice::getSize() const {
+	return memory.size();
+}
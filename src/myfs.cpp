@@ -1,123 +1,615 @@
 #include "myfs.hpp"
 #include "config.hpp"
+#include "crc32c.hpp"
+#include "fsck.hpp"
+#include "fatreader.hpp"
+#include "timeline.hpp"
 
 // const std::string MyFs::MYFS_MAGIC = "MYFS";
 //const uint8_t MyFs::CURR_VERSION = 0x03;
 
-MyFs::MyFs(BlockDeviceSimulator* blkdevsim_)
-	: blkdevsim(blkdevsim_), allocator(FAT_SIZE, blkdevsim->DEVICE_SIZE, DEFAULT_BLOCK_SIZE), totalFatSize(FAT_SIZE),
-	  BLOCK_SIZE(DEFAULT_BLOCK_SIZE) {
+// the metadata at the end has to fit with some room for data left
+static size_t journalAddressOf(const BlockDevice* blkdevsim) {
+	if (blkdevsim->getSize() < MIN_DEVICE_SIZE) {
+		throw std::runtime_error("Device too small, needs at least " + std::to_string(MIN_DEVICE_SIZE) + " bytes");
+	}
+	return blkdevsim->getSize() - JOURNAL_SIZE;
+}
+
+
+MyFs::MyFs(BlockDevice* blkdevsim_, MountOptions options)
+	: blkdevsim(blkdevsim_), mountOptions(options),
+	  allocator(FAT_SIZE, journalAddressOf(blkdevsim) - FAT_SLOT_COUNT * FAT_SIZE, DEFAULT_BLOCK_SIZE),
+	  totalFatSize(FAT_SIZE), BLOCK_SIZE(DEFAULT_BLOCK_SIZE), openTransactions(0),
+	  publishedEntries(new std::set<EntryInfo>()),
+	  journal(blkdevsim, journalAddressOf(blkdevsim), JOURNAL_SIZE), journalData(false),
+	  commitMode(CommitMode::JOURNAL), queuedTicket(0), durableTicket(0), flushing(false), generation(0),
+	  fatAddress(0), recordFormat(RecordFormat::FIXED), snapshotAddress(0), snapshotSize(0), snapshotChecksum(0),
+	  snapshotFormat(RecordFormat::FIXED),
+	  dentries(DENTRY_CACHE_SIZE), tracer(nullptr) {
 	try {
-		load();
-		allocator.initialize(entries, BLOCK_SIZE);
-		allocator.defrag(entries, blkdevsim);
-		// allocator.defrag(entries, blkdevsim);
+		open();
+	} catch (...) {
+		// the destructor won't run
+		delete publishedEntries.load();
+		throw;
+	}
+}
+
+void MyFs::open() {
+	TIMELINE_SPAN("MyFs::mount");
+	describeRegions();
+	bool unclean = false;
+	bool salvaged = false;
+	try {
+		unclean = mount();
 	} catch (const std::exception& e) {
-		format();
+		if (mountOptions.formatBlank && !hasFileSystem()) {
+			format();
+			return;
+		}
+		if (!mountOptions.repair) {
+			throw;
+		}
+		// there is a file system, it just doesn't mount, get back whatever is left of it instead of formatting
+		FsChecker(*this).salvage();
+		salvaged = true;
+	}
+	initializeAllocator();
+	publishEntries();
+	// flushes apply their records on top of this, a checkpoint before the first save must not lose the rest
+	durableEntries = entries;
+	if ((unclean || salvaged) && mountOptions.repair) {
+		// a crash can leave the table and the listings disagreeing, fix that before defrag moves anything
+		FsChecker(*this).check(true, false);
+	}
+	if (salvaged || (fatAddress == 0 && mountOptions.maintain)) {
+		// nothing on the device mounts until this is written, and a legacy image has no header slot yet
+		save();
+	}
+	if (mountOptions.maintain && !mountOptions.lazy) {
+		compact();
 	}
 }
 
 MyFs::~MyFs() {
 	try {
-		save(); // Ensure all changes are flushed to the block device
+		if (mountOptions.maintain) {
+			// Ensure all changes are flushed to the block device
+			if (mountOptions.lazy) {
+				compact();
+			} else {
+				save();
+			}
+		}
 	} catch (std::runtime_error& e) {
 		// std::cout << e.what() << std::endl;
 	}
+	delete publishedEntries.load();
 }
 
-#pragma region fatIO
+void MyFs::compact() {
+	TIMELINE_SPAN("MyFs::compact");
+	OperationLock lock(*this);
+	// moving data around would pull it from under the snapshot
+	if (!hasSnapshot()) {
+		relocateData();
+		allocator.releaseAllFree();
+	}
+	save();
+	discardReleased(false);
+}
 
-void MyFs::save() {
-	// Make sure we have the correct size
-	assert(std::accumulate(entries.begin(), entries.end(), static_cast<size_t>(0),
-						   [](size_t totalSize, const EntryInfo& entry) {
-							   return totalSize + entry.serializedSize();
-						   }) == totalFatSize);
+void MyFs::relocateData() {
+	TIMELINE_SPAN("MyFs::relocateData");
+	OperationLock lock(*this);
+	ThreadState& state = threadState();
+	// The data ends up packed to the front in address order without ever writing over what the FAT on
+	// disk points at. A batch is copied out to the top of the free space and checkpointed, which frees
+	// its old places and with them where it goes, then copied there and checkpointed again. A crash
+	// anywhere leaves the data of the layout the header points at untouched
+	struct Relocation {
+		EntryInfo entry; // as it was
+		size_t staged;
+		size_t target;
+	};
+	auto moveEntry = [&](const EntryInfo& entry, size_t from, size_t to) {
+		blkdevsim->move(from, to, entry.size);
+		// has to land before the checkpoint pointing at it
+		state.dirtyRanges.emplace_back(to, entry.size);
+		auto node = entries.extract(entry);
+		node.value().address = to;
+		entries.insert(std::move(node));
+	};
+
+	for (;;) {
+		std::vector<Relocation> batch;
+		{
+			std::lock_guard<std::mutex> entriesLock(entriesMutex);
+			std::vector<EntryInfo> byAddress;
+			std::copy_if(entries.begin(), entries.end(), std::back_inserter(byAddress),
+						 [](const EntryInfo& entry) { return entry.size != 0; });
+			std::sort(byAddress.begin(), byAddress.end(),
+					  [](const EntryInfo& a, const EntryInfo& b) { return a.address < b.address; });
+			size_t target = FAT_SIZE;
+			for (const EntryInfo& entry : byAddress) {
+				size_t targetEnd = target + allocator.alignToBlockSize(entry.size);
+				if (batch.empty() && entry.address == target) {
+					target = targetEnd;
+					continue;
+				}
+				// the staging copies must stay clear of where the batch goes
+				size_t staged = allocator.allocateHighest(entry.size);
+				if (staged != SIZE_MAX && staged < targetEnd) {
+					EntryInfo staging = entry;
+					staging.address = staged;
+					allocator.deallocate(staging);
+					staged = SIZE_MAX;
+				}
+				if (staged == SIZE_MAX) {
+					break;
+				}
+				moveEntry(entry, entry.address, staged);
+				batch.push_back({entry, staged, target});
+				target = targetEnd;
+			}
+			publishEntries();
+		}
+		if (batch.empty()) {
+			return;
+		}
+		save();
 
-	if (totalFatSize > static_cast<size_t>(FAT_SIZE - BLOCK_SIZE)) {
-		throw std::overflow_error("FAT partition full");
+		for (const Relocation& relocation : batch) {
+			allocator.deallocate(relocation.entry);
+		}
+		{
+			std::lock_guard<std::mutex> entriesLock(entriesMutex);
+			for (const Relocation& relocation : batch) {
+				allocator.reserve(relocation.target, relocation.entry.size);
+				moveEntry(relocation.entry, relocation.staged, relocation.target);
+			}
+			publishEntries();
+		}
+		save();
+		for (const Relocation& relocation : batch) {
+			EntryInfo staging = relocation.entry;
+			staging.address = relocation.staged;
+			allocator.deallocate(staging);
+		}
 	}
+}
+
+#pragma region fatIO
+
+std::vector<char> MyFs::serializeFat(const std::set<EntryInfo>& source) {
 	// Allocate a buffer to hold all serialized entries
-	std::vector<char> buffer(totalFatSize);
+	std::vector<char> buffer(std::accumulate(source.begin(), source.end(), static_cast<size_t>(0),
+											 [](size_t totalSize, const EntryInfo& entry) {
+												 return totalSize + entry.serializedSize();
+											 }));
 	size_t offset = 0;
-	for (const EntryInfo& entry : entries) {
+	for (const EntryInfo& entry : source) {
 		entry.serialize(buffer.data() + offset);
 		offset += entry.serializedSize();
 	}
+	return buffer;
+}
+
+void MyFs::deserializeFat(const char* buffer, size_t size, std::set<EntryInfo>& result, RecordFormat format) {
+	// one pass over the whole version, a record that doesn't decode means the FAT can't be trusted
+	if (FatReader::decode(buffer, size, format, result) != size) {
+		throw std::runtime_error("Malformed FAT record.");
+	}
+}
+
+RecordFormat MyFs::recordFormatOf(uint8_t version) {
+	if (version < NATIVE_RECORDS_VERSION) {
+		return RecordFormat::NATIVE_UNCHECKED;
+	}
+	return version == NATIVE_RECORDS_VERSION ? RecordFormat::NATIVE : RecordFormat::FIXED;
+}
+
+RecordFormat MyFs::snapshotFormatOf(const myfs_header& header) {
+	return recordFormatOf(header.snapshotVersion != 0 ? header.snapshotVersion : header.version);
+}
+
+uint32_t MyFs::headerChecksum(const myfs_header& header) {
+	return crc32c(&header, offsetof(myfs_header, checksum));
+}
+
+void MyFs::describeRegions() {
+	IoStats* stats = blkdevsim->getStats();
+	if (stats == nullptr) {
+		return;
+	}
+	size_t journalAddress = journalAddressOf(blkdevsim);
+	stats->setRegions({{"header", 0, FAT_SIZE},
+					   {"data", FAT_SIZE, fatAreaAddress()},
+					   {"fat", fatAreaAddress(), journalAddress},
+					   {"journal", journalAddress, blkdevsim->getSize()}});
+}
+
+IoStats* MyFs::getIoStats() {
+	return blkdevsim->getStats();
+}
+
+void MyFs::setTracer(OpTracer* tracer_) {
+	tracer = tracer_;
+}
+
+OpTracer* MyFs::activeTracer() {
+	OpTracer* current = tracer.load();
+	if (current == nullptr || threadState().lockDepth > 0) {
+		return nullptr;
+	}
+	return current;
+}
+
+size_t MyFs::fatAreaAddress() const {
+	return journalAddressOf(blkdevsim) - FAT_SLOT_COUNT * FAT_SIZE;
+}
+
+size_t MyFs::nextFatSlot() const {
+	// any slot that neither the live header nor the snapshot points at
+	for (size_t slot = 0; slot < FAT_SLOT_COUNT; slot++) {
+		size_t address = fatAreaAddress() + slot * FAT_SIZE;
+		if (address != fatAddress && address != snapshotAddress) {
+			return address;
+		}
+	}
+	throw std::logic_error("No free FAT slot");
+}
+
+void MyFs::save() {
+	TIMELINE_SPAN("MyFs::save");
+	OperationLock lock(*this);
+	ThreadState& state = threadState();
+	// nothing else is in flight, the checkpoint covers everything in memory and the journal starts over
+	syncDirtyData(state);
+	state.records.clear();
+	checkpointRanges.insert(checkpointRanges.end(), state.journaledRanges.begin(), state.journaledRanges.end());
+	state.journaledRanges.clear();
+	{
+		std::lock_guard<std::mutex> entriesLock(entriesMutex);
+		durableEntries = entries;
+	}
+	checkpoint(durableEntries);
+}
+
+void MyFs::checkpoint(const std::set<EntryInfo>& source) {
+	TIMELINE_SPAN("MyFs::checkpoint");
+	std::vector<char> buffer = serializeFat(source);
+	if (buffer.size() > static_cast<size_t>(FAT_SIZE - BLOCK_SIZE)) {
+		throw std::overflow_error("FAT partition full");
+	}
+
+	// the new FAT version goes next to the old one, which stays valid until the header flips
+	size_t newFatAddress = nextFatSlot();
+	assert(newFatAddress != fatAddress && newFatAddress != snapshotAddress);
+	blkdevsim->write(newFatAddress, buffer.size(), buffer.data());
+
+	// everything the new header points at must be on disk before it, the data of every
+	// transaction was synced before it committed, journaled data only now
+	for (const std::pair<size_t, size_t>& range : checkpointRanges) {
+		blkdevsim->sync(range.first, range.second);
+	}
+	checkpointRanges.clear();
+	blkdevsim->sync(newFatAddress, buffer.size());
 
-	// Write the header and entries to the block device
 	myfs_header header{};
 	std::memcpy(header.magic.data(), MYFS_MAGIC, header.magic.size());
-	strncpy(header.magic.data(), MYFS_MAGIC, header.magic.size());
 	header.version = CURR_VERSION;
 	header.blockSize = BLOCK_SIZE;
-	blkdevsim->write(0, sizeof(header), reinterpret_cast<const char*>(&header));
-	blkdevsim->write(sizeof(header), sizeof(totalFatSize), reinterpret_cast<const char*>(&totalFatSize));
+	header.generation = generation + 1;
+	header.fatAddress = newFatAddress;
+	header.fatSize = buffer.size();
+	header.fatChecksum = crc32c(buffer.data(), buffer.size());
+	header.snapshotAddress = snapshotAddress;
+	header.snapshotSize = snapshotSize;
+	header.snapshotChecksum = snapshotChecksum;
+	if (snapshotFormat == RecordFormat::NATIVE_UNCHECKED) {
+		header.snapshotVersion = SHADOW_VERSION;
+	} else if (snapshotFormat == RecordFormat::NATIVE) {
+		header.snapshotVersion = NATIVE_RECORDS_VERSION;
+	}
+	header.checksum = headerChecksum(header);
 
-	blkdevsim->write(sizeof(header) + sizeof(totalFatSize), buffer.size(), buffer.data());
+	// the atomic switch, a torn header fails its checksum and the other slot is used
+	size_t headerAddress = (header.generation % 2) * HEADER_SLOT_SIZE;
+	blkdevsim->write(headerAddress, sizeof(header), reinterpret_cast<const char*>(&header));
+	blkdevsim->sync(headerAddress, sizeof(header));
+
+	generation = header.generation;
+	fatAddress = newFatAddress;
+	journal.reset();
+}
+
+std::optional<MyFs::myfs_header> MyFs::readHeader(size_t slot) {
+	myfs_header header{};
+	blkdevsim->read(slot * HEADER_SLOT_SIZE, sizeof(header), reinterpret_cast<char*>(&header));
+
+	if (strncmp(header.magic.data(), MYFS_MAGIC, header.magic.size()) != 0 || header.version < SHADOW_VERSION ||
+		header.version > CURR_VERSION || header.checksum != headerChecksum(header)) {
+		return std::nullopt;
+	}
+	if (header.fatSize > FAT_SIZE || header.fatAddress < fatAreaAddress() ||
+		header.fatAddress + header.fatSize > journalAddressOf(blkdevsim)) {
+		return std::nullopt;
+	}
+	return header;
 }
 
 void MyFs::load() {
+	TIMELINE_SPAN("MyFs::load");
+	// Read both header slots, the newest one with an intact FAT wins
+	std::array<std::optional<myfs_header>, 2> headers = {readHeader(0), readHeader(1)};
+	if (headers[0] && headers[1] && headers[1]->generation > headers[0]->generation) {
+		std::swap(headers[0], headers[1]);
+	}
+
+	std::optional<myfs_header> chosen;
+	std::vector<char> fat;
+	std::vector<char> snapshot;
+	// an intact FAT whose snapshot isn't, mounted without the snapshot if no slot has both
+	std::optional<myfs_header> fallback;
+	std::vector<char> fallbackFat;
+	for (const std::optional<myfs_header>& header : headers) {
+		if (!header) {
+			continue;
+		}
+		if (header->blockSize <= 1 && header->blockSize < FAT_SIZE) {
+			continue;
+		}
+		std::vector<char> buffer(header->fatSize);
+		blkdevsim->read(header->fatAddress, buffer.size(), buffer.data());
+		if (crc32c(buffer.data(), buffer.size()) != header->fatChecksum) {
+			continue;
+		}
+		if (header->snapshotAddress != 0) {
+			std::vector<char> snapshotBuffer(std::min<size_t>(header->snapshotSize, FAT_SIZE));
+			blkdevsim->read(header->snapshotAddress, snapshotBuffer.size(), snapshotBuffer.data());
+			if (header->snapshotSize > FAT_SIZE ||
+				crc32c(snapshotBuffer.data(), snapshotBuffer.size()) != header->snapshotChecksum) {
+				if (!fallback) {
+					fallback = header;
+					fallbackFat = std::move(buffer);
+				}
+				continue;
+			}
+			snapshot = std::move(snapshotBuffer);
+		}
+		chosen = header;
+		fat = std::move(buffer);
+		break;
+	}
+	if (!chosen && fallback) {
+		// the snapshot is lost, the file system itself isn't, the next checkpoint writes a header without it
+		chosen = fallback;
+		fat = std::move(fallbackFat);
+		chosen->snapshotAddress = 0;
+		chosen->snapshotSize = 0;
+		chosen->snapshotChecksum = 0;
+		chosen->snapshotVersion = 0;
+	}
+	if (!chosen) {
+		throw std::runtime_error("Invalid file system magic number.");
+	}
+
+	recordFormat = recordFormatOf(chosen->version);
+	deserializeFat(fat.data(), fat.size(), entries, recordFormat);
+	BLOCK_SIZE = chosen->blockSize;
+	generation = chosen->generation;
+	fatAddress = chosen->fatAddress;
+
+	snapshotEntries.clear();
+	snapshotAddress = chosen->snapshotAddress;
+	snapshotSize = chosen->snapshotSize;
+	snapshotChecksum = chosen->snapshotChecksum;
+	snapshotFormat = snapshotFormatOf(*chosen);
+	if (snapshotAddress != 0) {
+		deserializeFat(snapshot.data(), snapshot.size(), snapshotEntries, snapshotFormat);
+	}
+}
+
+void MyFs::loadLegacy() {
 	// Read the header
-	myfs_header header{};
+	legacy_header header{};
 	blkdevsim->read(0, sizeof(header), reinterpret_cast<char*>(&header));
 
 	// Check for magic number and version
 	if (strncmp(header.magic.data(), MYFS_MAGIC, header.magic.size()) != 0) {
 		throw std::runtime_error("Invalid file system magic number.");
 	}
-	if (header.version != CURR_VERSION) {
+	if (header.version < FIRST_LEGACY_VERSION || header.version > LEGACY_VERSION) {
 		throw std::runtime_error("Unsupported file system version.");
 	}
 	if (header.blockSize <= 1 && header.blockSize < FAT_SIZE) {
 		throw std::runtime_error("Invalid block size");
 	}
 	BLOCK_SIZE = header.blockSize;
-	blkdevsim->read(sizeof(header), sizeof(totalFatSize), reinterpret_cast<char*>(&totalFatSize));
+	size_t fatSize = 0;
+	blkdevsim->read(sizeof(header), sizeof(fatSize), reinterpret_cast<char*>(&fatSize));
+	if (fatSize > FAT_SIZE - sizeof(header) - sizeof(fatSize)) {
+		throw std::runtime_error("Invalid FAT size.");
+	}
 
 	// Read the entries
-	size_t offset = sizeof(header) + sizeof(totalFatSize);
-
-	while (offset < totalFatSize) {
-		// Buffer for the entry
-		std::array<char, ENTRY_BUFFER_SIZE> buffer{};
-		// Read the type and path length first
-		blkdevsim->read(offset, HEADER_SIZE, buffer.data());
-		// Check if buffer is just zeros
-		assert(std::all_of(buffer.begin(), buffer.begin() + HEADER_SIZE, [](char c) { return c == 0; }) == false);
-		// Deserialize entry to get the path length
+	std::vector<char> buffer(fatSize);
+	blkdevsim->read(sizeof(header) + sizeof(fatSize), fatSize, buffer.data());
+	recordFormat = RecordFormat::NATIVE_UNCHECKED;
+	deserializeFat(buffer.data(), buffer.size(), entries, recordFormat);
+
+	// the FAT slots and the journal go at the end of the device, which has to be free for the upgrade
+	for (const EntryInfo& entry : entries) {
+		if (entry.address + entry.size > fatAreaAddress()) {
+			throw std::runtime_error("No room for the metadata area, can't upgrade the file system.");
+		}
+	}
+	if (header.version == FIRST_LEGACY_VERSION) {
+		// no journal before 0x04
+		journal.format();
+	}
+	// the first new header goes to slot B, slot A still holds this one until then
+	generation = 0;
+}
+
+size_t MyFs::replayJournal() {
+	TIMELINE_SPAN("MyFs::replayJournal");
+	if (!journal.open()) {
+		return 0;
+	}
+	return journal.replay([&](JournalRecordType type, const char* payload, size_t length) {
+		applyRecord(entries, type, payload, length, true);
+	});
+}
+
+void MyFs::applyRecord(std::set<EntryInfo>& target, JournalRecordType type, const char* payload, size_t length,
+					   bool writeData) {
+	switch (type) {
+	case JournalRecordType::ENTRY_UPSERT: {
+		// only replayed, written before the image was upgraded to fixed records
 		EntryInfo entry;
-		entry.deserialize(buffer.data());
-		// Validate path length
-		if (entry.path.size() > MAX_PATH_LENGTH) {
-			throw std::runtime_error("Path exceeds maximum length.");
-		}
-		// Calculate the full entry size
-		size_t entrySize = entry.serializedSize();
-		std::vector<char> entryBuffer(entrySize);
-		// Read the full entry into the buffer
-		blkdevsim->read(offset, entrySize, entryBuffer.data());
-		// Deserialize the entry
-		entry.deserialize(entryBuffer.data());
-		// Insert entry into the set
-		entries.insert(entry);
-		// Update the offset for the next entry
-		offset += entrySize;
+		if (recordFormat == RecordFormat::NATIVE_UNCHECKED) {
+			entry.deserializeLegacy(payload);
+		} else {
+			entry.deserializeNative(payload);
+		}
+		target.erase(entry);
+		target.insert(entry);
+		break;
+	}
+	case JournalRecordType::ENTRY_RECORD: {
+		if (length < RECORD_HEADER_SIZE) {
+			throw std::runtime_error("Truncated journal record");
+		}
+		EntryInfo entry;
+		entry.deserialize(payload);
+		target.erase(entry);
+		target.insert(entry);
+		break;
+	}
+	case JournalRecordType::ENTRY_ERASE: {
+		EntryInfo entry;
+		entry.path = std::string(payload, length);
+		target.erase(entry);
+		break;
+	}
+	case JournalRecordType::DATA: {
+		// a live commit already wrote the data in place, only a replay has to
+		if (writeData) {
+			size_t address = 0;
+			memcpy(&address, payload, sizeof(address));
+			blkdevsim->write(address, length - sizeof(address), payload + sizeof(address));
+		}
+		break;
+	}
+	case JournalRecordType::FAT_SNAPSHOT:
+		// only written by 0x04 checkpoints
+		memcpy(&BLOCK_SIZE, payload, sizeof(BLOCK_SIZE));
+		deserializeFat(payload + sizeof(BLOCK_SIZE), length - sizeof(BLOCK_SIZE), target, recordFormat);
+		break;
+	default:
+		throw std::runtime_error("Unknown journal record");
 	}
 }
 
-void MyFs::format() {
-	myfs_header header{};
-	strncpy(header.magic.data(), MYFS_MAGIC, header.magic.size());
-	header.version = CURR_VERSION;
-	header.blockSize = DEFAULT_BLOCK_SIZE;
-	totalFatSize = 0;
-	blkdevsim->write(0, sizeof(header), reinterpret_cast<const char*>(&header));
-	blkdevsim->write(sizeof(header), sizeof(totalFatSize), reinterpret_cast<const char*>(&totalFatSize));
+void MyFs::recalculateFatSize() {
+	totalFatSize = std::accumulate(entries.begin(), entries.end(), static_cast<size_t>(0),
+								   [](size_t totalSize, const EntryInfo& entry) {
+									   return totalSize + entry.serializedSize();
+								   });
+}
+
+void MyFs::upgradeRecords() {
+	// images before 0x06 never had checksums, trust whatever is on disk now
+	auto withChecksums = [this](const std::set<EntryInfo>& source) {
+		std::set<EntryInfo> result;
+		std::string content;
+		for (EntryInfo entry : source) {
+			content.resize(entry.size);
+			blkdevsim->read(entry.address, entry.size, content.data());
+			entry.checksum = crc32c(content.data(), content.size());
+			result.insert(entry);
+		}
+		return result;
+	};
+	if (recordFormat == RecordFormat::NATIVE_UNCHECKED) {
+		entries = withChecksums(entries);
+	}
+	// the snapshot stays in its slot and format, a rewritten copy would need a slot besides the two the
+	// header on disk points at and the one the next checkpoint takes, so its checksums only live in memory
+	if (snapshotFormat == RecordFormat::NATIVE_UNCHECKED) {
+		snapshotEntries = withChecksums(snapshotEntries);
+	}
+	recordFormat = RecordFormat::FIXED;
+}
+
+bool MyFs::hasFileSystem() {
+	// the magic of either header slot, legacy images have theirs where slot A is, or the journal's
+	std::array<char, 4> magic{};
+	for (size_t address : {static_cast<size_t>(0), static_cast<size_t>(HEADER_SLOT_SIZE)}) {
+		blkdevsim->read(address, magic.size(), magic.data());
+		if (strncmp(magic.data(), MYFS_MAGIC, magic.size()) == 0) {
+			return true;
+		}
+	}
+	blkdevsim->read(journalAddressOf(blkdevsim), magic.size(), magic.data());
+	return strncmp(magic.data(), JOURNAL_MAGIC, magic.size()) == 0;
+}
+
+bool MyFs::mount() {
+	// headers and FAT versions are only ever read a slot at a time
+	blkdevsim->advise(0, FAT_SIZE, AccessHint::RANDOM);
+	blkdevsim->advise(fatAreaAddress(), FAT_SLOT_COUNT * FAT_SIZE, AccessHint::RANDOM);
+	try {
+		load();
+	} catch (const std::runtime_error& e) {
+		loadLegacy();
+	}
+	// the FAT slot is only as new as the last checkpoint, the journal has the rest
+	size_t replayed = replayJournal();
+	if (recordFormat != RecordFormat::FIXED || snapshotFormat != RecordFormat::FIXED) {
+		upgradeRecords();
+	}
+	recalculateFatSize();
+	return replayed > 0;
+}
 
-	size_t remainingSize = blkdevsim->DEVICE_SIZE - sizeof(header) - sizeof(totalFatSize);
-	std::vector<char> clearBuffer(remainingSize, 0); // Create a buffer filled with zeros
-	blkdevsim->write(sizeof(header) + sizeof(totalFatSize), remainingSize, clearBuffer.data());
+void MyFs::format() {
+	TIMELINE_SPAN("MyFs::format");
+	OperationLock lock(*this);
+	// release everything instead of writing zeros over it, only the header slots must read back empty
+	blkdevsim->discard(0, blkdevsim->getSize());
+	std::vector<char> clearBuffer(FAT_SIZE, 0);
+	blkdevsim->write(0, clearBuffer.size(), clearBuffer.data());
+
+	{
+		std::lock_guard<std::mutex> entriesLock(entriesMutex);
+		entries.clear();
+		totalFatSize = 0;
+		publishEntries();
+	}
+	BLOCK_SIZE = DEFAULT_BLOCK_SIZE;
+	generation = 0;
+	fatAddress = 0;
+	recordFormat = RecordFormat::FIXED;
+	snapshotAddress = 0;
+	snapshotSize = 0;
+	snapshotChecksum = 0;
+	snapshotFormat = RecordFormat::FIXED;
+	snapshotEntries.clear();
+	pinnedExtents.clear();
+	dentries.clear();
+	allocator.initialize(entries, DEFAULT_BLOCK_SIZE);
+	journal.format();
+	durableEntries.clear();
+	checkpointRanges.clear();
+	commitError = nullptr;
+	ThreadState& state = threadState();
+	state.records.clear();
+	state.dirtyRanges.clear();
+	state.journaledRanges.clear();
 
 	EntryInfo newEntry;
 	newEntry.path = "/";
@@ -126,6 +618,422 @@ void MyFs::format() {
 	newEntry.address = -1;
 	// Add the entry to the file system
 	addTableEntry(newEntry);
+	save();
+}
+
+#pragma endregion
+
+#pragma region locking
+
+MyFs::ThreadState& MyFs::threadState() {
+	return threadStates.local();
+}
+
+size_t MyFs::pathStripe(const std::string& path) const {
+	return std::hash<std::string>{}(path) % PATH_LOCK_STRIPES;
+}
+
+MyFs::OperationLock::OperationLock(MyFs& myfs_) : myfs(myfs_), nested(false), exclusive(true) {
+	ThreadState& state = myfs.threadState();
+	if (state.lockDepth > 0) {
+		nested = true;
+		state.lockDepth++;
+		return;
+	}
+	// it would wait for itself
+	if (state.transactionDepth > 0) {
+		throw std::runtime_error("Can't lock the whole file system inside a transaction");
+	}
+	// one that begins once the count was checked can't change anything before this lock is let go
+	for (;;) {
+		myfs.operationMutex.lock();
+		std::unique_lock<std::mutex> lock(myfs.transactionsMutex);
+		if (myfs.openTransactions == 0) {
+			break;
+		}
+		myfs.operationMutex.unlock();
+		myfs.transactionsDone.wait(lock, [this] { return myfs.openTransactions == 0; });
+	}
+	state.lockDepth++;
+}
+
+MyFs::OperationLock::OperationLock(MyFs& myfs_, std::initializer_list<std::pair<std::string, LockMode>> paths)
+	: myfs(myfs_), nested(false), exclusive(false) {
+	ThreadState& state = myfs.threadState();
+	nested = state.lockDepth++ > 0;
+	if (nested) {
+		return;
+	}
+
+	std::map<size_t, bool> wanted;
+	auto want = [&](const std::string& path, bool exclusiveLock) {
+		bool& held = wanted[myfs.pathStripe(path)];
+		held = held || exclusiveLock;
+	};
+	for (const std::pair<std::string, LockMode>& path : paths) {
+		want(path.first, path.second != LockMode::READ);
+		// every directory above is locked shared, so a writer holding one of them has its subtree to itself
+		std::string current = path.first;
+		bool parent = true;
+		while (!current.empty() && current != "/") {
+			current = splitPath(current).first;
+			want(current, parent && path.second == LockMode::WRITE_WITH_PARENT);
+			parent = false;
+		}
+	}
+	stripes.assign(wanted.begin(), wanted.end());
+
+	myfs.operationMutex.lock_shared();
+	for (const std::pair<size_t, bool>& stripe : stripes) {
+		if (stripe.second) {
+			myfs.pathLocks[stripe.first].lock();
+		} else {
+			myfs.pathLocks[stripe.first].lock_shared();
+		}
+	}
+}
+
+MyFs::OperationLock::~OperationLock() {
+	myfs.threadState().lockDepth--;
+	if (nested) {
+		return;
+	}
+	if (exclusive) {
+		myfs.operationMutex.unlock();
+		return;
+	}
+	for (auto it = stripes.rbegin(); it != stripes.rend(); ++it) {
+		if (it->second) {
+			myfs.pathLocks[it->first].unlock();
+		} else {
+			myfs.pathLocks[it->first].unlock_shared();
+		}
+	}
+	myfs.operationMutex.unlock_shared();
+}
+
+#pragma endregion
+
+#pragma region journaling
+
+MyFs::Transaction::Transaction(MyFs& myfs_) : myfs(myfs_), uncaughtExceptions(std::uncaught_exceptions()) {
+	myfs.beginTransaction();
+}
+
+MyFs::Transaction::~Transaction() noexcept(false) {
+	if (std::uncaught_exceptions() > uncaughtExceptions) {
+		// already unwinding, commit what was done but don't throw over the original error
+		try {
+			myfs.commitTransaction();
+		} catch (const std::exception& e) {
+		}
+		return;
+	}
+	myfs.commitTransaction();
+}
+
+void MyFs::beginTransaction() {
+	TraceScope trace(activeTracer(), TraceOp::BEGIN_TRANSACTION, "");
+	ThreadState& state = threadState();
+	if (state.transactionDepth++ == 0) {
+		std::lock_guard<std::mutex> lock(transactionsMutex);
+		openTransactions++;
+	}
+}
+
+void MyFs::commitTransaction() {
+	TraceScope trace(activeTracer(), TraceOp::COMMIT_TRANSACTION, "");
+	ThreadState& state = threadState();
+	if (state.transactionDepth == 0) {
+		throw std::runtime_error("No transaction to commit");
+	}
+	// keeps checkpoints out while this thread flushes, a no-op inside an operation
+	OperationLock lock(*this, {});
+	if (--state.transactionDepth > 0) {
+		return;
+	}
+	// a checkpoint may go once this is flushed, or failed to
+	auto close = [this] {
+		std::lock_guard<std::mutex> transactionsLock(transactionsMutex);
+		if (--openTransactions == 0) {
+			transactionsDone.notify_all();
+		}
+	};
+	try {
+		commit();
+	} catch (...) {
+		close();
+		throw;
+	}
+	close();
+}
+
+bool MyFs::inTransaction() {
+	return threadState().transactionDepth > 0;
+}
+
+void MyFs::setDataJournaling(bool enabled) {
+	journalData = enabled;
+}
+
+void MyFs::setCommitMode(CommitMode mode) {
+	commitMode = mode;
+}
+
+void MyFs::commit() {
+	TIMELINE_SPAN("MyFs::commit");
+	ThreadState& state = threadState();
+	if (state.transactionDepth > 0 || state.records.empty()) {
+		return;
+	}
+	// ordered mode, the data lands before the metadata pointing at it
+	syncDirtyData(state);
+
+	std::unique_lock<std::mutex> lock(commitMutex);
+	if (commitError) {
+		std::rethrow_exception(commitError);
+	}
+	commitQueue.append(state.records);
+	queuedJournaledRanges.insert(queuedJournaledRanges.end(), state.journaledRanges.begin(),
+								 state.journaledRanges.end());
+	state.records.clear();
+	state.journaledRanges.clear();
+	uint64_t ticket = ++queuedTicket;
+
+	// the first thread to find no flush running writes everything queued so far, the others wait for it
+	while (durableTicket < ticket) {
+		if (commitError) {
+			std::rethrow_exception(commitError);
+		}
+		if (flushing) {
+			commitDone.wait(lock);
+			continue;
+		}
+		flushing = true;
+		JournalRecords batch;
+		std::swap(batch, commitQueue);
+		checkpointRanges.insert(checkpointRanges.end(), queuedJournaledRanges.begin(), queuedJournaledRanges.end());
+		queuedJournaledRanges.clear();
+		uint64_t batchTicket = queuedTicket;
+		lock.unlock();
+
+		try {
+			flush(batch);
+		} catch (...) {
+			lock.lock();
+			commitError = std::current_exception();
+			flushing = false;
+			commitDone.notify_all();
+			throw;
+		}
+
+		lock.lock();
+		durableTicket = batchTicket;
+		flushing = false;
+		commitDone.notify_all();
+	}
+}
+
+void MyFs::flush(const JournalRecords& batch) {
+	TIMELINE_SPAN("MyFs::flush");
+	batch.forEach([this](JournalRecordType type, const char* payload, size_t length) {
+		applyRecord(durableEntries, type, payload, length, false);
+	});
+	if (commitMode == CommitMode::SHADOW || !journal.fits(batch.size())) {
+		// a whole new FAT version, the batch is part of it
+		checkpoint(durableEntries);
+	} else {
+		journal.commit(batch);
+	}
+	// the frees are durable now, nothing on disk points at the released ranges anymore
+	discardReleased(false);
+}
+
+void MyFs::writeData(size_t address, size_t size, const char* data) {
+	ThreadState& state = threadState();
+	if (journalData && commitMode == CommitMode::JOURNAL && size <= JOURNAL_DATA_THRESHOLD) {
+		state.records.logData(address, data, size);
+		state.journaledRanges.emplace_back(address, size);
+	} else {
+		state.dirtyRanges.emplace_back(address, size);
+	}
+	blkdevsim->write(address, size, data);
+}
+
+void MyFs::syncDirtyData(ThreadState& state) {
+	TIMELINE_SPAN("MyFs::syncDirtyData");
+	for (const std::pair<size_t, size_t>& range : state.dirtyRanges) {
+		blkdevsim->sync(range.first, range.second);
+	}
+	state.dirtyRanges.clear();
+}
+
+#pragma endregion
+
+#pragma region discard
+
+size_t MyFs::discardReleased(bool force) {
+	if (!force && allocator.releasedBytes() < DISCARD_BATCH_SIZE) {
+		return 0;
+	}
+	size_t discarded = 0;
+	allocator.takeReleased(DISCARD_MIN_SIZE, [this, &discarded](size_t address, size_t size) {
+		// free in memory isn't enough, a transaction that freed it may not have committed yet
+		std::vector<std::pair<size_t, size_t>> live;
+		for (const EntryInfo& entry : durableEntries) {
+			size_t extent = std::max<size_t>((entry.size + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE, BLOCK_SIZE);
+			if (entry.address < address + size && entry.address + extent > address) {
+				live.emplace_back(entry.address, entry.address + extent);
+			}
+		}
+		std::sort(live.begin(), live.end());
+
+		size_t current = address;
+		for (const std::pair<size_t, size_t>& extent : live) {
+			if (extent.first > current) {
+				blkdevsim->discard(current, extent.first - current);
+				discarded += extent.first - current;
+			}
+			current = std::max(current, extent.second);
+		}
+		if (current < address + size) {
+			blkdevsim->discard(current, address + size - current);
+			discarded += address + size - current;
+		}
+	});
+	return discarded;
+}
+
+size_t MyFs::shrink() {
+	TIMELINE_SPAN("MyFs::shrink");
+	TraceScope trace(activeTracer(), TraceOp::SHRINK, "");
+	OperationLock lock(*this);
+	// moving data around would pull it from under the snapshot
+	if (hasSnapshot()) {
+		throw std::runtime_error("Can't shrink while a snapshot exists");
+	}
+	relocateData();
+	allocator.releaseAllFree();
+	save();
+	return discardReleased(true);
+}
+
+std::map<size_t, size_t> MyFs::freeSpace() const {
+	return allocator.freeRanges();
+}
+
+#pragma endregion
+
+#pragma region snapshots
+
+void MyFs::initializeAllocator() {
+	allocator.initialize(entries, BLOCK_SIZE);
+
+	pinnedExtents.clear();
+	for (const EntryInfo& entry : snapshotEntries) {
+		pinnedExtents.emplace(entry.address, entry.size);
+		allocator.reserve(entry.address, entry.size);
+	}
+}
+
+bool MyFs::isPinned(const EntryInfo& entry) const {
+	return pinnedExtents.find(entry.address) != pinnedExtents.end();
+}
+
+void MyFs::createSnapshot() {
+	TraceScope trace(activeTracer(), TraceOp::CREATE_SNAPSHOT, "");
+	OperationLock lock(*this);
+	if (hasSnapshot()) {
+		throw std::runtime_error("A snapshot already exists");
+	}
+	// the FAT version written now becomes the snapshot, the next save moves on to another slot
+	save();
+	std::vector<char> buffer = serializeFat(entries);
+	snapshotAddress = fatAddress;
+	snapshotSize = buffer.size();
+	snapshotChecksum = crc32c(buffer.data(), buffer.size());
+	snapshotFormat = RecordFormat::FIXED;
+	snapshotEntries = entries;
+	initializeAllocator();
+	save();
+}
+
+void MyFs::dropSnapshot() {
+	TraceScope trace(activeTracer(), TraceOp::DROP_SNAPSHOT, "");
+	OperationLock lock(*this);
+	if (!hasSnapshot()) {
+		throw std::runtime_error("No snapshot to drop");
+	}
+	snapshotAddress = 0;
+	snapshotSize = 0;
+	snapshotChecksum = 0;
+	snapshotFormat = RecordFormat::FIXED;
+	snapshotEntries.clear();
+	// extents only the snapshot held become free again
+	initializeAllocator();
+	allocator.releaseAllFree();
+	save();
+	discardReleased(false);
+}
+
+bool MyFs::hasSnapshot() const {
+	return snapshotAddress != 0;
+}
+
+std::vector<EntryInfo> MyFs::listSnapshot() {
+	OperationLock lock(*this, {});
+	return {snapshotEntries.begin(), snapshotEntries.end()};
+}
+
+std::string MyFs::getSnapshotContent(const std::string& filepath) {
+	OperationLock lock(*this, {});
+	EntryInfo key;
+	key.path = filepath;
+	auto it = snapshotEntries.find(key);
+	if (it == snapshotEntries.end()) {
+		throw std::runtime_error("File not found in snapshot: " + filepath);
+	}
+	return getContent(*it);
+}
+
+#pragma endregion
+
+#pragma region integrity
+
+std::vector<std::string> MyFs::scrub(std::string& cursor, size_t maxBytes) {
+	std::vector<std::string> corrupted;
+	size_t bytesRead = 0;
+	std::string content;
+	for (;;) {
+		// one entry at a time, writers only wait for the entry being checked
+		std::string path;
+		{
+			EntryView view = listTree();
+			EntryInfo key;
+			key.path = cursor;
+			auto it = cursor.empty() ? view.begin() : view.table->upper_bound(key);
+			if (it == view.end()) {
+				cursor.clear();
+				return corrupted;
+			}
+			path = it->path;
+		}
+		if (bytesRead >= maxBytes) {
+			return corrupted;
+		}
+
+		OperationLock lock(*this, {{path, LockMode::READ}});
+		std::optional<EntryInfo> entry = getEntryInfo(path);
+		if (entry) {
+			content.resize(entry->size);
+			blkdevsim->read(entry->address, entry->size, content.data());
+			if (crc32c(content.data(), content.size()) != entry->checksum) {
+				corrupted.push_back(path);
+			}
+			bytesRead += entry->size;
+		}
+		cursor = path;
+	}
 }
 
 #pragma endregion
@@ -133,92 +1041,380 @@ void MyFs::format() {
 #pragma region entryManagment
 
 void MyFs::setContent(const std::string& filepath, const std::string& content) {
+	TraceScope trace(activeTracer(), TraceOp::SET_CONTENT, filepath, content.size());
+	OperationLock lock(*this, {{filepath, LockMode::WRITE}});
 	std::optional<EntryInfo> entryOpt = getEntryInfo(filepath);
 	if (!entryOpt) {
 		throw std::runtime_error("File not found: " + filepath);
 	}
 
-	EntryInfo entry = *entryOpt;
-	size_t newSize = content.size();
+	setContent(*entryOpt, content);
+}
 
-	reallocateTableEntry(entry, newSize);
-	blkdevsim->write(entry.address, newSize, content.data());
+void MyFs::setContent(EntryInfo entry, const std::string& content) {
+	TraceScope trace(activeTracer(), TraceOp::SET_CONTENT, entry.path, content.size());
+	setContent(std::move(entry), content.data(), content.size());
+}
 
-	save();
+void MyFs::setContent(EntryInfo entry, const char* data, size_t size) {
+	TIMELINE_SPAN("MyFs::setContent");
+	TraceScope trace(activeTracer(), TraceOp::SET_CONTENT, entry.path, size);
+	writeContent(std::move(entry), data, size, FILE_TYPE);
 }
 
-void MyFs::setContent(EntryInfo entry, const std::string& content) {
-	size_t newSize = content.size();
+void MyFs::writeContent(EntryInfo entry, const char* data, size_t size, EntryTypes type) {
+	OperationLock lock(*this, {{entry.path, LockMode::WRITE}});
+	// whatever the caller looked up may be stale by the time the lock is held
+	std::optional<EntryInfo> current = getEntryInfo(entry.path);
+	if (!current) {
+		throw std::runtime_error("File not found: " + entry.path);
+	}
+	// content written over a listing would orphan everything in the directory
+	if (current->type != type) {
+		throw std::runtime_error((type == FILE_TYPE ? "Not a file: " : "Not a directory: ") + entry.path);
+	}
+	entry = *current;
+	Transaction transaction(*this);
+	entry.checksum = crc32c(data, size);
 
-	reallocateTableEntry(entry, newSize);
-	blkdevsim->write(entry.address, newSize, content.data());
+	reallocateTableEntry(entry, size);
+	writeData(entry.address, size, data);
 
-	save();
+	// only file content counts, directories are metadata like the FAT
+	IoStats* stats = blkdevsim->getStats();
+	if (stats != nullptr && entry.type == FILE_TYPE) {
+		stats->recordLogicalWrite(size);
+	}
 }
 
-std::string MyFs::getContent(const EntryInfo& entry) {
-	std::string content(entry.size, '\0');
+void MyFs::importFile(int fd, size_t size, const std::string& filepath) {
+	TraceScope trace(activeTracer(), TraceOp::IMPORT_FILE, filepath, size);
+	OperationLock lock(*this, {{filepath, LockMode::WRITE_WITH_PARENT}});
+	Transaction transaction(*this);
+	std::optional<EntryInfo> entryOpt = getEntryInfo(filepath);
+	EntryInfo entry = entryOpt ? *entryOpt : createFile(filepath);
+	if (entry.type != FILE_TYPE) {
+		throw std::runtime_error("Not a file: " + filepath);
+	}
+
+	if (size == 0) {
+		entry.checksum = 0;
+		reallocateTableEntry(entry, 0);
+		return;
+	}
+	// a fresh extent, the data goes straight into it and the old content stays until it's complete
+	EntryInfo fresh = entry;
+	fresh.address = allocator.allocate(size);
+	fresh.size = size;
+	try {
+		fresh.checksum = blkdevsim->fillFrom(fd, fresh.address, size);
+	} catch (...) {
+		allocator.deallocate(fresh);
+		throw;
+	}
+	threadState().dirtyRanges.emplace_back(fresh.address, size);
+	{
+		std::lock_guard<std::mutex> entriesLock(entriesMutex);
+		// a snapshot keeps the old extent
+		if (entry.size != 0 && !isPinned(entry)) {
+			allocator.deallocate(entry);
+		}
+		entries.erase(entry);
+		entry = fresh;
+		entries.insert(entry);
+		publishEntries();
+	}
+	threadState().records.logUpsert(entry);
+	commit();
+
+	IoStats* stats = blkdevsim->getStats();
+	if (stats != nullptr) {
+		stats->recordLogicalWrite(size);
+	}
+}
+
+// the whole range or an exception, a host file that got shorter since it was looked at is an error
+static void readHostRange(int fd, size_t offset, size_t length, char* buffer) {
+	for (size_t done = 0; done < length;) {
+		ssize_t result = pread(fd, buffer + done, length - done, offset + done);
+		if (result == 0) {
+			throw std::runtime_error("File ended before its size");
+		}
+		if (result < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			throw std::system_error(errno, std::generic_category(), "Failed to read file");
+		}
+		done += result;
+	}
+}
+
+size_t MyFs::updateFile(int fd, size_t size, const std::string& filepath) {
+	TraceScope trace(activeTracer(), TraceOp::UPDATE_FILE, filepath, size);
+	OperationLock lock(*this, {{filepath, LockMode::WRITE_WITH_PARENT}});
+	std::optional<EntryInfo> entryOpt = getEntryInfo(filepath);
+	if (!entryOpt) {
+		importFile(fd, size, filepath);
+		return size;
+	}
+	if (entryOpt->type != FILE_TYPE) {
+		throw std::runtime_error("Not a file: " + filepath);
+	}
+	EntryInfo entry = *entryOpt;
+	std::vector<char> hostBlock(std::min<size_t>(size, SYNC_BLOCK_SIZE));
+
+	// the host side alone first, an unchanged file never reads its extent
+	if (entry.size == size) {
+		uint32_t checksum = 0;
+		for (size_t offset = 0; offset < size; offset += hostBlock.size()) {
+			size_t length = std::min(hostBlock.size(), size - offset);
+			readHostRange(fd, offset, length, hostBlock.data());
+			checksum = crc32c(hostBlock.data(), length, checksum);
+		}
+		if (checksum == entry.checksum) {
+			return 0;
+		}
+	}
+
+	Transaction transaction(*this);
+	size_t oldAddress = entry.address;
+	size_t oldSize = entry.size;
+	reallocateTableEntry(entry, size);
+	// a moved extent, or the copy on write of a snapshot's, has none of the old content to keep
+	size_t comparable = entry.address == oldAddress ? std::min(oldSize, size) : 0;
+	std::vector<char> deviceBlock(std::min(hostBlock.size(), comparable));
+	uint32_t checksum = 0;
+	size_t written = 0;
+	try {
+		for (size_t offset = 0; offset < size; offset += hostBlock.size()) {
+			size_t length = std::min(hostBlock.size(), size - offset);
+			readHostRange(fd, offset, length, hostBlock.data());
+			checksum = crc32c(hostBlock.data(), length, checksum);
+			if (offset + length <= comparable) {
+				blkdevsim->read(entry.address + offset, length, deviceBlock.data());
+				if (memcmp(hostBlock.data(), deviceBlock.data(), length) == 0) {
+					continue;
+				}
+			}
+			writeData(entry.address + offset, length, hostBlock.data());
+			written += length;
+		}
+	} catch (...) {
+		// same as a failed import, part of the blocks may be new already
+		entry.checksum = 0;
+		reallocateTableEntry(entry, 0);
+		throw;
+	}
+	entry.checksum = checksum;
+	reallocateTableEntry(entry, size);
+
+	IoStats* stats = blkdevsim->getStats();
+	if (stats != nullptr) {
+		stats->recordLogicalWrite(written);
+	}
+	return written;
+}
+
+void MyFs::exportFile(const std::string& filepath, int fd, const std::function<void(const EntryInfo&)>& before) {
+	TraceScope trace(activeTracer(), TraceOp::EXPORT_FILE, filepath);
+	// held the whole way, what already went out can't be taken back if a writer got in between
+	OperationLock lock(*this, {{filepath, LockMode::READ}});
+	std::optional<EntryInfo> entryOpt = getEntryInfo(filepath);
+	if (!entryOpt) {
+		throw std::runtime_error("File not found: " + filepath);
+	}
+	trace.setSize(entryOpt->size);
+	if (entryOpt->type != FILE_TYPE) {
+		throw std::runtime_error("Not a file: " + filepath);
+	}
+	if (before) {
+		before(*entryOpt);
+	}
+	if (entryOpt->size >= READAHEAD_MIN_SIZE) {
+		blkdevsim->advise(entryOpt->address, entryOpt->size, AccessHint::SEQUENTIAL);
+	}
+	if (blkdevsim->copyTo(fd, entryOpt->address, entryOpt->size) != entryOpt->checksum) {
+		throw std::runtime_error("Checksum mismatch: " + filepath);
+	}
+}
+
+bool MyFs::readContent(const EntryInfo& entry, std::string& content) {
+	TIMELINE_SPAN("MyFs::readContent");
+	if (entry.size >= READAHEAD_MIN_SIZE) {
+		blkdevsim->advise(entry.address, entry.size, AccessHint::WILLNEED);
+	}
+	content.resize(entry.size);
 	blkdevsim->read(entry.address, entry.size, content.data());
+	return crc32c(content.data(), content.size()) == entry.checksum;
+}
+
+std::string MyFs::getContent(const EntryInfo& entry) {
+	TraceScope trace(activeTracer(), TraceOp::GET_CONTENT, entry.path, entry.size);
+	// optimistic, the checksum tells whether a writer got in the way
+	std::string content;
+	if (readContent(entry, content)) {
+		return content;
+	}
+	OperationLock lock(*this, {{entry.path, LockMode::READ}});
+	if (!readContent(entry, content)) {
+		throw std::runtime_error("Checksum mismatch: " + entry.path);
+	}
 	return content;
 }
 
+size_t MyFs::getContent(const std::string& filepath, char* buffer, size_t bufferSize) {
+	TraceScope trace(activeTracer(), TraceOp::GET_CONTENT, filepath);
+	// optimistic like the others, the lock only if a writer got in the way
+	std::optional<EntryInfo> entryOpt = getEntryInfo(filepath);
+	if (!entryOpt) {
+		throw std::runtime_error("File not found: " + filepath);
+	}
+	trace.setSize(entryOpt->size);
+	if (entryOpt->size > bufferSize) {
+		return entryOpt->size;
+	}
+	blkdevsim->read(entryOpt->address, entryOpt->size, buffer);
+	if (crc32c(buffer, entryOpt->size) == entryOpt->checksum) {
+		return entryOpt->size;
+	}
+	OperationLock lock(*this, {{filepath, LockMode::READ}});
+	entryOpt = getEntryInfo(filepath);
+	if (!entryOpt) {
+		throw std::runtime_error("File not found: " + filepath);
+	}
+	if (entryOpt->size > bufferSize) {
+		return entryOpt->size;
+	}
+	blkdevsim->read(entryOpt->address, entryOpt->size, buffer);
+	if (crc32c(buffer, entryOpt->size) != entryOpt->checksum) {
+		throw std::runtime_error("Checksum mismatch: " + filepath);
+	}
+	return entryOpt->size;
+}
+
+void MyFs::viewContent(const std::string& filepath, const std::function<void(const char*, size_t)>& reader) {
+	TraceScope trace(activeTracer(), TraceOp::VIEW_CONTENT, filepath);
+	OperationLock lock(*this, {{filepath, LockMode::READ}});
+	std::optional<EntryInfo> entryOpt = getEntryInfo(filepath);
+	if (!entryOpt) {
+		throw std::runtime_error("File not found: " + filepath);
+	}
+	trace.setSize(entryOpt->size);
+	// an empty file may have no extent at all
+	const char* data = entryOpt->size == 0 ? "" : blkdevsim->view(entryOpt->address, entryOpt->size);
+	std::string copy;
+	if (data == nullptr) {
+		copy.resize(entryOpt->size);
+		blkdevsim->read(entryOpt->address, entryOpt->size, copy.data());
+		data = copy.data();
+	}
+	if (crc32c(data, entryOpt->size) != entryOpt->checksum) {
+		throw std::runtime_error("Checksum mismatch: " + filepath);
+	}
+	reader(data, entryOpt->size);
+}
+
 std::string MyFs::getContent(const std::string& filepath) {
+	TraceScope trace(activeTracer(), TraceOp::GET_CONTENT, filepath);
 	std::optional<EntryInfo> entryOpt = getEntryInfo(filepath);
 	if (!entryOpt) {
 		throw std::runtime_error("File not found");
 	}
+	trace.setSize(entryOpt->size);
+	std::string content;
+	if (readContent(*entryOpt, content)) {
+		return content;
+	}
 
-	const EntryInfo entry = *entryOpt;
-	std::string content(entry.size, '\0');
-	blkdevsim->read(entry.address, entry.size, content.data());
-	return content;
+	// raced with a writer reusing the extent, wait for it and look again
+	OperationLock lock(*this, {{filepath, LockMode::READ}});
+	entryOpt = getEntryInfo(filepath);
+	if (!entryOpt) {
+		throw std::runtime_error("File not found");
+	}
+	return getContent(*entryOpt);
 }
 
-std::optional<EntryInfo> MyFs::getEntryInfo(const std::string& fileName) {
-	auto it =
-		std::find_if(entries.begin(), entries.end(), [&](const EntryInfo& entry) { return entry.path == fileName; });
+void MyFs::publishEntries() {
+	// a whole copy per change, the FAT caps the table at a few hundred entries so that's cheap
+	const std::set<EntryInfo>* previous = publishedEntries.exchange(new std::set<EntryInfo>(entries));
+	entryEpochs.retire([previous] { delete previous; });
+}
 
-	if (it != entries.end()) {
+std::optional<EntryInfo> MyFs::getEntryInfo(const std::string& fileName) {
+	TraceScope trace(activeTracer(), TraceOp::GET_ENTRY_INFO, fileName);
+	EpochManager::Guard guard = entryEpochs.pin();
+	const std::set<EntryInfo>* table = publishedEntries.load();
+	EntryInfo key;
+	key.path = fileName;
+	auto it = table->find(key);
+	if (it != table->end()) {
 		return *it;
 	}
 	return std::nullopt;
 }
 
 void MyFs::addTableEntry(EntryInfo& entryToAdd) {
-	// Insert the entry into the set
-	if (totalFatSize >= FAT_SIZE - 1) {
-		entries.erase(entryToAdd);
-		throw std::overflow_error("FAT table full");
+	{
+		std::lock_guard<std::mutex> entriesLock(entriesMutex);
+		if (totalFatSize + entryToAdd.serializedSize() > FAT_SIZE - BLOCK_SIZE) {
+			throw std::overflow_error("FAT table full");
+		}
+		entryToAdd.address = allocator.allocate(entryToAdd.size);
+		assert(entryToAdd.address >= FAT_SIZE && entryToAdd.address < fatAreaAddress());
+		totalFatSize += entryToAdd.serializedSize();
+		entries.insert(entryToAdd);
+		publishEntries();
 	}
-	totalFatSize += entryToAdd.serializedSize();
-
-	entryToAdd.address = allocator.allocate(entryToAdd.size);
-	assert(entryToAdd.address >= FAT_SIZE && entryToAdd.address < blkdevsim->DEVICE_SIZE);
-	entries.insert(entryToAdd);
-	save();
+	threadState().records.logUpsert(entryToAdd);
+	commit();
 }
 
 void MyFs::removeTableEntry(EntryInfo& entryToRemove) {
-	totalFatSize -= entryToRemove.serializedSize();
-	assert(totalFatSize >= 1);
-
-	allocator.deallocate(entryToRemove);
-	entries.erase(entryToRemove);
+	{
+		std::lock_guard<std::mutex> entriesLock(entriesMutex);
+		totalFatSize -= entryToRemove.serializedSize();
+		assert(totalFatSize >= 1);
+
+		// the snapshot still reads a pinned extent, it's released when the snapshot is dropped
+		if (!isPinned(entryToRemove)) {
+			allocator.deallocate(entryToRemove);
+		}
+		entries.erase(entryToRemove);
+		publishEntries();
+	}
+	dentries.invalidate(entryToRemove.path);
+	threadState().records.logErase(entryToRemove.path);
 
-	save();
+	commit();
 }
 
 void MyFs::reallocateTableEntry(EntryInfo& entryToUpdate, size_t newSize) {
-	entries.erase(entryToUpdate);
-	allocator.reallocate(entryToUpdate, newSize);
-	//assert(entryToUpdate.address + entryToUpdate.size == allocator.nextAvailableAddress);
+	{
+		std::lock_guard<std::mutex> entriesLock(entriesMutex);
+		// a full device throws here, the table keeps the entry as it was
+		EntryInfo updated = entryToUpdate;
+		if (isPinned(updated)) {
+			// copy on write, the snapshot keeps the old extent
+			updated.address = allocator.allocate(newSize);
+			updated.size = newSize;
+		} else {
+			allocator.reallocate(updated, newSize);
+		}
+		//assert(entryToUpdate.address + entryToUpdate.size == allocator.nextAvailableAddress);
 
-	assert(entryToUpdate.address >= FAT_SIZE && entryToUpdate.address < blkdevsim->DEVICE_SIZE);
-	assert(entryToUpdate.size == newSize);
+		assert(updated.address >= FAT_SIZE && updated.address < fatAreaAddress());
+		assert(updated.size == newSize);
 
-	entries.insert(entryToUpdate);
+		entries.erase(entryToUpdate);
+		entryToUpdate = updated;
+		entries.insert(entryToUpdate);
+		publishEntries();
+	}
+	threadState().records.logUpsert(entryToUpdate);
 
-	save();
+	commit();
 }
 
 #pragma endregion
@@ -226,13 +1422,17 @@ void MyFs::reallocateTableEntry(EntryInfo& entryToUpdate, size_t newSize) {
 #pragma region fileIO
 
 bool MyFs::isFileExists(const std::string& filepath) {
+	TraceScope trace(activeTracer(), TraceOp::GET_ENTRY_INFO, filepath);
 	return getEntryInfo(filepath).has_value();
 }
 
 EntryInfo MyFs::createFile(const std::string& filepath) {
+	TIMELINE_SPAN("MyFs::createFile");
+	TraceScope trace(activeTracer(), TraceOp::CREATE_FILE, filepath);
 	if (filepath.empty()) {
 		throw std::runtime_error("invalid file path:" + filepath);
 	}
+	OperationLock lock(*this, {{filepath, LockMode::WRITE_WITH_PARENT}});
 	if (isFileExists(filepath)) {
 		throw std::runtime_error("File already exists");
 	}
@@ -245,8 +1445,8 @@ EntryInfo MyFs::createFile(const std::string& filepath) {
 
 	std::pair<std::string, std::string> pathAndName = splitPath(filepath);
 	// Add the entry to the file system
-	addFileToDirectory(pathAndName.first, pathAndName.second);
-	addTableEntry(newEntry);
+	Transaction transaction(*this);
+	addNewEntry(newEntry, pathAndName);
 	return newEntry;
 }
 
@@ -254,6 +1454,9 @@ EntryInfo MyFs::createFile(const std::string& filepath) {
 #pragma region directoryIO
 
 EntryInfo MyFs::createDirectory(const std::string& filepath) {
+	TIMELINE_SPAN("MyFs::createDirectory");
+	TraceScope trace(activeTracer(), TraceOp::CREATE_DIRECTORY, filepath);
+	OperationLock lock(*this, {{filepath, LockMode::WRITE_WITH_PARENT}});
 	if (isFileExists(filepath)) {
 		throw std::runtime_error("Directory already exists");
 	}
@@ -266,43 +1469,64 @@ EntryInfo MyFs::createDirectory(const std::string& filepath) {
 	newEntry.address = -1;
 
 	std::pair<std::string, std::string> pathAndName = splitPath(filepath);
-	addFileToDirectory(pathAndName.first, pathAndName.second);
-
+	Transaction transaction(*this);
 	// Add the entry to the file system
-	addTableEntry(newEntry);
-
-	save();
+	addNewEntry(newEntry, pathAndName);
 	return newEntry;
 }
 
-std::vector<std::string> MyFs::readDirectoryEntries(const EntryInfo& directoryEntry) {
+void MyFs::addNewEntry(EntryInfo& newEntry, const std::pair<std::string, std::string>& pathAndName) {
+	// the table entry first, a full FAT then leaves the listing alone
+	addTableEntry(newEntry);
+	try {
+		addFileToDirectory(pathAndName.first, pathAndName.second);
+	} catch (const std::exception&) {
+		removeTableEntry(newEntry);
+		throw;
+	}
+}
+
+// what readDirectoryEntries makes of a listing, trimming may have changed a name from what was written
+static std::vector<std::string> parseListing(const std::string& content) {
 	std::vector<std::string> directoryEntries;
+	// Assuming entries are separated by new lines or some delimiter
+	std::istringstream stream(content);
+	std::string entry;
+	while (std::getline(stream, entry)) {
+		directoryEntries.push_back(entry);
+	}
+	return directoryEntries;
+}
 
+std::vector<std::string> MyFs::readDirectoryEntries(const EntryInfo& directoryEntry) {
+	TIMELINE_SPAN("MyFs::readDirectoryEntries");
 	// Ensure the directoryEntry type is correct (e.g., directory type)
 	if (directoryEntry.type != DIRECTORY_TYPE) {
 		throw std::runtime_error("Invalid entry type for directory");
 	}
 
+	std::optional<EntryInfo> current = getEntryInfo(directoryEntry.path);
+	if (current) {
+		std::optional<std::vector<std::string>> cached = dentries.find(*current);
+		if (cached) {
+			return std::move(*cached);
+		}
+	}
+
 	// Read the directory content from the file system
 	std::string content = getContent(directoryEntry.path);
+	std::vector<std::string> directoryEntries = parseListing(content);
 
-	// Assuming entries are separated by new lines or some delimiter
-	std::istringstream stream(content);
-	std::string entry;
-	while (std::getline(stream, entry)) {
-		directoryEntries.push_back(entry);
-	}
-
+	// keyed by what was actually read, a writer may have gotten in between the lookup and the read
+	dentries.insert(directoryEntry.path, content.size(), crc32c(content.data(), content.size()), directoryEntries);
 	return directoryEntries;
 }
 
 void MyFs::writeDirectoryEntries(const EntryInfo& directoryEntry, const std::vector<std::string>& directoryEntries) {
+	TIMELINE_SPAN("MyFs::writeDirectoryEntries");
 	if (directoryEntries.size() > MAX_DIRECTORY_SIZE) {
 		throw std::runtime_error("maxium amount of files in a directory exceeded");
 	}
-	if (directoryEntries.empty()) {
-		setContent(directoryEntry, "");
-	}
 	// Convert directory entries to a single string with appropriate delimiter
 	std::ostringstream oss;
 	for (const std::string& entryName : directoryEntries) {
@@ -314,7 +1538,9 @@ void MyFs::writeDirectoryEntries(const EntryInfo& directoryEntry, const std::vec
 	// Erase characters from the end to the found position
 	content.erase(end, content.end());
 	// Write the content to the file system
-	setContent(directoryEntry, content);
+	writeContent(directoryEntry, content.data(), content.size(), DIRECTORY_TYPE);
+	// the next read of this listing doesn't have to read it back
+	dentries.insert(directoryEntry.path, content.size(), crc32c(content.data(), content.size()), parseListing(content));
 }
 
 void MyFs::addFileToDirectory(const std::string& directoryPath, const std::string& filename) {
@@ -372,6 +1598,8 @@ void MyFs::removeFileFromDirectory(const std::string& directoryPath, const std::
 #pragma region generalUtils
 
 std::vector<EntryInfo> MyFs::listDir(const std::string& currentDir) {
+	TIMELINE_SPAN("MyFs::listDir");
+	TraceScope trace(activeTracer(), TraceOp::LIST_DIR, currentDir);
 	if (currentDir.empty()) {
 		return {}; // List root directory if no path is provided
 	}
@@ -394,49 +1622,45 @@ std::vector<EntryInfo> MyFs::listDir(const std::string& currentDir) {
 	return result;
 }
 
-std::vector<EntryInfo> MyFs::listTree() {
-	std::vector<EntryInfo> result;
-	result.reserve(entries.size());
-	for (const EntryInfo& entry : entries) {
-		result.push_back(entry);
-	}
-	return result;
+MyFs::EntryView MyFs::listTree() {
+	TraceScope trace(activeTracer(), TraceOp::LIST_TREE, "/");
+	EpochManager::Guard guard = entryEpochs.pin();
+	return EntryView(std::move(guard), publishedEntries.load());
 }
 
 void MyFs::remove(const std::string& filepath) {
+	TIMELINE_SPAN("MyFs::remove");
+	TraceScope trace(activeTracer(), TraceOp::REMOVE, filepath);
+	OperationLock lock(*this, {{filepath, LockMode::WRITE_WITH_PARENT}});
 	std::optional<EntryInfo> entryOpt = getEntryInfo(filepath);
 	if (!entryOpt) {
 		throw std::runtime_error("Invalid file: " + filepath);
 	}
-	EntryInfo entry = *entryOpt;
 
 	std::pair<std::string, std::string> pathAndName = splitPath(filepath);
-
-	if (entry.type == FILE_TYPE) {
-		removeTableEntry(entry);
-
-	} else if (entry.type == DIRECTORY_TYPE) {
-		std::vector<std::string> directoryEntries = readDirectoryEntries(entry);
-		for (const std::string& filename : directoryEntries) {
-			try {
-				remove(addCurrentDir(filename, filepath));
-			} catch (std::runtime_error& e) {
-				// incase
-			}
-		}
-		if (filepath != "/") [[unlikely]] {
-			removeTableEntry(entry);
-		}
+	Transaction transaction(*this);
+
+	// the whole subtree goes in one table update, nothing below has to be read
+	std::vector<EntryInfo> subtree = collectSubtree(filepath);
+	if (filepath == "/") [[unlikely]] {
+		// the root stays, it's only emptied
+		subtree.erase(subtree.begin());
+		removeTableEntries(subtree);
+		writeDirectoryEntries(*entryOpt, {});
+		return;
 	}
+	removeTableEntries(subtree);
 	removeFileFromDirectory(pathAndName.first, pathAndName.second);
 }
 
 void MyFs::move(const std::string& srcfilepath, const std::string& dstfilepath) {
+	TIMELINE_SPAN("MyFs::move");
+	TraceScope trace(activeTracer(), TraceOp::MOVE, srcfilepath, 0, dstfilepath);
+	OperationLock lock(*this, {{srcfilepath, LockMode::WRITE_WITH_PARENT}, {dstfilepath, LockMode::WRITE_WITH_PARENT}});
 	std::optional<EntryInfo> entryOpt = getEntryInfo(srcfilepath);
 	if (!entryOpt) {
 		throw std::runtime_error("Invalid file: " + srcfilepath);
 	}
-	EntryInfo entry = *entryOpt;
 	if (isFileExists(dstfilepath)) {
 		throw std::runtime_error("file " + dstfilepath + " already exists");
 	}
@@ -448,32 +1672,40 @@ void MyFs::move(const std::string& srcfilepath, const std::string& dstfilepath)
 	}
 	std::pair<std::string, std::string> dstPathAndName = splitPath(dstfilepath);
 	std::pair<std::string, std::string> srcPathAndName = splitPath(srcfilepath);
-
-	if (entry.type == DIRECTORY_TYPE) {
-		std::vector<std::string> directoryEntries = readDirectoryEntries(entry);
-		for (const std::string& filename : directoryEntries) {
-			try {
-				move(addCurrentDir(filename, srcfilepath), addCurrentDir(filename, dstfilepath));
-			} catch (const std::runtime_error& e) {
-				// Handle exception if needed
-			}
-		}
+	std::optional<EntryInfo> dstDirectory = getEntryInfo(dstPathAndName.first);
+	if (!dstDirectory || dstDirectory->type != DIRECTORY_TYPE) {
+		throw std::runtime_error("Invalid directory: " + dstPathAndName.first);
 	}
+	Transaction transaction(*this);
 
+	// listings only hold names, so the subtree is renamed without touching any data,
+	// first, a full FAT stops the move before any listing changed
+	renameTableEntries(srcfilepath, dstfilepath);
 	removeFileFromDirectory(srcPathAndName.first, srcPathAndName.second);
-	entries.erase(entry);
-	totalFatSize -= entry.path.size();
-	entry.path = dstfilepath;
-	totalFatSize += entry.path.size();
-	entries.insert(entry);
-	addFileToDirectory(dstPathAndName.first, dstPathAndName.second);
+	try {
+		addFileToDirectory(dstPathAndName.first, dstPathAndName.second);
+	} catch (const std::exception&) {
+		// the transaction commits whatever was done, put the source back the way it was
+		addFileToDirectory(srcPathAndName.first, srcPathAndName.second);
+		renameTableEntries(dstfilepath, srcfilepath);
+		throw;
+	}
 }
 
 void MyFs::copy(const std::string& srcfilepath, const std::string& dstfilepath) {
+	TIMELINE_SPAN("MyFs::copy");
+	TraceScope trace(activeTracer(), TraceOp::COPY, srcfilepath, 0, dstfilepath);
+	// a directory is held exclusively so nothing changes underneath while its subtree is copied
 	std::optional<EntryInfo> entryOpt = getEntryInfo(srcfilepath);
+	LockMode srcMode = entryOpt && entryOpt->type == DIRECTORY_TYPE ? LockMode::WRITE : LockMode::READ;
+	OperationLock lock(*this, {{srcfilepath, srcMode}, {dstfilepath, LockMode::WRITE_WITH_PARENT}});
+	entryOpt = getEntryInfo(srcfilepath);
 	if (!entryOpt) {
 		throw std::runtime_error("Invalid file: " + srcfilepath);
 	}
+	if (entryOpt->type == DIRECTORY_TYPE && srcMode != LockMode::WRITE) {
+		throw std::runtime_error("File changed type during copy: " + srcfilepath);
+	}
 	EntryInfo entry = *entryOpt;
 	if (isFileExists(dstfilepath)) {
 		throw std::runtime_error("file " + dstfilepath + " already exists");
@@ -486,25 +1718,25 @@ void MyFs::copy(const std::string& srcfilepath, const std::string& dstfilepath)
 	if (dstfilepath.find(srcfilepath) == 0 && dstfilepath[srcfilepath.length()] == '/') {
 		throw std::runtime_error("recursive copy detected");
 	}
-	std::pair<std::string, std::string> dstPathAndName = splitPath(dstfilepath);
+	Transaction transaction(*this);
 
-	if (entry.type == FILE_TYPE) {
+	if (entry.type == FILE_TYPE && entry.size <= TREE_COPY_CHUNK_SIZE) {
 		EntryInfo dstEntry = createFile(dstfilepath); // Create the new file at dstfilepath and get its EntryInfo
 		std::string content = getContent(entry);
 		setContent(dstEntry, content);
+		return;
+	}
 
+	// subtrees and chunks of big files are copied by the pool, it all commits as this one transaction
+	TreeOperation operation(treePool());
+	if (entry.type == FILE_TYPE) {
+		EntryInfo dstEntry = createFile(dstfilepath);
+		copyContent(operation, entry, dstEntry);
 	} else if (entry.type == DIRECTORY_TYPE) {
 		createDirectory(dstfilepath); // Create the new directory at dstfilepath
-
-		std::vector<std::string> directoryEntries = readDirectoryEntries(entry);
-		for (const std::string& filename : directoryEntries) {
-			try {
-				copy(addCurrentDir(filename, srcfilepath), addCurrentDir(filename, dstfilepath));
-			} catch (const std::runtime_error& e) {
-				// Handle exception if needed
-			}
-		}
+		copyTree(operation, entry, dstfilepath);
 	}
+	finishTreeOperation(operation, "copy");
 }
 
 std::pair<std::string, std::string> MyFs::splitPath(const std::string& filepath) {
@@ -540,4 +1772,236 @@ std::string MyFs::addCurrentDir(const std::string& filename, const std::string&
 	return currentDir + "/" + filename;
 }
 
-#pragma endregion
\ No newline at end of file
+#pragma endregion
+
+#pragma region treeOperations
+
+static std::string describeFailures(const std::string& operation,
+									const std::vector<std::pair<std::string, std::string>>& failures) {
+	std::string message = operation + " failed for " + std::to_string(failures.size()) + " entries";
+	for (size_t i = 0; i < failures.size() && i < TREE_ERROR_DETAILS; i++) {
+		message += (i == 0 ? ": " : "; ") + failures[i].first + " (" + failures[i].second + ")";
+	}
+	if (failures.size() > TREE_ERROR_DETAILS) {
+		message += "; ...";
+	}
+	return message;
+}
+
+TreeOperationError::TreeOperationError(const std::string& operation,
+									   std::vector<std::pair<std::string, std::string>> failures_)
+	: std::runtime_error(describeFailures(operation, failures_)), failures(std::move(failures_)) {
+}
+
+const std::vector<std::pair<std::string, std::string>>& TreeOperationError::getFailures() const {
+	return failures;
+}
+
+WorkStealingPool& MyFs::treePool() {
+	std::call_once(treePoolOnce, [this] { treeWorkers = std::make_unique<WorkStealingPool>(TREE_WORKER_THREADS); });
+	return *treeWorkers;
+}
+
+void MyFs::spawnTreeTask(TreeOperation& operation, const std::string& path, std::function<void()> task) {
+	// taken before the task can run, so whatever the task spawns sorts after it
+	uint64_t sequence = operation.nextSequence++;
+	operation.group.spawn([this, &operation, sequence, path, task = std::move(task)] {
+		TIMELINE_SPAN("MyFs::treeTask");
+		// the thread that started the operation holds the locks of the subtree and commits for it,
+		// so whatever this thread had going on is put aside and the task's changes collected
+		ThreadState& state = threadState();
+		ThreadState changes;
+		std::swap(changes.records, state.records);
+		std::swap(changes.dirtyRanges, state.dirtyRanges);
+		std::swap(changes.journaledRanges, state.journaledRanges);
+		state.lockDepth++;
+		state.transactionDepth++;
+		try {
+			task();
+		} catch (const std::exception& e) {
+			std::lock_guard<std::mutex> lock(operation.mutex);
+			operation.failures.emplace_back(path, e.what());
+		} catch (...) {
+			std::lock_guard<std::mutex> lock(operation.mutex);
+			operation.failures.emplace_back(path, "unknown error");
+		}
+		state.lockDepth--;
+		state.transactionDepth--;
+		std::swap(changes.records, state.records);
+		std::swap(changes.dirtyRanges, state.dirtyRanges);
+		std::swap(changes.journaledRanges, state.journaledRanges);
+
+		std::lock_guard<std::mutex> lock(operation.mutex);
+		operation.batches.emplace_back(sequence, std::move(changes));
+	});
+}
+
+void MyFs::finishTreeOperation(TreeOperation& operation, const std::string& name) {
+	TIMELINE_SPAN("MyFs::finishTreeOperation");
+	std::exception_ptr error;
+	try {
+		operation.group.wait();
+	} catch (...) {
+		error = std::current_exception();
+	}
+
+	// the tasks already changed the entries, their records have to be committed whatever failed
+	std::sort(operation.batches.begin(), operation.batches.end(),
+			  [](const std::pair<uint64_t, ThreadState>& a, const std::pair<uint64_t, ThreadState>& b) {
+				  return a.first < b.first;
+			  });
+	ThreadState& state = threadState();
+	for (const std::pair<uint64_t, ThreadState>& batch : operation.batches) {
+		state.records.append(batch.second.records);
+		state.dirtyRanges.insert(state.dirtyRanges.end(), batch.second.dirtyRanges.begin(),
+								 batch.second.dirtyRanges.end());
+		state.journaledRanges.insert(state.journaledRanges.end(), batch.second.journaledRanges.begin(),
+									 batch.second.journaledRanges.end());
+	}
+	operation.batches.clear();
+
+	if (error) {
+		std::rethrow_exception(error);
+	}
+	if (!operation.failures.empty()) {
+		throw TreeOperationError(name, std::move(operation.failures));
+	}
+}
+
+void MyFs::copyTree(TreeOperation& operation, const EntryInfo& directory, const std::string& dstPath) {
+	TIMELINE_SPAN("MyFs::copyTree");
+	// the children are created one after another here, they all go into the same listing,
+	// their content and subtrees are copied by tasks of their own
+	std::vector<std::string> directoryEntries = readDirectoryEntries(directory);
+	for (const std::string& filename : directoryEntries) {
+		std::string srcPath = addCurrentDir(filename, directory.path);
+		std::string childPath = addCurrentDir(filename, dstPath);
+		try {
+			std::optional<EntryInfo> child = getEntryInfo(srcPath);
+			if (!child) {
+				throw std::runtime_error("Invalid file: " + srcPath);
+			}
+			if (child->type == FILE_TYPE) {
+				EntryInfo dstEntry = createFile(childPath);
+				spawnTreeTask(operation, srcPath, [this, &operation, source = *child, dstEntry] {
+					copyContent(operation, source, dstEntry);
+				});
+			} else {
+				createDirectory(childPath);
+				spawnTreeTask(operation, srcPath, [this, &operation, source = *child, childPath] {
+					copyTree(operation, source, childPath);
+				});
+			}
+		} catch (const std::exception& e) {
+			std::lock_guard<std::mutex> lock(operation.mutex);
+			operation.failures.emplace_back(srcPath, e.what());
+		}
+	}
+}
+
+void MyFs::copyContent(TreeOperation& operation, const EntryInfo& source, const EntryInfo& destination) {
+	TIMELINE_SPAN("MyFs::copyContent");
+	if (source.size <= TREE_COPY_CHUNK_SIZE) {
+		setContent(destination, getContent(source));
+		return;
+	}
+
+	// same content, same checksum, a corrupted source stays recognizable in the copy
+	EntryInfo target = destination;
+	target.checksum = source.checksum;
+	reallocateTableEntry(target, source.size);
+	IoStats* stats = blkdevsim->getStats();
+	if (stats != nullptr) {
+		stats->recordLogicalWrite(source.size);
+	}
+	for (size_t offset = 0; offset < source.size; offset += TREE_COPY_CHUNK_SIZE) {
+		size_t length = std::min<size_t>(TREE_COPY_CHUNK_SIZE, source.size - offset);
+		spawnTreeTask(operation, source.path, [this, source, target, offset, length] {
+			std::vector<char> buffer(length);
+			blkdevsim->read(source.address + offset, length, buffer.data());
+			writeData(target.address + offset, length, buffer.data());
+		});
+	}
+}
+
+std::vector<EntryInfo> MyFs::collectSubtree(const std::string& path) {
+	EntryView view = listTree();
+	std::vector<EntryInfo> result;
+	EntryInfo key;
+	key.path = path;
+	auto it = view.table->find(key);
+	if (it != view.end()) {
+		result.push_back(*it);
+	}
+	// not contiguous with path itself, "/a b" sorts between "/a" and "/a/x"
+	std::string prefix = path.back() == '/' ? path : path + "/";
+	key.path = prefix;
+	for (it = view.table->lower_bound(key); it != view.end() && it->path.compare(0, prefix.size(), prefix) == 0;
+		 ++it) {
+		if (it->path != path) {
+			result.push_back(*it);
+		}
+	}
+	return result;
+}
+
+void MyFs::removeTableEntries(std::vector<EntryInfo>& entriesToRemove) {
+	{
+		std::lock_guard<std::mutex> entriesLock(entriesMutex);
+		for (const EntryInfo& entry : entriesToRemove) {
+			totalFatSize -= entry.serializedSize();
+			// the snapshot still reads a pinned extent, it's released when the snapshot is dropped
+			if (!isPinned(entry)) {
+				allocator.deallocate(entry);
+			}
+			entries.erase(entry);
+		}
+		assert(totalFatSize >= 1);
+		publishEntries();
+	}
+	ThreadState& state = threadState();
+	for (const EntryInfo& entry : entriesToRemove) {
+		if (entry.type == DIRECTORY_TYPE) {
+			dentries.invalidate(entry.path);
+		}
+		state.records.logErase(entry.path);
+	}
+
+	commit();
+}
+
+void MyFs::renameTableEntries(const std::string& srcPath, const std::string& dstPath) {
+	std::vector<EntryInfo> subtree = collectSubtree(srcPath);
+	std::vector<EntryInfo> renamed = subtree;
+	size_t oldSize = 0;
+	size_t newSize = 0;
+	for (EntryInfo& entry : renamed) {
+		oldSize += entry.serializedSize();
+		entry.path = dstPath + entry.path.substr(srcPath.size());
+		newSize += entry.serializedSize();
+	}
+	{
+		std::lock_guard<std::mutex> entriesLock(entriesMutex);
+		size_t newFatSize = totalFatSize - oldSize + newSize;
+		if (newFatSize > totalFatSize && newFatSize > static_cast<size_t>(FAT_SIZE - BLOCK_SIZE)) {
+			throw std::overflow_error("FAT table full");
+		}
+		for (const EntryInfo& entry : subtree) {
+			entries.erase(entry);
+		}
+		entries.insert(renamed.begin(), renamed.end());
+		totalFatSize = newFatSize;
+		publishEntries();
+	}
+	// the listings moved with their directories, the cache only knows them by the old paths
+	dentries.invalidate(srcPath);
+	ThreadState& state = threadState();
+	for (size_t i = 0; i < subtree.size(); i++) {
+		state.records.logErase(subtree[i].path);
+		state.records.logUpsert(renamed[i]);
+	}
+
+	commit();
+}
+
+#pragma endregion
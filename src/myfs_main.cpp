@@ -77,6 +77,14 @@ void printHelpMessage() {
         << std::setw(COLUMN_SPACING) << std::left << MAGENTA EDIT_CMD"  <path>" << std::setw(0) << YELLOW "Re-sets file content.\r\n" RESET
         << std::setw(COLUMN_SPACING) << std::left << MAGENTA MOVE_CMD"    <path1> <path2>" << std::setw(0) << YELLOW "Moves the file.\r\n" RESET
         << std::setw(COLUMN_SPACING) << std::left << MAGENTA COPY_CMD"    <path1> <path2>" << std::setw(0) << YELLOW "Copies a file.\r\n" RESET
+        << std::setw(COLUMN_SPACING) << std::left << MAGENTA PUT_CMD"   <host> <path>" << std::setw(0) << YELLOW "Copies a host file or directory in.\r\n" RESET
+        << std::setw(COLUMN_SPACING) << std::left << MAGENTA GET_CMD"   <path> <host>" << std::setw(0) << YELLOW "Copies a file or directory out to the host.\r\n" RESET
+        << std::setw(COLUMN_SPACING) << std::left << MAGENTA SYNC_CMD"  <host> <dir>" << std::setw(0) << YELLOW "Makes a directory a copy of a host one, writing only changes.\r\n" RESET
+        << std::setw(COLUMN_SPACING) << std::left << MAGENTA IMPORT_TAR_CMD" <dir> [tar]" << std::setw(0) << YELLOW "Unpacks a tar archive, stdin by default.\r\n" RESET
+        << std::setw(COLUMN_SPACING) << std::left << MAGENTA EXPORT_TAR_CMD" <path> [tar]" << std::setw(0) << YELLOW "Packs a tree into a tar archive, stdout by default.\r\n" RESET
+        << std::setw(COLUMN_SPACING) << std::left << MAGENTA SCRUB_CMD << std::setw(0) << YELLOW "Checks every file against its checksum.\r\n" RESET
+        << std::setw(COLUMN_SPACING) << std::left << MAGENTA STATS_CMD"  [json|reset]" << std::setw(0) << YELLOW "Shows device I/O statistics.\r\n" RESET
+        << std::setw(COLUMN_SPACING) << std::left << MAGENTA SHRINK_CMD << std::setw(0) << YELLOW "Packs the data and releases the free space.\r\n" RESET
         << std::setw(COLUMN_SPACING) << std::left << MAGENTA HELP_CMD << std::setw(0) << YELLOW "Shows this help message.\r\n" RESET
         << std::setw(COLUMN_SPACING) << std::left << MAGENTA EXIT_CMD << std::setw(0) << YELLOW "Gracefully exit.\r\n" RESET;
 
@@ -92,7 +100,14 @@ std::vector<std::string> splitCmd(const std::string& cmd) {
 	std::string current;
 
 	while (std::getline(ss, part, ' ')) {
-		if (!inQuotes && part.front() == '"' && part.back() == '"') {
+		if (part.empty()) {
+			// two spaces in a row, only matters inside quotes
+			if (inQuotes) {
+				current += " ";
+			}
+			continue;
+		}
+		if (!inQuotes && part.size() > 1 && part.front() == '"' && part.back() == '"') {
 			// Handle strings fully enclosed in quotes
 			ans.push_back(part.substr(1, part.size() - 2));
 		} else if (!inQuotes && part.front() == '"') {
@@ -116,22 +131,74 @@ std::vector<std::string> splitCmd(const std::string& cmd) {
 	return ans;
 }
 
+#define ANY_ARGS SIZE_MAX
+
+static const std::array<CommandSpec, 20> COMMANDS = {{
+	{LIST_CMD, CommandType::LIST, 0, 0, LIST_CMD ": zero arguments requested", false},
+	{TREE_CMD, CommandType::TREE, 0, 1, TREE_CMD " takes at most a directory", false},
+	{HELP_CMD, CommandType::HELP, 0, ANY_ARGS, "", false},
+	{EXIT_CMD, CommandType::EXIT, 0, ANY_ARGS, "", false},
+	{CREATE_FILE_CMD, CommandType::CREATE_FILE, 1, 1, CREATE_FILE_CMD " needs arguments", false},
+	{CONTENT_CMD, CommandType::CONTENT, 1, 1, CONTENT_CMD " needs arguments", false},
+	{DELETE_CMD, CommandType::DELETE, 1, 1, DELETE_CMD " needs arguments", false},
+	{CREATE_DIR_CMD, CommandType::CREATE_DIR, 1, 1, CREATE_DIR_CMD " needs arguments", false},
+	{CD_CMD, CommandType::CD, 1, 1, CD_CMD " needs arguments", false},
+	{MOVE_CMD, CommandType::MOVE, 2, 2, MOVE_CMD " requires 2 arguments", false},
+	{COPY_CMD, CommandType::COPY, 2, 2, COPY_CMD " requires 2 arguments", false},
+	{STATS_CMD, CommandType::STATS, 0, 1, STATS_CMD " takes " STATS_JSON_ARG " or " STATS_RESET_ARG, false},
+	{EDIT_CMD, CommandType::EDIT, 0, 1, EDIT_CMD " takes at most a file", true},
+	{SCRUB_CMD, CommandType::SCRUB, 0, 0, SCRUB_CMD ": zero arguments requested", true},
+	{SHRINK_CMD, CommandType::SHRINK, 0, 0, SHRINK_CMD ": zero arguments requested", true},
+	{PUT_CMD, CommandType::PUT, 2, 2, PUT_CMD " requires 2 arguments", true},
+	{GET_CMD, CommandType::GET, 2, 2, GET_CMD " requires 2 arguments", true},
+	{SYNC_CMD, CommandType::SYNC, 2, 2, SYNC_CMD " requires 2 arguments", true},
+	{IMPORT_TAR_CMD, CommandType::IMPORT_TAR, 1, 2, IMPORT_TAR_CMD " requires a directory and optionally an archive",
+	 true},
+	{EXPORT_TAR_CMD, CommandType::EXPORT_TAR, 1, 2, EXPORT_TAR_CMD " requires a path and optionally an archive",
+	 true},
+}};
+
+static const CommandSpec* findCommand(const std::string& cmd) {
+	for (const CommandSpec& spec : COMMANDS) {
+		if (cmd == spec.name) {
+			return &spec;
+		}
+	}
+	return nullptr;
+}
+
 CommandType getCommandType(const std::string& cmd) {
-	static const std::map<std::string, CommandType> commandMap = {{LIST_CMD, CommandType::LIST},
-																  {EXIT_CMD, CommandType::EXIT},
-																  {HELP_CMD, CommandType::HELP},
-																  {CREATE_FILE_CMD, CommandType::CREATE_FILE},
-																  {CONTENT_CMD, CommandType::CONTENT},
-																  {DELETE_CMD, CommandType::DELETE},
-																  {TREE_CMD, CommandType::TREE},
-																  {EDIT_CMD, CommandType::EDIT},
-																  {CREATE_DIR_CMD, CommandType::CREATE_DIR},
-																  {CD_CMD, CommandType::CD},
-																  {MOVE_CMD, CommandType::MOVE},
-																  {COPY_CMD, CommandType::COPY}};
-
-	auto it = commandMap.find(cmd);
-	return (it != commandMap.end()) ? it->second : CommandType::UNKNOWN;
+	const CommandSpec* spec = findCommand(cmd);
+	return spec != nullptr ? spec->type : CommandType::UNKNOWN;
+}
+
+const CommandSpec& checkCommand(const std::string& command, const std::vector<std::string>& args) {
+	const CommandSpec* spec = findCommand(command);
+	if (spec == nullptr) {
+		throw std::runtime_error("Unknown command: " + command);
+	}
+	if (args.size() < spec->minArgs || args.size() > spec->maxArgs) {
+		throw std::runtime_error(spec->usage);
+	}
+	return *spec;
+}
+
+bool isPathArgument(CommandType commandType, size_t index) {
+	// everything else takes paths inside the file system, relative to the current directory
+	switch (commandType) {
+	case CommandType::STATS:
+		return false;
+	// host paths are relative to wherever the shell was started
+	case CommandType::PUT:
+	case CommandType::SYNC:
+		return index != 0;
+	case CommandType::GET:
+	case CommandType::IMPORT_TAR:
+	case CommandType::EXPORT_TAR:
+		return index != 1;
+	default:
+		return true;
+	}
 }
 
 void editFile(MyFs& myfs, const std::string& fileLocation) {	
@@ -170,153 +237,407 @@ void printEntries(const std::vector<EntryInfo>& entries) {
 	// clang-format on
 }
 
-bool handleCommand(const std::string& command, std::vector<std::string>& args, MyFs& myfs, std::string& currentDir) {
-
-	CommandType commandType = getCommandType(command);
-
+// the commands that run the same against the image and through myfsd, the arguments are checked already
+template <typename Fs>
+static bool runSharedCommand(CommandType commandType, const std::vector<std::string>& args, Fs& fs,
+							 std::string& currentDir) {
 	switch (commandType) {
 	case CommandType::LIST: {
-		std::vector<EntryInfo> dlist;
-		if (args.empty()) {
-			dlist = myfs.listTree();
-		} else {
-			std::cout << RED << TREE_CMD << ": zero arguments requested" RESET << std::endl;
-			return false;
-		}
-		printEntries(dlist);
-
+		auto tree = fs.listTree();
+		printEntries(std::vector<EntryInfo>(tree.begin(), tree.end()));
 		break;
 	}
 	// Swaped with LIST cause it gave me anurism
 	case CommandType::TREE: {
-		std::vector<EntryInfo> dlist;
-		if (args.empty()) {
-			dlist = myfs.listDir(currentDir);
-		} else {
-			dlist = myfs.listDir(args[0]);
-		}
+		std::vector<EntryInfo> dlist = fs.listDir(args.empty() ? currentDir : args[0]);
 		for (EntryInfo& entry : dlist) {
 			entry.path = MyFs::splitPath(entry.path).second;
 		}
 		printEntries(dlist);
-
 		break;
 	}
 	case CommandType::HELP:
 		printHelpMessage();
 		break;
 	case CommandType::CREATE_FILE:
-		if (args.size() != 1) {
-			throw std::runtime_error(CREATE_FILE_CMD " needs arguments");
-		}
-		myfs.createFile(args[0]);
+		fs.createFile(args[0]);
 		break;
 	case CommandType::CONTENT: {
-		if (args.size() != 1) {
-			throw std::runtime_error(CONTENT_CMD " needs arguments");
-		}
-		std::optional<EntryInfo> entryOpt = myfs.getEntryInfo(args[0]);
-		if (!entryOpt) {
-			throw std::runtime_error("File doesn't exist");
-		}
-		EntryInfo entry = *entryOpt;
-		if (entry.type != FILE_TYPE) {
-			// throw std::runtime_error("Can only get content of files");
-		}
-		std::string content = myfs.getContent(entry);
+		std::string content = fs.getContent(args[0]);
 		if (!content.empty() && content.back() != '\n') {
 			content += '\n';
 		}
 		std::cout << content;
 		break;
 	}
-	case CommandType::DELETE: {
-		if (args.size() != 1) {
-			throw std::runtime_error(DELETE_CMD " needs arguments");
-		}
-		myfs.remove(args[0]);
+	case CommandType::DELETE:
+		fs.remove(args[0]);
 		break;
-	}
-	case CommandType::EDIT: {
-		if (args.size() > 1) {
-			throw std::runtime_error(EDIT_CMD " needs arguments");
-		}
-		if (args.size() == 1) {
-			editFile(myfs, args[0]);
+	case CommandType::CREATE_DIR:
+		fs.createDirectory(args[0]);
+		break;
+	case CommandType::CD: {
+		std::optional<EntryInfo> entryOpt = fs.getEntryInfo(args[0]);
+		if (!entryOpt) {
+			std::cout << RED << "No such file or directory: " << args[0] << RESET << std::endl;
+		} else if (entryOpt->type != DIRECTORY_TYPE) {
+			std::cout << RED << "Cannot change directory to a file: " << args[0] << RESET << std::endl;
 		} else {
-			editFile(myfs, "");
+			currentDir = entryOpt->path;
 		}
 		break;
 	}
-	case CommandType::CREATE_DIR: {
-		if (args.size() != 1) {
-			throw std::runtime_error(CREATE_DIR_CMD " needs arguments");
-		}
-		myfs.createDirectory(args[0]);
+	case CommandType::MOVE:
+		fs.move(args[0], args[1]);
+		break;
+	case CommandType::COPY:
+		fs.copy(args[0], args[1]);
 		break;
+	case CommandType::EXIT:
+		return true;
+	default:
+		throw std::logic_error("Not a shared command");
 	}
-	case CommandType::CD: {
-		if (args.size() != 1) {
-			throw std::runtime_error(CD_CMD " needs arguments");
+	return false;
+}
+
+bool handleCommand(const std::string& command, std::vector<std::string>& args, MyFs& myfs, std::string& currentDir) {
+	CommandType commandType = checkCommand(command, args).type;
+
+	switch (commandType) {
+	case CommandType::EDIT:
+		editFile(myfs, args.empty() ? "" : args[0]);
+		break;
+	case CommandType::PUT:
+		HostTransfer(myfs).put(args[0], args[1]);
+		break;
+	case CommandType::GET:
+		HostTransfer(myfs).get(args[0], args[1]);
+		break;
+	case CommandType::IMPORT_TAR: {
+		if (args.size() == 1 && isatty(STDIN_FILENO) != 0) {
+			throw std::runtime_error("stdin is a terminal, give " IMPORT_TAR_CMD " an archive");
 		}
-		std::string newDir = args[0];
-		std::optional<EntryInfo> entryOpt = myfs.getEntryInfo(newDir);
-		if (!entryOpt) {
-			std::cout << RED << "No such file or directory: " << args[0] << RESET << std::endl;
-			break;
+		std::optional<HostFile> archive;
+		if (args.size() == 2) {
+			archive.emplace(args[1], O_RDONLY);
 		}
-		EntryInfo entry = entryOpt.value();
-		if (entry.type != DIRECTORY_TYPE) {
-			std::cout << RED << "Cannot change directory to a file: " << args[0] << RESET << std::endl;
-			break;
+		size_t imported = TarStream(myfs).importFrom(archive ? archive->fd : STDIN_FILENO, args[0]);
+		std::cerr << "Imported " << imported << " files" << std::endl;
+		break;
+	}
+	case CommandType::EXPORT_TAR: {
+		if (args.size() == 1 && isatty(STDOUT_FILENO) != 0) {
+			throw std::runtime_error("stdout is a terminal, give " EXPORT_TAR_CMD " an archive");
 		}
-
-		currentDir = entry.path;
+		std::optional<HostFile> archive;
+		if (args.size() == 2) {
+			archive.emplace(args[1], O_WRONLY | O_CREAT | O_TRUNC);
+		}
+		// the archive goes around the stream's buffer, what's in it has to be out first
+		std::cout.flush();
+		TarStream(myfs).exportTo(args[0], archive ? archive->fd : STDOUT_FILENO);
 		break;
 	}
-	case CommandType::MOVE: {
-		if (args.size() != 2) {
-			throw std::runtime_error(MOVE_CMD " requires 2 arguments");
+	case CommandType::SYNC: {
+		SyncResult result = HostTransfer(myfs).sync(args[0], args[1]);
+		std::cout << "Compared " << result.files << " files, updated " << result.updated << " (" << result.bytesWritten
+				  << " bytes), removed " << result.removed << std::endl;
+		break;
+	}
+	case CommandType::SCRUB: {
+		std::string cursor;
+		std::vector<std::string> corrupted = myfs.scrub(cursor, std::numeric_limits<size_t>::max());
+		for (const std::string& path : corrupted) {
+			std::cout << RED << "Checksum mismatch: " << path << RESET << "\r\n";
+		}
+		if (corrupted.empty()) {
+			std::cout << GREEN << "No corruption found" << RESET << std::endl;
 		}
-		myfs.move(args[0], args[1]);
 		break;
 	}
-	case CommandType::COPY: {
-		if (args.size() != 2) {
-			throw std::runtime_error(COPY_CMD " requires 2 arguments");
+	case CommandType::STATS: {
+		IoStats* stats = myfs.getIoStats();
+		if (stats == nullptr) {
+			throw std::runtime_error("This device keeps no statistics");
+		}
+		if (args.empty()) {
+			stats->snapshot().print(std::cout);
+		} else if (args[0] == STATS_JSON_ARG) {
+			std::cout << stats->snapshot().toJson() << std::endl;
+		} else if (args[0] == STATS_RESET_ARG) {
+			stats->reset();
+		} else {
+			throw std::runtime_error(STATS_CMD " takes " STATS_JSON_ARG " or " STATS_RESET_ARG);
 		}
-		myfs.copy(args[0], args[1]);
 		break;
 	}
-	case CommandType::EXIT:
-		return true;
-	case CommandType::UNKNOWN:
+	case CommandType::SHRINK:
+		std::cout << "Released " << myfs.shrink() << " bytes" << std::endl;
+		break;
 	default:
-		std::cout << RED "Unknown command: " << command << RESET << std::endl;
+		return runSharedCommand(commandType, args, myfs, currentDir);
+	}
+	return false;
+}
+
+bool handleRemoteCommand(const std::string& command, std::vector<std::string>& args, RemoteFs& remote, std::string& currentDir) {
+	const CommandSpec& spec = checkCommand(command, args);
+	if (spec.needsImage) {
+		throw std::runtime_error(command + " needs the image, it can't go through myfsd");
+	}
+
+	switch (spec.type) {
+	case CommandType::STATS:
+		// the daemon's counters, only as json
+		std::cout << remote.stats() << std::endl;
 		break;
+	default:
+		return runSharedCommand(spec.type, args, remote, currentDir);
 	}
 	return false;
 }
 
+size_t parseSize(const std::string& text) {
+	// stoull takes a minus and wraps it around to a huge size
+	if (text.find('-') != std::string::npos) {
+		throw std::invalid_argument("Negative size: " + text);
+	}
+	size_t suffixStart = 0;
+	size_t size = std::stoull(text, &suffixStart);
+	std::string suffix = text.substr(suffixStart);
+	int shift = 0;
+	if (suffix == "K" || suffix == "k") {
+		shift = 10;
+	} else if (suffix == "M" || suffix == "m") {
+		shift = 20;
+	} else if (suffix == "G" || suffix == "g") {
+		shift = 30;
+	} else if (!suffix.empty()) {
+		throw std::invalid_argument("Unknown size suffix: " + suffix);
+	}
+	// the shift would drop the high bits and leave a much smaller size
+	if (size > (SIZE_MAX >> shift)) {
+		throw std::out_of_range("Size too large: " + text);
+	}
+	return size << shift;
+}
+
+bool runCommandLine(const std::string& cmdline, const CommandHandler& handler, std::string& currentDir, bool batch) {
+	std::vector<std::string> cmd = splitCmd(cmdline);
+	if (cmd.empty()) {
+		return false;
+	}
+	std::string command = cmd[0];
+	std::vector<std::string> args(cmd.begin() + 1, cmd.end());
+	CommandType commandType = getCommandType(command);
+	if (batch && commandType == CommandType::EDIT) {
+		throw std::runtime_error(EDIT_CMD " needs a terminal");
+	}
+	for (size_t i = 0; i < args.size(); i++) {
+		if (isPathArgument(commandType, i)) {
+			args[i] = addCurrentDirAdvance(args[i], currentDir);
+		}
+	}
+	return handler(command, args, currentDir);
+}
+
+int runBatch(std::istream& script, char separator, const CommandHandler& handler, MyFs* transaction) {
+	std::string currentDir = "/";
+	size_t failed = 0;
+	size_t commandNumber = 0;
+	try {
+		// everything the script changes reaches the journal as one commit, begun and committed by hand,
+		// a Transaction would throw the failed commit from its destructor
+		if (transaction != nullptr) {
+			transaction->beginTransaction();
+		}
+		std::string cmdline;
+		while (std::getline(script, cmdline, separator)) {
+			commandNumber++;
+			size_t start = cmdline.find_first_not_of(" \t\r\n");
+			if (start == std::string::npos || cmdline[start] == BATCH_COMMENT) {
+				continue;
+			}
+			cmdline = cmdline.substr(start, cmdline.find_last_not_of(" \t\r\n") + 1 - start);
+			try {
+				if (runCommandLine(cmdline, handler, currentDir, true)) {
+					break;
+				}
+			} catch (const std::exception& e) {
+				// the rest of the script still runs, the exit status tells something failed
+				std::cerr << commandNumber << ": " << cmdline << ": " << e.what() << std::endl;
+				failed++;
+			}
+		}
+		if (transaction != nullptr) {
+			transaction->commitTransaction();
+		}
+	} catch (const std::exception& e) {
+		std::cerr << "Can't commit the script: " << e.what() << std::endl;
+		return 1;
+	}
+	return failed == 0 ? 0 : 1;
+}
+
+// writes the timeline when it goes out of scope, whichever way main returns
+struct TimelineFile {
+	explicit TimelineFile(std::optional<std::string> path_) : path(std::move(path_)) {
+	}
+	~TimelineFile() {
+		if (!path) {
+			return;
+		}
+		std::ofstream out(*path);
+		Timeline::dump(out);
+		if (!out) {
+			std::cerr << "Can't write the timeline to " << *path << std::endl;
+		}
+	}
+
+	std::optional<std::string> path;
+};
+
 int main(int argc, char** argv) {
 	std::string bldevfile;
-	if (argc == 1) {
+	size_t deviceSize = BlockDevice::DEFAULT_DEVICE_SIZE;
+	std::optional<std::string> commands;
+	bool singleTransaction = false;
+	std::optional<std::string> tracePath;
+	std::optional<std::string> timelinePath;
+	std::vector<std::string> positional;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == BATCH_COMMANDS_ARG) {
+			if (i + 1 == argc) {
+				std::cerr << BATCH_COMMANDS_ARG " needs the commands to run" << std::endl;
+				return -1;
+			}
+			commands = argv[++i];
+		} else if (arg == BATCH_TRANSACTION_ARG) {
+			singleTransaction = true;
+		} else if (arg == TRACE_ARG) {
+			if (i + 1 == argc) {
+				std::cerr << TRACE_ARG " needs the file to write the trace to" << std::endl;
+				return -1;
+			}
+			tracePath = argv[++i];
+		} else if (arg == TIMELINE_ARG) {
+			if (i + 1 == argc) {
+				std::cerr << TIMELINE_ARG " needs the file to write the timeline to" << std::endl;
+				return -1;
+			}
+			if (!Timeline::ENABLED) {
+				std::cerr << TIMELINE_ARG " needs a build with -DMYFS_TIMELINE=ON" << std::endl;
+				return -1;
+			}
+			timelinePath = argv[++i];
+		} else {
+			positional.push_back(arg);
+		}
+	}
+	// a script comes from -c or from whatever stdin is if it isn't a terminal
+	bool batch = commands || isatty(STDIN_FILENO) == 0;
+
+	if (positional.empty()) {
+		if (batch) {
+			std::cerr << "No image given" << std::endl;
+			return -1;
+		}
 		std::cout << CYAN "Please enter the file name: " RESET;
 		std::cin >> bldevfile;
 		// Flush stdin to clear any leftover input
 		std::cin.clear();
 		std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-	} else if (argc == 2) {
-		bldevfile = argv[1];
+	} else if (positional.size() == 1) {
+		bldevfile = positional[0];
+	} else if (positional.size() == 2) {
+		// only used when the image is created
+		bldevfile = positional[0];
+		try {
+			deviceSize = parseSize(positional[1]);
+		} catch (const std::exception& e) {
+			std::cerr << "Invalid size: " << positional[1] << std::endl;
+			return -1;
+		}
 	} else {
 		std::cerr << "Too many arguments" << std::endl;
 		return -1;
 	}
 
 	std::string currentDir = "/";
-	// may fail, if can't create file, or file is read-only
-	BlockDeviceSimulator blkdevptr(bldevfile);
-	MyFs myfs(&blkdevptr);
+	// goes last, the unmount is on the timeline too
+	TimelineFile timeline(timelinePath);
+	std::unique_ptr<BlockDeviceSimulator> blkdev;
+	// outlives the mount, the unmount may still be traced
+	std::unique_ptr<OpTracer> tracer;
+	std::unique_ptr<MyFs> mounted;
+	std::unique_ptr<RemoteFs> remote;
+	CommandHandler handler;
+	struct stat imageInfo {};
+	if (stat(bldevfile.c_str(), &imageInfo) == 0 && S_ISSOCK(imageInfo.st_mode)) {
+		// a myfsd socket, the daemon has the image mounted already
+		try {
+			remote = std::make_unique<RemoteFs>(bldevfile);
+		} catch (const std::exception& e) {
+			std::cerr << e.what() << std::endl;
+			return -1;
+		}
+		if (singleTransaction) {
+			std::cerr << BATCH_TRANSACTION_ARG " needs the image, it can't go through myfsd" << std::endl;
+			return -1;
+		}
+		if (tracePath) {
+			std::cerr << TRACE_ARG " needs the image, start myfsd with it instead" << std::endl;
+			return -1;
+		}
+		handler = [&remote](const std::string& command, std::vector<std::string>& args, std::string& dir) {
+			return handleRemoteCommand(command, args, *remote, dir);
+		};
+	} else {
+		// may fail, if can't create file, or file is read-only, or another mount holds it
+		try {
+			blkdev = std::make_unique<BlockDeviceSimulator>(bldevfile, deviceSize);
+		} catch (const std::exception& e) {
+			std::cerr << "Can't open " << bldevfile << ": " << e.what() << std::endl;
+			return -1;
+		}
+		// an image that doesn't mount is left alone, it used to be formatted over
+		try {
+			// the prompt comes up right away, the data is packed on exit
+			MountOptions options;
+			options.lazy = true;
+			mounted = std::make_unique<MyFs>(blkdev.get(), options);
+		} catch (const std::exception& e) {
+			std::cerr << "Can't mount " << bldevfile << ": " << e.what() << std::endl;
+			std::cerr << "Run myfs_fsck " << bldevfile << " to see what is wrong with it" << std::endl;
+			return -1;
+		}
+		if (tracePath) {
+			try {
+				tracer = std::make_unique<OpTracer>(*tracePath);
+			} catch (const std::exception& e) {
+				std::cerr << e.what() << std::endl;
+				return -1;
+			}
+			mounted->setTracer(tracer.get());
+		}
+		handler = [&mounted](const std::string& command, std::vector<std::string>& args, std::string& dir) {
+			return handleCommand(command, args, *mounted, dir);
+		};
+	}
+	MyFs* transaction = singleTransaction ? mounted.get() : nullptr;
+
+	if (commands) {
+		// newlines separate commands just as well
+		std::replace(commands->begin(), commands->end(), '\n', BATCH_SEPARATOR);
+		std::istringstream script(*commands);
+		return runBatch(script, BATCH_SEPARATOR, handler, transaction);
+	}
+	if (batch) {
+		std::ios::sync_with_stdio(false);
+		return runBatch(std::cin, '\n', handler, transaction);
+	}
 
 	// Print the welcome message
 	std::cout << GREEN << MENU_ASCII_ART << RESET << std::endl;
@@ -333,15 +654,8 @@ int main(int argc, char** argv) {
 			continue;
 		}
 
-		std::vector<std::string> cmd = splitCmd(cmdline);
-		std::string command = cmd[0];
-		std::vector<std::string> args(cmd.begin() + 1, cmd.end());
-		for (std::string& arg : args) {
-			arg = addCurrentDirAdvance(arg, currentDir);
-		}
-
 		try {
-			exit = handleCommand(command, args, myfs, currentDir);
+			exit = runCommandLine(cmdline, handler, currentDir, false);
 		} catch (const std::exception& e) {
 			std::cout << RED << "An error occurred: " << e.what() << RESET << std::endl;
 		}
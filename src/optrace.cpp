@@ -0,0 +1,184 @@
+#include "optrace.hpp"
+#include "EntryInfo.hpp"
+#include "config.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <stdexcept>
+
+// magic, version u16, reserved u16
+#define TRACE_HEADER_SIZE 8
+// start u64, duration u64, size u64, client u32, path length u16, other path length u16, op u8, flags u8
+#define TRACE_START_OFFSET 0
+#define TRACE_DURATION_OFFSET 8
+#define TRACE_SIZE_OFFSET 16
+#define TRACE_CLIENT_OFFSET 24
+#define TRACE_PATH_LENGTH_OFFSET 28
+#define TRACE_OTHER_PATH_LENGTH_OFFSET 30
+#define TRACE_OP_OFFSET 32
+#define TRACE_FLAGS_OFFSET 33
+#define TRACE_RECORD_HEADER_SIZE 34
+#define TRACE_FAILED_FLAG 1
+
+static const std::array<const char*, static_cast<size_t>(TraceOp::COUNT)> OP_NAMES = {
+	"getEntryInfo", "listDir",		  "listTree",		  "getContent",		 "viewContent",
+	"setContent",	"createFile",	  "createDirectory",  "remove",			 "move",
+	"copy",			"importFile",	  "updateFile",		  "exportFile",		 "beginTransaction",
+	"commitTransaction", "createSnapshot", "dropSnapshot", "shrink"};
+
+static std::atomic<uint32_t> nextClient{1};
+static thread_local uint32_t threadClient = 0;
+// calls of this thread that are being traced right now, the ones they make aren't recorded
+static thread_local int traceDepth = 0;
+
+const char* traceOpName(TraceOp op) {
+	size_t index = static_cast<size_t>(op);
+	return index < OP_NAMES.size() ? OP_NAMES[index] : "unknown";
+}
+
+#pragma region writing
+
+OpTracer::OpTracer(const std::string& tracePath)
+	: started(std::chrono::steady_clock::now()), out(tracePath, std::ios::binary | std::ios::trunc) {
+	if (!out) {
+		throw std::runtime_error("Can't create trace " + tracePath);
+	}
+	std::array<char, TRACE_HEADER_SIZE> header{};
+	memcpy(header.data(), TRACE_MAGIC, 4);
+	storeLittleEndian<uint16_t>(header.data() + 4, TRACE_VERSION);
+	out.write(header.data(), header.size());
+	buffer.reserve(TRACE_BUFFER_SIZE);
+}
+
+OpTracer::~OpTracer() {
+	std::lock_guard<std::mutex> lock(bufferMutex);
+	flushLocked();
+}
+
+void OpTracer::record(const TraceRecord& traceRecord) {
+	// the lengths only have 16 bits, a longer path is cut there so the records after it still line up
+	size_t pathLength = std::min<size_t>(traceRecord.path.size(), UINT16_MAX);
+	size_t otherPathLength = std::min<size_t>(traceRecord.otherPath.size(), UINT16_MAX);
+	std::array<char, TRACE_RECORD_HEADER_SIZE> header{};
+	storeLittleEndian<uint64_t>(header.data() + TRACE_START_OFFSET, traceRecord.start);
+	storeLittleEndian<uint64_t>(header.data() + TRACE_DURATION_OFFSET, traceRecord.duration);
+	storeLittleEndian<uint64_t>(header.data() + TRACE_SIZE_OFFSET, traceRecord.size);
+	storeLittleEndian<uint32_t>(header.data() + TRACE_CLIENT_OFFSET, traceRecord.client);
+	storeLittleEndian<uint16_t>(header.data() + TRACE_PATH_LENGTH_OFFSET, static_cast<uint16_t>(pathLength));
+	storeLittleEndian<uint16_t>(header.data() + TRACE_OTHER_PATH_LENGTH_OFFSET,
+								static_cast<uint16_t>(otherPathLength));
+	header[TRACE_OP_OFFSET] = static_cast<char>(traceRecord.op);
+	header[TRACE_FLAGS_OFFSET] = traceRecord.failed ? TRACE_FAILED_FLAG : 0;
+
+	std::lock_guard<std::mutex> lock(bufferMutex);
+	buffer.insert(buffer.end(), header.begin(), header.end());
+	buffer.insert(buffer.end(), traceRecord.path.begin(), traceRecord.path.begin() + pathLength);
+	buffer.insert(buffer.end(), traceRecord.otherPath.begin(), traceRecord.otherPath.begin() + otherPathLength);
+	if (buffer.size() >= TRACE_BUFFER_SIZE) {
+		flushLocked();
+	}
+}
+
+void OpTracer::flush() {
+	std::lock_guard<std::mutex> lock(bufferMutex);
+	flushLocked();
+}
+
+void OpTracer::flushLocked() {
+	out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+	out.flush();
+	buffer.clear();
+}
+
+uint64_t OpTracer::now() const {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started).count();
+}
+
+uint32_t OpTracer::currentClient() {
+	if (threadClient == 0) {
+		threadClient = nextClient.fetch_add(1);
+	}
+	return threadClient;
+}
+
+void OpTracer::setClient(uint32_t client) {
+	threadClient = client;
+}
+
+#pragma endregion
+#pragma region scopes
+
+TraceScope::TraceScope(OpTracer* tracer_, TraceOp op, const std::string& path, uint64_t size,
+					   const std::string& otherPath)
+	: tracer(traceDepth == 0 ? tracer_ : nullptr), uncaughtExceptions(std::uncaught_exceptions()) {
+	if (tracer == nullptr) {
+		return;
+	}
+	traceDepth++;
+	traceRecord.op = op;
+	traceRecord.path = path;
+	traceRecord.otherPath = otherPath;
+	traceRecord.size = size;
+	traceRecord.client = OpTracer::currentClient();
+	traceRecord.start = tracer->now();
+}
+
+TraceScope::~TraceScope() {
+	if (tracer == nullptr) {
+		return;
+	}
+	traceDepth--;
+	traceRecord.duration = tracer->now() - traceRecord.start;
+	traceRecord.failed = std::uncaught_exceptions() > uncaughtExceptions;
+	try {
+		tracer->record(traceRecord);
+	} catch (const std::exception&) {
+		// losing a record beats failing the call it describes
+	}
+}
+
+void TraceScope::setSize(uint64_t size) {
+	traceRecord.size = size;
+}
+
+#pragma endregion
+#pragma region reading
+
+std::vector<TraceRecord> readTrace(const std::string& tracePath) {
+	std::ifstream in(tracePath, std::ios::binary);
+	if (!in) {
+		throw std::runtime_error("Can't open trace " + tracePath);
+	}
+	std::array<char, TRACE_HEADER_SIZE> header{};
+	if (!in.read(header.data(), header.size()) || memcmp(header.data(), TRACE_MAGIC, 4) != 0) {
+		throw std::runtime_error("Not a trace: " + tracePath);
+	}
+	if (loadLittleEndian<uint16_t>(header.data() + 4) > TRACE_VERSION) {
+		throw std::runtime_error("Trace of a newer version: " + tracePath);
+	}
+
+	std::vector<TraceRecord> records;
+	std::array<char, TRACE_RECORD_HEADER_SIZE> recordHeader{};
+	while (in.read(recordHeader.data(), recordHeader.size())) {
+		TraceRecord traceRecord;
+		traceRecord.start = loadLittleEndian<uint64_t>(recordHeader.data() + TRACE_START_OFFSET);
+		traceRecord.duration = loadLittleEndian<uint64_t>(recordHeader.data() + TRACE_DURATION_OFFSET);
+		traceRecord.size = loadLittleEndian<uint64_t>(recordHeader.data() + TRACE_SIZE_OFFSET);
+		traceRecord.client = loadLittleEndian<uint32_t>(recordHeader.data() + TRACE_CLIENT_OFFSET);
+		traceRecord.op = static_cast<TraceOp>(recordHeader[TRACE_OP_OFFSET]);
+		traceRecord.failed = (recordHeader[TRACE_FLAGS_OFFSET] & TRACE_FAILED_FLAG) != 0;
+		traceRecord.path.resize(loadLittleEndian<uint16_t>(recordHeader.data() + TRACE_PATH_LENGTH_OFFSET));
+		traceRecord.otherPath.resize(loadLittleEndian<uint16_t>(recordHeader.data() + TRACE_OTHER_PATH_LENGTH_OFFSET));
+		if (!in.read(traceRecord.path.data(), static_cast<std::streamsize>(traceRecord.path.size())) ||
+			!in.read(traceRecord.otherPath.data(), static_cast<std::streamsize>(traceRecord.otherPath.size()))) {
+			break;
+		}
+		if (traceRecord.op >= TraceOp::COUNT) {
+			throw std::runtime_error("Unknown op in trace " + tracePath);
+		}
+		records.push_back(std::move(traceRecord));
+	}
+	return records;
+}
+
+#pragma endregion
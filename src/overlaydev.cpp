@@ -0,0 +1,64 @@
+#include "overlaydev.hpp"
+#include "config.hpp"
+#include <algorithm>
+
+OverlayBlockDevice::OverlayBlockDevice(BlockDevice* inner_) : inner(inner_) {
+}
+
+void OverlayBlockDevice::check(size_t addr, size_t size) const {
+	if (addr > getSize() || size > getSize() - addr) {
+		throw std::out_of_range("Access past the end of the device");
+	}
+}
+
+void OverlayBlockDevice::read(size_t addr, size_t size, char* ans) {
+	check(addr, size);
+	std::lock_guard<std::mutex> lock(pagesMutex);
+	if (pages.empty()) {
+		inner->read(addr, size, ans);
+		return;
+	}
+	for (size_t done = 0; done < size;) {
+		size_t page = (addr + done) / OVERLAY_PAGE_SIZE;
+		size_t offset = (addr + done) % OVERLAY_PAGE_SIZE;
+		size_t length = std::min(size - done, OVERLAY_PAGE_SIZE - offset);
+		auto it = pages.find(page);
+		if (it != pages.end()) {
+			memcpy(ans + done, it->second.data() + offset, length);
+		} else {
+			inner->read(addr + done, length, ans + done);
+		}
+		done += length;
+	}
+}
+
+void OverlayBlockDevice::write(size_t addr, size_t size, const char* data) {
+	check(addr, size);
+	std::lock_guard<std::mutex> lock(pagesMutex);
+	for (size_t done = 0; done < size;) {
+		size_t page = (addr + done) / OVERLAY_PAGE_SIZE;
+		size_t offset = (addr + done) % OVERLAY_PAGE_SIZE;
+		size_t length = std::min(size - done, OVERLAY_PAGE_SIZE - offset);
+		auto it = pages.find(page);
+		if (it == pages.end()) {
+			// the rest of the page still reads as what's underneath, the last one may be cut short
+			size_t start = page * OVERLAY_PAGE_SIZE;
+			std::vector<char> copy(std::min<size_t>(OVERLAY_PAGE_SIZE, getSize() - start));
+			inner->read(start, copy.size(), copy.data());
+			it = pages.emplace(page, std::move(copy)).first;
+		}
+		memcpy(it->second.data() + offset, data + done, length);
+		done += length;
+	}
+}
+
+void OverlayBlockDevice::sync([[maybe_unused]] size_t addr, [[maybe_unused]] size_t size) {
+}
+
+void OverlayBlockDevice::advise(size_t addr, size_t size, AccessHint hint) {
+	inner->advise(addr, size, hint);
+}
+
+size_t OverlayBlockDevice::getSize() const {
+	return inner->getSize();
+}
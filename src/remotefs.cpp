@@ -0,0 +1,155 @@
+#include "remotefs.hpp"
+#include <stdexcept>
+#include <system_error>
+#include <sys/socket.h>
+#include <unistd.h>
+
+RemoteFs::RemoteFs(const std::string& socketPath) : fd(-1), nextId(0), closed(false) {
+	sockaddr_un address = socketAddress(socketPath);
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1) {
+		throw std::system_error(errno, std::generic_category(), "Can't create a socket");
+	}
+	if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1) {
+		int error = errno;
+		close(fd);
+		throw std::system_error(error, std::generic_category(), "Can't connect to " + socketPath);
+	}
+	reader = std::thread([this] { readResponses(); });
+}
+
+RemoteFs::~RemoteFs() {
+	// the daemon answers what it already got and hangs up
+	shutdown(fd, SHUT_WR);
+	reader.join();
+	close(fd);
+}
+
+std::string RemoteFs::call(RemoteOp op, const std::string& payload) {
+	std::future<Response> response;
+	uint32_t id = 0;
+	{
+		std::lock_guard<std::mutex> lock(pendingMutex);
+		if (closed) {
+			throw std::runtime_error("Connection to the daemon closed");
+		}
+		id = nextId++;
+		response = pending[id].get_future();
+	}
+	try {
+		std::lock_guard<std::mutex> lock(writeMutex);
+		writeFrame(fd, id, static_cast<uint8_t>(op), payload);
+	} catch (...) {
+		std::lock_guard<std::mutex> lock(pendingMutex);
+		pending.erase(id);
+		throw;
+	}
+	Response result = response.get();
+	if (result.first != RemoteStatus::OK) {
+		throw std::runtime_error(result.second);
+	}
+	return std::move(result.second);
+}
+
+void RemoteFs::readResponses() {
+	std::string error = "Connection to the daemon closed";
+	try {
+		Frame frame;
+		while (readFrame(fd, frame)) {
+			std::lock_guard<std::mutex> lock(pendingMutex);
+			auto it = pending.find(frame.id);
+			if (it != pending.end()) {
+				it->second.set_value({static_cast<RemoteStatus>(frame.code), std::move(frame.payload)});
+				pending.erase(it);
+			}
+		}
+	} catch (const std::exception& e) {
+		error = e.what();
+	}
+	// whoever still waits would wait forever
+	std::lock_guard<std::mutex> lock(pendingMutex);
+	closed = true;
+	for (std::pair<const uint32_t, std::promise<Response>>& waiting : pending) {
+		waiting.second.set_value({RemoteStatus::FAILED, error});
+	}
+	pending.clear();
+}
+
+std::vector<EntryInfo> RemoteFs::entries(const std::string& payload) {
+	MessageReader response(payload);
+	std::vector<EntryInfo> result(response.getUint32());
+	for (EntryInfo& entry : result) {
+		entry = response.getEntry();
+	}
+	return result;
+}
+
+std::optional<EntryInfo> RemoteFs::getEntryInfo(const std::string& path) {
+	MessageWriter request;
+	request.putString(path);
+	std::string payload = call(RemoteOp::STAT, request.buffer);
+	MessageReader response(payload);
+	if (response.getUint8() == 0) {
+		return std::nullopt;
+	}
+	return response.getEntry();
+}
+
+std::vector<EntryInfo> RemoteFs::listDir(const std::string& path) {
+	MessageWriter request;
+	request.putString(path);
+	return entries(call(RemoteOp::LIST_DIR, request.buffer));
+}
+
+std::vector<EntryInfo> RemoteFs::listTree() {
+	return entries(call(RemoteOp::LIST_TREE, ""));
+}
+
+std::string RemoteFs::getContent(const std::string& path) {
+	MessageWriter request;
+	request.putString(path);
+	return call(RemoteOp::GET_CONTENT, request.buffer);
+}
+
+void RemoteFs::setContent(const std::string& path, const std::string& content) {
+	MessageWriter request;
+	request.putString(path);
+	request.putString(content);
+	call(RemoteOp::SET_CONTENT, request.buffer);
+}
+
+void RemoteFs::createFile(const std::string& path) {
+	MessageWriter request;
+	request.putString(path);
+	call(RemoteOp::CREATE_FILE, request.buffer);
+}
+
+void RemoteFs::createDirectory(const std::string& path) {
+	MessageWriter request;
+	request.putString(path);
+	call(RemoteOp::CREATE_DIRECTORY, request.buffer);
+}
+
+void RemoteFs::remove(const std::string& path) {
+	MessageWriter request;
+	request.putString(path);
+	call(RemoteOp::REMOVE, request.buffer);
+}
+
+void RemoteFs::move(const std::string& source, const std::string& destination) {
+	MessageWriter request;
+	request.putString(source);
+	request.putString(destination);
+	call(RemoteOp::MOVE, request.buffer);
+}
+
+void RemoteFs::copy(const std::string& source, const std::string& destination) {
+	MessageWriter request;
+	request.putString(source);
+	request.putString(destination);
+	call(RemoteOp::COPY, request.buffer);
+}
+
+std::string RemoteFs::stats() {
+	return call(RemoteOp::STATS, "");
+}
@@ -0,0 +1,75 @@
+#include "scrubber.hpp"
+#include <chrono>
+
+Scrubber::Scrubber(MyFs& myfs_, size_t bytesPerSecond_)
+	: myfs(myfs_), bytesPerSecond(bytesPerSecond_), stopping(false), completedPasses(0) {
+	assert(bytesPerSecond > 0);
+}
+
+Scrubber::~Scrubber() {
+	stop();
+}
+
+void Scrubber::start() {
+	if (worker.joinable()) {
+		return;
+	}
+	stopping = false;
+	worker = std::thread(&Scrubber::run, this);
+}
+
+void Scrubber::stop() {
+	{
+		std::lock_guard<std::mutex> lock(stateMutex);
+		stopping = true;
+	}
+	wakeUp.notify_all();
+	if (worker.joinable()) {
+		worker.join();
+	}
+}
+
+std::vector<std::string> Scrubber::getCorruptedPaths() {
+	std::lock_guard<std::mutex> lock(stateMutex);
+	return {corruptedPaths.begin(), corruptedPaths.end()};
+}
+
+size_t Scrubber::getCompletedPasses() {
+	std::lock_guard<std::mutex> lock(stateMutex);
+	return completedPasses;
+}
+
+void Scrubber::run() {
+	// one step every stepTime keeps the average under the rate limit
+	const auto stepTime = std::chrono::microseconds(static_cast<size_t>(SCRUB_STEP_SIZE) * 1000000 / bytesPerSecond);
+	std::string cursor;
+	std::set<std::string> passCorrupted;
+
+	std::unique_lock<std::mutex> stateLock(stateMutex);
+	while (!stopping) {
+		stateLock.unlock();
+		std::vector<std::string> corrupted;
+		bool failed = false;
+		try {
+			corrupted = myfs.scrub(cursor, SCRUB_STEP_SIZE);
+		} catch (const std::exception& e) {
+			// entries can vanish between steps, just start over
+			cursor.clear();
+			failed = true;
+		}
+		stateLock.lock();
+
+		passCorrupted.insert(corrupted.begin(), corrupted.end());
+		corruptedPaths.insert(corrupted.begin(), corrupted.end());
+		if (failed) {
+			// a pass that didn't get through every entry doesn't count, nor does what it found so far
+			passCorrupted.clear();
+		} else if (cursor.empty()) {
+			// fixed files drop out once a full pass didn't see them
+			corruptedPaths = passCorrupted;
+			passCorrupted.clear();
+			completedPasses++;
+		}
+		wakeUp.wait_for(stateLock, stepTime, [this] { return stopping; });
+	}
+}
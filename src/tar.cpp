@@ -0,0 +1,450 @@
+#include "tar.hpp"
+#include <algorithm>
+#include <ctime>
+
+// ustar header fields, offset and length
+#define TAR_BLOCK_SIZE 512
+#define TAR_NAME_OFFSET 0
+#define TAR_NAME_LENGTH 100
+#define TAR_MODE_OFFSET 100
+#define TAR_NUMBER_LENGTH 8
+#define TAR_UID_OFFSET 108
+#define TAR_GID_OFFSET 116
+#define TAR_SIZE_OFFSET 124
+#define TAR_SIZE_LENGTH 12
+#define TAR_MTIME_OFFSET 136
+#define TAR_CHECKSUM_OFFSET 148
+#define TAR_TYPE_OFFSET 156
+#define TAR_MAGIC_OFFSET 257
+#define TAR_VERSION_OFFSET 263
+#define TAR_PREFIX_OFFSET 345
+#define TAR_PREFIX_LENGTH 155
+// 11 octal digits, a bigger size goes in a pax header
+#define TAR_MAX_OCTAL_SIZE 077777777777ULL
+
+#define TAR_TYPE_FILE '0'
+#define TAR_TYPE_OLD_FILE '\0'
+#define TAR_TYPE_CONTIGUOUS '7'
+#define TAR_TYPE_DIRECTORY '5'
+#define TAR_TYPE_PAX 'x'
+#define TAR_TYPE_PAX_GLOBAL 'g'
+#define TAR_TYPE_GNU_LONG_NAME 'L'
+
+#define TAR_FILE_MODE 0644
+#define TAR_DIRECTORY_MODE 0755
+
+using TarHeader = std::array<char, TAR_BLOCK_SIZE>;
+
+// what pax or GNU long name headers say about the entry after them
+struct ExtendedHeader {
+	std::string name;
+	uint64_t size = 0;
+	bool hasSize = false;
+};
+
+#pragma region streamHelpers
+
+// false if the stream ended right away, a block cut short means the archive was
+static bool readBlock(int fd, char* block, size_t size) {
+	size_t done = 0;
+	while (done < size) {
+		ssize_t result = read(fd, block + done, size - done);
+		if (result == 0) {
+			if (done == 0) {
+				return false;
+			}
+			throw std::runtime_error("Archive ends in the middle of an entry");
+		}
+		if (result < 0 && errno != EINTR) {
+			throw std::system_error(errno, std::generic_category(), "Failed to read archive");
+		}
+		done += std::max<ssize_t>(result, 0);
+	}
+	return true;
+}
+
+static void writeBlock(int fd, const char* block, size_t size) {
+	size_t done = 0;
+	while (done < size) {
+		ssize_t result = write(fd, block + done, size - done);
+		if (result < 0 && errno != EINTR) {
+			throw std::system_error(errno, std::generic_category(), "Failed to write archive");
+		}
+		done += std::max<ssize_t>(result, 0);
+	}
+}
+
+static size_t paddingOf(uint64_t size) {
+	return (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+}
+
+// pipes can't seek, whatever isn't needed is read and dropped
+static void skip(int fd, uint64_t size) {
+	TarHeader scratch{};
+	while (size > 0) {
+		size_t length = std::min<uint64_t>(size, scratch.size());
+		if (!readBlock(fd, scratch.data(), length)) {
+			throw std::runtime_error("Archive ends in the middle of an entry");
+		}
+		size -= length;
+	}
+}
+
+static std::string readData(int fd, uint64_t size) {
+	std::string data(size, '\0');
+	if (size > 0 && !readBlock(fd, data.data(), size)) {
+		throw std::runtime_error("Archive ends in the middle of an entry");
+	}
+	skip(fd, paddingOf(size));
+	return data;
+}
+
+#pragma endregion
+#pragma region headerFields
+
+static std::string fieldString(const char* field, size_t length) {
+	return {field, strnlen(field, length)};
+}
+
+// octal, or big endian base 256 if the top bit is set, which is how GNU tar writes big numbers
+static uint64_t parseNumber(const char* field, size_t length) {
+	uint64_t value = 0;
+	if (static_cast<unsigned char>(field[0]) & 0x80) {
+		value = static_cast<unsigned char>(field[0]) & 0x7f;
+		for (size_t i = 1; i < length; i++) {
+			value = value << 8 | static_cast<unsigned char>(field[i]);
+		}
+		return value;
+	}
+	for (size_t i = 0; i < length && field[i] != '\0'; i++) {
+		if (field[i] >= '0' && field[i] <= '7') {
+			value = value << 3 | (field[i] - '0');
+		} else if (field[i] != ' ') {
+			throw std::runtime_error("Malformed number in a tar header");
+		}
+	}
+	return value;
+}
+
+static void formatNumber(char* field, size_t length, uint64_t value) {
+	snprintf(field, length, "%0*llo", static_cast<int>(length - 1), static_cast<unsigned long long>(value));
+}
+
+// the checksum field itself counts as spaces
+static uint64_t headerChecksum(const TarHeader& header) {
+	uint64_t sum = 0;
+	for (size_t i = 0; i < header.size(); i++) {
+		bool inField = i >= TAR_CHECKSUM_OFFSET && i < TAR_CHECKSUM_OFFSET + TAR_NUMBER_LENGTH;
+		sum += inField ? ' ' : static_cast<unsigned char>(header[i]);
+	}
+	return sum;
+}
+
+static std::string headerName(const TarHeader& header) {
+	std::string name = fieldString(header.data() + TAR_NAME_OFFSET, TAR_NAME_LENGTH);
+	if (strncmp(header.data() + TAR_MAGIC_OFFSET, "ustar", 5) == 0) {
+		std::string prefix = fieldString(header.data() + TAR_PREFIX_OFFSET, TAR_PREFIX_LENGTH);
+		if (!prefix.empty()) {
+			name = prefix + "/" + name;
+		}
+	}
+	return name;
+}
+
+// "length key=value\n" records, only the ones describing a single entry matter here
+static void parsePax(const std::string& data, ExtendedHeader& extended) {
+	size_t offset = 0;
+	while (offset < data.size()) {
+		size_t space = data.find(' ', offset);
+		if (space == std::string::npos) {
+			throw std::runtime_error("Malformed pax header");
+		}
+		size_t length = std::stoull(data.substr(offset, space - offset));
+		if (length <= space - offset || offset + length > data.size()) {
+			throw std::runtime_error("Malformed pax header");
+		}
+		std::string record = data.substr(space + 1, offset + length - space - 2);
+		size_t equals = record.find('=');
+		if (equals != std::string::npos) {
+			std::string key = record.substr(0, equals);
+			if (key == "path") {
+				extended.name = record.substr(equals + 1);
+			} else if (key == "size") {
+				extended.size = std::stoull(record.substr(equals + 1));
+				extended.hasSize = true;
+			}
+		}
+		offset += length;
+	}
+}
+
+static std::string paxRecord(const std::string& key, const std::string& value) {
+	// the length counts its own digits, which may take one more once they're added
+	size_t base = key.size() + value.size() + 3;
+	size_t length = base + std::to_string(base).size();
+	if (std::to_string(length).size() != std::to_string(base).size()) {
+		length++;
+	}
+	return std::to_string(length) + " " + key + "=" + value + "\n";
+}
+
+static TarHeader makeHeader(const std::string& name, const std::string& prefix, char type, uint64_t size,
+							time_t mtime) {
+	TarHeader header{};
+	memcpy(header.data() + TAR_NAME_OFFSET, name.data(), std::min<size_t>(name.size(), TAR_NAME_LENGTH));
+	formatNumber(header.data() + TAR_MODE_OFFSET, TAR_NUMBER_LENGTH,
+				 type == TAR_TYPE_DIRECTORY ? TAR_DIRECTORY_MODE : TAR_FILE_MODE);
+	formatNumber(header.data() + TAR_UID_OFFSET, TAR_NUMBER_LENGTH, 0);
+	formatNumber(header.data() + TAR_GID_OFFSET, TAR_NUMBER_LENGTH, 0);
+	formatNumber(header.data() + TAR_SIZE_OFFSET, TAR_SIZE_LENGTH, size);
+	formatNumber(header.data() + TAR_MTIME_OFFSET, TAR_SIZE_LENGTH, mtime);
+	header[TAR_TYPE_OFFSET] = type;
+	memcpy(header.data() + TAR_MAGIC_OFFSET, "ustar", 6);
+	memcpy(header.data() + TAR_VERSION_OFFSET, "00", 2);
+	memcpy(header.data() + TAR_PREFIX_OFFSET, prefix.data(), std::min<size_t>(prefix.size(), TAR_PREFIX_LENGTH));
+	formatNumber(header.data() + TAR_CHECKSUM_OFFSET, TAR_NUMBER_LENGTH - 1, headerChecksum(header));
+	header[TAR_CHECKSUM_OFFSET + TAR_NUMBER_LENGTH - 1] = ' ';
+	return header;
+}
+
+// where an archive name ends up below root, empty for the root itself
+static std::string targetPath(const std::string& root, std::string name) {
+	while (name.compare(0, 2, "./") == 0 || name.compare(0, 1, "/") == 0) {
+		name.erase(0, name[0] == '.' ? 2 : 1);
+	}
+	while (!name.empty() && name.back() == '/') {
+		name.pop_back();
+	}
+	if (name.empty() || name == ".") {
+		return "";
+	}
+	if (name == ".." || name.compare(0, 3, "../") == 0 || name.find("/../") != std::string::npos ||
+		(name.size() >= 3 && name.compare(name.size() - 3, 3, "/..") == 0)) {
+		throw std::runtime_error("Path leaves the target directory");
+	}
+	return root == "/" ? "/" + name : root + "/" + name;
+}
+
+#pragma endregion
+
+TarStream::TarStream(MyFs& myfs_) : myfs(myfs_) {
+}
+
+#pragma region import
+
+size_t TarStream::importFrom(int fd, const std::string& path) {
+	std::optional<EntryInfo> root = myfs.getEntryInfo(path);
+	if (!root || root->type != DIRECTORY_TYPE) {
+		throw std::runtime_error("Not a directory: " + path);
+	}
+	knownDirectories = {path};
+	failures.clear();
+
+	size_t imported = 0;
+	bool more = true;
+	while (more) {
+		// a commit per batch of entries instead of one per entry, a failed one throws from here
+		MyFs::Transaction batch(myfs);
+		size_t batchEnd = imported + TAR_IMPORT_BATCH_SIZE;
+		while (imported < batchEnd && (more = importEntry(fd, path, imported))) {
+		}
+	}
+	finish("import-tar");
+	return imported;
+}
+
+bool TarStream::importEntry(int fd, const std::string& path, size_t& imported) {
+	ExtendedHeader extended;
+	TarHeader header{};
+	char type = 0;
+	uint64_t size = 0;
+	while (true) {
+		if (!readBlock(fd, header.data(), header.size()) ||
+			std::all_of(header.begin(), header.end(), [](char c) { return c == '\0'; })) {
+			// the end marker, whatever follows it is padding
+			return false;
+		}
+		if (parseNumber(header.data() + TAR_CHECKSUM_OFFSET, TAR_NUMBER_LENGTH) != headerChecksum(header)) {
+			throw std::runtime_error("Not a tar archive, or a damaged one");
+		}
+		type = header[TAR_TYPE_OFFSET];
+		size = parseNumber(header.data() + TAR_SIZE_OFFSET, TAR_SIZE_LENGTH);
+		if (type == TAR_TYPE_PAX) {
+			parsePax(readData(fd, size), extended);
+		} else if (type == TAR_TYPE_GNU_LONG_NAME) {
+			std::string data = readData(fd, size);
+			extended.name = fieldString(data.data(), data.size());
+		} else if (type == TAR_TYPE_PAX_GLOBAL) {
+			skip(fd, size + paddingOf(size));
+		} else {
+			break;
+		}
+	}
+
+	std::string name = extended.name.empty() ? headerName(header) : extended.name;
+	if (extended.hasSize) {
+		size = extended.size;
+	}
+	bool isFile = type == TAR_TYPE_FILE || type == TAR_TYPE_OLD_FILE || type == TAR_TYPE_CONTIGUOUS;
+	std::string target;
+	bool created = false;
+	try {
+		target = targetPath(path, name);
+		if (type == TAR_TYPE_DIRECTORY) {
+			makeDirectories(target);
+		} else if (isFile && !target.empty()) {
+			makeDirectories(MyFs::splitPath(target).first);
+			std::optional<EntryInfo> existing = myfs.getEntryInfo(target);
+			if (existing && existing->type != FILE_TYPE) {
+				throw std::runtime_error("Not a file: " + target);
+			}
+			if (!existing) {
+				myfs.createFile(target);
+				created = true;
+			}
+		}
+		// links, devices and the like have no counterpart in here
+	} catch (const std::exception& e) {
+		failures.emplace_back(name, e.what());
+		isFile = false;
+	}
+	if (!isFile || target.empty()) {
+		skip(fd, size + paddingOf(size));
+		return true;
+	}
+
+	try {
+		myfs.importFile(fd, size, target);
+	} catch (const std::overflow_error& e) {
+		// no room for it, that's found before any of the content is read
+		failures.emplace_back(name, e.what());
+		if (created) {
+			myfs.remove(target);
+		}
+		skip(fd, size + paddingOf(size));
+		return true;
+	}
+	// anything else came from reading the content, the stream is somewhere in the middle of the entry then
+	skip(fd, paddingOf(size));
+	imported++;
+	return true;
+}
+
+void TarStream::makeDirectories(const std::string& path) {
+	if (path.empty() || knownDirectories.count(path) != 0) {
+		return;
+	}
+	std::optional<EntryInfo> entry = myfs.getEntryInfo(path);
+	if (entry && entry->type != DIRECTORY_TYPE) {
+		throw std::runtime_error("Not a directory: " + path);
+	}
+	if (!entry) {
+		makeDirectories(MyFs::splitPath(path).first);
+		myfs.createDirectory(path);
+	}
+	knownDirectories.insert(path);
+}
+
+#pragma endregion
+#pragma region export
+
+size_t TarStream::exportTo(const std::string& path, int fd) {
+	std::optional<EntryInfo> root = myfs.getEntryInfo(path);
+	if (!root) {
+		throw std::runtime_error("File not found: " + path);
+	}
+	failures.clear();
+
+	std::vector<EntryInfo> directories;
+	std::vector<EntryInfo> files;
+	std::string prefix = path == "/" ? path : path + "/";
+	{
+		MyFs::EntryView view = myfs.listTree();
+		for (const EntryInfo& entry : view) {
+			if (entry.path == path || entry.path.compare(0, prefix.size(), prefix) == 0) {
+				(entry.type == DIRECTORY_TYPE ? directories : files).push_back(entry);
+			}
+		}
+	}
+	// a file on its own is named by its name, everything below a directory relative to it
+	auto nameOf = [&](const EntryInfo& entry) {
+		return entry.path == path ? MyFs::splitPath(path).second : entry.path.substr(prefix.size());
+	};
+
+	size_t exported = 0;
+	// directories before anything in them, then the content front to back across the device
+	for (const EntryInfo& directory : directories) {
+		if (directory.path != path) {
+			writeHeader(fd, nameOf(directory) + "/", TAR_TYPE_DIRECTORY, 0);
+			exported++;
+		}
+	}
+	std::sort(files.begin(), files.end(),
+			  [](const EntryInfo& a, const EntryInfo& b) { return a.address < b.address; });
+	for (const EntryInfo& file : files) {
+		bool started = false;
+		uint64_t size = 0;
+		try {
+			// the header is written with the size the content has while it's locked
+			myfs.exportFile(file.path, fd, [&](const EntryInfo& current) {
+				writeHeader(fd, nameOf(file), TAR_TYPE_FILE, current.size);
+				started = true;
+				size = current.size;
+			});
+		} catch (const std::exception& e) {
+			if (started) {
+				// the header promised content that didn't come, the archive can't be continued
+				throw;
+			}
+			failures.emplace_back(file.path, e.what());
+			continue;
+		}
+		TarHeader padding{};
+		writeBlock(fd, padding.data(), paddingOf(size));
+		exported++;
+	}
+	std::array<char, 2 * TAR_BLOCK_SIZE> end{};
+	writeBlock(fd, end.data(), end.size());
+	finish("export-tar");
+	return exported;
+}
+
+void TarStream::writeHeader(int fd, const std::string& name, char type, uint64_t size) {
+	time_t now = time(nullptr);
+	std::string shortName = name;
+	std::string prefix;
+	std::string pax;
+	if (name.size() > TAR_NAME_LENGTH) {
+		// ustar splits a long name at a slash, pax takes whatever doesn't split
+		size_t slash = name.find('/', name.size() - TAR_NAME_LENGTH - 1);
+		if (slash != std::string::npos && slash <= TAR_PREFIX_LENGTH && slash + 1 < name.size()) {
+			prefix = name.substr(0, slash);
+			shortName = name.substr(slash + 1);
+		} else {
+			pax += paxRecord("path", name);
+			shortName = name.substr(0, TAR_NAME_LENGTH);
+		}
+	}
+	if (size > TAR_MAX_OCTAL_SIZE) {
+		pax += paxRecord("size", std::to_string(size));
+		size = 0;
+	}
+	if (!pax.empty()) {
+		TarHeader extended = makeHeader("././@PaxHeader", "", TAR_TYPE_PAX, pax.size(), now);
+		writeBlock(fd, extended.data(), extended.size());
+		pax.resize(pax.size() + paddingOf(pax.size()), '\0');
+		writeBlock(fd, pax.data(), pax.size());
+	}
+	TarHeader header = makeHeader(shortName, prefix, type, size, now);
+	writeBlock(fd, header.data(), header.size());
+}
+
+#pragma endregion
+
+void TarStream::finish(const std::string& name) {
+	if (!failures.empty()) {
+		std::vector<std::pair<std::string, std::string>> failed = std::move(failures);
+		failures.clear();
+		throw TreeOperationError(name, std::move(failed));
+	}
+}
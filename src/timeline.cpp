@@ -0,0 +1,75 @@
+#include "timeline.hpp"
+#include "config.hpp"
+#include "threadslots.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <memory>
+
+// The spans of one thread. Only that thread writes, a slot is filled before the count moves past it,
+// so a dump sees whole spans unless the thread laps it while it reads.
+struct TimelineRing {
+	struct Slot {
+		std::atomic<const char*> name{nullptr};
+		std::atomic<uint64_t> start{0};
+		std::atomic<uint64_t> end{0};
+	};
+
+	TimelineRing() : thread(nextThread()++), slots(new Slot[TIMELINE_RING_SIZE]), written(0) {
+	}
+
+	static std::atomic<uint32_t>& nextThread() {
+		static std::atomic<uint32_t> next{1};
+		return next;
+	}
+
+	const uint32_t thread; // the track in the timeline
+	std::unique_ptr<Slot[]> slots;
+	std::atomic<uint64_t> written;
+};
+
+static const std::chrono::steady_clock::time_point timelineStart = std::chrono::steady_clock::now();
+
+// a thread that exits hands its ring to the next new one, which goes on on the same track, so there are
+// only ever as many rings as threads at once, and a dump at exit still sees the spans of the pool's
+static ThreadSlots<TimelineRing> rings;
+
+uint64_t Timeline::now() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - timelineStart)
+		.count();
+}
+
+void Timeline::record(const char* name, uint64_t start, uint64_t end) {
+	TimelineRing& ring = rings.local();
+	uint64_t index = ring.written.load(std::memory_order_relaxed);
+	TimelineRing::Slot& slot = ring.slots[index % TIMELINE_RING_SIZE];
+	slot.name.store(name, std::memory_order_relaxed);
+	slot.start.store(start, std::memory_order_relaxed);
+	slot.end.store(end, std::memory_order_relaxed);
+	ring.written.store(index + 1, std::memory_order_release);
+}
+
+void Timeline::dump(std::ostream& out) {
+	// complete events with microsecond timestamps, one track per ring
+	out << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+	bool first = true;
+	out << std::fixed << std::setprecision(3);
+	rings.forEach([&](const TimelineRing& ring) {
+		out << (first ? "" : ",") << "\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": "
+			<< ring.thread << ", \"args\": {\"name\": \"thread " << ring.thread << "\"}}";
+		first = false;
+		uint64_t written = ring.written.load(std::memory_order_acquire);
+		uint64_t oldest = written > TIMELINE_RING_SIZE ? written - TIMELINE_RING_SIZE : 0;
+		for (uint64_t index = oldest; index < written; index++) {
+			const TimelineRing::Slot& slot = ring.slots[index % TIMELINE_RING_SIZE];
+			uint64_t start = slot.start.load(std::memory_order_relaxed);
+			uint64_t end = slot.end.load(std::memory_order_relaxed);
+			out << ",\n{\"name\": \"" << slot.name.load(std::memory_order_relaxed)
+				<< "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << ring.thread
+				<< ", \"ts\": " << static_cast<double>(start) / 1000
+				<< ", \"dur\": " << static_cast<double>(std::max(end, start) - start) / 1000 << "}";
+		}
+	});
+	out << "\n]}" << std::endl;
+}
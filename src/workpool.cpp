@@ -0,0 +1,163 @@
+#include "workpool.hpp"
+#include <chrono>
+
+static std::atomic<uint64_t> nextPoolId{1};
+
+// which pool and worker the current thread is, workers push their own tasks to their own deque
+static thread_local uint64_t currentPoolId = 0;
+static thread_local size_t currentWorker = 0;
+
+WorkStealingPool::WorkStealingPool(size_t threadCount)
+	: id(nextPoolId.fetch_add(1)), nextQueue(0), queued(0), stopping(false) {
+	if (threadCount == 0) {
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+	for (size_t i = 0; i < threadCount; i++) {
+		queues.push_back(std::make_unique<Queue>());
+	}
+	for (size_t i = 0; i < threadCount; i++) {
+		workers.emplace_back(&WorkStealingPool::work, this, i);
+	}
+}
+
+WorkStealingPool::~WorkStealingPool() {
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		stopping = true;
+	}
+	wakeUp.notify_all();
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+}
+
+size_t WorkStealingPool::size() const {
+	return workers.size();
+}
+
+size_t WorkStealingPool::localIndex() {
+	if (currentPoolId == id) {
+		return currentWorker;
+	}
+	return nextQueue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+}
+
+#pragma region scheduling
+
+void WorkStealingPool::submit(std::function<void()> task) {
+	{
+		// counted first so it never drops below zero, a worker woken early just looks again
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		queued++;
+	}
+	Queue& queue = *queues[localIndex()];
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.tasks.push_back(std::move(task));
+	}
+	wakeUp.notify_one();
+}
+
+bool WorkStealingPool::take(size_t index, std::function<void()>& task) {
+	// own deque from the back, the newest task is the one whose data is still warm
+	{
+		Queue& own = *queues[index];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (!own.tasks.empty()) {
+			task = std::move(own.tasks.back());
+			own.tasks.pop_back();
+			queued--;
+			return true;
+		}
+	}
+	for (size_t offset = 1; offset < queues.size(); offset++) {
+		Queue& victim = *queues[(index + offset) % queues.size()];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.tasks.empty()) {
+			task = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+			queued--;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool WorkStealingPool::runPending() {
+	std::function<void()> task;
+	size_t index = currentPoolId == id ? currentWorker : 0;
+	if (!take(index, task)) {
+		return false;
+	}
+	task();
+	return true;
+}
+
+void WorkStealingPool::work(size_t index) {
+	currentPoolId = id;
+	currentWorker = index;
+	std::function<void()> task;
+	for (;;) {
+		if (take(index, task)) {
+			task();
+			task = nullptr;
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		wakeUp.wait(lock, [this] { return stopping || queued > 0; });
+		if (stopping && queued == 0) {
+			return;
+		}
+	}
+}
+
+#pragma endregion
+#pragma region taskGroup
+
+TaskGroup::TaskGroup(WorkStealingPool& pool_) : pool(pool_), outstanding(0) {
+}
+
+TaskGroup::~TaskGroup() {
+	try {
+		wait();
+	} catch (...) {
+	}
+}
+
+void TaskGroup::spawn(std::function<void()> task) {
+	outstanding++;
+	pool.submit([this, task = std::move(task)] {
+		try {
+			task();
+		} catch (...) {
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!error) {
+				error = std::current_exception();
+			}
+		}
+		// under the lock, the group may be gone as soon as a waiter sees zero
+		std::lock_guard<std::mutex> lock(mutex);
+		if (--outstanding == 0) {
+			done.notify_all();
+		}
+	});
+}
+
+void TaskGroup::wait() {
+	while (outstanding > 0) {
+		if (pool.runPending()) {
+			continue;
+		}
+		// the rest is running on other threads, they may still spawn more to help with
+		std::unique_lock<std::mutex> lock(mutex);
+		done.wait_for(lock, std::chrono::milliseconds(1), [this] { return outstanding == 0; });
+	}
+	std::lock_guard<std::mutex> lock(mutex);
+	if (error) {
+		std::exception_ptr thrown = error;
+		error = nullptr;
+		std::rethrow_exception(thrown);
+	}
+}
+
+#pragma endregion
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+// The tests are plain executables run by ctest, a failed check ends one with where it failed.
+#define CHECK(condition)                                                                                          \
+	do {                                                                                                          \
+		if (!(condition)) {                                                                                       \
+			throw std::logic_error(std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": " #condition); \
+		}                                                                                                         \
+	} while (false)
+
+// runs the test body, returns the exit status for main
+template <typename Body> int runTest(const char* name, Body body) {
+	try {
+		body();
+	} catch (const std::exception& e) {
+		std::cerr << name << " failed: " << e.what() << std::endl;
+		return 1;
+	}
+	std::cout << name << " passed" << std::endl;
+	return 0;
+}
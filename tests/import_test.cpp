@@ -0,0 +1,53 @@
+#include "check.hpp"
+#include "memdev.hpp"
+#include "myfs.hpp"
+
+// An import over an existing file that fails halfway leaves the file as it was, and one that goes
+// through replaces its content.
+
+#define TEST_DEVICE_SIZE (1024 * 1024)
+
+// a pipe holding content, the reader sees it end there
+static int pipeOf(const std::string& content) {
+	int fds[2];
+	CHECK(pipe(fds) == 0);
+	CHECK(write(fds[1], content.data(), content.size()) == static_cast<ssize_t>(content.size()));
+	close(fds[1]);
+	return fds[0];
+}
+
+int main() {
+	return runTest("import", [] {
+		MemoryBlockDevice blkdev(TEST_DEVICE_SIZE);
+		MyFs myfs(&blkdev);
+		myfs.createFile("/notes");
+		myfs.setContent("/notes", "what was there before");
+
+		// the host file is shorter than it claimed to be
+		int fd = pipeOf("cut");
+		bool failed = false;
+		try {
+			myfs.importFile(fd, 100, "/notes");
+		} catch (const std::runtime_error&) {
+			failed = true;
+		}
+		close(fd);
+		CHECK(failed);
+		CHECK(myfs.getContent("/notes") == "what was there before");
+		size_t free = 0;
+		for (const std::pair<const size_t, size_t>& space : myfs.freeSpace()) {
+			free += space.second;
+		}
+
+		fd = pipeOf("the new content");
+		myfs.importFile(fd, 15, "/notes");
+		close(fd);
+		CHECK(myfs.getContent("/notes") == "the new content");
+		size_t freeAfter = 0;
+		for (const std::pair<const size_t, size_t>& space : myfs.freeSpace()) {
+			freeAfter += space.second;
+		}
+		// the old extent went back
+		CHECK(freeAfter == free);
+	});
+}
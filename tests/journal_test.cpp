@@ -0,0 +1,77 @@
+#include "check.hpp"
+#include "memdev.hpp"
+#include "myfs.hpp"
+
+// What was committed comes back from the journal after a crash without a checkpoint, and a commit
+// torn halfway through its journal write comes back not at all, none of its changes and all of the
+// ones before it.
+
+#define TEST_DEVICE_SIZE (1024 * 1024)
+
+// once armed, the next write into the journal only gets its first half down, as if the power went
+class TearingDevice : public BlockDevice {
+  public:
+	explicit TearingDevice(BlockDevice& device_) : armed(false), device(device_) {
+	}
+
+	void read(size_t addr, size_t size, char* ans) override {
+		device.read(addr, size, ans);
+	}
+	void write(size_t addr, size_t size, const char* data) override {
+		if (armed && addr >= getSize() - JOURNAL_SIZE) {
+			armed = false;
+			device.write(addr, size / 2, data);
+			throw std::runtime_error("torn");
+		}
+		device.write(addr, size, data);
+	}
+	void sync(size_t addr, size_t size) override {
+		device.sync(addr, size);
+	}
+	[[nodiscard]] size_t getSize() const override {
+		return device.getSize();
+	}
+
+	bool armed;
+
+  private:
+	BlockDevice& device;
+};
+
+int main() {
+	return runTest("journal", [] {
+		MemoryBlockDevice blkdev(TEST_DEVICE_SIZE);
+		{
+			TearingDevice tearing(blkdev);
+			// no maintain, nothing is checkpointed after the format, it all lives in the journal
+			MyFs myfs(&tearing, MountOptions{true, true, false});
+			myfs.createDirectory("/kept");
+			{
+				MyFs::Transaction transaction(myfs);
+				myfs.createFile("/kept/a");
+				myfs.setContent("/kept/a", "committed before the crash");
+			}
+
+			tearing.armed = true;
+			bool torn = false;
+			try {
+				MyFs::Transaction transaction(myfs);
+				myfs.createDirectory("/torn");
+				myfs.createFile("/torn/b");
+				myfs.setContent("/torn/b", "never committed");
+			} catch (const std::runtime_error&) {
+				torn = true;
+			}
+			CHECK(torn);
+		}
+
+		MyFs myfs(&blkdev);
+		CHECK(myfs.getContent("/kept/a") == "committed before the crash");
+		CHECK(!myfs.isFileExists("/torn"));
+		CHECK(!myfs.isFileExists("/torn/b"));
+		// the replayed state checkpoints and takes new commits like any other
+		myfs.createFile("/kept/after");
+		myfs.setContent("/kept/after", "written after the replay");
+		CHECK(myfs.listDir("/kept").size() == 2);
+	});
+}
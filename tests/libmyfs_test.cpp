@@ -0,0 +1,53 @@
+#include "check.hpp"
+#include "libmyfs.h"
+#include <string>
+#include <unistd.h>
+
+// The C interface as an embedding program sees it: a new image with the default size, content that
+// outlives a close, statuses instead of aborts for calls out of order, and no image left behind by an
+// open that failed.
+
+static bool exists(const std::string& path) {
+	return access(path.c_str(), F_OK) == 0;
+}
+
+static std::string readAll(myfs_t* fs, const char* path) {
+	char buffer[64];
+	size_t size = 0;
+	CHECK(myfs_read(fs, path, buffer, sizeof(buffer), &size) == MYFS_OK);
+	return std::string(buffer, size);
+}
+
+int main() {
+	return runTest("libmyfs", [] {
+		std::string image = "/tmp/libmyfs_test_" + std::to_string(getpid()) + ".img";
+		unlink(image.c_str());
+
+		myfs_t* fs = nullptr;
+		CHECK(myfs_open(image.c_str(), 0, MYFS_OPEN_NO_FORMAT, &fs) != MYFS_OK);
+		CHECK(!exists(image));
+
+		CHECK(myfs_open(image.c_str(), 0, 0, &fs) == MYFS_OK);
+		CHECK(myfs_write(fs, "/notes", "first", 5) == MYFS_OK);
+		CHECK(readAll(fs, "/notes") == "first");
+		myfs_stat_t stat{};
+		CHECK(myfs_stat(fs, "/notes", &stat) == MYFS_OK);
+		CHECK(stat.size == 5 && stat.type == MYFS_TYPE_FILE);
+		CHECK(myfs_stat(fs, "/missing", &stat) == MYFS_NOT_FOUND);
+
+		CHECK(myfs_commit(fs) == MYFS_INVALID);
+		CHECK(myfs_begin(fs) == MYFS_OK);
+		CHECK(myfs_mkdir(fs, "/dir") == MYFS_OK);
+		CHECK(myfs_write(fs, "/dir/inner", "second", 6) == MYFS_OK);
+		CHECK(myfs_commit(fs) == MYFS_OK);
+		// the depth didn't go below zero, a begin still holds back
+		CHECK(myfs_commit(fs) == MYFS_INVALID);
+		CHECK(myfs_close(fs) == MYFS_OK);
+
+		CHECK(myfs_open(image.c_str(), 0, MYFS_OPEN_NO_FORMAT, &fs) == MYFS_OK);
+		CHECK(readAll(fs, "/notes") == "first");
+		CHECK(readAll(fs, "/dir/inner") == "second");
+		CHECK(myfs_close(fs) == MYFS_OK);
+		unlink(image.c_str());
+	});
+}
@@ -0,0 +1,57 @@
+#include "check.hpp"
+#include "fsck.hpp"
+#include "memdev.hpp"
+#include "myfs.hpp"
+
+// A move whose longer paths don't fit the FAT anymore has to leave the tree the way it was,
+// not drop the name from the source listing and commit that.
+
+#define TEST_DEVICE_SIZE (1024 * 1024)
+
+static std::string longName(char letter, size_t index) {
+	return std::string(60, letter) + std::to_string(index);
+}
+
+int main() {
+	return runTest("move", [] {
+		MemoryBlockDevice blkdev(TEST_DEVICE_SIZE);
+		MyFs myfs(&blkdev);
+		std::string filePath;
+		bool full = false;
+		try {
+			for (size_t top = 0; top < MAX_DIRECTORY_SIZE && !full; top++) {
+				std::string topPath = "/t" + std::to_string(top);
+				myfs.createDirectory(topPath);
+				for (size_t middle = 0; middle < MAX_DIRECTORY_SIZE; middle++) {
+					std::string middlePath = topPath + "/" + longName('d', middle);
+					myfs.createDirectory(middlePath);
+					for (size_t leaf = 0; leaf < MAX_DIRECTORY_SIZE; leaf++) {
+						std::string leafPath = middlePath + "/" + longName('f', leaf);
+						myfs.createFile(leafPath);
+						myfs.setContent(leafPath, leafPath);
+						filePath = leafPath;
+					}
+				}
+			}
+		} catch (const std::overflow_error&) {
+			full = true;
+		}
+		CHECK(full);
+		CHECK(!filePath.empty() && filePath.rfind("/t0/", 0) == 0);
+
+		bool threw = false;
+		try {
+			myfs.move("/t0", "/t0_moved_somewhere_with_a_much_longer_name_than_before");
+		} catch (const std::overflow_error&) {
+			threw = true;
+		}
+		CHECK(threw);
+		CHECK(myfs.getContent(filePath) == filePath);
+		std::vector<EntryInfo> rootListing = myfs.listDir("/");
+		CHECK(std::any_of(rootListing.begin(), rootListing.end(),
+						  [](const EntryInfo& entry) { return entry.path == "/t0"; }));
+		FsckReport report = FsChecker(myfs).check(false, false);
+		report.print(std::cerr);
+		CHECK(report.clean());
+	});
+}
@@ -0,0 +1,25 @@
+#include "check.hpp"
+#include "optrace.hpp"
+#include <unistd.h>
+
+// A path too long for the trace's 16 bit lengths is cut short, and the records after it still read
+// back as they were written.
+
+int main() {
+	return runTest("optrace", [] {
+		std::string tracePath = "/tmp/optrace_test_" + std::to_string(getpid()) + ".trace";
+		{
+			OpTracer tracer(tracePath);
+			TraceRecord longPath{1, 2, 3, TraceOp::GET_ENTRY_INFO, true, 0, "/" + std::string(70000, 'a'), ""};
+			TraceRecord next{4, 5, 6, TraceOp::MOVE, false, 0, "/from", "/to"};
+			tracer.record(longPath);
+			tracer.record(next);
+		}
+		std::vector<TraceRecord> trace = readTrace(tracePath);
+		unlink(tracePath.c_str());
+		CHECK(trace.size() == 2);
+		CHECK(trace[0].path.size() == UINT16_MAX && trace[0].failed);
+		CHECK(trace[1].op == TraceOp::MOVE && trace[1].client == 6);
+		CHECK(trace[1].path == "/from" && trace[1].otherPath == "/to");
+	});
+}
@@ -0,0 +1,42 @@
+#include "check.hpp"
+#include "memdev.hpp"
+#include "myfs.hpp"
+#include "overlaydev.hpp"
+
+// A mount through the overlay replays journaled data into memory, reads see it, and the image
+// underneath stays exactly as the crash left it.
+
+#define TEST_DEVICE_SIZE (1024 * 1024)
+
+int main() {
+	return runTest("overlay", [] {
+		MemoryBlockDevice blkdev(TEST_DEVICE_SIZE);
+		EntryInfo entry;
+		{
+			// no maintain, the unmount leaves the change in the journal only
+			MyFs myfs(&blkdev, MountOptions{true, true, false});
+			myfs.setDataJournaling(true);
+			myfs.createFile("/small");
+			myfs.setContent("/small", "journaled");
+			entry = *myfs.getEntryInfo("/small");
+		}
+		// the data never made it to its home before the crash
+		std::string lost(entry.size, '\0');
+		blkdev.write(entry.address, lost.size(), lost.data());
+
+		OverlayBlockDevice overlay(&blkdev);
+		{
+			MyFs myfs(&overlay, MountOptions{false, false, false});
+			CHECK(myfs.getContent("/small") == "journaled");
+		}
+		std::string home(entry.size, 'x');
+		blkdev.read(entry.address, home.size(), home.data());
+		CHECK(home == lost);
+
+		// and a real mount still replays it into the image
+		MyFs myfs(&blkdev, MountOptions{false, false, false});
+		CHECK(myfs.getContent("/small") == "journaled");
+		blkdev.read(entry.address, home.size(), home.data());
+		CHECK(home == "journaled");
+	});
+}
@@ -0,0 +1,78 @@
+#include "check.hpp"
+#include "memdev.hpp"
+#include "scrubber.hpp"
+#include <atomic>
+#include <chrono>
+
+// The background scrubber reports a file whose content no longer matches its checksum once a pass
+// got through, and a pass that broke off on a failed read doesn't count as one.
+
+#define TEST_DEVICE_SIZE (1024 * 1024)
+#define TEST_SCRUB_RATE (1024 * 1024 * 1024)
+
+// fails every read while it's armed, like a disk that went away for a moment
+class FailingDevice : public BlockDevice {
+  public:
+	explicit FailingDevice(BlockDevice& device_) : failing(false), device(device_) {
+	}
+
+	void read(size_t addr, size_t size, char* ans) override {
+		if (failing) {
+			throw std::runtime_error("read failed");
+		}
+		device.read(addr, size, ans);
+	}
+	void write(size_t addr, size_t size, const char* data) override {
+		device.write(addr, size, data);
+	}
+	void sync(size_t addr, size_t size) override {
+		device.sync(addr, size);
+	}
+	[[nodiscard]] size_t getSize() const override {
+		return device.getSize();
+	}
+
+	std::atomic<bool> failing;
+
+  private:
+	BlockDevice& device;
+};
+
+// waits until the scrubber got through the given number of passes, false if it took too long
+static bool waitForPasses(Scrubber& scrubber, size_t passes) {
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while (scrubber.getCompletedPasses() < passes) {
+		if (std::chrono::steady_clock::now() > deadline) {
+			return false;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	return true;
+}
+
+int main() {
+	return runTest("scrubber", [] {
+		MemoryBlockDevice blkdev(TEST_DEVICE_SIZE);
+		FailingDevice device(blkdev);
+		MyFs myfs(&device);
+		myfs.createFile("/good");
+		myfs.setContent("/good", "still what it was");
+		myfs.createFile("/bad");
+		myfs.setContent("/bad", "about to rot");
+		std::optional<EntryInfo> bad = myfs.getEntryInfo("/bad");
+		CHECK(bad);
+		blkdev.write(bad->address, 5, "ROTTN");
+
+		Scrubber scrubber(myfs, TEST_SCRUB_RATE);
+		device.failing = true;
+		scrubber.start();
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		CHECK(scrubber.getCompletedPasses() == 0);
+		CHECK(scrubber.getCorruptedPaths().empty());
+
+		device.failing = false;
+		CHECK(waitForPasses(scrubber, 1));
+		scrubber.stop();
+		CHECK(scrubber.getCorruptedPaths() == std::vector<std::string>{"/bad"});
+	});
+}
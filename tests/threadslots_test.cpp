@@ -0,0 +1,49 @@
+#include "check.hpp"
+#include "iostats.hpp"
+#include "threadslots.hpp"
+#include <thread>
+
+// Threads that come and go reuse the slots of the ones that exited instead of piling up new ones,
+// and what a thread left in its slot is still there for whoever sums them up.
+
+#define TEST_THREAD_COUNT 64
+#define TEST_CONCURRENT_THREADS 4
+
+int main() {
+	return runTest("threadslots", [] {
+		ThreadSlots<size_t> slots;
+		for (int thread = 0; thread < TEST_THREAD_COUNT; thread++) {
+			std::thread([&slots] { slots.local()++; }).join();
+		}
+		CHECK(slots.size() == 1);
+
+		for (int round = 0; round < TEST_THREAD_COUNT / TEST_CONCURRENT_THREADS; round++) {
+			std::vector<std::thread> threads;
+			for (int thread = 0; thread < TEST_CONCURRENT_THREADS; thread++) {
+				threads.emplace_back([&slots] { slots.local()++; });
+			}
+			for (std::thread& thread : threads) {
+				thread.join();
+			}
+		}
+		CHECK(slots.size() <= TEST_CONCURRENT_THREADS);
+		size_t total = 0;
+		slots.forEach([&total](size_t value) { total += value; });
+		CHECK(total == 2 * TEST_THREAD_COUNT);
+
+		// the owner may go before the threads that used it
+		auto owner = std::make_unique<ThreadSlots<size_t>>();
+		std::thread([&owner] {
+			owner->local()++;
+			owner.reset();
+			ThreadSlots<size_t> other;
+			other.local()++;
+		}).join();
+
+		IoStats stats;
+		for (int thread = 0; thread < TEST_THREAD_COUNT; thread++) {
+			std::thread([&stats] { stats.record(IoOp::READ, 0, 1, std::chrono::nanoseconds(1)); }).join();
+		}
+		CHECK(stats.snapshot().ops[static_cast<size_t>(IoOp::READ)].count == TEST_THREAD_COUNT);
+	});
+}
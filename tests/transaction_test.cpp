@@ -0,0 +1,66 @@
+#include "check.hpp"
+#include "memdev.hpp"
+#include "myfs.hpp"
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+// A checkpoint taken while another thread is in the middle of a transaction waits for it to be
+// committed instead of writing out half of it, and one taken inside the caller's own transaction
+// throws instead of waiting for itself.
+
+#define TEST_DEVICE_SIZE (1024 * 1024)
+
+int main() {
+	return runTest("transaction", [] {
+		MemoryBlockDevice blkdev(TEST_DEVICE_SIZE);
+		MyFs myfs(&blkdev);
+
+		myfs.beginTransaction();
+		myfs.createFile("/own");
+		bool refused = false;
+		try {
+			myfs.createSnapshot();
+		} catch (const std::runtime_error&) {
+			refused = true;
+		}
+		CHECK(refused);
+		myfs.commitTransaction();
+
+		std::atomic<bool> begun(false);
+		std::atomic<bool> commit(false);
+		std::thread writer([&] {
+			myfs.beginTransaction();
+			myfs.createFile("/first");
+			begun = true;
+			while (!commit) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+			myfs.createFile("/second");
+			myfs.setContent("/second", "both or neither");
+			myfs.commitTransaction();
+		});
+		while (!begun) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+
+		std::atomic<bool> snapshotTaken(false);
+		std::thread snapshotter([&] {
+			myfs.createSnapshot();
+			snapshotTaken = true;
+		});
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		CHECK(!snapshotTaken);
+		commit = true;
+		writer.join();
+		snapshotter.join();
+
+		// the snapshot is the FAT version the checkpoint wrote, the whole transaction is in it
+		size_t found = 0;
+		for (const EntryInfo& entry : myfs.listSnapshot()) {
+			found += entry.path == "/first" || entry.path == "/second";
+		}
+		CHECK(found == 2);
+		CHECK(myfs.getSnapshotContent("/second") == "both or neither");
+	});
+}
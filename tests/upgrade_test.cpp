@@ -0,0 +1,144 @@
+#include "check.hpp"
+#include "crc32c.hpp"
+#include "fatreader.hpp"
+#include "memdev.hpp"
+#include "myfs.hpp"
+
+// An image of 0x06 with a snapshot gets upgraded on mount, and the power goes out right before the
+// first header of the new format lands. The header still on disk points at the old FAT and the old
+// snapshot, neither may have been written over.
+
+#define TEST_DEVICE_SIZE (1024 * 1024)
+
+// the header as MyFs lays it out
+#define HEADER_VERSION_OFFSET 4
+#define HEADER_GENERATION_OFFSET 8
+#define HEADER_FAT_ADDRESS_OFFSET 16
+#define HEADER_FAT_SIZE_OFFSET 24
+#define HEADER_SNAPSHOT_ADDRESS_OFFSET 32
+#define HEADER_SNAPSHOT_SIZE_OFFSET 40
+#define HEADER_FAT_CHECKSUM_OFFSET 48
+#define HEADER_SNAPSHOT_CHECKSUM_OFFSET 52
+#define HEADER_CHECKSUM_OFFSET 56
+#define HEADER_SIZE 64
+
+// loses every header write once armed, as if the machine died right before it
+class CrashingDevice : public BlockDevice {
+  public:
+	explicit CrashingDevice(BlockDevice& device_) : device(device_) {
+	}
+
+	void read(size_t addr, size_t size, char* ans) override {
+		device.read(addr, size, ans);
+	}
+	void write(size_t addr, size_t size, const char* data) override {
+		if (addr < 2 * HEADER_SLOT_SIZE) {
+			throw std::runtime_error("crashed");
+		}
+		device.write(addr, size, data);
+	}
+	void sync(size_t addr, size_t size) override {
+		device.sync(addr, size);
+	}
+	[[nodiscard]] size_t getSize() const override {
+		return device.getSize();
+	}
+
+  private:
+	BlockDevice& device;
+};
+
+template <typename T> static T load(const std::vector<char>& buffer, size_t offset) {
+	T value;
+	memcpy(&value, buffer.data() + offset, sizeof(T));
+	return value;
+}
+
+template <typename T> static void store(std::vector<char>& buffer, size_t offset, T value) {
+	memcpy(buffer.data() + offset, &value, sizeof(T));
+}
+
+// a FAT version rewritten in the host sized records of 0x06
+static std::vector<char> toNative(BlockDevice& device, size_t address, size_t size) {
+	std::vector<char> fixed(size);
+	device.read(address, size, fixed.data());
+	std::set<EntryInfo> entries;
+	CHECK(FatReader::decode(fixed.data(), fixed.size(), RecordFormat::FIXED, entries) == size);
+	std::vector<char> native;
+	for (const EntryInfo& entry : entries) {
+		size_t offset = native.size();
+		size_t pathLength = entry.path.size();
+		native.resize(offset + entry.nativeSerializedSize());
+		char* record = native.data() + offset;
+		memcpy(record, &entry.type, sizeof(entry.type));
+		record += sizeof(entry.type);
+		memcpy(record, &pathLength, sizeof(pathLength));
+		record += sizeof(pathLength);
+		memcpy(record, entry.path.data(), pathLength);
+		record += pathLength;
+		memcpy(record, &entry.size, sizeof(entry.size));
+		record += sizeof(entry.size);
+		memcpy(record, &entry.address, sizeof(entry.address));
+		record += sizeof(entry.address);
+		memcpy(record, &entry.checksum, sizeof(entry.checksum));
+	}
+	device.write(address, native.size(), native.data());
+	return native;
+}
+
+// turns the newest header and both FAT versions it points at into what 0x06 wrote
+static void downgrade(BlockDevice& device) {
+	std::vector<char> header(HEADER_SIZE);
+	std::vector<char> other(HEADER_SIZE);
+	device.read(0, HEADER_SIZE, header.data());
+	device.read(HEADER_SLOT_SIZE, HEADER_SIZE, other.data());
+	if (load<uint64_t>(other, HEADER_GENERATION_OFFSET) > load<uint64_t>(header, HEADER_GENERATION_OFFSET)) {
+		std::swap(header, other);
+	}
+	std::vector<char> fat = toNative(device, load<uint64_t>(header, HEADER_FAT_ADDRESS_OFFSET),
+									 load<uint64_t>(header, HEADER_FAT_SIZE_OFFSET));
+	std::vector<char> snapshot = toNative(device, load<uint64_t>(header, HEADER_SNAPSHOT_ADDRESS_OFFSET),
+										  load<uint64_t>(header, HEADER_SNAPSHOT_SIZE_OFFSET));
+	header[HEADER_VERSION_OFFSET] = NATIVE_RECORDS_VERSION;
+	uint64_t generation = load<uint64_t>(header, HEADER_GENERATION_OFFSET) + 1;
+	store<uint64_t>(header, HEADER_GENERATION_OFFSET, generation);
+	store<uint64_t>(header, HEADER_FAT_SIZE_OFFSET, fat.size());
+	store<uint64_t>(header, HEADER_SNAPSHOT_SIZE_OFFSET, snapshot.size());
+	store<uint32_t>(header, HEADER_FAT_CHECKSUM_OFFSET, crc32c(fat.data(), fat.size()));
+	store<uint32_t>(header, HEADER_SNAPSHOT_CHECKSUM_OFFSET, crc32c(snapshot.data(), snapshot.size()));
+	store<uint32_t>(header, HEADER_CHECKSUM_OFFSET, crc32c(header.data(), HEADER_CHECKSUM_OFFSET));
+	device.write((generation % 2) * HEADER_SLOT_SIZE, HEADER_SIZE, header.data());
+}
+
+int main() {
+	return runTest("upgrade", [] {
+		MemoryBlockDevice blkdev(TEST_DEVICE_SIZE);
+		{
+			MyFs myfs(&blkdev);
+			myfs.createFile("/a");
+			myfs.setContent("/a", "before the snapshot");
+			myfs.createSnapshot();
+			myfs.setContent("/a", "after the snapshot");
+			myfs.createFile("/b");
+		}
+		downgrade(blkdev);
+
+		bool crashed = false;
+		try {
+			CrashingDevice crashing(blkdev);
+			MyFs myfs(&crashing);
+		} catch (const std::runtime_error&) {
+			crashed = true;
+		}
+		CHECK(crashed);
+
+		// once after the crash, once more on the upgraded image
+		for (int mount = 0; mount < 2; mount++) {
+			MyFs myfs(&blkdev);
+			CHECK(myfs.hasSnapshot());
+			CHECK(myfs.getContent("/a") == "after the snapshot");
+			CHECK(myfs.isFileExists("/b"));
+			CHECK(myfs.getSnapshotContent("/a") == "before the snapshot");
+		}
+	});
+}
@@ -0,0 +1,77 @@
+#include "fsck.hpp"
+#include "overlaydev.hpp"
+#include <iostream>
+#include <memory>
+
+// Checks an image and optionally repairs it. Without --repair nothing is written to the image.
+// usage: myfs_fsck [--repair] [--data] <image>
+//   --repair  fix what can be fixed, salvage an image that doesn't mount at all
+//   --data    also verify every file's content against its checksum
+
+#define FSCK_EXIT_CLEAN 0
+#define FSCK_EXIT_REPAIRED 1
+#define FSCK_EXIT_PROBLEMS_LEFT 4
+#define FSCK_EXIT_FAILED 8
+#define FSCK_EXIT_USAGE 16
+
+int main(int argc, char** argv) {
+	bool repair = false;
+	bool verifyData = false;
+	std::string path;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--repair") {
+			repair = true;
+		} else if (arg == "--data") {
+			verifyData = true;
+		} else if (path.empty() && arg.rfind("--", 0) != 0) {
+			path = arg;
+		} else {
+			path.clear();
+			break;
+		}
+	}
+	if (path.empty()) {
+		std::cerr << "usage: myfs_fsck [--repair] [--data] <image>" << std::endl;
+		return FSCK_EXIT_USAGE;
+	}
+	// the simulator would create a missing image
+	if (access(path.c_str(), F_OK) == -1) {
+		std::cerr << "No such image: " << path << std::endl;
+		return FSCK_EXIT_FAILED;
+	}
+
+	try {
+		BlockDeviceSimulator blkdev(path);
+		// a check replays the journal into memory only, its data records would land in the image otherwise
+		OverlayBlockDevice overlay(&blkdev);
+		BlockDevice* device = repair ? static_cast<BlockDevice*>(&blkdev) : &overlay;
+		// the checker does the repairing itself, the mount only replays the journal
+		MountOptions options{false, false, false};
+		std::unique_ptr<MyFs> myfs;
+		bool salvaged = false;
+		try {
+			myfs = std::make_unique<MyFs>(device, options);
+		} catch (const std::exception& e) {
+			std::cout << "doesn't mount: " << e.what() << std::endl;
+			if (!repair) {
+				return FSCK_EXIT_PROBLEMS_LEFT;
+			}
+			// salvages what's left and repairs it right away
+			options.repair = true;
+			myfs = std::make_unique<MyFs>(&blkdev, options);
+			salvaged = true;
+			std::cout << "repaired: salvaged the entry table" << std::endl;
+		}
+
+		FsckReport report = FsChecker(*myfs).check(repair, verifyData);
+		report.print(std::cout);
+		if (!report.remaining.empty() || (!repair && !report.clean())) {
+			return FSCK_EXIT_PROBLEMS_LEFT;
+		}
+		return salvaged || !report.clean() ? FSCK_EXIT_REPAIRED : FSCK_EXIT_CLEAN;
+	} catch (const std::exception& e) {
+		std::cerr << "Can't check " << path << ": " << e.what() << std::endl;
+		return FSCK_EXIT_FAILED;
+	}
+}
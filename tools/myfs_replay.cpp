@@ -0,0 +1,299 @@
+#include "myfs.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <map>
+
+// Runs a trace recorded with --trace (by the shell or myfsd) against an image again and shows how long
+// each kind of call took, next to what the trace says it took back then. Content isn't traced, writes
+// put the traced number of bytes. Every client of the trace gets a thread of its own and makes its calls
+// in the order it made them, or the clients share --threads threads, unless the trace has transactions,
+// those are per thread and the clients' would end up in each other's. --paced waits for each call's
+// original moment instead of going as fast as possible. --base copies an image over the target first,
+// to start from the state the trace was recorded on.
+// usage: myfs_replay <trace> <image> [--base image] [--size bytes] [--threads n] [--paced] [--json]
+
+struct ReplayOptions {
+	std::string tracePath;
+	std::string imagePath;
+	std::optional<std::string> basePath;
+	size_t deviceSize = BlockDevice::DEFAULT_DEVICE_SIZE;
+	size_t threads = 0; // one per client
+	bool paced = false;
+	bool json = false;
+};
+
+// what one thread saw, merged once they're all done
+struct ReplayResults {
+	std::array<std::vector<uint64_t>, static_cast<size_t>(TraceOp::COUNT)> latencies;
+	std::array<size_t, static_cast<size_t>(TraceOp::COUNT)> failed{};
+	// failed now but not back then, or the other way around
+	std::array<size_t, static_cast<size_t>(TraceOp::COUNT)> mismatched{};
+
+	void merge(ReplayResults& other) {
+		for (size_t op = 0; op < latencies.size(); op++) {
+			latencies[op].insert(latencies[op].end(), other.latencies[op].begin(), other.latencies[op].end());
+			failed[op] += other.failed[op];
+			mismatched[op] += other.mismatched[op];
+		}
+	}
+};
+
+using Clock = std::chrono::steady_clock;
+
+static void execute(MyFs& myfs, const TraceRecord& call, const std::string& content) {
+	switch (call.op) {
+	case TraceOp::GET_ENTRY_INFO:
+		myfs.getEntryInfo(call.path);
+		break;
+	case TraceOp::LIST_DIR:
+		myfs.listDir(call.path);
+		break;
+	case TraceOp::LIST_TREE:
+		myfs.listTree();
+		break;
+	case TraceOp::GET_CONTENT:
+	case TraceOp::EXPORT_FILE:
+		myfs.getContent(call.path);
+		break;
+	case TraceOp::VIEW_CONTENT:
+		myfs.viewContent(call.path, [](const char*, size_t) {});
+		break;
+	case TraceOp::SET_CONTENT:
+		myfs.setContent(call.path, content);
+		break;
+	case TraceOp::IMPORT_FILE:
+	case TraceOp::UPDATE_FILE: {
+		// both create the file if it's missing
+		MyFs::Transaction transaction(myfs);
+		if (!myfs.isFileExists(call.path)) {
+			myfs.createFile(call.path);
+		}
+		myfs.setContent(call.path, content);
+		break;
+	}
+	case TraceOp::CREATE_FILE:
+		myfs.createFile(call.path);
+		break;
+	case TraceOp::CREATE_DIRECTORY:
+		myfs.createDirectory(call.path);
+		break;
+	case TraceOp::REMOVE:
+		myfs.remove(call.path);
+		break;
+	case TraceOp::MOVE:
+		myfs.move(call.path, call.otherPath);
+		break;
+	case TraceOp::COPY:
+		myfs.copy(call.path, call.otherPath);
+		break;
+	case TraceOp::BEGIN_TRANSACTION:
+		myfs.beginTransaction();
+		break;
+	case TraceOp::COMMIT_TRANSACTION:
+		myfs.commitTransaction();
+		break;
+	case TraceOp::CREATE_SNAPSHOT:
+		myfs.createSnapshot();
+		break;
+	case TraceOp::DROP_SNAPSHOT:
+		myfs.dropSnapshot();
+		break;
+	case TraceOp::SHRINK:
+		myfs.shrink();
+		break;
+	case TraceOp::COUNT:
+		break;
+	}
+}
+
+static bool writesContent(TraceOp op) {
+	return op == TraceOp::SET_CONTENT || op == TraceOp::IMPORT_FILE || op == TraceOp::UPDATE_FILE;
+}
+
+static void replay(MyFs& myfs, const std::vector<const TraceRecord*>& calls, Clock::time_point started, bool paced,
+				   ReplayResults& results) {
+	int openTransactions = 0;
+	for (const TraceRecord* call : calls) {
+		if (paced) {
+			std::this_thread::sleep_until(started + std::chrono::nanoseconds(call->start));
+		}
+		std::string content = writesContent(call->op) ? std::string(call->size, 'r') : std::string();
+		size_t op = static_cast<size_t>(call->op);
+		bool failed = false;
+		Clock::time_point start = Clock::now();
+		try {
+			execute(myfs, *call, content);
+		} catch (const std::exception&) {
+			failed = true;
+		}
+		results.latencies[op].push_back(
+			std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+		if (failed) {
+			results.failed[op]++;
+		}
+		if (failed != call->failed) {
+			results.mismatched[op]++;
+		}
+		if (!failed && call->op == TraceOp::BEGIN_TRANSACTION) {
+			openTransactions++;
+		} else if (!failed && call->op == TraceOp::COMMIT_TRANSACTION) {
+			openTransactions--;
+		}
+	}
+	// the trace ended inside a transaction
+	for (; openTransactions > 0; openTransactions--) {
+		myfs.commitTransaction();
+	}
+}
+
+#pragma region output
+
+static double percentileMicroseconds(std::vector<uint64_t>& values, double share) {
+	if (values.empty()) {
+		return 0;
+	}
+	size_t index = std::min(values.size() - 1, static_cast<size_t>(share * static_cast<double>(values.size())));
+	std::nth_element(values.begin(), values.begin() + static_cast<std::ptrdiff_t>(index), values.end());
+	return static_cast<double>(values[index]) / 1000;
+}
+
+static void printResults(ReplayResults& results, ReplayResults& traced, double seconds, size_t calls,
+						 const ReplayOptions& options) {
+	if (options.json) {
+		std::cout << "{\"calls\": " << calls << ", \"seconds\": " << seconds << ", \"ops\": [";
+	} else {
+		std::cout << calls << " calls in " << std::fixed << std::setprecision(3) << seconds << " s" << std::endl;
+		std::cout << std::left << std::setw(20) << "op" << std::right << std::setw(9) << "count" << std::setw(8)
+				  << "failed" << std::setw(10) << "mismatch" << std::setw(10) << "p50 us" << std::setw(10) << "p90 us"
+				  << std::setw(10) << "p99 us" << std::setw(11) << "max us" << std::setw(12) << "traced p50"
+				  << std::setw(12) << "traced p99" << std::endl;
+	}
+	bool first = true;
+	for (size_t op = 0; op < results.latencies.size(); op++) {
+		std::vector<uint64_t>& latencies = results.latencies[op];
+		if (latencies.empty()) {
+			continue;
+		}
+		double maxLatency = static_cast<double>(*std::max_element(latencies.begin(), latencies.end())) / 1000;
+		double p50 = percentileMicroseconds(latencies, 0.5);
+		double p90 = percentileMicroseconds(latencies, 0.9);
+		double p99 = percentileMicroseconds(latencies, 0.99);
+		double tracedP50 = percentileMicroseconds(traced.latencies[op], 0.5);
+		double tracedP99 = percentileMicroseconds(traced.latencies[op], 0.99);
+		const char* name = traceOpName(static_cast<TraceOp>(op));
+		if (options.json) {
+			std::cout << (first ? "" : ", ") << "{\"op\": \"" << name << "\", \"count\": " << latencies.size()
+					  << ", \"failed\": " << results.failed[op] << ", \"mismatched\": " << results.mismatched[op]
+					  << ", \"p50_us\": " << p50 << ", \"p90_us\": " << p90 << ", \"p99_us\": " << p99
+					  << ", \"max_us\": " << maxLatency << ", \"traced_p50_us\": " << tracedP50
+					  << ", \"traced_p99_us\": " << tracedP99 << "}";
+		} else {
+			std::cout << std::left << std::setw(20) << name << std::right << std::setw(9) << latencies.size()
+					  << std::setw(8) << results.failed[op] << std::setw(10) << results.mismatched[op]
+					  << std::setprecision(1) << std::setw(10) << p50 << std::setw(10) << p90 << std::setw(10) << p99
+					  << std::setw(11) << maxLatency << std::setw(12) << tracedP50 << std::setw(12) << tracedP99
+					  << std::endl;
+		}
+		first = false;
+	}
+	if (options.json) {
+		std::cout << "]}" << std::endl;
+	}
+}
+
+#pragma endregion
+
+static const char* const USAGE =
+	"usage: myfs_replay <trace> <image> [--base image] [--size bytes] [--threads n] [--paced] [--json]";
+
+int main(int argc, char** argv) {
+	ReplayOptions options;
+	std::vector<std::string> positional;
+	try {
+		for (int i = 1; i < argc; i++) {
+			std::string arg = argv[i];
+			if (arg == "--paced") {
+				options.paced = true;
+			} else if (arg == "--json") {
+				options.json = true;
+			} else if (arg == "--base" && i + 1 < argc) {
+				options.basePath = argv[++i];
+			} else if (arg == "--size" && i + 1 < argc) {
+				options.deviceSize = std::stoull(argv[++i]);
+			} else if (arg == "--threads" && i + 1 < argc) {
+				options.threads = std::stoull(argv[++i]);
+			} else if (arg.rfind("--", 0) == 0) {
+				throw std::invalid_argument(arg);
+			} else {
+				positional.push_back(arg);
+			}
+		}
+		if (positional.size() != 2) {
+			throw std::invalid_argument("arguments");
+		}
+	} catch (const std::exception&) {
+		std::cerr << USAGE << std::endl;
+		return -1;
+	}
+	options.tracePath = positional[0];
+	options.imagePath = positional[1];
+
+	try {
+		std::vector<TraceRecord> trace = readTrace(options.tracePath);
+		// written as the calls finished, replayed in the order they started
+		std::stable_sort(trace.begin(), trace.end(),
+						 [](const TraceRecord& a, const TraceRecord& b) { return a.start < b.start; });
+
+		ReplayResults traced;
+		std::vector<uint32_t> clients;
+		for (const TraceRecord& call : trace) {
+			traced.latencies[static_cast<size_t>(call.op)].push_back(call.duration);
+			if (std::find(clients.begin(), clients.end(), call.client) == clients.end()) {
+				clients.push_back(call.client);
+			}
+		}
+		bool transactions = std::any_of(trace.begin(), trace.end(), [](const TraceRecord& call) {
+			return call.op == TraceOp::BEGIN_TRANSACTION;
+		});
+		if (transactions && options.threads != 0 && options.threads < clients.size()) {
+			throw std::runtime_error("The trace has transactions, its " + std::to_string(clients.size()) +
+									 " clients need a thread each");
+		}
+		size_t threadCount = options.threads == 0 ? clients.size() : std::min(options.threads, clients.size());
+		threadCount = std::max<size_t>(threadCount, 1);
+		// a client's calls all go to the same thread, in the order it made them
+		std::vector<std::vector<const TraceRecord*>> perThread(threadCount);
+		for (const TraceRecord& call : trace) {
+			size_t client = std::find(clients.begin(), clients.end(), call.client) - clients.begin();
+			perThread[client % threadCount].push_back(&call);
+		}
+
+		if (options.basePath) {
+			std::filesystem::copy_file(*options.basePath, options.imagePath,
+									   std::filesystem::copy_options::overwrite_existing);
+		}
+		BlockDeviceSimulator blkdev(options.imagePath, options.deviceSize);
+		MyFs myfs(&blkdev);
+
+		std::vector<ReplayResults> results(threadCount);
+		std::vector<std::thread> threads;
+		Clock::time_point started = Clock::now();
+		for (size_t thread = 0; thread < threadCount; thread++) {
+			threads.emplace_back([&, thread] { replay(myfs, perThread[thread], started, options.paced, results[thread]); });
+		}
+		for (std::thread& thread : threads) {
+			thread.join();
+		}
+		double seconds = std::chrono::duration<double>(Clock::now() - started).count();
+		for (size_t thread = 1; thread < threadCount; thread++) {
+			results[0].merge(results[thread]);
+		}
+		printResults(results[0], traced, seconds, trace.size(), options);
+		return 0;
+	} catch (const std::exception& e) {
+		std::cerr << "myfs_replay: " << e.what() << std::endl;
+		return -1;
+	}
+}
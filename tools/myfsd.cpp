@@ -0,0 +1,97 @@
+#include "fsserver.hpp"
+#include "scrubber.hpp"
+#include <csignal>
+#include <iostream>
+#include <pthread.h>
+
+// Mounts an image once and serves it on a Unix domain socket until SIGINT or SIGTERM, then
+// finishes what's running and unmounts. Point the shell at the socket instead of an image to use it.
+// With --trace every call of every client is recorded for myfs_replay. A scrubber checks the content
+// against its checksums in the background at --scrub-rate bytes per second, 0 turns it off, what it
+// found corrupted is reported on the way out.
+// usage: myfsd <image> <socket> [size] [--trace file] [--scrub-rate bytes]
+
+int main(int argc, char** argv) {
+	std::vector<std::string> positional;
+	std::optional<std::string> tracePath;
+	size_t scrubRate = SCRUB_BYTES_PER_SECOND;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == TRACE_ARG && i + 1 < argc) {
+			tracePath = argv[++i];
+		} else if (arg == SCRUB_RATE_ARG && i + 1 < argc) {
+			try {
+				scrubRate = std::stoull(argv[++i]);
+			} catch (const std::exception& e) {
+				std::cerr << "Invalid scrub rate: " << argv[i] << std::endl;
+				return -1;
+			}
+		} else {
+			positional.push_back(arg);
+		}
+	}
+	if (positional.size() < 2 || positional.size() > 3) {
+		std::cerr << "usage: myfsd <image> <socket> [size] [" TRACE_ARG " file] [" SCRUB_RATE_ARG " bytes]"
+				  << std::endl;
+		return -1;
+	}
+	size_t deviceSize = BlockDevice::DEFAULT_DEVICE_SIZE;
+	if (positional.size() == 3) {
+		try {
+			deviceSize = std::stoull(positional[2]);
+		} catch (const std::exception& e) {
+			std::cerr << "Invalid size: " << positional[2] << std::endl;
+			return -1;
+		}
+	}
+
+	// every thread started from here on leaves the signals to the one waiting for them
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+	try {
+		// the socket first, a second daemon on the same socket stops before it touches the image,
+		// one on another socket stops at the image's lock
+		FsServer server(positional[1]);
+		BlockDeviceSimulator blkdev(positional[0], deviceSize);
+		std::unique_ptr<OpTracer> tracer;
+		if (tracePath) {
+			tracer = std::make_unique<OpTracer>(*tracePath);
+		}
+		MyFs myfs(&blkdev);
+		myfs.setTracer(tracer.get());
+		std::unique_ptr<Scrubber> scrubber;
+		if (scrubRate > 0) {
+			scrubber = std::make_unique<Scrubber>(myfs, scrubRate);
+			scrubber->start();
+		}
+		std::thread waiter([&server, &signals] {
+			int signal = 0;
+			sigwait(&signals, &signal);
+			server.stop();
+		});
+		int status = 0;
+		try {
+			server.serve(myfs);
+		} catch (const std::exception& e) {
+			std::cerr << "myfsd: " << e.what() << std::endl;
+			status = -1;
+		}
+		// the waiter may still be waiting if serving failed
+		pthread_kill(waiter.native_handle(), SIGTERM);
+		waiter.join();
+		if (scrubber) {
+			scrubber->stop();
+			for (const std::string& path : scrubber->getCorruptedPaths()) {
+				std::cerr << "myfsd: corrupted: " << path << std::endl;
+			}
+		}
+		return status;
+	} catch (const std::exception& e) {
+		std::cerr << "Can't serve " << positional[0] << ": " << e.what() << std::endl;
+		return -1;
+	}
+}